@@ -3,8 +3,14 @@
 //create audio objects
 AudioInputI2SQuad_F32   audio_in(audio_settings);
 EarpieceMixer_F32_UI    earpieceMixer(audio_settings); //mixes earpiece mics, allows switching to analog inputs, mixes left+right, etc
+AudioLatencyProbe_F32   latencyProbe(audio_settings);  //injects a marker to measure the latencies (see AudioLatencyProbe_F32.h).  Passes the audio through otherwise
 AudioEffectBTNRH_F32    BTNRH_alg1(audio_settings);    //see tab "AudioEffectBTNRH.h"
 AudioEffectGain_F32     gain1(audio_settings);         //added gain block to easily increase or lower the gain
+AudioLatencyProbeTap_F32 latencyProbeTap(audio_settings, latencyProbe); //must be created after gain1
+#if (RUN_BINAURAL)
+AudioEffectBTNRH_F32    BTNRH_alg2(audio_settings);    //right ear (shares its coefficients with BTNRH_alg1)
+AudioEffectGain_F32     gain2(audio_settings);
+#endif
 AudioOutputI2SQuad_F32  audio_out(audio_settings);
 AudioSDWriter_F32_UI    audioSDWriter(audio_settings); //this is 2-channels of audio by default, but can be changed to 4 in setup()
 
@@ -16,14 +22,25 @@ AudioConnection_F32   patchCord3(audio_in, 2, earpieceMixer, 2);
 AudioConnection_F32   patchCord4(audio_in, 3, earpieceMixer, 3);
 
 //connect to BTNRH algorithm
-AudioConnection_F32   patchCord6(earpieceMixer, earpieceMixer.LEFT, BTNRH_alg1, 0);
+AudioConnection_F32   patchCord5(earpieceMixer, earpieceMixer.LEFT, latencyProbe, 0);
+AudioConnection_F32   patchCord6(latencyProbe, 0, BTNRH_alg1, 0);
 AudioConnection_F32   patchCord7(BTNRH_alg1, 0, gain1, 0);
+AudioConnection_F32   patchCord10(gain1, 0, latencyProbeTap, 0);
+#if (RUN_BINAURAL)
+AudioConnection_F32   patchCord8(earpieceMixer, earpieceMixer.RIGHT, BTNRH_alg2, 0);
+AudioConnection_F32   patchCord9(BTNRH_alg2, 0, gain2, 0);
+#endif
 
 //connect the BTNRH alg to the outputs
 AudioConnection_F32   patchCord11(gain1, 0, audio_out,  EarpieceShield::OUTPUT_LEFT_TYMPAN);    //Tympan AIC, left output
-AudioConnection_F32   patchCord12(gain1, 0, audio_out,  EarpieceShield::OUTPUT_RIGHT_TYMPAN);   //Tympan AIC, right output
 AudioConnection_F32   patchCord13(gain1, 0, audio_out,  EarpieceShield::OUTPUT_LEFT_EARPIECE);  //Shield AIC, left output
+#if (RUN_BINAURAL)
+AudioConnection_F32   patchCord12(gain2, 0, audio_out,  EarpieceShield::OUTPUT_RIGHT_TYMPAN);   //Tympan AIC, right output
+AudioConnection_F32   patchCord14(gain2, 0, audio_out,  EarpieceShield::OUTPUT_RIGHT_EARPIECE); //Shield AIC, right output
+#else
+AudioConnection_F32   patchCord12(gain1, 0, audio_out,  EarpieceShield::OUTPUT_RIGHT_TYMPAN);   //Tympan AIC, right output
 AudioConnection_F32   patchCord14(gain1, 0, audio_out,  EarpieceShield::OUTPUT_RIGHT_EARPIECE); //Shield AIC, right output
+#endif
 
 //connect to the SD writer
 AudioConnection_F32   patchCord21(earpieceMixer, earpieceMixer.LEFT, audioSDWriter,  0);  //left will be the raw input
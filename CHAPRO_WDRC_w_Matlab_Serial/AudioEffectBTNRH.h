@@ -20,17 +20,27 @@
 // Algorithm-specific include files
 #include <chapro.h>
 #include "test_gha.h"            ////////////////////////////////////////// Update this for your CHAPRO Algorithm!!!!
+#include "FeedbackModelSnapshot_F32.h"
+#include "BTNRH_StateArena.h"
+#include "BTNRH_FixedCheck.h"     //BTNRH_FixedFB, the fixed-size filterbank, and its self-check
+#include "BTNRH_DataBlob.h"
+#include "BTNRH_BlobSettings.h"
+
+#define BTNRH_MAX_SNAPSHOT_LEN 256  //longest AFC model (afl) that can be printed from loop()
+
 
 
 class AudioEffectBTNRH_F32 : public AudioStream_F32
 {
   public:
     //constructor
-    AudioEffectBTNRH_F32(const AudioSettings_F32 &settings) : AudioStream_F32(1, inputQueueArray_f32){ };
+    AudioEffectBTNRH_F32(const AudioSettings_F32 &settings) : AudioStream_F32(1, inputQueueArray_f32){ block_len = settings.audio_block_samples; };
 
     //CHAPRO usually uses a bunch of global data structures/arrays to hold parameters and states.  Let's make copies
     //here within this class so that we can run multiple instances of the algorithm (such as left and right) without
-    //worrying about the left and right overwriting each other's settings or states.
+    //worrying about the left and right overwriting each other's settings or states.  Once prepared, the processing
+    //only needs this instance's cp[] (see process_chunk_ctx()), so the local_xxx structures are just a record of
+    //the settings that were used to prepare it.
     //
     //CHAPRO-relevant data members...each instance of this algorithm gets its own copy of these data structures
     void *cp[NPTR] = {0};        // NPTR is set in chapro.h???
@@ -40,7 +50,8 @@ class AudioEffectBTNRH_F32 : public AudioStream_F32
     CHA_DSL local_dsl;     ////////////////////////////////////////// Add or remove based on *your* CHAPRO Algorithm!!!!
     CHA_WDRC local_agc;    ////////////////////////////////////////// Add or remove based on *your* CHAPRO Algorithm!!!!
 
-    //methods to access the CHA_DVAR and CHA_IVAR values
+    //methods to access the CHA_DVAR and CHA_IVAR values.  (These are not on the per-chunk path: the per-chunk
+    //stages in libchapro read CHA_DVAR themselves, and the sketch's own per-chunk code never reads it.)
     double get_cha_dvar(int ind) { return ((double *)cp[_dvar])[ind]; }; 
     double set_cha_dvar(int ind, double val) { return ((double *)cp[_dvar])[ind] = val; };
     int get_cha_ivar(int ind) { return ((int *)cp[_ivar])[ind]; }; 
@@ -52,6 +63,17 @@ class AudioEffectBTNRH_F32 : public AudioStream_F32
     void print_afc_params(void);
     bool servicePrintingFeedbackModel(unsigned long curTime_millis, unsigned long updatePeriod_millis);
     bool servicePrintingFeedbackModel_toApp(unsigned long curTime_millis, unsigned long updatePeriod_millis, BLE_UI &ble);
+
+    //The AFC model (efbp) is rewritten by every audio block, so loop() reads a snapshot of it instead.
+    //The snapshot is copied every N audio blocks from within update().  See FeedbackModelSnapshot_F32.h.
+    void publishFeedbackModel(void) {
+      if ((!setup_complete) || (cp[_efbp] == NULL)) return;
+      fb_snapshot.publish((float *)cp[_efbp], get_cha_ivar(_afl));
+    }
+    int setFeedbackModelPeriod_blocks(int n_blocks) { return fb_snapshot.setPeriod_blocks(n_blocks); }
+    int getFeedbackModel(float32_t *h, int n_max, uint32_t *seq = NULL) { return fb_snapshot.read(h, n_max, seq); }
+    uint32_t getFeedbackModelSequence(void) { return fb_snapshot.getSequence(); }
+    int writeFeedbackModelBinary(Print *p) { return fb_snapshot.writeBinary(p); }
     
     //methods to reset some AFC state arrays?  [is this complete?  I think that it's missing stuff?]
     void reset_feedback_model(void) {
@@ -60,8 +82,15 @@ class AudioEffectBTNRH_F32 : public AudioStream_F32
       for (int i=0; i<n_coeff;i++) efbp[i]=0.0f;
     }
 
+    //Measure the per-block cost of the processing with (the old way) and without (the current way)
+    //copying the CHAPRO structures in and out of the globals.  The live audio is used, so each
+    //way is timed for dur_msec.  Call from loop().
+    void benchmarkGlobalCopies(Print *p, unsigned long dur_msec = 2000);
+    bool use_global_copies = false;
+
     //enable different parts of the algorithm
     bool setEnabled(bool val = true) { return enabled = val; }  //overall enabled or not
+    bool getEnabled(void) { return enabled; }
     bool setAfcEnabled(bool _enable);
     bool getAfcEnabled(void) { int cur_mxl = get_cha_ivar(_mxl); if (cur_mxl > 0) { return true; } else { return false; } };
     int baselineVal_mxl = -1;
@@ -78,16 +107,82 @@ class AudioEffectBTNRH_F32 : public AudioStream_F32
 
       //run the configure() and prepare() functions in the global space
       configure(&io);               //in test_gha.h
+      prepare_arena = arena;        //if given, the arrays from each stage of prepare() are moved into the arena
       prepare(&io, cp);             //in test_gha.h
+      prepare_arena = NULL;
+      for (int I = 0; I < N_PREP_STAGES; I++) stage_bytes[I] = prepare_stage_bytes[I];
+      if (prepare_n_on_heap > 0) {
+        Serial.println("AudioEffectBTNRH_F32: setup: *** WARNING ***: " + String(prepare_n_on_heap) + " CHAPRO arrays did not fit in the arena.  Needs " +
+                       String(dryRunArenaBytes(arena->getAlignment())) + " bytes, has " + String(arena->getBytesTotal()) + ".");
+      }
 
       //copy global instances back to local instances for safe-keeping (not really needed for monural operation, but some day this will be important for binaural
       memcpy(&local_afc, &afc_global, sizeof(CHA_AFC));  //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
       memcpy(&local_dsl, &dsl_global, sizeof(CHA_DSL));  //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
       memcpy(&local_agc, &agc_global, sizeof(CHA_WDRC)); //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
       local_prepared = prepared; //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!!  
+      chapro_cs = get_cha_ivar(_cs);
       
       setup_complete = true;
+      setupFixedPipeline(&Serial);  //use the fixed-size filterbank, if the configuration matches
     }    
+
+    //Fixed-size filterbank.  If the channel count, filter order, and chunk size match BTNRH_FIXED_xx,
+    //build the fixed-size filterbank from the same design as CHAPRO's, measure its channel delays
+    //against CHAPRO's filterbank, and check that both give the same output.  Only then is it used.
+    //checkFixedPipeline() runs the same check again on a copy of the one in use.  The checks and the
+    //benchmark run on copies of the filter states, so the audio keeps running (and is not touched).
+    bool setupFixedPipeline(Print *p = NULL);
+    bool checkFixedPipeline(Print *p);
+    void benchmarkFixedPipeline(Print *p, int n_chunks = 1000);
+    bool getUseFixedPipeline(void) { return use_fixed_pipeline; }
+    bool setUseFixedPipeline(bool val) { return use_fixed_pipeline = (val && fixed_pipeline_ok); }
+
+    //Binaural: call this on the second ear's instance, after the first ear's setup().  Instead of
+    //running configure() and prepare() again, this ear shares the first ear's copy of the coefficients
+    //that never change (the filterbank and, if both ears use the same prescription, the per-channel AGC
+    //settings).  Each ear keeps its own filter states, AGC envelopes, AFC ring, etc, and both ears'
+    //copies of those are carved from the given arena (the first ear's are moved there).
+    bool setupBinaural(AudioEffectBTNRH_F32 &first_ear, BTNRH_StateArena &arena, bool share_agc_coeff = true);
+
+    //Chunk size: CHAPRO can work in chunks that are smaller than the audio block (each block is split
+    //up) or bigger (the blocks are collected, which adds chunk - block samples of latency but costs less
+    //CPU).  setChunkSize() prepares CHAPRO again for the new chunk size (including the AFC's hardware
+    //delay), keeps the filterbank, AGC, and AFC states that it can, and then switches over between
+    //audio blocks.  The new chunk must be a multiple or a divisor of the audio block size.  The new
+    //arrays are on the heap.  Not available for binaural, where the ears share the coefficients.
+    int setChunkSize(int new_cs);
+    int getChunkSize(void) { return chapro_cs; }
+    int getAddedLatency_samples(void) { return max(chapro_cs - block_len, 0); }
+
+    //The AFC's hardware delay (output to input, in samples), such as from AudioLatencyProbe_F32.  Like
+    //setChunkSize(), this prepares CHAPRO again and keeps the states.
+    int setAfcHdel(int new_hdel);
+    int getAfcHdel(void) { return local_afc.hdel; }
+    static bool isSharedCoeff(int idx, bool share_agc_coeff);
+    int getCpSize(int idx) {  //bytes (as recorded by cha_allocate)
+      if (cp[_size] == NULL) return 0;
+      if (idx == _size) return NPTR * sizeof(int);  //the list of sizes itself
+      return ((int *)cp[_size])[idx];
+    }
+    void printMemoryUsage(Print *p);
+
+    //Arena: give it before setup() to keep the CHAPRO arrays out of the heap (see BTNRH_StateArena.h and
+    //prepare() in test_gha.h).  dryRunArenaBytes() prepares a throw-away copy of the configured CHAPRO
+    //chain on the heap to find how big the arena needs to be (per ear) for the given alignment.  To size
+    //the arena before building the sketch, run host/chapro_arena on a PC.
+    BTNRH_StateArena* setArena(BTNRH_StateArena *_arena) { return arena = _arena; }
+    static int dryRunArenaBytes(int align, Print *p = NULL);
+
+    //Data blob: everything that configure() and prepare() produce, in one block of bytes (see BTNRH_DataBlob.h).
+    //Save it after setup() (before the audio starts, so that the states are fresh).  Starting from a blob
+    //does no design math.  If this instance is already set up with the same array sizes (such as another
+    //preset with the same number of channels), loading a blob just copies it over the current arrays.
+    //The fixed-size filterbank's measured delays are saved too, so loading rebuilds it without the self-check.
+    int getDataBlobSize(void);
+    int saveDataBlob(uint8_t *dest, int max_bytes);
+    bool setupFromDataBlob(const uint8_t *blob, int n_bytes);
+    void printDataBlobAsC(Print *p, const char *name);
     
 
     // ////////////////////////////////////////// Here is the call into the CHAPRO that actually does the signal processing
@@ -95,25 +190,51 @@ class AudioEffectBTNRH_F32 : public AudioStream_F32
     void applyMyAlgorithm(audio_block_f32_t *audio_block)
     {
       float *x = audio_block->data;  //This is used input audio.  And, the output is written back in here, too
-      int cs = audio_block->length;  //How many audio samples to process?
-      
-      
-      //copy local copies to global instances before calling functions in the global scope
-      memcpy(&afc_global, &local_afc, sizeof(CHA_AFC));  //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
-      memcpy(&dsl_global, &local_dsl, sizeof(CHA_DSL));  //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
-      memcpy(&agc_global, &local_agc, sizeof(CHA_WDRC)); //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
-      prepared = local_prepared; //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!!  
-       
-      //hopefully, this one line is all that needs to change to reflect what CHAPRO code you want to use
-      process_chunk(cp, x, x, cs); //see test_gha.h  (or whatever test_xxxx.h is #included at the top)
-
-      //copy global instances back to local copies after completing the functions that are in the global scope
-      memcpy(&local_afc, &afc_global, sizeof(CHA_AFC));  //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
-      memcpy(&local_dsl, &dsl_global, sizeof(CHA_DSL));  //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
-      memcpy(&local_agc, &agc_global, sizeof(CHA_WDRC)); //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
-      local_prepared = prepared; //////////////////// Add or remove items based on *your* CHAPRO Algorithm!!!! 
-      
+      int len = audio_block->length;  //How many audio samples to process?
+      uint32_t start_cycles = ARM_DWT_CYCCNT;
+
+      if ((chapro_cs == len) || (chapro_cs <= 0)) {
+        processChunk(x, len);
+      } else if (chapro_cs < len) {
+        //split the block into CHAPRO's chunks
+        for (int i = 0; i + chapro_cs <= len; i += chapro_cs) processChunk(x + i, chapro_cs);
+      } else {
+        //collect the blocks into one of CHAPRO's chunks, while playing out the chunk before it
+        memcpy(reblock_in + reblock_pos, x, len * sizeof(float));
+        reblock_pos += len;
+        if (reblock_pos >= chapro_cs) {
+          processChunk(reblock_in, chapro_cs);
+          memcpy(reblock_out, reblock_in, chapro_cs * sizeof(float));
+          reblock_pos = 0;
+        }
+        memcpy(x, reblock_out + reblock_pos, len * sizeof(float));
+      }
+
+      block_cycles_sum += (ARM_DWT_CYCCNT - start_cycles);
+      n_blocks_timed++;
     } //end of applyMyAlgorithms
+
+    void processChunk(float *x, int cs)
+    {
+      if (use_global_copies) {
+        //the old way (kept only for benchmarkGlobalCopies()): swap this instance's structures in and out of the globals
+        memcpy(&afc_global, &local_afc, sizeof(CHA_AFC));
+        memcpy(&dsl_global, &local_dsl, sizeof(CHA_DSL));
+        memcpy(&agc_global, &local_agc, sizeof(CHA_WDRC));
+        prepared = local_prepared;
+        process_chunk(cp, x, x, cs);
+        memcpy(&local_afc, &afc_global, sizeof(CHA_AFC));
+        memcpy(&local_dsl, &dsl_global, sizeof(CHA_DSL));
+        memcpy(&local_agc, &agc_global, sizeof(CHA_WDRC));
+        local_prepared = prepared;
+      } else if (use_fixed_pipeline && (cs == BTNRH_FIXED_CS)) {
+        //same processing, but with the fixed-size filterbank
+        process_chunk_fixed(cp, local_prepared, fixed_fb, x, x, cs);
+      } else {
+        //everything that the CHAPRO stages need is in this instance's cp[], so no copying is needed
+        process_chunk_ctx(cp, local_prepared, x, x, cs); //see test_gha.h  (or whatever test_xxxx.h is #included at the top)
+      }
+    }
     // /////////// End of the signal processing code that references CHAPRO
 
     
@@ -133,6 +254,7 @@ class AudioEffectBTNRH_F32 : public AudioStream_F32
 
         //do your work
         applyMyAlgorithm(audio_block); //this is the method defined earlier that you can touch as you see fit
+        if (fb_snapshot.blockTick()) publishFeedbackModel();  //every so often, give loop() a copy of the AFC model
 
         ///transmit the block and release memory
         AudioStream_F32::transmit(audio_block);
@@ -144,6 +266,22 @@ class AudioEffectBTNRH_F32 : public AudioStream_F32
     //state-related variables
     audio_block_f32_t *inputQueueArray_f32[1]; //memory pointer for the input to this module
     bool enabled = false;
+    FeedbackModelSnapshot_F32<BTNRH_MAX_SNAPSHOT_LEN> fb_snapshot;
+    volatile uint32_t block_cycles_sum = 0, n_blocks_timed = 0;  //for benchmarkGlobalCopies()
+    BTNRH_FixedFB fixed_fb;
+    bool use_fixed_pipeline = false, fixed_pipeline_ok = false;
+    BTNRH_StateArena *arena = NULL;
+    int stage_bytes[N_PREP_STAGES] = {0};  //bytes of CHAPRO arrays made by each stage of prepare()
+    int block_len = AUDIO_BLOCK_SAMPLES;  //audio block size
+    int chapro_cs = 0;                    //CHAPRO's chunk size
+    bool is_binaural = false;             //shares arrays with the other ear
+    float reblock_in[AUDIO_BLOCK_SAMPLES], reblock_out[AUDIO_BLOCK_SAMPLES] = {0};  //for chunks bigger than the audio block
+    int reblock_pos = 0;
+
+    void reprepare(int new_cs, int new_hdel, int model_shift = 0);
+
+    void printFixedCheck(Print *p, bool is_ok, const float *err_dB, const char *action);
+    bool loadFixedPipeline(const int *delays, bool was_ok, Print *p = NULL);
 
 }; //end class definition for AudioEffectBTNRH
 
@@ -183,6 +321,407 @@ void AudioEffectBTNRH_F32::print_afc_params(void) {
   Serial.println("AFC: fbm = " + String(get_cha_dvar(_fbm),8));      
 }
 
+void AudioEffectBTNRH_F32::benchmarkGlobalCopies(Print *p, unsigned long dur_msec) {
+  float ave_cycles[2] = {0.0f, 0.0f};
+  bool orig_use_global_copies = use_global_copies;
+  for (int Itest = 0; Itest < 2; Itest++) {
+    use_global_copies = (Itest == 0);
+    __disable_irq(); block_cycles_sum = 0; n_blocks_timed = 0; __enable_irq();
+    delay(dur_msec);
+    __disable_irq(); uint32_t cycles = block_cycles_sum, n_blocks = n_blocks_timed; __enable_irq();
+    if (n_blocks > 0) ave_cycles[Itest] = (float)cycles / (float)n_blocks;
+  }
+  use_global_copies = orig_use_global_copies;
+
+  float usec_per_cycle = 1.0e6f / (float)F_CPU_ACTUAL;
+  p->println("AudioEffectBTNRH_F32: benchmarkGlobalCopies: per-block cost of process_chunk (chunk = " + String(chunk) + ")");
+  p->println("    : with global struct copies = " + String(ave_cycles[0], 0) + " cycles (" + String(ave_cycles[0] * usec_per_cycle, 2) + " usec)");
+  p->println("    : with context (no copies)  = " + String(ave_cycles[1], 0) + " cycles (" + String(ave_cycles[1] * usec_per_cycle, 2) + " usec)");
+  float blocks_per_sec = (float)srate / (float)chunk;
+  p->println("    : savings = " + String(ave_cycles[0] - ave_cycles[1], 0) + " cycles per block, " + 
+             String(100.0f * (ave_cycles[0] - ave_cycles[1]) * blocks_per_sec / (float)F_CPU_ACTUAL, 2) + "% of the CPU");
+}
+
+//the arrays that are set by prepare() and never change after that
+bool AudioEffectBTNRH_F32::isSharedCoeff(int idx, bool share_agc_coeff) {
+  switch (idx) {
+    case _size: case _bb: case _aa: case _dd:          //the array sizes, and the filterbank coefficients and delays
+      return true;
+    case _gctk: case _gccr: case _gctkgn: case _gcbolt: //the per-channel AGC settings (from the prescription)
+      return share_agc_coeff;
+  }
+  return false;
+}
+
+bool AudioEffectBTNRH_F32::setupBinaural(AudioEffectBTNRH_F32 &first_ear, BTNRH_StateArena &arena, bool share_agc_coeff) {
+  if ((!first_ear.setup_complete) || (first_ear.cp[_size] == NULL)) {
+    Serial.println("AudioEffectBTNRH_F32: setupBinaural: *** ERROR ***: call setup() on the first ear first.");
+    return false;
+  }
+
+  //make sure that every per-ear array can be copied (and that there is room) before changing anything
+  int need_bytes = arena.getAlignment();  //in case the arena is not aligned yet
+  for (int idx = 0; idx < NPTR; idx++) {
+    if ((first_ear.cp[idx] == NULL) || isSharedCoeff(idx, share_agc_coeff)) continue;
+    int n = first_ear.getCpSize(idx);
+    if (n <= 0) {
+      Serial.println("AudioEffectBTNRH_F32: setupBinaural: *** ERROR ***: unknown size for cp[" + String(idx) + "].");
+      return false;
+    }
+    need_bytes += (arena.contains(first_ear.cp[idx]) ? 1 : 2) * arena.getPaddedSize(n);  //the first ear's might be there already
+  }
+  if (need_bytes > arena.getBytesTotal() - arena.getBytesUsed()) {
+    Serial.println("AudioEffectBTNRH_F32: setupBinaural: *** ERROR ***: arena is too small.  Need " + String(need_bytes) +
+        " bytes, have " + String(arena.getBytesTotal() - arena.getBytesUsed()) + ".");
+    return false;
+  }
+
+  //all of the first ear's states, then all of this ear's states
+  AudioNoInterrupts();  //the first ear might already be processing audio
+  for (int Iear = 0; Iear < 2; Iear++) {
+    for (int idx = 0; idx < NPTR; idx++) {
+      if ((first_ear.cp[idx] == NULL) || isSharedCoeff(idx, share_agc_coeff)) {
+        if (Iear == 1) cp[idx] = first_ear.cp[idx];  //shared (or unused)
+        continue;
+      }
+      if ((Iear == 0) && arena.contains(first_ear.cp[idx])) continue;  //already moved there by prepare()
+      void *ptr = arena.allocateCopy(first_ear.cp[idx], first_ear.getCpSize(idx));
+      if (Iear == 0) {
+        free(first_ear.cp[idx]);  //was calloc'd by cha_allocate()
+        first_ear.cp[idx] = ptr;
+      } else {
+        cp[idx] = ptr;
+      }
+    }
+  }
+  AudioInterrupts();
+
+  //this ear was prepared with the same settings as the first ear
+  memcpy(&local_afc, &first_ear.local_afc, sizeof(CHA_AFC));
+  memcpy(&local_dsl, &first_ear.local_dsl, sizeof(CHA_DSL));
+  memcpy(&local_agc, &first_ear.local_agc, sizeof(CHA_WDRC));
+  local_prepared = first_ear.local_prepared;
+  for (int I = 0; I < N_PREP_STAGES; I++) stage_bytes[I] = first_ear.stage_bytes[I];
+  this->arena = &arena;
+  chapro_cs = first_ear.chapro_cs;
+  is_binaural = true;  first_ear.is_binaural = true;
+  fixed_fb = first_ear.fixed_fb;  fixed_fb.reset();
+  fixed_pipeline_ok = first_ear.fixed_pipeline_ok;
+  use_fixed_pipeline = first_ear.use_fixed_pipeline;
+  setup_complete = true;
+  return true;
+}
+
+void AudioEffectBTNRH_F32::printMemoryUsage(Print *p) {
+  int coeff_bytes = 0, state_bytes = 0;
+  for (int idx = 0; idx < NPTR; idx++) {
+    if (cp[idx] == NULL) continue;
+    if (isSharedCoeff(idx, true)) { coeff_bytes += getCpSize(idx); } else { state_bytes += getCpSize(idx); }
+  }
+  p->println("AudioEffectBTNRH_F32: CHAPRO arrays: coefficients = " + String(coeff_bytes) + " bytes, states = " + String(state_bytes) + " bytes");
+  p->println("    : two independent ears = " + String(2*(coeff_bytes + state_bytes)) + " bytes, binaural (shared coefficients) = " +
+             String(coeff_bytes + 2*state_bytes) + " bytes");
+  p->print("    : made by prepare(): ");
+  for (int I = 0; I < N_PREP_STAGES; I++) p->print(String(prepare_stage_names[I]) + " = " + String(stage_bytes[I]) + " bytes" + ((I < N_PREP_STAGES-1) ? ", " : "\n"));
+  if (arena == NULL) {
+    p->println("    : on the heap (no arena)");
+  } else {
+    int n_on_heap = 0;
+    for (int idx = 0; idx < NPTR; idx++) if ((cp[idx] != NULL) && !arena->contains(cp[idx])) n_on_heap++;
+    p->println("    : arena = " + String(arena->getBytesUsed()) + " of " + String(arena->getBytesTotal()) + " bytes used (peak " +
+               String(arena->getPeakBytesUsed()) + ", aligned to " + String(arena->getAlignment()) + " bytes).  Arrays still on the heap = " + String(n_on_heap));
+  }
+}
+
+int AudioEffectBTNRH_F32::dryRunArenaBytes(int align, Print *p) {
+  void *tmp_cp[NPTR] = {0};
+  I_O tmp_io;
+  BTNRH_StateArena *orig_arena = prepare_arena;
+  prepare_arena = NULL;  //everything stays on the heap, to be measured and then freed
+  prepare(&tmp_io, tmp_cp);
+  prepare_arena = orig_arena;
+
+  align = max(align, BTNRH_ARENA_ALIGN);
+  int n_bytes = align;  //in case the arena itself is not aligned
+  int sizes[NPTR];
+  cp_sizes(tmp_cp, sizes);
+  for (int idx = 0; idx < NPTR; idx++) {
+    if (tmp_cp[idx] == NULL) continue;
+    n_bytes += (sizes[idx] + align - 1) & ~(align - 1);
+    free(tmp_cp[idx]);  //calloc'd by cha_allocate
+  }
+  if (p) {
+    p->print("AudioEffectBTNRH_F32: dryRunArenaBytes: " + String(n_bytes) + " bytes (aligned to " + String(align) + ").  By stage: ");
+    for (int I = 0; I < N_PREP_STAGES; I++) p->print(String(prepare_stage_names[I]) + " = " + String(prepare_stage_bytes[I]) + ((I < N_PREP_STAGES-1) ? ", " : "\n"));
+  }
+  return n_bytes;
+}
+
+int AudioEffectBTNRH_F32::setChunkSize(int new_cs) {
+  if (!setup_complete) return chapro_cs;
+  if ((new_cs < 1) || (new_cs > AUDIO_BLOCK_SAMPLES) || (((new_cs % block_len) != 0) && ((block_len % new_cs) != 0))) {
+    Serial.println("AudioEffectBTNRH_F32: setChunkSize: *** ERROR ***: chunk must be a multiple or divisor of the audio block (" + String(block_len) + ") and <= " + String(AUDIO_BLOCK_SAMPLES));
+    return chapro_cs;
+  }
+  if (is_binaural) {
+    Serial.println("AudioEffectBTNRH_F32: setChunkSize: *** ERROR ***: not available for binaural processing.");
+    return chapro_cs;
+  }
+  if (new_cs == chapro_cs) return chapro_cs;
+
+  //the AFC's hardware delay: the part from the hardware stays, the part from the blocking changes
+  int old_blocking = 2*block_len + max(chapro_cs - block_len, 0), new_blocking = 2*block_len + max(new_cs - block_len, 0);
+  int hw_delay = local_afc.hdel - old_blocking;
+  reprepare(new_cs, hw_delay + new_blocking);
+  Serial.println("AudioEffectBTNRH_F32: setChunkSize: chunk = " + String(chapro_cs) + ", AFC hdel = " + String(local_afc.hdel) +
+                 ", added latency = " + String(getAddedLatency_samples()) + " samples");
+  return chapro_cs;
+}
+
+int AudioEffectBTNRH_F32::setAfcHdel(int new_hdel) {
+  if (!setup_complete) return local_afc.hdel;
+  if (is_binaural) {
+    Serial.println("AudioEffectBTNRH_F32: setAfcHdel: *** ERROR ***: not available for binaural processing.");
+    return local_afc.hdel;
+  }
+  if ((new_hdel < 0) || (new_hdel == local_afc.hdel)) return local_afc.hdel;
+  reprepare(chapro_cs, new_hdel, local_afc.hdel - new_hdel);  //the feedback path itself is the same, so move the model to match
+  Serial.println("AudioEffectBTNRH_F32: setAfcHdel: AFC hdel = " + String(local_afc.hdel));
+  return local_afc.hdel;
+}
+
+//prepare a new set of arrays (with this instance's settings) while the audio keeps running on the old ones
+//model_shift: how far the AFC model's taps move (when the delay that they start from changes)
+void AudioEffectBTNRH_F32::reprepare(int new_cs, int new_hdel, int model_shift) {
+  memcpy(&afc_global, &local_afc, sizeof(CHA_AFC));
+  memcpy(&dsl_global, &local_dsl, sizeof(CHA_DSL));
+  memcpy(&agc_global, &local_agc, sizeof(CHA_WDRC));
+  afc_global.hdel = new_hdel;
+  chunk = new_cs;
+  void *new_cp[NPTR] = {0}, *old_cp[NPTR];
+  BTNRH_StateArena *orig_arena = prepare_arena;
+  prepare_arena = NULL;  //the arena cannot give memory back, so the new arrays go on the heap
+  prepare(&io, new_cp);  //in test_gha.h
+  prepare_arena = orig_arena;
+  memcpy(&local_afc, &afc_global, sizeof(CHA_AFC));
+
+  //keep the states that do not depend on the chunk size, and the AFC settings that might have been changed
+  const int keep[] = {_zz, _xpk, _ppk, _efbp};  //filter states, AGC envelopes, AFC model
+  const int keep_dvar[] = {_mu, _rho, _eps, _alf};
+  AudioNoInterrupts();
+  for (unsigned int I = 0; I < sizeof(keep)/sizeof(keep[0]); I++) {
+    int idx = keep[I];
+    if ((cp[idx] != NULL) && (new_cp[idx] != NULL) && (getCpSize(idx) == ((int *)new_cp[_size])[idx])) memcpy(new_cp[idx], cp[idx], getCpSize(idx));
+  }
+  if ((model_shift != 0) && (new_cp[_efbp] != NULL)) {
+    float *efbp = (float *)new_cp[_efbp];
+    int afl = ((int *)new_cp[_ivar])[_afl];
+    if (model_shift > 0) { for (int j = afl-1; j >= 0; j--) efbp[j] = (j >= model_shift) ? efbp[j - model_shift] : 0.0f; }
+    else                 { for (int j = 0; j < afl; j++) efbp[j] = (j - model_shift < afl) ? efbp[j - model_shift] : 0.0f; }
+  }
+  for (unsigned int I = 0; I < sizeof(keep_dvar)/sizeof(keep_dvar[0]); I++) ((double *)new_cp[_dvar])[keep_dvar[I]] = get_cha_dvar(keep_dvar[I]);
+  ((int *)new_cp[_ivar])[_mxl] = get_cha_ivar(_mxl);  //AFC enabled or not
+  for (int idx = 0; idx < NPTR; idx++) { old_cp[idx] = cp[idx]; cp[idx] = new_cp[idx]; }
+  use_fixed_pipeline = false;
+  chapro_cs = new_cs;
+  reblock_pos = 0;
+  for (int i = 0; i < AUDIO_BLOCK_SAMPLES; i++) reblock_out[i] = 0.0f;
+  AudioInterrupts();
+
+  for (int idx = 0; idx < NPTR; idx++) {
+    if ((old_cp[idx] != NULL) && ((arena == NULL) || !arena->contains(old_cp[idx]))) free(old_cp[idx]);  //calloc'd by cha_allocate
+  }
+  setupFixedPipeline(&Serial);  //only used if the new chunk size matches
+}
+
+int AudioEffectBTNRH_F32::getDataBlobSize(void) {
+  int sizes[NPTR];
+  for (int idx = 0; idx < NPTR; idx++) sizes[idx] = getCpSize(idx);
+  return BTNRH_DataBlob::getSize(cp, sizes, NPTR, sizeof(BTNRH_BlobSettings));
+}
+
+int AudioEffectBTNRH_F32::saveDataBlob(uint8_t *dest, int max_bytes) {
+  if (!setup_complete) return 0;
+  BTNRH_BlobSettings settings;
+  memset(&settings, 0, sizeof(settings));
+  settings.srate = srate;
+  settings.chunk = get_cha_ivar(_cs);
+  BTNRH_saveBlobAFC(&settings.afc, &local_afc);
+  memcpy(&settings.dsl, &local_dsl, sizeof(CHA_DSL));
+  memcpy(&settings.agc, &local_agc, sizeof(CHA_WDRC));
+  memcpy(settings.iirfb_z, iirfb_z, sizeof(iirfb_z));
+  memcpy(settings.iirfb_p, iirfb_p, sizeof(iirfb_p));
+  memcpy(settings.iirfb_g, iirfb_g, sizeof(iirfb_g));
+  memcpy(settings.iirfb_d, iirfb_d, sizeof(iirfb_d));
+  for (int k = 0; k < BTNRH_FIXED_NC; k++) settings.fixed_delays[k] = fixed_fb.getDelay(k);
+  settings.fixed_ok = fixed_pipeline_ok ? 1 : 0;
+
+  int sizes[NPTR];
+  for (int idx = 0; idx < NPTR; idx++) sizes[idx] = getCpSize(idx);
+  AudioNoInterrupts();  //in case the audio is already running
+  int n_bytes = BTNRH_DataBlob::write(dest, max_bytes, cp, sizes, NPTR, &settings, sizeof(settings));
+  AudioInterrupts();
+  return n_bytes;
+}
+
+bool AudioEffectBTNRH_F32::setupFromDataBlob(const uint8_t *blob, int n_bytes) {
+  if (!BTNRH_DataBlob::isValid(blob, n_bytes) || (BTNRH_DataBlob::getHeader(blob)->n_ptr != NPTR) ||
+      (BTNRH_DataBlob::getHeader(blob)->extra_bytes != (int)sizeof(BTNRH_BlobSettings))) {
+    Serial.println("AudioEffectBTNRH_F32: setupFromDataBlob: *** ERROR ***: not a valid CHAPRO data blob.");
+    return false;
+  }
+  const BTNRH_BlobSettings *settings = (const BTNRH_BlobSettings *)BTNRH_DataBlob::getExtra(blob);
+  if ((settings->srate != srate) || (settings->chunk != chunk)) {
+    Serial.println("AudioEffectBTNRH_F32: setupFromDataBlob: *** ERROR ***: blob is for fs = " + String(settings->srate, 0) +
+        " Hz, chunk = " + String(settings->chunk) + ", not fs = " + String(srate, 0) + " Hz, chunk = " + String(chunk));
+    return false;
+  }
+
+  bool is_ok;
+  if (setup_complete) {
+    //switching presets: copy over the current arrays
+    int sizes[NPTR];
+    for (int idx = 0; idx < NPTR; idx++) sizes[idx] = getCpSize(idx);
+    AudioNoInterrupts();
+    use_fixed_pipeline = false;  //its coefficients are about to change
+    is_ok = BTNRH_DataBlob::load(blob, cp, sizes);
+    AudioInterrupts();
+  } else {
+    is_ok = BTNRH_DataBlob::load(blob, cp, NULL);
+    if (is_ok && (arena != NULL)) {
+      int sizes[NPTR];
+      for (int idx = 0; idx < NPTR; idx++) sizes[idx] = getCpSize(idx);
+      arena->adopt(cp, sizes, NPTR);  //keep the arrays out of the heap, like prepare() does
+    }
+  }
+  if (!is_ok) return false;
+
+  BTNRH_loadBlobAFC(&local_afc, &settings->afc);
+  memcpy(&local_dsl, &settings->dsl, sizeof(CHA_DSL));
+  memcpy(&local_agc, &settings->agc, sizeof(CHA_WDRC));
+  memcpy(iirfb_z, settings->iirfb_z, sizeof(iirfb_z));
+  memcpy(iirfb_p, settings->iirfb_p, sizeof(iirfb_p));
+  memcpy(iirfb_g, settings->iirfb_g, sizeof(iirfb_g));
+  memcpy(iirfb_d, settings->iirfb_d, sizeof(iirfb_d));
+  local_prepared = 1;
+  chapro_cs = get_cha_ivar(_cs);
+  setup_complete = true;
+  loadFixedPipeline(settings->fixed_delays, (settings->fixed_ok != 0), &Serial);  //no self-check: it was done before the blob was saved
+  return true;
+}
+
+void AudioEffectBTNRH_F32::printDataBlobAsC(Print *p, const char *name) {
+  int n_bytes = getDataBlobSize();
+  uint8_t *blob = (uint8_t *)malloc(n_bytes);
+  if (blob == NULL) { p->println("AudioEffectBTNRH_F32: printDataBlobAsC: *** ERROR ***: out of memory."); return; }
+  if (saveDataBlob(blob, n_bytes) > 0) BTNRH_DataBlob::printAsC(blob, p, name);
+  free(blob);
+}
+
+void AudioEffectBTNRH_F32::printFixedCheck(Print *p, bool is_ok, const float *err_dB, const char *action) {
+  p->print("AudioEffectBTNRH_F32: fixed-size filterbank (nc = " + String(BTNRH_FIXED_NC) + ", nz = " + String(BTNRH_FIXED_NZ) + ", cs = " + String(BTNRH_FIXED_CS) + ") ");
+  p->print(is_ok ? "passed" : "FAILED");
+  p->println(" the self-check: error vs CHAPRO = " + String(err_dB[0], 1) + " dB (impulse), " + String(err_dB[1], 1) + " dB (noise), " +
+             String(err_dB[2], 1) + " dB (synthesized).  " + String(action));
+}
+
+bool AudioEffectBTNRH_F32::setupFixedPipeline(Print *p) {
+  use_fixed_pipeline = false;  fixed_pipeline_ok = false;
+  if (!setup_complete) return false;
+  int nc = get_cha_ivar(_nc), cs = get_cha_ivar(_cs), nz = local_agc.nz;
+  if ((nc != BTNRH_FIXED_NC) || (nz != BTNRH_FIXED_NZ) || (cs != BTNRH_FIXED_CS)) {
+    if (p) p->println("AudioEffectBTNRH_F32: using the generic filterbank (nc = " + String(nc) + ", nz = " + String(nz) + ", cs = " + String(cs) + ")");
+    return false;
+  }
+  BTNRH_FixedFB *fb = new BTNRH_FixedFB;  //build and check a new one, and only then copy it in
+  if ((fb == NULL) || !fb->setCoeff(iirfb_z, iirfb_p, iirfb_g)) {
+    if (p) p->println("AudioEffectBTNRH_F32: *** WARNING ***: could not build the fixed-size filterbank.  Using the generic one.");
+    if (fb) delete fb;
+    return false;
+  }
+
+  float err_dB[3];
+  bool is_ok = BTNRH_FixedCheck::check(cp, fb, true, err_dB);  //(on scratch filter states, so the audio keeps running)
+  if (is_ok) { fixed_fb = *fb;  fixed_fb.reset(); }  //(the audio is not using fixed_fb: use_fixed_pipeline is false)
+  delete fb;
+
+  fixed_pipeline_ok = is_ok;
+  use_fixed_pipeline = is_ok;
+  if (p) printFixedCheck(p, is_ok, err_dB, is_ok ? "Using it." : "Using the generic filterbank.");
+  return is_ok;
+}
+
+bool AudioEffectBTNRH_F32::checkFixedPipeline(Print *p) {
+  if (!fixed_pipeline_ok) { p->println("AudioEffectBTNRH_F32: checkFixedPipeline: the fixed-size filterbank is not available."); return false; }
+  BTNRH_FixedFB *fb = new BTNRH_FixedFB(fixed_fb);  //a copy (with the measured delays), so that the audio's filter states are not touched
+  if (fb == NULL) return false;
+  float err_dB[3];
+  bool is_ok = BTNRH_FixedCheck::check(cp, fb, false, err_dB);
+  delete fb;
+  printFixedCheck(p, is_ok, err_dB, use_fixed_pipeline ? "(in use)" : "(not in use)");
+  return is_ok;
+}
+
+//rebuild the fixed-size filterbank from the design and the delays that were saved in a data blob.  Unlike
+//setupFixedPipeline(), there is no self-check, so the audio is never held up.  The audio is not using
+//fixed_fb while this runs (setupFromDataBlob() turned it off), so it can be rebuilt in place.
+bool AudioEffectBTNRH_F32::loadFixedPipeline(const int *delays, bool was_ok, Print *p) {
+  use_fixed_pipeline = false;  fixed_pipeline_ok = false;
+  int nc = get_cha_ivar(_nc), cs = get_cha_ivar(_cs), nz = local_agc.nz;
+  if ((nc != BTNRH_FIXED_NC) || (nz != BTNRH_FIXED_NZ) || (cs != BTNRH_FIXED_CS) || !was_ok) {
+    if (p) p->println("AudioEffectBTNRH_F32: using the generic filterbank (nc = " + String(nc) + ", nz = " + String(nz) + ", cs = " + String(cs) +
+                      (was_ok ? ")" : ", the fixed-size one failed its self-check when the blob was saved)"));
+    return false;
+  }
+  if (!fixed_fb.setCoeff(iirfb_z, iirfb_p, iirfb_g) || !fixed_fb.setDelays(delays)) {
+    if (p) p->println("AudioEffectBTNRH_F32: *** WARNING ***: could not build the fixed-size filterbank from the blob.  Using the generic one.");
+    return false;
+  }
+  fixed_fb.reset();
+  fixed_pipeline_ok = true;
+  use_fixed_pipeline = true;
+  if (p) p->println("AudioEffectBTNRH_F32: fixed-size filterbank (nc = " + String(BTNRH_FIXED_NC) + ", nz = " + String(BTNRH_FIXED_NZ) + ", cs = " + String(BTNRH_FIXED_CS) +
+                    ") loaded with the delays from the blob.  Using it.");
+  return true;
+}
+
+void AudioEffectBTNRH_F32::benchmarkFixedPipeline(Print *p, int n_chunks) {
+  if (!fixed_pipeline_ok) { p->println("AudioEffectBTNRH_F32: benchmarkFixedPipeline: the fixed-size filterbank is not available."); return; }
+  const int cs = BTNRH_FIXED_CS;
+  float x[cs], z[BTNRH_FIXED_NC * cs], y[cs];
+  uint32_t seed = 12345, cycles[2] = {0, 0};
+  void *scratch_cp[NPTR];
+  BTNRH_FixedFB *fb = new BTNRH_FixedFB(fixed_fb);  //a copy, so that the audio's filter states are not touched
+  if ((fb == NULL) || !BTNRH_FixedCheck::makeScratch(cp, scratch_cp)) {  //(and the same for CHAPRO's filterbank)
+    p->println("AudioEffectBTNRH_F32: benchmarkFixedPipeline: *** ERROR ***: not enough memory.");
+    if (fb) { BTNRH_FixedCheck::freeScratch(scratch_cp);  delete fb; }
+    return;
+  }
+  for (int Itest = 0; Itest < 2; Itest++) {
+    for (int Ichunk = 0; Ichunk < n_chunks; Ichunk++) {
+      for (int i = 0; i < cs; i++) { seed = seed * 1664525UL + 1013904223UL; x[i] = ((float)(seed >> 8) / 16777216.0f) - 0.5f; }
+      uint32_t start_cycles = ARM_DWT_CYCCNT;
+      if (Itest == 0) {
+        cha_iirfb_analyze(scratch_cp, x, z, cs);
+        cha_iirfb_synthesize(scratch_cp, z, y, cs);
+      } else {
+        fb->analyze(x, z);
+        fb->synthesize(z, y);
+      }
+      cycles[Itest] += ARM_DWT_CYCCNT - start_cycles;
+    }
+  }
+  BTNRH_FixedCheck::freeScratch(scratch_cp);
+  delete fb;
+
+  float usec_per_cycle = 1.0e6f / (float)F_CPU_ACTUAL;
+  p->println("AudioEffectBTNRH_F32: filterbank (analyze + synthesize) per chunk of " + String(cs) + ", " + String(BTNRH_FIXED_NC) + " channels:");
+  for (int Itest = 0; Itest < 2; Itest++) {
+    float ave = (float)cycles[Itest] / (float)n_chunks;
+    p->println(String((Itest == 0) ? "    : generic (CHAPRO) = " : "    : fixed-size       = ") + String(ave, 0) + " cycles (" + String(ave * usec_per_cycle, 2) + " usec)");
+  }
+}
+
 //setAfcEnabled: enable or disable the AFC portion of the BTNRH algorithm.
 //  This is done by setting the "mxl" (max AFC filter length) to zero.
 //  To re-enable, we set the mxl back to its proper (non-zero) value
@@ -215,7 +754,8 @@ bool AudioEffectBTNRH_F32::servicePrintingFeedbackModel(unsigned long curTime_mi
   if (curTime_millis < lastUpdate_millis) lastUpdate_millis = 0; //handle wrap-around of the clock
   if ((curTime_millis - lastUpdate_millis) >= updatePeriod_millis) { //is it time to update the user interface?
 
-    int n_coeff = get_cha_ivar(_afl);
+    static float efbp[BTNRH_MAX_SNAPSHOT_LEN];
+    int n_coeff = getFeedbackModel(efbp, BTNRH_MAX_SNAPSHOT_LEN);  //a tear-free copy of the AFC model
     if (n_coeff > 0) {
       //Serial.println("servicePrintingFeedbackModel: printing feedback model for AFC...");
       float scale_fac = 100.0;  //choose whatever to make the plot prettier
@@ -225,7 +765,6 @@ bool AudioEffectBTNRH_F32::servicePrintingFeedbackModel(unsigned long curTime_mi
       Serial.println(scale_fac,n_decimals);
       Serial.println(-scale_fac,n_decimals);
       //Serial.println(0.0);   
-      float *efbp = (float *)(cp[_efbp]);  //get a simpler name for the array that we're going to print
       for (int i=0; i<n_coeff; i++) { 
         Serial.println(scale_fac*efbp[i],n_decimals); //print x decimal places
       }
@@ -244,7 +783,8 @@ bool AudioEffectBTNRH_F32::servicePrintingFeedbackModel_toApp(unsigned long curT
   //has enough time passed to update everything?
   if (curTime_millis < lastUpdate_millis) lastUpdate_millis = 0; //handle wrap-around of the clock
   if ((curTime_millis - lastUpdate_millis) >= updatePeriod_millis) { //is it time to update the user interface?
-    int n_coeff = get_cha_ivar(_afl);
+    static float efbp[BTNRH_MAX_SNAPSHOT_LEN];
+    int n_coeff = getFeedbackModel(efbp, BTNRH_MAX_SNAPSHOT_LEN);  //a tear-free copy of the AFC model
     if (n_coeff > 0) {
       Serial.println("servicePrintingFeedbackModel: printing feedback model for AFC...");
       float scale_fac = 1.0;  //choose whatever to make the plot prettier
@@ -255,7 +795,6 @@ bool AudioEffectBTNRH_F32::servicePrintingFeedbackModel_toApp(unsigned long curT
       ble.sendMessage(line_prefix + String(scale_fac,n_decimals) + String('\n'));
       ble.sendMessage(line_prefix + String(-scale_fac,n_decimals) + String('\n'));
       //ble.sendMessage(line_prefix + String(0.0,n_decimals) + String('\n'));      
-      float *efbp = (float *)(cp[_efbp]); //get a simpler name for the array that we're going to print
       for (int i=0; i<n_coeff; i++) { 
         ble.sendMessage(line_prefix + String(scale_fac*efbp[i],n_decimals) + String('\n')); //print x decimal places
       }
@@ -0,0 +1,190 @@
+/*
+   AudioLatencyProbe_F32
+
+   Created: OpenAudio, 2022
+   Purpose: Measure the real delays of the hearing-aid path, instead of assuming them (as the AFC's hdel does).
+
+       AudioLatencyProbe_F32 goes in front of the algorithm.  When started, it adds a marker (a maximum-
+       length sequence, MLS) to the audio going into the algorithm, and it records the microphone audio
+       coming in.  AudioLatencyProbeTap_F32 goes on the output (after the algorithm and the gain) and
+       records that, too.  Afterwards, analyze() cross-correlates the marker with both recordings:
+
+         * algorithm latency: marker in -> output tap (the processing, including any re-blocking)
+         * loop latency: output tap -> microphone (DAC, receiver, acoustics, mic, ADC, and the I2S
+           buffering).  This is what the AFC's hdel should be (plus the algorithm's re-blocking).
+
+       The tap must be created after the probe (and after the algorithm), so that it is updated later
+       in the same audio cycle.  Only the recording happens in the audio interrupt.  The cross-correlation
+       is done in analyze(), from loop().
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _AudioLatencyProbe_F32_h
+#define _AudioLatencyProbe_F32_h
+
+#include <Arduino.h>
+#include "AudioStream_F32.h"
+
+#define LATENCY_PROBE_MLS_ORDER   10
+#define LATENCY_PROBE_MLS_LEN     ((1 << LATENCY_PROBE_MLS_ORDER) - 1)       //1023 samples
+#define LATENCY_PROBE_MAX_LAG     1024                                        //longest delay that can be found (samples)
+#define LATENCY_PROBE_CAPTURE_LEN (LATENCY_PROBE_MLS_LEN + LATENCY_PROBE_MAX_LAG)
+
+class AudioLatencyProbe_F32 : public AudioStream_F32
+{
+  public:
+    AudioLatencyProbe_F32(const AudioSettings_F32 &settings) : AudioStream_F32(1, inputQueueArray_f32) {
+      fs_Hz = settings.sample_rate_Hz;
+      makeMLS();
+    }
+
+    enum STATE { IDLE = 0, RUNNING, DONE };
+
+    //start a measurement (from loop()).  amplitude is the marker's level (the MLS is +/- amplitude).
+    //Any measurement already running is restarted.
+    void start(float _amplitude = 0.05f) {
+      AudioNoInterrupts();
+      amplitude = _amplitude;
+      n_done = 0;  block_start = 0;  n_out_captured = 0;
+      state = RUNNING;  //the audio interrupt takes it from here
+      AudioInterrupts();
+    }
+    int getState(void) { return state; }
+    bool isDone(void) { return state == DONE; }
+
+    //cross-correlate the marker with the recordings.  Returns true if both delays were found.
+    bool analyze(void);
+    float getAlgorithmLatency_samples(void) { return alg_lag; }
+    float getLoopLatency_samples(void) { return mic_lag - alg_lag; }
+    float getAlgorithmLatency_msec(void) { return 1000.0f * alg_lag / fs_Hz; }
+    float getLoopLatency_msec(void) { return 1000.0f * (mic_lag - alg_lag) / fs_Hz; }
+    float getAlgorithmConfidence_dB(void) { return alg_conf_dB; }  //correlation peak vs the rest
+    float getLoopConfidence_dB(void) { return mic_conf_dB; }
+    float setMinConfidence_dB(float val) { return min_conf_dB = val; }
+    void printResults(Print *p);
+
+    //called by AudioLatencyProbeTap_F32
+    void captureOutputTap(const float32_t *x, int n) {
+      if (state != RUNNING) return;
+      for (int i = 0; i < n; i++) {
+        int ind = block_start + i;
+        if (ind < LATENCY_PROBE_CAPTURE_LEN) out_rec[ind] = x[i];
+      }
+      n_out_captured = max(n_out_captured, block_start + n);
+      if (n_out_captured >= LATENCY_PROBE_CAPTURE_LEN) state = DONE;
+    }
+
+    virtual void update(void) {
+      audio_block_f32_t *block = AudioStream_F32::receiveWritable_f32();
+      if (!block) return;
+      if (state == RUNNING) {
+        block_start = n_done;
+        for (int i = 0; i < block->length; i++) {
+          int ind = n_done + i;
+          if (ind < LATENCY_PROBE_CAPTURE_LEN) mic_rec[ind] = block->data[i];  //before the marker is added
+          if (ind < LATENCY_PROBE_MLS_LEN) block->data[i] += amplitude * (float32_t)mls[ind];
+        }
+        n_done += block->length;
+        if (n_done >= LATENCY_PROBE_CAPTURE_LEN + 4 * AUDIO_BLOCK_SAMPLES) state = DONE;  //in case there is no tap
+      }
+      AudioStream_F32::transmit(block);
+      AudioStream_F32::release(block);
+    }
+
+  protected:
+    audio_block_f32_t *inputQueueArray_f32[1];
+    float fs_Hz;
+    float amplitude = 0.05f;
+    volatile int state = IDLE;
+    volatile int n_done = 0, block_start = 0, n_out_captured = 0;
+    int8_t mls[LATENCY_PROBE_MLS_LEN];  //+1 or -1
+    float32_t mic_rec[LATENCY_PROBE_CAPTURE_LEN], out_rec[LATENCY_PROBE_CAPTURE_LEN];
+    float alg_lag = -1.0f, mic_lag = -1.0f, alg_conf_dB = 0.0f, mic_conf_dB = 0.0f;
+    float min_conf_dB = 15.0f;  //noise alone gives about 11 dB
+
+    void makeMLS(void) {
+      uint32_t reg = 1;  //10-bit LFSR, taps 10 and 7 (x^10 + x^7 + 1)
+      for (int i = 0; i < LATENCY_PROBE_MLS_LEN; i++) {
+        mls[i] = (reg & 1) ? 1 : -1;
+        uint32_t bit = ((reg >> 0) ^ (reg >> 3)) & 1;
+        reg = (reg >> 1) | (bit << (LATENCY_PROBE_MLS_ORDER - 1));
+      }
+    }
+
+    //lag (with sub-sample interpolation) of the marker in rec, and how much the peak stands out (dB)
+    float findLag(const float32_t *rec, int n_rec, float *conf_dB);
+};
+
+//Output tap: records the audio for AudioLatencyProbe_F32.  It has no output, so it just listens.
+class AudioLatencyProbeTap_F32 : public AudioStream_F32
+{
+  public:
+    AudioLatencyProbeTap_F32(const AudioSettings_F32 &, AudioLatencyProbe_F32 &_probe) :  //(the block size comes with each block)
+      AudioStream_F32(1, inputQueueArray_f32), probe(_probe) {}
+
+    virtual void update(void) {
+      audio_block_f32_t *block = AudioStream_F32::receiveReadOnly_f32();
+      if (!block) return;
+      probe.captureOutputTap(block->data, block->length);
+      AudioStream_F32::release(block);
+    }
+
+  protected:
+    audio_block_f32_t *inputQueueArray_f32[1];
+    AudioLatencyProbe_F32 &probe;
+};
+
+// ///////////////////////////////////////////////////////////////////////////////////
+
+float AudioLatencyProbe_F32::findLag(const float32_t *rec, int n_rec, float *conf_dB) {
+  static float32_t xc[LATENCY_PROBE_MAX_LAG + 1];
+  int max_lag = min(LATENCY_PROBE_MAX_LAG, n_rec - LATENCY_PROBE_MLS_LEN);
+  if (max_lag < 0) { *conf_dB = 0.0f; return -1.0f; }
+  int best = 0;
+  for (int lag = 0; lag <= max_lag; lag++) {
+    float32_t acc = 0.0f;
+    for (int k = 0; k < LATENCY_PROBE_MLS_LEN; k++) acc += (float32_t)mls[k] * rec[k + lag];
+    xc[lag] = fabsf(acc);  //the path might flip the polarity
+    if (xc[lag] > xc[best]) best = lag;
+  }
+
+  //how far the peak stands out from the rest of the cross-correlation
+  double sum_sq = 0.0;  int n = 0;
+  for (int lag = 0; lag <= max_lag; lag++) {
+    if (abs(lag - best) <= 2) continue;
+    sum_sq += (double)xc[lag] * (double)xc[lag];  n++;
+  }
+  float rms = (n > 0) ? sqrtf((float)(sum_sq / n)) : 0.0f;
+  *conf_dB = 20.0f * log10f(max(xc[best], 1.0e-20f) / max(rms, 1.0e-20f));
+
+  //parabolic interpolation around the peak
+  float frac = 0.0f;
+  if ((best > 0) && (best < max_lag)) {
+    float a = xc[best - 1], b = xc[best], c = xc[best + 1];
+    float denom = a - 2.0f * b + c;
+    if (denom < 0.0f) frac = 0.5f * (a - c) / denom;
+  }
+  return (float)best + frac;
+}
+
+bool AudioLatencyProbe_F32::analyze(void) {
+  if (state != DONE) return false;
+  alg_lag = findLag(out_rec, min((int)n_out_captured, LATENCY_PROBE_CAPTURE_LEN), &alg_conf_dB);
+  mic_lag = findLag(mic_rec, min((int)n_done, LATENCY_PROBE_CAPTURE_LEN), &mic_conf_dB);
+  state = IDLE;
+  return (alg_conf_dB >= min_conf_dB) && (mic_conf_dB >= min_conf_dB) && (mic_lag >= alg_lag);
+}
+
+void AudioLatencyProbe_F32::printResults(Print *p) {
+  bool alg_ok = (alg_conf_dB >= min_conf_dB), mic_ok = (mic_conf_dB >= min_conf_dB);
+  p->println("AudioLatencyProbe_F32: algorithm (in -> out tap): " + String(alg_lag, 1) + " samples (" + String(getAlgorithmLatency_msec(), 2) +
+             " ms), peak " + String(alg_conf_dB, 1) + " dB" + (alg_ok ? "" : " *** not found ***"));
+  p->println("    : loop (out tap -> mic): " + String(mic_lag - alg_lag, 1) + " samples (" + String(getLoopLatency_msec(), 2) +
+             " ms), peak " + String(mic_conf_dB, 1) + " dB" + (mic_ok ? "" : " *** not found (is the earpiece coupled to the mic?) ***"));
+  if (alg_ok && mic_ok) {
+    p->println("    : total (mic -> out tap -> mic): " + String(mic_lag, 1) + " samples (" + String(1000.0f * mic_lag / fs_Hz, 2) + " ms)");
+  }
+}
+
+#endif
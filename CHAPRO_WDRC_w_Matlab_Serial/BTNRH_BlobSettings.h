@@ -0,0 +1,55 @@
+/*
+   BTNRH_BlobSettings
+
+   Created: OpenAudio, 2022
+   Purpose: The settings that AudioEffectBTNRH_F32 saves along with the prepared CHAPRO arrays in a data
+       blob (see BTNRH_DataBlob.h).  The blob can be made on the Tympan (AudioEffectBTNRH_F32::
+       saveDataBlob()) or on a PC (host/chapro_datagen), so the layout must be the same on both.
+       Everything in here is a double, a float, or an int (32 bits on both), with the doubles on 8-byte
+       boundaries, and there are no pointers (CHA_AFC has some, so only its parameters are kept).
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _BTNRH_BlobSettings_h
+#define _BTNRH_BlobSettings_h
+
+#include <chapro.h>
+#include "BTNRH_FixedCheck.h"   //for BTNRH_FIXED_NC
+
+//the parameters of CHA_AFC, without its buffer pointers
+typedef struct {
+  double fbg, rho, eps, mu, alf;
+  int32_t afl, wfl, pfl, fbl, hdel, pup;
+  int32_t nqm, iqm, sqm;
+  int32_t pad;  //(so that the size is a multiple of 8 everywhere)
+} BTNRH_BlobAFC;
+
+typedef struct {
+  double srate;
+  int chunk, pad;
+  BTNRH_BlobAFC afc;
+  CHA_DSL dsl;
+  CHA_WDRC agc;
+  float iirfb_z[64], iirfb_p[64], iirfb_g[8];  //the filterbank design (for BTNRH_FixedFilterbank)
+  int iirfb_d[8];
+  int fixed_delays[BTNRH_FIXED_NC];  //the fixed-size filterbank's channel delays, as measured by BTNRH_FixedCheck::check()
+  int fixed_ok;                      //1 if the fixed-size filterbank passed its self-check
+  int pad2;
+} BTNRH_BlobSettings;
+
+static inline void BTNRH_saveBlobAFC(BTNRH_BlobAFC *dest, const CHA_AFC *afc) {
+  memset(dest, 0, sizeof(BTNRH_BlobAFC));
+  dest->fbg = afc->fbg;  dest->rho = afc->rho;  dest->eps = afc->eps;  dest->mu = afc->mu;  dest->alf = afc->alf;
+  dest->afl = afc->afl;  dest->wfl = afc->wfl;  dest->pfl = afc->pfl;  dest->fbl = afc->fbl;  dest->hdel = afc->hdel;  dest->pup = afc->pup;
+  dest->nqm = afc->nqm;  dest->iqm = afc->iqm;  dest->sqm = afc->sqm;
+}
+
+//only the parameters: afc's buffer pointers are left as they are (prepare() sets them)
+static inline void BTNRH_loadBlobAFC(CHA_AFC *afc, const BTNRH_BlobAFC *src) {
+  afc->fbg = src->fbg;  afc->rho = src->rho;  afc->eps = src->eps;  afc->mu = src->mu;  afc->alf = src->alf;
+  afc->afl = src->afl;  afc->wfl = src->wfl;  afc->pfl = src->pfl;  afc->fbl = src->fbl;  afc->hdel = src->hdel;  afc->pup = src->pup;
+  afc->nqm = src->nqm;  afc->iqm = src->iqm;  afc->sqm = src->sqm;
+}
+
+#endif
@@ -0,0 +1,138 @@
+/*
+   BTNRH_DataBlob
+
+   Created: OpenAudio, 2022
+   Purpose: Save all of the prepared CHAPRO arrays (the cp[] pointers, as sized by cha_allocate) in one
+       block of bytes, and load them back.  Loading a blob replaces configure() and prepare(), so none
+       of the design math (such as cha_iirfb_design()) is done at boot.  This is the Tympan version of
+       CHAPRO's cha_data_gen(): the blob can be printed as a C header (to be compiled into the sketch)
+       or written to the SD card (to switch presets).
+
+       The blob is: the header, then the caller's own settings ("extra"), then each cp[] array.  Each
+       piece starts on an 8-byte boundary (the CHAPRO arrays include doubles).  The checksum covers
+       everything after the header.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _BTNRH_DataBlob_h
+#define _BTNRH_DataBlob_h
+
+#include <Arduino.h>
+
+#define BTNRH_BLOB_MAGIC   0x424F4C42  //"BLOB"
+#define BTNRH_BLOB_VERSION 1
+#define BTNRH_BLOB_MAX_PTR 64          //same as CHAPRO's NPTR
+#define BTNRH_BLOB_ALIGN   8
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t n_bytes;      //the whole blob, including this header
+  uint32_t checksum;     //of everything after this header
+  int32_t n_ptr;
+  int32_t extra_bytes;   //the caller's settings, stored just after the header
+  int32_t size[BTNRH_BLOB_MAX_PTR];  //bytes of each cp[] array (0 = not used)
+} BTNRH_BlobHeader;
+
+class BTNRH_DataBlob {
+  public:
+    static int padded(int n) { return (n + BTNRH_BLOB_ALIGN - 1) & ~(BTNRH_BLOB_ALIGN - 1); }
+
+    //bytes needed to hold the given arrays.  sizes[idx] is the size of cp[idx] in bytes.
+    static int getSize(void **cp, const int *sizes, int n_ptr, int extra_bytes) {
+      int n = padded(sizeof(BTNRH_BlobHeader)) + padded(extra_bytes);
+      for (int idx = 0; idx < n_ptr; idx++) if (cp[idx] != NULL) n += padded(sizes[idx]);
+      return n;
+    }
+
+    //returns the number of bytes written, or 0 if dest is too small
+    static int write(uint8_t *dest, int max_bytes, void **cp, const int *sizes, int n_ptr, const void *extra, int extra_bytes) {
+      int n_bytes = getSize(cp, sizes, n_ptr, extra_bytes);
+      if ((n_ptr > BTNRH_BLOB_MAX_PTR) || (n_bytes > max_bytes)) {
+        Serial.println(F("BTNRH_DataBlob: write: *** ERROR ***: blob is too big."));
+        return 0;
+      }
+      memset(dest, 0, n_bytes);
+      BTNRH_BlobHeader *h = (BTNRH_BlobHeader *)dest;
+      h->magic = BTNRH_BLOB_MAGIC;  h->version = BTNRH_BLOB_VERSION;
+      h->n_bytes = n_bytes;  h->n_ptr = n_ptr;  h->extra_bytes = extra_bytes;
+      int offset = padded(sizeof(BTNRH_BlobHeader));
+      if (extra_bytes > 0) memcpy(dest + offset, extra, extra_bytes);
+      offset += padded(extra_bytes);
+      for (int idx = 0; idx < n_ptr; idx++) {
+        h->size[idx] = (cp[idx] == NULL) ? 0 : sizes[idx];
+        if (h->size[idx] == 0) continue;
+        memcpy(dest + offset, cp[idx], sizes[idx]);
+        offset += padded(sizes[idx]);
+      }
+      h->checksum = checksum(dest, n_bytes);
+      return n_bytes;
+    }
+
+    static bool isValid(const uint8_t *blob, int n_bytes) {
+      const BTNRH_BlobHeader *h = (const BTNRH_BlobHeader *)blob;
+      if ((blob == NULL) || (n_bytes < (int)sizeof(BTNRH_BlobHeader))) return false;
+      if ((h->magic != BTNRH_BLOB_MAGIC) || (h->version != BTNRH_BLOB_VERSION) || ((int)h->n_bytes > n_bytes)) return false;
+      if ((h->n_ptr < 0) || (h->n_ptr > BTNRH_BLOB_MAX_PTR) || (h->extra_bytes < 0)) return false;
+      return (h->checksum == checksum(blob, h->n_bytes));
+    }
+    static const BTNRH_BlobHeader* getHeader(const uint8_t *blob) { return (const BTNRH_BlobHeader *)blob; }
+    static const void* getExtra(const uint8_t *blob) { return blob + padded(sizeof(BTNRH_BlobHeader)); }
+
+    //Copy the blob's arrays into cp[].  If cur_sizes is NULL, each array is calloc'd (like cha_allocate).
+    //Otherwise, the arrays in cp[] must already have exactly the blob's sizes, and the blob is just
+    //copied into them (to switch presets without touching the heap).  Check isValid() first.
+    static bool load(const uint8_t *blob, void **cp, const int *cur_sizes) {
+      const BTNRH_BlobHeader *h = getHeader(blob);
+      if (cur_sizes != NULL) {
+        for (int idx = 0; idx < h->n_ptr; idx++) {
+          if ((h->size[idx] > 0) && ((cp[idx] == NULL) || (cur_sizes[idx] != h->size[idx]))) {
+            Serial.println(F("BTNRH_DataBlob: load: *** ERROR ***: blob does not match the current CHAPRO arrays."));
+            return false;
+          }
+        }
+      } else {
+        for (int idx = 0; idx < h->n_ptr; idx++) {
+          cp[idx] = NULL;
+          if ((h->size[idx] > 0) && ((cp[idx] = calloc(1, h->size[idx])) == NULL)) {
+            Serial.println(F("BTNRH_DataBlob: load: *** ERROR ***: out of memory."));
+            return false;
+          }
+        }
+      }
+      int offset = padded(sizeof(BTNRH_BlobHeader)) + padded(h->extra_bytes);
+      for (int idx = 0; idx < h->n_ptr; idx++) {
+        if (h->size[idx] == 0) continue;
+        memcpy(cp[idx], blob + offset, h->size[idx]);
+        offset += padded(h->size[idx]);
+      }
+      return true;
+    }
+
+    //print the blob as a C header, to be saved as (for example) CHAPRO_Data.h and #included by the sketch
+    static void printAsC(const uint8_t *blob, Print *p, const char *name) {
+      int n_bytes = getHeader(blob)->n_bytes;
+      p->println("// " + String(name) + ": prepared CHAPRO data (see BTNRH_DataBlob.h).  " + String(n_bytes) + " bytes.");
+      p->println("#pragma once");
+      p->println("const uint8_t " + String(name) + "[" + String(n_bytes) + "] PROGMEM __attribute__ ((aligned (" + String(BTNRH_BLOB_ALIGN) + "))) = {");  //in flash, not RAM
+      char buf[8];
+      for (int i = 0; i < n_bytes; i++) {
+        sprintf(buf, "0x%02X,", blob[i]);
+        p->print(buf);
+        if (((i + 1) % 24) == 0) p->println();
+      }
+      p->println("};");
+    }
+
+  protected:
+    static uint32_t checksum(const uint8_t *blob, int n_bytes) {
+      const uint32_t *words = (const uint32_t *)(blob + padded(sizeof(BTNRH_BlobHeader)));
+      int n_words = (n_bytes - padded(sizeof(BTNRH_BlobHeader))) / sizeof(uint32_t);
+      uint32_t sum = 0;
+      for (int i = 0; i < n_words; i++) sum = (sum << 1 | sum >> 31) + words[i];  //rotate, so that swapped words are caught
+      return sum;
+    }
+};
+
+#endif
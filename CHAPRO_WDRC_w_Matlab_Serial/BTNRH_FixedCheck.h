@@ -0,0 +1,154 @@
+/*
+   BTNRH_FixedCheck
+
+   Created: OpenAudio, 2022
+   Purpose: The configuration that the sketch compiles BTNRH_FixedFilterbank for, and the self-check that
+       lines it up with CHAPRO's own filterbank before it is used.  The check measures each channel's
+       delay from the impulse responses of the two filterbanks, and then compares their outputs
+       (impulse, noise, and the synthesized noise).
+
+       CHAPRO's filterbank runs on a copy of cp[] with its own filter states (makeScratch()), so the
+       states that the audio is using are never touched.  Nothing here depends on the Tympan, so the
+       same check runs in AudioEffectBTNRH_F32 and in the host tools (host/chapro_datagen).
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _BTNRH_FixedCheck_h
+#define _BTNRH_FixedCheck_h
+
+#include <Arduino.h>
+#include <chapro.h>
+#include "BTNRH_FixedFilterbank.h"
+
+//The configuration for which the filterbank is compiled with fixed sizes (see BTNRH_FixedFilterbank.h).
+//Any other configuration uses CHAPRO's own filterbank.
+#define BTNRH_FIXED_NC 8  //number of channels
+#define BTNRH_FIXED_NZ 4  //filter order
+#define BTNRH_FIXED_CS 8  //chunk size
+typedef BTNRH_FixedFilterbank<BTNRH_FIXED_NC, BTNRH_FIXED_NZ, BTNRH_FIXED_CS> BTNRH_FixedFB;
+
+#define BTNRH_FIXED_MAX_ERR_dB (-60.0f)  //the self-check passes if every error is below this
+
+class BTNRH_FixedCheck {
+  public:
+    //bytes of cp[idx] (as recorded by cha_allocate)
+    static int getCpSize(void **cp, int idx) {
+      if (cp[_size] == NULL) return 0;
+      if (idx == _size) return NPTR * sizeof(int);  //the list of sizes itself
+      return ((int *)cp[_size])[idx];
+    }
+
+    //fill scratch_cp (NPTR pointers) with cp[], except for the filterbank's states, which are new (zeroed)
+    //arrays.  Returns false if there is not enough memory.  Always call freeScratch() afterwards.
+    static bool makeScratch(void **cp, void **scratch_cp) {
+      bool is_ok = true;
+      for (int idx = 0; idx < NPTR; idx++) scratch_cp[idx] = cp[idx];
+      for (int I = 0; I < N_STATES; I++) {
+        int idx = stateIndex(I);
+        scratch_cp[idx] = NULL;
+        if (cp[idx] == NULL) continue;
+        scratch_cp[idx] = calloc(getCpSize(cp, idx), 1);
+        if (scratch_cp[idx] == NULL) is_ok = false;
+      }
+      return is_ok;
+    }
+    static void freeScratch(void **scratch_cp) {
+      for (int I = 0; I < N_STATES; I++) {
+        int idx = stateIndex(I);
+        if (scratch_cp[idx] != NULL) free(scratch_cp[idx]);
+        scratch_cp[idx] = NULL;
+      }
+    }
+
+    //The self-check, on fb (never on a filterbank that the audio is using).  If measure_delays, first set
+    //fb's channel delays by lining up its impulse responses with CHAPRO's.  err_dB gets the errors vs
+    //CHAPRO: impulse, noise, and the synthesized noise.
+    static bool check(void **cp, BTNRH_FixedFB *fb, bool measure_delays, float *err_dB) {
+      const int n_samples = BTNRH_FIXED_MAX_DELAY + 8*BTNRH_FIXED_CS;
+      float *x = (float *)malloc(n_samples * sizeof(float));
+      float *z_gen = (float *)malloc(BTNRH_FIXED_NC * n_samples * sizeof(float));
+      float *z_fix = (float *)malloc(BTNRH_FIXED_NC * n_samples * sizeof(float));
+      void *scratch_cp[NPTR];
+      for (int I = 0; I < 3; I++) err_dB[I] = 0.0f;
+      bool is_ok = makeScratch(cp, scratch_cp) && x && z_gen && z_fix;
+      if (is_ok) {
+        for (int i = 0; i < n_samples; i++) x[i] = (i == 0) ? 1.0f : 0.0f;
+        if (measure_delays) {
+          //measure each channel's delay by lining up the impulse responses of the two filterbanks
+          int zeros[BTNRH_FIXED_NC] = {0}, delays[BTNRH_FIXED_NC];
+          fb->setDelays(zeros);
+          reset(scratch_cp, fb);
+          compare_dB(scratch_cp, fb, x, n_samples, z_gen, z_fix);
+          for (int k = 0; k < BTNRH_FIXED_NC; k++) {
+            const float *g = z_gen + k*n_samples, *f = z_fix + k*n_samples;
+            double best_err = 1.0e30;  delays[k] = 0;
+            for (int lag = 0; lag <= BTNRH_FIXED_MAX_DELAY - BTNRH_FIXED_CS; lag++) {
+              double err = 0.0;
+              for (int i = 0; i < n_samples; i++) { double d = g[i] - ((i >= lag) ? f[i - lag] : 0.0f); err += d * d; }
+              if (err < best_err) { best_err = err; delays[k] = lag; }
+            }
+          }
+          fb->setDelays(delays);
+        }
+
+        //check the impulse response (with the delays) and then a noise signal, both filterbanks starting from zero
+        reset(scratch_cp, fb);
+        err_dB[0] = compare_dB(scratch_cp, fb, x, n_samples, z_gen, z_fix);
+        uint32_t seed = 12345;
+        for (int i = 0; i < n_samples; i++) { seed = seed * 1664525UL + 1013904223UL; x[i] = ((float)(seed >> 8) / 16777216.0f) - 0.5f; }
+        err_dB[1] = compare_dB(scratch_cp, fb, x, n_samples, z_gen, z_fix, &err_dB[2]);
+        is_ok = (err_dB[0] < BTNRH_FIXED_MAX_ERR_dB) && (err_dB[1] < BTNRH_FIXED_MAX_ERR_dB) && (err_dB[2] < BTNRH_FIXED_MAX_ERR_dB);
+      }
+      freeScratch(scratch_cp);
+      if (x) free(x);
+      if (z_gen) free(z_gen);
+      if (z_fix) free(z_fix);
+      return is_ok;
+    }
+
+  protected:
+    //CHAPRO's filter states and channel delay lines: the only arrays that cha_iirfb_analyze() and
+    //cha_iirfb_synthesize() write to
+    static const int N_STATES = 2;
+    static int stateIndex(int I) { return (I == 0) ? _zz : _yd; }
+
+    //run x through CHAPRO's filterbank (on scratch_cp) and fb, from their current states.  Returns the difference
+    //of the channel outputs relative to CHAPRO's, in dB.  z_gen and z_fix get NC * n_samples values (channel-major).
+    //If synth_err_dB is given, it gets the difference of the synthesized outputs too.
+    static float compare_dB(void **scratch_cp, BTNRH_FixedFB *fb, float *x, int n_samples, float *z_gen, float *z_fix, float *synth_err_dB = NULL) {
+      const int cs = BTNRH_FIXED_CS, nc = BTNRH_FIXED_NC;
+      float zg_chunk[nc * cs], zf_chunk[nc * cs], yg[cs], yf[cs];
+      double err = 0.0, pow = 0.0, synth_err = 0.0, synth_pow = 0.0;
+      for (int start = 0; start + cs <= n_samples; start += cs) {
+        cha_iirfb_analyze(scratch_cp, x + start, zg_chunk, cs);
+        fb->analyze(x + start, zf_chunk);
+        for (int k = 0; k < nc; k++) {
+          for (int i = 0; i < cs; i++) { z_gen[k*n_samples + start + i] = zg_chunk[k*cs + i];  z_fix[k*n_samples + start + i] = zf_chunk[k*cs + i]; }
+        }
+        if (synth_err_dB) {
+          cha_iirfb_synthesize(scratch_cp, zg_chunk, yg, cs);
+          fb->synthesize(zf_chunk, yf);
+          for (int i = 0; i < cs; i++) { double d = yg[i] - yf[i];  synth_err += d * d;  synth_pow += (double)yg[i] * (double)yg[i]; }
+        }
+      }
+      for (int i = 0; i < nc * n_samples; i++) {
+        double d = z_gen[i] - z_fix[i];
+        err += d * d;  pow += (double)z_gen[i] * (double)z_gen[i];
+      }
+      if (synth_err_dB) *synth_err_dB = 10.0f * log10f((float)(max(synth_err, 1.0e-30) / max(synth_pow, 1.0e-30)));
+      return 10.0f * log10f((float)(max(err, 1.0e-30) / max(pow, 1.0e-30)));
+    }
+
+    //zero the states of CHAPRO's filterbank (in scratch_cp) and of fb, so that the two start together.
+    //(The scratch states have the same sizes as the originals, which cp[_size] still gives.)
+    static void reset(void **scratch_cp, BTNRH_FixedFB *fb) {
+      for (int I = 0; I < N_STATES; I++) {
+        int idx = stateIndex(I);
+        if (scratch_cp[idx] != NULL) memset(scratch_cp[idx], 0, getCpSize(scratch_cp, idx));
+      }
+      fb->reset();
+    }
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*
+   BTNRH_FixedFilterbank
+
+   Created: OpenAudio, 2022
+   Purpose: The CHAPRO IIR filterbank (cha_iirfb_analyze() and cha_iirfb_synthesize()) with the number
+       of channels (NC), the filter order (NZ), and the chunk size (CS) fixed at compile time.  With
+       the loop bounds known, the compiler unrolls the loops over the samples and the biquads, and
+       each channel's filter states stay in registers for the whole chunk.
+
+       Each channel is built from the zeros, poles, and gain from cha_iirfb_design(), as NZ/2 biquads
+       (transposed direct form II), followed by a delay that lines up the channels.  The output has
+       the same layout as cha_iirfb_analyze(): channel k is at y[k*CS ... k*CS + CS-1].
+
+       The delays are given by the caller.  AudioEffectBTNRH_F32 measures them from CHAPRO's own
+       filterbank and checks that the two agree (see AudioEffectBTNRH_F32::setupFixedPipeline()).
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _BTNRH_FixedFilterbank_h
+#define _BTNRH_FixedFilterbank_h
+
+#include <Arduino.h>
+#include <math.h>
+
+#define BTNRH_FIXED_MAX_DELAY 128  //longest channel delay (samples).  Must be a power of 2.
+
+template <int NC, int NZ, int CS>
+class BTNRH_FixedFilterbank {
+  public:
+    static const int N_SOS = NZ / 2;
+    static const int DELAY_MASK = BTNRH_FIXED_MAX_DELAY - 1;
+
+    BTNRH_FixedFilterbank(void) { reset(); }
+
+    //z and p are the zeros and poles from cha_iirfb_design(): NZ complex values (re, im) per channel.
+    //g is the gain of each channel.  Returns false if the roots cannot be paired into real biquads.
+    bool setCoeff(const float *z, const float *p, const float *g) {
+      if ((NZ % 2) != 0) return false;
+      for (int k = 0; k < NC; k++) {
+        double bq[N_SOS][3], aq[N_SOS][3];
+        if (!pairRoots(z + k*NZ*2, bq)) return false;
+        if (!pairRoots(p + k*NZ*2, aq)) return false;
+        for (int j = 0; j < N_SOS; j++) {
+          double gain = (j == 0) ? g[k] : 1.0;
+          for (int i = 0; i < 3; i++) b[k][j][i] = (float)(gain * bq[j][i]);
+          a[k][j][0] = (float)aq[j][1];
+          a[k][j][1] = (float)aq[j][2];
+        }
+      }
+      reset();
+      return true;
+    }
+    bool setDelays(const int *d) {
+      for (int k = 0; k < NC; k++) {
+        if ((d[k] < 0) || (d[k] > BTNRH_FIXED_MAX_DELAY - CS)) return false;
+        delay[k] = d[k];
+      }
+      return true;
+    }
+    int getDelay(int k) { return delay[k]; }
+
+    void reset(void) {
+      for (int k = 0; k < NC; k++) {
+        for (int j = 0; j < N_SOS; j++) { state[k][j][0] = 0.0f; state[k][j][1] = 0.0f; }
+        for (int i = 0; i < BTNRH_FIXED_MAX_DELAY; i++) dline[k][i] = 0.0f;
+      }
+      write_ind = 0;
+    }
+
+    //x has CS samples.  y gets NC*CS samples.
+    void analyze(const float *x, float *y) {
+      for (int k = 0; k < NC; k++) {
+        float s[N_SOS][2];
+        #pragma GCC unroll 8
+        for (int j = 0; j < N_SOS; j++) { s[j][0] = state[k][j][0]; s[j][1] = state[k][j][1]; }
+        float *dl = dline[k];
+        int ind = write_ind, read_ind = write_ind - delay[k];
+        float *yk = y + k*CS;
+        #pragma GCC unroll 16
+        for (int i = 0; i < CS; i++) {
+          float v = x[i];
+          #pragma GCC unroll 8
+          for (int j = 0; j < N_SOS; j++) {
+            float out = b[k][j][0] * v + s[j][0];
+            s[j][0] = b[k][j][1] * v - a[k][j][0] * out + s[j][1];
+            s[j][1] = b[k][j][2] * v - a[k][j][1] * out;
+            v = out;
+          }
+          dl[(ind + i) & DELAY_MASK] = v;
+          yk[i] = dl[(read_ind + i) & DELAY_MASK];
+        }
+        #pragma GCC unroll 8
+        for (int j = 0; j < N_SOS; j++) { state[k][j][0] = s[j][0]; state[k][j][1] = s[j][1]; }
+      }
+      write_ind = (write_ind + CS) & DELAY_MASK;
+    }
+
+    //sum the channels.  y has NC*CS samples, out gets CS samples.
+    static void synthesize(const float *y, float *out) {
+      #pragma GCC unroll 16
+      for (int i = 0; i < CS; i++) {
+        float sum = 0.0f;
+        #pragma GCC unroll 16
+        for (int k = 0; k < NC; k++) sum += y[k*CS + i];
+        out[i] = sum;
+      }
+    }
+
+  protected:
+    //turn NZ complex roots (re, im) into NZ/2 real quadratics (1, c1, c2): conjugate pairs together,
+    //and the real roots two at a time
+    static bool pairRoots(const float *r, double q[][3]) {
+      bool used[NZ];
+      for (int j = 0; j < NZ; j++) used[j] = false;
+      int n_q = 0;
+      for (int j = 0; j < NZ; j++) {
+        if (used[j]) continue;
+        used[j] = true;
+        double re = r[2*j], im = r[2*j+1];
+        bool is_real = (fabs(im) <= 1.0e-6 * (fabs(re) + 1.0e-6));
+        int best = -1;
+        double best_err = 1.0e30;
+        for (int m = j+1; m < NZ; m++) {
+          if (used[m]) continue;
+          double re_m = r[2*m], im_m = r[2*m+1];
+          bool is_real_m = (fabs(im_m) <= 1.0e-6 * (fabs(re_m) + 1.0e-6));
+          if (is_real != is_real_m) continue;
+          double err = is_real ? 0.0 : (fabs(re_m - re) + fabs(im_m + im));  //the conjugate
+          if (err < best_err) { best = m; best_err = err; }
+          if (is_real) break;
+        }
+        if ((best < 0) || (n_q >= N_SOS) || (best_err > 1.0e-4)) return false;
+        used[best] = true;
+        double re2 = r[2*best], im2 = r[2*best+1];
+        q[n_q][0] = 1.0;
+        q[n_q][1] = -(re + re2);
+        q[n_q][2] = re*re2 - im*im2;  //real part of the product
+        n_q++;
+      }
+      return (n_q == N_SOS);
+    }
+
+    float b[NC][N_SOS][3];      //numerator of each biquad (the gain is in the first one)
+    float a[NC][N_SOS][2];      //denominator (a1, a2) of each biquad
+    float state[NC][N_SOS][2];
+    float dline[NC][BTNRH_FIXED_MAX_DELAY];
+    int delay[NC] = {0};
+    int write_ind = 0;
+};
+
+#endif
@@ -0,0 +1,222 @@
+/*
+   BTNRH_OfflineProcessor
+
+   Created: OpenAudio, 2022
+   Purpose: Run WAV files from the SD card through the same CHAPRO chain that processes the live audio
+       (process_chunk_ctx() in test_gha.h), chunk by chunk, and write the result back to the SD card.
+       This takes the place of the WAV input/output in the original tst_gha.c main(), so that recorded
+       field audio can be pushed through the device's own code and compared between prescriptions.
+
+       Each file gets its own freshly-prepared CHAPRO context (configure() settings, prepare() states),
+       so the output of a file does not depend on the live audio or on the files processed before it.
+       The live audio keeps running.  The files are processed from loop() as fast as the CPU allows,
+       and the real-time factor (seconds of audio per second of CPU) is reported for the CHAPRO
+       processing alone and for the whole job (including the SD card).
+
+       Input: 16-bit PCM or 32-bit float WAV.  Only the first channel is used.  Output: 16-bit PCM mono.
+
+       This is the small, on-device version, for checking a few recordings without a PC.  For hours of
+       audio, use host/chapro_batch, which runs the same process_chunk_ctx() on a PC, one file per core.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _BTNRH_OfflineProcessor_h
+#define _BTNRH_OfflineProcessor_h
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <chapro.h>
+#include "test_gha.h"
+
+#define BTNRH_OFFLINE_BLOCK     256     //samples read from the SD card at a time.  Must be a multiple of the chunk size.
+#define BTNRH_OFFLINE_MAX_FILES 32      //most files in one batch
+#define BTNRH_OFFLINE_MAX_NAME  64      //longest file name (including the prefix)
+#define BTNRH_OFFLINE_PREFIX    "OUT_"  //added to the name of each output file (and such files are not processed)
+
+class BTNRH_OfflineProcessor {
+  public:
+    BTNRH_OfflineProcessor(SdFs *_sd) : sd(_sd) {}
+
+    //process one file.  Returns false if the file could not be read or written.
+    bool processFile(const char *in_fname, const char *out_fname, Print *p);
+
+    //process every WAV file in the root of the SD card (except earlier outputs).  Returns the number processed.
+    int processAllFiles(Print *p);
+
+    float getLastRealTimeFactor(void) { return last_rtf_dsp; }
+
+  protected:
+    SdFs *sd;
+    void *cp[NPTR] = {0};
+    float last_rtf_dsp = 0.0f;
+    uint64_t total_cycles = 0;  //of the CHAPRO processing, for the batch summary
+    uint32_t total_samples = 0;
+
+    typedef struct { int fmt, n_chan, bits; float fs_Hz; uint32_t data_start, n_frames; } WavInfo;
+    int listWavFiles(char fnames[][BTNRH_OFFLINE_MAX_NAME], Print *p);  //the WAV files in the root of the SD card, except earlier outputs
+    bool readWavHeader(FsFile &file, WavInfo *info);
+    void writeWavHeader(FsFile &file, float fs_Hz, uint32_t n_frames);
+    int readFrames(FsFile &file, const WavInfo &info, float *x, int n_frames);
+    void freeContext(void) { for (int idx = 0; idx < NPTR; idx++) { if (cp[idx]) free(cp[idx]); cp[idx] = NULL; } }  //calloc'd by cha_allocate
+};
+
+// ///////////////////////////////////////////////////////////////////////////////////
+
+bool BTNRH_OfflineProcessor::processFile(const char *in_fname, const char *out_fname, Print *p) {
+  FsFile in_file = sd->open(in_fname, O_RDONLY);
+  if (!in_file) { p->println("BTNRH_OfflineProcessor: *** ERROR ***: could not open " + String(in_fname)); return false; }
+  WavInfo info;
+  if (!readWavHeader(in_file, &info)) {
+    p->println("BTNRH_OfflineProcessor: *** ERROR ***: " + String(in_fname) + " is not a 16-bit PCM or 32-bit float WAV file.");
+    in_file.close();
+    return false;
+  }
+  if (info.fs_Hz != (float)srate) {
+    p->println("BTNRH_OfflineProcessor: *** WARNING ***: " + String(in_fname) + " is " + String(info.fs_Hz, 0) +
+               " Hz, but CHAPRO is prepared for " + String(srate, 0) + " Hz.  Processing it anyway.");
+  }
+  FsFile out_file = sd->open(out_fname, O_WRITE | O_CREAT | O_TRUNC);
+  if (!out_file) { p->println("BTNRH_OfflineProcessor: *** ERROR ***: could not open " + String(out_fname)); in_file.close(); return false; }
+  writeWavHeader(out_file, (float)srate, 0);  //the sizes are filled in at the end
+
+  //a fresh CHAPRO context, prepared exactly like the live one
+  I_O io;
+  freeContext();
+  prepare(&io, cp);  //in test_gha.h
+  const int cs = chunk;
+
+  static float x[BTNRH_OFFLINE_BLOCK];
+  static int16_t out16[BTNRH_OFFLINE_BLOCK];
+  uint64_t dsp_cycles = 0;
+  uint32_t n_done = 0;
+  unsigned long start_usec = micros();
+  while (n_done < info.n_frames) {
+    int n = readFrames(in_file, info, x, min((uint32_t)BTNRH_OFFLINE_BLOCK, info.n_frames - n_done));
+    if (n <= 0) break;
+    int n_chunks = (n + cs - 1) / cs;
+    for (int i = n; i < n_chunks * cs; i++) x[i] = 0.0f;  //the last chunk is padded with silence
+
+    uint32_t start_cycles = ARM_DWT_CYCCNT;
+    for (int Ichunk = 0; Ichunk < n_chunks; Ichunk++) process_chunk_ctx(cp, 1, x + Ichunk*cs, x + Ichunk*cs, cs);
+    dsp_cycles += (uint32_t)(ARM_DWT_CYCCNT - start_cycles);
+
+    for (int i = 0; i < n; i++) out16[i] = (int16_t)(max(min(x[i], 1.0f), -1.0f) * 32767.0f);
+    out_file.write((const uint8_t *)out16, n * sizeof(int16_t));
+    n_done += n;
+  }
+  unsigned long dT_usec = micros() - start_usec;
+  writeWavHeader(out_file, (float)srate, n_done);
+  out_file.close();
+  in_file.close();
+  freeContext();
+
+  float audio_sec = (float)n_done / info.fs_Hz;
+  float dsp_sec = (float)dsp_cycles / (float)F_CPU_ACTUAL;
+  last_rtf_dsp = audio_sec / max(dsp_sec, 1.0e-6f);
+  total_cycles += dsp_cycles;  total_samples += n_done;
+  p->println("BTNRH_OfflineProcessor: " + String(in_fname) + " -> " + String(out_fname) + ": " + String(audio_sec, 2) + " sec of audio.  " +
+             "x real time: CHAPRO = " + String(last_rtf_dsp, 1) + ", with SD = " + String(audio_sec / max(1.0e-6f * (float)dT_usec, 1.0e-6f), 1));
+  return (n_done == info.n_frames);
+}
+
+int BTNRH_OfflineProcessor::listWavFiles(char fnames[][BTNRH_OFFLINE_MAX_NAME], Print *p) {
+  int n_files = 0;
+  FsFile root = sd->open("/"), file;
+  if (!root) { p->println("BTNRH_OfflineProcessor: *** ERROR ***: could not open the SD card."); return 0; }
+  while ((n_files < BTNRH_OFFLINE_MAX_FILES) && file.openNext(&root, O_RDONLY)) {
+    char *name = fnames[n_files];
+    file.getName(name, BTNRH_OFFLINE_MAX_NAME - strlen(BTNRH_OFFLINE_PREFIX));
+    bool is_dir = file.isDir();
+    file.close();
+    int len = strlen(name);
+    if (is_dir || (len < 5) || (strcasecmp(name + len - 4, ".wav") != 0)) continue;
+    if (strncasecmp(name, BTNRH_OFFLINE_PREFIX, strlen(BTNRH_OFFLINE_PREFIX)) == 0) continue;
+    n_files++;
+  }
+  root.close();
+  return n_files;
+}
+
+int BTNRH_OfflineProcessor::processAllFiles(Print *p) {
+  //list the files first, because the outputs are written to the same directory
+  static char fnames[BTNRH_OFFLINE_MAX_FILES][BTNRH_OFFLINE_MAX_NAME];
+  int n_files = listWavFiles(fnames, p);
+
+  p->println("BTNRH_OfflineProcessor: processing " + String(n_files) + " WAV files (fs = " + String(srate, 0) + " Hz, chunk = " + String(chunk) + ")...");
+  total_cycles = 0;  total_samples = 0;
+  int n_done = 0;
+  char out_fname[BTNRH_OFFLINE_MAX_NAME + 8];
+  for (int I = 0; I < n_files; I++) {
+    sprintf(out_fname, "%s%s", BTNRH_OFFLINE_PREFIX, fnames[I]);
+    if (processFile(fnames[I], out_fname, p)) n_done++;
+  }
+  float dsp_sec = (float)total_cycles / (float)F_CPU_ACTUAL;
+  p->println("BTNRH_OfflineProcessor: done.  " + String(n_done) + " of " + String(n_files) + " files, " + String((float)total_samples / (float)srate, 1) +
+             " sec of audio, x real time (CHAPRO) = " + String(((float)total_samples / (float)srate) / max(dsp_sec, 1.0e-6f), 1));
+  return n_done;
+}
+
+bool BTNRH_OfflineProcessor::readWavHeader(FsFile &file, WavInfo *info) {
+  uint8_t hdr[12], chunk_hdr[8], fmt[16];
+  if ((file.read(hdr, 12) != 12) || (memcmp(hdr, "RIFF", 4) != 0) || (memcmp(hdr + 8, "WAVE", 4) != 0)) return false;
+  bool have_fmt = false;
+  while (file.read(chunk_hdr, 8) == 8) {
+    uint32_t len = chunk_hdr[4] | (chunk_hdr[5] << 8) | (chunk_hdr[6] << 16) | ((uint32_t)chunk_hdr[7] << 24);
+    if (memcmp(chunk_hdr, "fmt ", 4) == 0) {
+      if ((len < 16) || (file.read(fmt, 16) != 16)) return false;
+      info->fmt = fmt[0] | (fmt[1] << 8);
+      info->n_chan = fmt[2] | (fmt[3] << 8);
+      info->fs_Hz = (float)(fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | ((uint32_t)fmt[7] << 24));
+      info->bits = fmt[14] | (fmt[15] << 8);
+      if (info->fmt == 0xFFFE) info->fmt = (info->bits == 32) ? 3 : 1;  //WAVE_FORMAT_EXTENSIBLE (assume PCM or float by the bit depth)
+      have_fmt = true;
+      file.seekCur(len - 16 + (len & 1));
+    } else if (memcmp(chunk_hdr, "data", 4) == 0) {
+      if (!have_fmt || (info->n_chan < 1)) return false;
+      if (!(((info->fmt == 1) && (info->bits == 16)) || ((info->fmt == 3) && (info->bits == 32)))) return false;
+      info->data_start = file.curPosition();
+      info->n_frames = len / (info->n_chan * info->bits / 8);
+      return true;
+    } else {
+      file.seekCur(len + (len & 1));  //chunks are padded to an even length
+    }
+  }
+  return false;
+}
+
+void BTNRH_OfflineProcessor::writeWavHeader(FsFile &file, float fs_Hz, uint32_t n_frames) {
+  uint32_t fs = (uint32_t)fs_Hz, data_bytes = n_frames * sizeof(int16_t);
+  uint8_t hdr[44];
+  memcpy(hdr, "RIFF", 4);  uint32_t riff_len = 36 + data_bytes;  memcpy(hdr + 4, &riff_len, 4);
+  memcpy(hdr + 8, "WAVEfmt ", 8);
+  uint32_t fmt_len = 16;  memcpy(hdr + 16, &fmt_len, 4);
+  uint16_t fmt = 1, n_chan = 1, block_align = 2, bits = 16;
+  memcpy(hdr + 20, &fmt, 2);  memcpy(hdr + 22, &n_chan, 2);
+  uint32_t byte_rate = fs * block_align;
+  memcpy(hdr + 24, &fs, 4);  memcpy(hdr + 28, &byte_rate, 4);
+  memcpy(hdr + 32, &block_align, 2);  memcpy(hdr + 34, &bits, 2);
+  memcpy(hdr + 36, "data", 4);  memcpy(hdr + 40, &data_bytes, 4);  //the Teensy is little-endian, like WAV
+  file.seek(0);
+  file.write(hdr, 44);
+  file.seekEnd();
+}
+
+int BTNRH_OfflineProcessor::readFrames(FsFile &file, const WavInfo &info, float *x, int n_frames) {
+  static uint8_t buf[BTNRH_OFFLINE_BLOCK * 8 * sizeof(float)];  //up to 8 channels
+  int frame_bytes = info.n_chan * info.bits / 8;
+  n_frames = min(n_frames, (int)(sizeof(buf) / frame_bytes));
+  int n_read = file.read(buf, n_frames * frame_bytes) / frame_bytes;
+  for (int i = 0; i < n_read; i++) {
+    const uint8_t *frame = buf + i * frame_bytes;  //only the first channel is used
+    if (info.fmt == 1) {
+      int16_t val;  memcpy(&val, frame, 2);
+      x[i] = (float)val / 32768.0f;
+    } else {
+      memcpy(x + i, frame, 4);
+    }
+  }
+  return n_read;
+}
+
+#endif
@@ -0,0 +1,151 @@
+/*
+   BTNRH_ParameterSweep
+
+   Created: OpenAudio, 2022
+   Purpose: Run the WAV files on the SD card through CHAPRO for every setting of a BTNRH_SweepGrid (the
+       AFC's mu, rho, eps, afl and the compressor's ratios and gains), and write the results to a CSV
+       file on the SD card, one line per setting and file: the output level, the AFC's misalignment
+       and added stable gain (see BTNRH_SweepGrid.h), and the CPU time.
+
+       This is the small, on-device version, for a quick look at a few settings without a PC.  It runs
+       one setting at a time on the Tympan's one core, and by default only the first 10 seconds of each
+       file.  For real sweeps, use host/chapro_sweep, which runs the same grid over whole files on every
+       core of a PC.
+
+       The settings are taken BTNRH_SWEEP_N_PER_READ at a time, and each block of a file is run through
+       all of them before the next block is read, so that each file is read from the SD card once per
+       group instead of once per setting.  The live audio keeps running (and its interrupts are counted
+       in the CPU time, as in BTNRH_OfflineProcessor).
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _BTNRH_ParameterSweep_h
+#define _BTNRH_ParameterSweep_h
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <chapro.h>
+#include "test_gha.h"
+#include "BTNRH_OfflineProcessor.h"
+#include "BTNRH_SweepGrid.h"
+
+#define BTNRH_SWEEP_N_PER_READ 4       //settings run on each read of a file
+#define BTNRH_SWEEP_CSV_FNAME  "SWEEP.CSV"
+
+class BTNRH_ParameterSweep : public BTNRH_OfflineProcessor, public BTNRH_SweepGrid {
+  public:
+    BTNRH_ParameterSweep(SdFs *_sd) : BTNRH_OfflineProcessor(_sd), BTNRH_SweepGrid() {}
+
+    float setMaxSecondsPerFile(float val) { return max_sec_per_file = val; }
+
+    //run every setting over every WAV file in the root of the SD card.  Returns the number of CSV lines written.
+    int run(const char *csv_fname, Print *p);
+
+  protected:
+    float max_sec_per_file = 10.0f;
+    void *cps[BTNRH_SWEEP_N_PER_READ][NPTR];
+
+    typedef struct { double sum_sq_out; uint64_t cycles; } Result;
+
+    bool runGroup(const char *fname, int n_ctx, Result *results, double *sum_sq_in, uint32_t *n_samples);
+    void freeContexts(void) {
+      for (int k = 0; k < BTNRH_SWEEP_N_PER_READ; k++) {
+        for (int idx = 0; idx < NPTR; idx++) { if (cps[k][idx]) free(cps[k][idx]); cps[k][idx] = NULL; }
+      }
+    }
+};
+
+// ///////////////////////////////////////////////////////////////////////////////////
+
+int BTNRH_ParameterSweep::run(const char *csv_fname, Print *p) {
+  static char fnames[BTNRH_OFFLINE_MAX_FILES][BTNRH_OFFLINE_MAX_NAME];
+  int n_files = listWavFiles(fnames, p);
+  int n_settings = getNumSettings();
+  if (n_files == 0) { p->println("BTNRH_ParameterSweep: no WAV files to process."); return 0; }
+  FsFile csv = sd->open(csv_fname, O_WRITE | O_CREAT | O_TRUNC);
+  if (!csv) { p->println("BTNRH_ParameterSweep: *** ERROR ***: could not open " + String(csv_fname)); return 0; }
+  csv.println("setting,file,mu,rho,eps,afl,cr_scale,gain_dB,in_dBFS,out_dBFS,misalign_dB,asg_dB,cpu_pct");
+  p->println("BTNRH_ParameterSweep: " + String(n_settings) + " settings x " + String(n_files) + " files -> " + String(csv_fname));
+
+  //the live configuration is in the globals, so keep it
+  saveGlobals();
+  BTNRH_StateArena *orig_arena = prepare_arena;
+  prepare_arena = NULL;  //each context is freed after its group
+  memset(cps, 0, sizeof(cps));
+
+  int n_lines = 0;
+  unsigned long start_msec = millis();
+  for (int first = 0; first < n_settings; first += BTNRH_SWEEP_N_PER_READ) {
+    int n_ctx = min(BTNRH_SWEEP_N_PER_READ, n_settings - first);
+    for (int Ifile = 0; Ifile < n_files; Ifile++) {
+      //fresh contexts for each file, so that no file depends on the one before it
+      for (int k = 0; k < n_ctx; k++) {
+        float setting[N_PARAMS];
+        getSetting(first + k, setting);
+        applySetting(setting);
+        I_O io;
+        prepare(&io, cps[k]);  //in test_gha.h
+      }
+      Result results[BTNRH_SWEEP_N_PER_READ];
+      double sum_sq_in = 0.0;  uint32_t n_samples = 0;
+      bool is_ok = runGroup(fnames[Ifile], n_ctx, results, &sum_sq_in, &n_samples);
+      for (int k = 0; is_ok && (k < n_ctx); k++) {
+        float setting[N_PARAMS], misalign_dB, asg_dB;
+        getSetting(first + k, setting);
+        feedbackMetrics(cps[k], &misalign_dB, &asg_dB);
+        float in_dBFS = 10.0f * log10f(max((float)(sum_sq_in / max(n_samples, (uint32_t)1)), 1.0e-20f));
+        float out_dBFS = 10.0f * log10f(max((float)(results[k].sum_sq_out / max(n_samples, (uint32_t)1)), 1.0e-20f));
+        float cpu_pct = 100.0f * ((float)results[k].cycles / (float)F_CPU_ACTUAL) / max((float)n_samples / (float)srate, 1.0e-6f);
+        csv.println(String(first + k) + "," + String(fnames[Ifile]) + "," + String(setting[MU], 9) + "," + String(setting[RHO], 9) + "," +
+                    String(setting[EPS], 9) + "," + String((int)(setting[AFL] + 0.5f)) + "," + String(setting[CR_SCALE], 3) + "," +
+                    String(setting[GAIN_dB], 2) + "," + String(in_dBFS, 2) + "," + String(out_dBFS, 2) + "," + String(misalign_dB, 2) + "," +
+                    String(asg_dB, 2) + "," + String(cpu_pct, 2));
+        n_lines++;
+      }
+      freeContexts();
+    }
+    p->println("BTNRH_ParameterSweep: " + String(first + n_ctx) + " of " + String(n_settings) + " settings done (" + String((millis() - start_msec) / 1000) + " sec)");
+  }
+  csv.close();
+
+  restoreGlobals();
+  prepare_arena = orig_arena;
+  p->println("BTNRH_ParameterSweep: done.  Wrote " + String(n_lines) + " lines to " + String(csv_fname));
+  return n_lines;
+}
+
+bool BTNRH_ParameterSweep::runGroup(const char *fname, int n_ctx, Result *results, double *sum_sq_in, uint32_t *n_samples) {
+  FsFile in_file = sd->open(fname, O_RDONLY);
+  WavInfo info;
+  if (!in_file || !readWavHeader(in_file, &info)) {
+    Serial.println("BTNRH_ParameterSweep: *** ERROR ***: could not read " + String(fname));
+    if (in_file) in_file.close();
+    return false;
+  }
+  const int cs = chunk;
+  uint32_t max_frames = min(info.n_frames, (uint32_t)(max_sec_per_file * info.fs_Hz));
+  static float x[BTNRH_OFFLINE_BLOCK], y[BTNRH_OFFLINE_BLOCK];
+  for (int k = 0; k < n_ctx; k++) { results[k].sum_sq_out = 0.0;  results[k].cycles = 0; }
+  uint32_t n_done = 0;
+  while (n_done < max_frames) {
+    int n = readFrames(in_file, info, x, min((uint32_t)BTNRH_OFFLINE_BLOCK, max_frames - n_done));
+    if (n <= 0) break;
+    int n_chunks = (n + cs - 1) / cs;
+    for (int i = n; i < n_chunks * cs; i++) x[i] = 0.0f;
+    for (int i = 0; i < n; i++) *sum_sq_in += (double)(x[i] * x[i]);
+    for (int k = 0; k < n_ctx; k++) {
+      memcpy(y, x, n_chunks * cs * sizeof(float));  //each setting gets its own copy of the input
+      uint32_t start_cycles = ARM_DWT_CYCCNT;
+      for (int Ichunk = 0; Ichunk < n_chunks; Ichunk++) process_chunk_ctx(cps[k], 1, y + Ichunk*cs, y + Ichunk*cs, cs);
+      results[k].cycles += (uint32_t)(ARM_DWT_CYCCNT - start_cycles);
+      for (int i = 0; i < n; i++) results[k].sum_sq_out += (double)(y[i] * y[i]);
+    }
+    n_done += n;
+  }
+  in_file.close();
+  *n_samples = n_done;
+  return (n_done > 0);
+}
+
+#endif
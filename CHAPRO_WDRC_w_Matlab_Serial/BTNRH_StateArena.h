@@ -0,0 +1,85 @@
+/*
+   BTNRH_StateArena
+
+   Created: OpenAudio, 2022
+   Purpose: One contiguous block of memory from which the CHAPRO arrays (the cp[] pointers) can be
+       carved, instead of each array being malloc'd separately.  Keeping the arrays together (and, on
+       the Teensy 4, in the fast DTCM memory that holds the global variables) keeps them close to
+       each other in the cache and avoids fragmenting the heap.
+
+       Memory is only ever handed out, never given back individually.  Call reset() to start over.
+
+       Each array starts on a multiple of the arena's alignment (at least 8 bytes, for the doubles).
+       Use a larger alignment (such as 32, a cache line on the Teensy 4) for arrays that are read
+       with wide loads.  adopt() moves arrays that were calloc'd (by cha_allocate) into the arena.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _BTNRH_StateArena_h
+#define _BTNRH_StateArena_h
+
+#include <Arduino.h>
+
+#define BTNRH_ARENA_ALIGN 8  //the CHAPRO arrays include doubles
+
+class BTNRH_StateArena {
+  public:
+    //align must be a power of 2
+    BTNRH_StateArena(uint8_t *_mem, int _n_bytes, int _align = BTNRH_ARENA_ALIGN) : mem(_mem), n_bytes(_n_bytes) {
+      align = max(_align, BTNRH_ARENA_ALIGN);
+    }
+
+    //returns NULL if there is not enough room left
+    void* allocate(int n) {
+      int start = (int)((((uintptr_t)(mem + n_used) + align - 1) & ~(uintptr_t)(align - 1)) - (uintptr_t)mem);
+      if ((n < 0) || (start + n > n_bytes)) {
+        n_failed++;
+        return NULL;
+      }
+      n_used = start + n;
+      n_peak = max(n_peak, n_used);
+      return (void *)(mem + start);
+    }
+    void* allocateCopy(const void *src, int n) {
+      void *dest = allocate(n);
+      if (dest && src) memcpy(dest, src, n);
+      return dest;
+    }
+
+    //Move the arrays ptrs[0..n_ptr-1] (sizes in bytes) from the heap into the arena.  Arrays that are NULL
+    //or already in the arena are skipped.  An array that does not fit stays on the heap.  Returns the
+    //number of arrays that did not fit.
+    int adopt(void **ptrs, const int *sizes, int n_ptr) {
+      int n_left = 0;
+      for (int idx = 0; idx < n_ptr; idx++) {
+        if ((ptrs[idx] == NULL) || contains(ptrs[idx]) || (sizes[idx] <= 0)) continue;
+        void *dest = allocateCopy(ptrs[idx], sizes[idx]);
+        if (dest == NULL) { n_left++; continue; }
+        free(ptrs[idx]);
+        ptrs[idx] = dest;
+      }
+      return n_left;
+    }
+
+    //bytes needed for an array of n bytes (at worst, including the padding before it)
+    int getPaddedSize(int n) { return (n + align - 1) & ~(align - 1); }
+
+    void reset(void) { n_used = 0; n_failed = 0; }
+    int getBytesUsed(void) { return n_used; }
+    int getPeakBytesUsed(void) { return n_peak; }
+    int getBytesTotal(void) { return n_bytes; }
+    int getNumFailed(void) { return n_failed; }
+    int getAlignment(void) { return align; }
+    bool contains(const void *ptr) { return ((const uint8_t *)ptr >= mem) && ((const uint8_t *)ptr < mem + n_bytes); }
+
+  protected:
+    uint8_t *mem;
+    int n_bytes;
+    int align;
+    int n_used = 0;
+    int n_peak = 0;
+    int n_failed = 0;
+};
+
+#endif
@@ -0,0 +1,141 @@
+/*
+   BTNRH_SweepGrid
+
+   Created: OpenAudio, 2022
+   Purpose: The grid of settings for tuning the AFC (mu, rho, eps, afl) and the compressor (the
+       per-channel compression ratios and gains), and the feedback metrics that each setting is
+       judged by.  Used by BTNRH_ParameterSweep (on the Tympan, from the SD card) and by
+       host/chapro_sweep (on a PC, on every core).
+
+       Every setting starts from the configuration in GHA_Constants.h (translated by translator.h,
+       just like configure() does at boot), then the swept values are applied, ready for prepare().
+       The feedback is CHAPRO's own simulated feedback path (afc.fbg, as in the original tst_gha.c
+       with feedback simulation enabled), so the AFC's final estimate can be compared to the true path:
+         * misalignment (dB): error energy of the estimate relative to the true path
+         * added stable gain (dB): maximum stable gain with the AFC minus without, for a flat forward path
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _BTNRH_SweepGrid_h
+#define _BTNRH_SweepGrid_h
+
+#include <Arduino.h>
+#include <chapro.h>
+#include "test_gha.h"
+
+#define BTNRH_SWEEP_MAX_VALS   8       //most values for any one parameter
+#define BTNRH_SWEEP_SIM_FBL    100     //length of the simulated feedback path (samples)
+#define BTNRH_SWEEP_N_FREQ     128     //frequencies at which the feedback paths are compared
+
+class BTNRH_SweepGrid {
+  public:
+    enum PARAM { MU = 0, RHO, EPS, AFL, CR_SCALE, GAIN_dB, N_PARAMS };
+
+    BTNRH_SweepGrid(void) { setDefaultGrid(); }
+
+    //the values to try for one parameter.  MU, RHO, EPS, and AFL are absolute values.  CR_SCALE multiplies
+    //every channel's compression ratio and GAIN_dB is added to every channel's compression-start gain.
+    int setValues(int param, const float *vals, int n) {
+      if ((param < 0) || (param >= N_PARAMS) || (n < 1)) return 0;
+      n_vals[param] = min(n, BTNRH_SWEEP_MAX_VALS);
+      for (int i = 0; i < n_vals[param]; i++) values[param][i] = vals[i];
+      return n_vals[param];
+    }
+    void setDefaultGrid(void);  //mu and rho at x0.5, x1, x2 of GHA_Constants.h, everything else as given there
+    int getNumSettings(void) { int n = 1; for (int i = 0; i < N_PARAMS; i++) n *= n_vals[i]; return n; }
+    void getSetting(int ind, float *setting) {
+      for (int i = 0; i < N_PARAMS; i++) { setting[i] = values[i][ind % n_vals[i]];  ind /= n_vals[i]; }
+    }
+    float setSimulatedFeedbackGain(float val) { return sim_fbg = val; }
+
+    //put GHA_Constants.h's configuration, with this setting applied, into test_gha.h's globals (for prepare())
+    void applySetting(const float *setting);
+
+    //keep (and later put back) the live configuration, which applySetting() overwrites
+    void saveGlobals(void) {
+      memcpy(&orig_afc, &afc_global, sizeof(CHA_AFC));  memcpy(&orig_dsl, &dsl_global, sizeof(CHA_DSL));  memcpy(&orig_agc, &agc_global, sizeof(CHA_WDRC));
+    }
+    void restoreGlobals(void) {
+      memcpy(&afc_global, &orig_afc, sizeof(CHA_AFC));  memcpy(&dsl_global, &orig_dsl, sizeof(CHA_DSL));  memcpy(&agc_global, &orig_agc, sizeof(CHA_WDRC));
+    }
+
+    //compare the AFC's final estimate with the simulated path
+    static void feedbackMetrics(CHA_PTR cp, float *misalign_dB, float *asg_dB);
+
+  protected:
+    float values[N_PARAMS][BTNRH_SWEEP_MAX_VALS];
+    int n_vals[N_PARAMS];
+    float sim_fbg = 1.0f;
+    CHA_AFC orig_afc;  CHA_DSL orig_dsl;  CHA_WDRC orig_agc;
+
+    void configureBase(void) { configure_compressor(); configure_feedback(); }  //from GHA_Constants.h, in test_gha.h
+};
+
+// ///////////////////////////////////////////////////////////////////////////////////
+
+void BTNRH_SweepGrid::setDefaultGrid(void) {
+  saveGlobals();
+  configureBase();
+  const float scale[3] = {0.5f, 1.0f, 2.0f};
+  n_vals[MU] = 3;   for (int i = 0; i < 3; i++) values[MU][i] = scale[i] * (float)afc_global.mu;
+  n_vals[RHO] = 3;  for (int i = 0; i < 3; i++) values[RHO][i] = scale[i] * (float)afc_global.rho;
+  n_vals[EPS] = 1;  values[EPS][0] = (float)afc_global.eps;
+  n_vals[AFL] = 1;  values[AFL][0] = (float)afc_global.afl;
+  n_vals[CR_SCALE] = 1;  values[CR_SCALE][0] = 1.0f;
+  n_vals[GAIN_dB] = 1;   values[GAIN_dB][0] = 0.0f;
+  restoreGlobals();
+}
+
+void BTNRH_SweepGrid::applySetting(const float *setting) {
+  configureBase();
+  afc_global.mu = setting[MU];
+  afc_global.rho = setting[RHO];
+  afc_global.eps = setting[EPS];
+  afc_global.afl = (int)(setting[AFL] + 0.5f);
+  afc_global.fbg = sim_fbg;  afc_global.fbl = BTNRH_SWEEP_SIM_FBL;
+  afc_global.hdel = 0;  //the simulated path has no hardware delay of its own
+  for (int i = 0; i < dsl_global.nchannel; i++) {
+    dsl_global.cr[i] *= setting[CR_SCALE];
+    dsl_global.tkgain[i] += setting[GAIN_dB];
+  }
+}
+
+//compare the AFC's estimate (efbp, which applies after the hardware delay hdel) with the simulated path (sfbp)
+void BTNRH_SweepGrid::feedbackMetrics(CHA_PTR cp, float *misalign_dB, float *asg_dB) {
+  *misalign_dB = 0.0f;  *asg_dB = 0.0f;
+  if ((cp[_sfbp] == NULL) || (cp[_efbp] == NULL)) return;
+  const float *sfbp = (const float *)cp[_sfbp], *efbp = (const float *)cp[_efbp];
+  int fbl = ((int *)cp[_size])[_sfbp] / sizeof(float);
+  int afl = min(((int *)cp[_ivar])[_afl], (int)(((int *)cp[_size])[_efbp] / sizeof(float)));
+  int hdel = ((int *)cp[_ivar])[_hdel];
+  int len = max(fbl, hdel + afl);
+
+  //time domain: misalignment
+  double err = 0.0, ref = 0.0;
+  for (int j = 0; j < len; j++) {
+    float s = (j < fbl) ? sfbp[j] : 0.0f;
+    float e = ((j >= hdel) && (j - hdel < afl)) ? efbp[j - hdel] : 0.0f;
+    err += (double)(s - e) * (s - e);  ref += (double)s * s;
+  }
+  *misalign_dB = 10.0f * log10f(max((float)(err / max(ref, 1.0e-30)), 1.0e-20f));
+
+  //frequency domain: the stable gain is set by the peak of the (residual) feedback response
+  float max_mag2 = 1.0e-20f, max_res2 = 1.0e-20f;
+  for (int Ifreq = 0; Ifreq < BTNRH_SWEEP_N_FREQ; Ifreq++) {
+    float w = PI * (Ifreq + 0.5f) / BTNRH_SWEEP_N_FREQ;
+    float s_re = 0.0f, s_im = 0.0f, r_re = 0.0f, r_im = 0.0f;
+    for (int j = 0; j < len; j++) {
+      float s = (j < fbl) ? sfbp[j] : 0.0f;
+      float e = ((j >= hdel) && (j - hdel < afl)) ? efbp[j - hdel] : 0.0f;
+      float c = cosf(w * j), sn = sinf(w * j);
+      s_re += s * c;  s_im -= s * sn;
+      r_re += (s - e) * c;  r_im -= (s - e) * sn;
+    }
+    max_mag2 = max(max_mag2, s_re * s_re + s_im * s_im);
+    max_res2 = max(max_res2, r_re * r_re + r_im * r_im);
+  }
+  *asg_dB = 10.0f * log10f(max_mag2 / max_res2);
+}
+
+#endif
@@ -20,6 +20,9 @@
 //Include algorithm-specific files
 #include "test_gha.h"          //see the tab "test_gha.h"..........be sure to update the name if you change the filename!
 #include "AudioEffectBTNRH.h"  //see the tab "AudioEffectBTNRH.h"
+#include "BTNRH_OfflineProcessor.h"  //for running WAV files from the SD card through CHAPRO
+#include "BTNRH_ParameterSweep.h"    //for tuning CHAPRO over a grid of settings, using the WAV files on the SD card
+#include "AudioLatencyProbe_F32.h"   //for measuring the latency of the algorithm and of the acoustic loop
  
 // ///////////////////////////////////////// setup the audio processing classes and connections
 
@@ -28,6 +31,18 @@ const float sample_rate_Hz = (int)srate;  //Set in test_gha.h.  Must be one of t
 const int audio_block_samples = chunk;    //Set in test_gha.h.  Must be less than or equal to 128 
 AudioSettings_F32 audio_settings(sample_rate_Hz, audio_block_samples);
 
+//set true to process the left and right earpieces separately (sharing one copy of the CHAPRO coefficients)
+#define RUN_BINAURAL (false)
+
+//set true to start from the prepared CHAPRO data in CHAPRO_Data.h instead of designing the filters at boot.
+//To make CHAPRO_Data.h, set PRINT_CHAPRO_DATA true, run once, and save what is printed (see BTNRH_DataBlob.h),
+//or run host/chapro_datagen on a PC.
+#define USE_CHAPRO_DATA (false)
+#define PRINT_CHAPRO_DATA (false)
+#if (USE_CHAPRO_DATA)
+  #include "CHAPRO_Data.h"   //defines chapro_data[]
+#endif
+
 // Create the Tympan
 Tympan myTympan(TympanRev::E, audio_settings);
 EarpieceShield   earpieceShield(TympanRev::E, AICShieldRev::A);  //Note that EarpieceShield is defined in the Tympan_Libarary in AICShield.h
@@ -56,14 +71,123 @@ void setupSerialManager(void) {
 }
 
 float setDigitalGain_dB(float val_dB) {
+  #if (RUN_BINAURAL)
+    gain2.setGain_dB(val_dB);
+  #endif
     return myState.digital_gain_dB = gain1.setGain_dB(val_dB);
 }
 
+//the CHAPRO arrays (both ears' states, if binaural) are carved from here instead of from the heap
+//(see BTNRH_StateArena.h, prepare() in test_gha.h, and AudioEffectBTNRH_F32::setupBinaural()).
+//If it is too small, setup() says how big it needs to be (or use the 'u' command).
+#define BTNRH_ARENA_BYTES 32768
+#define BTNRH_ARENA_ALIGN_BYTES 32   //a cache line on the Teensy 4
+uint8_t btnrh_arena_mem[BTNRH_ARENA_BYTES] __attribute__ ((aligned (BTNRH_ARENA_ALIGN_BYTES)));
+BTNRH_StateArena btnrh_arena(btnrh_arena_mem, BTNRH_ARENA_BYTES, BTNRH_ARENA_ALIGN_BYTES);
+
 float setOutputGain_dB(float gain_dB) {  
   earpieceShield.volume_dB(gain_dB);
   return myState.output_gain_dB = myTympan.volume_dB(gain_dB);
 }
 
+//save and load the prepared CHAPRO data (see BTNRH_DataBlob.h) on the SD card, for switching presets
+SdFs chapro_sd;
+bool beginCHAPRODataSD(const char *caller) {
+  static bool is_begun = false;
+  if (audioSDWriter.getState() == AudioSDWriter::STATE::RECORDING) {
+    Serial.println(String(caller) + ": SD is busy recording audio.  Skipping.");
+    return false;
+  }
+  if (!is_begun) is_begun = chapro_sd.begin(SdioConfig(FIFO_SDIO));
+  if (!is_begun) Serial.println(String(caller) + ": *** ERROR ***: could not open the SD card.");
+  return is_begun;
+}
+
+bool saveCHAPRODataToSD(const char *fname) {
+  if (!beginCHAPRODataSD("saveCHAPRODataToSD")) return false;
+  int n_bytes = BTNRH_alg1.getDataBlobSize();
+  uint8_t *blob = (uint8_t *)malloc(n_bytes);
+  if ((blob == NULL) || (BTNRH_alg1.saveDataBlob(blob, n_bytes) == 0)) { if (blob) free(blob); return false; }
+  FsFile file = chapro_sd.open(fname, O_WRITE | O_CREAT | O_TRUNC);
+  bool is_ok = false;
+  if (file) { is_ok = (file.write(blob, n_bytes) == (size_t)n_bytes); file.close(); }
+  free(blob);
+  Serial.println("saveCHAPRODataToSD: " + String(is_ok ? "wrote " : "*** ERROR ***: could not write ") + String(n_bytes) + " bytes to " + String(fname));
+  return is_ok;
+}
+
+bool loadCHAPRODataFromSD(const char *fname) {
+  if (!beginCHAPRODataSD("loadCHAPRODataFromSD")) return false;
+  FsFile file = chapro_sd.open(fname, O_RDONLY);
+  if (!file) { Serial.println("loadCHAPRODataFromSD: no CHAPRO data in " + String(fname)); return false; }
+  int n_bytes = file.size();
+  uint8_t *blob = (uint8_t *)malloc(max(n_bytes, 1));
+  bool is_ok = ((blob != NULL) && (file.read(blob, n_bytes) == n_bytes));
+  file.close();
+  unsigned long start_usec = micros();
+  #if (RUN_BINAURAL)
+    //the right ear shares some of the left ear's arrays, so it is held off until it has the blob's states (and fixed filterbank) too
+    bool prev_enabled = BTNRH_alg2.getEnabled();
+    BTNRH_alg2.setEnabled(false);
+    if (is_ok) is_ok = BTNRH_alg1.setupFromDataBlob(blob, n_bytes);
+    if (is_ok) is_ok = BTNRH_alg2.setupFromDataBlob(blob, n_bytes);
+    BTNRH_alg2.setEnabled(prev_enabled);
+  #else
+    if (is_ok) is_ok = BTNRH_alg1.setupFromDataBlob(blob, n_bytes);
+  #endif
+  if (blob) free(blob);
+  if (is_ok) Serial.println("loadCHAPRODataFromSD: loaded " + String(fname) + " in " + String(micros() - start_usec) + " usec");
+  return is_ok;
+}
+
+//run every WAV file on the SD card through CHAPRO (see BTNRH_OfflineProcessor.h).  Takes a while.
+//For large batches, run host/chapro_batch on a PC instead.
+int processWavFilesOnSD(void) {
+  if (!beginCHAPRODataSD("processWavFilesOnSD")) return 0;
+  BTNRH_OfflineProcessor offline(&chapro_sd);
+  return offline.processAllFiles(&Serial);
+}
+
+//run every WAV file on the SD card through CHAPRO for a grid of AFC and compression settings (see
+//BTNRH_ParameterSweep.h).  The results go to a CSV file on the SD card.  Takes a long while.
+//For real sweeps (whole files, bigger grids), run host/chapro_sweep on a PC instead.
+int runParameterSweepOnSD(void) {
+  if (!beginCHAPRODataSD("runParameterSweepOnSD")) return 0;
+  BTNRH_ParameterSweep sweep(&chapro_sd);  //default grid: mu and rho at x0.5, x1, x2 of GHA_Constants.h
+  return sweep.run(BTNRH_SWEEP_CSV_FNAME, &Serial);
+}
+
+//measure the algorithm latency and the loop latency (output -> earpiece -> mic -> input) with a marker
+//signal.  The AFC is paused, so that it doesn't adapt to (or cancel) the marker.  If apply_to_afc is
+//true, the measured loop latency becomes the AFC's hdel.  Blocks loop() for about a tenth of a second.
+bool measureLatency(bool apply_to_afc) {
+  bool prev_afc = BTNRH_alg1.getAfcEnabled();
+  if (prev_afc) BTNRH_alg1.setAfcEnabled(false);
+  delay(50);  //let the old feedback estimate drain out of the loop
+  latencyProbe.start();
+  bool timed_out = false;
+  unsigned long start_msec = millis();
+  while (!timed_out && !latencyProbe.isDone()) {
+    timed_out = ((millis() - start_msec) > 1000);
+    delay(1);
+  }
+  bool is_ok = (!timed_out) && latencyProbe.analyze();
+  if (prev_afc) BTNRH_alg1.setAfcEnabled(true);
+  if (timed_out) {
+    Serial.println("measureLatency: *** ERROR ***: the measurement did not finish.  Is the audio running?");
+    return false;
+  }
+  latencyProbe.printResults(&Serial);
+  if (!is_ok) {
+    Serial.println("measureLatency: could not measure the loop latency.  Not changing the AFC.");
+    return false;
+  }
+  int hdel = (int)(latencyProbe.getLoopLatency_samples() + 0.5f) + BTNRH_alg1.getAddedLatency_samples();  //as seen by CHAPRO
+  Serial.println("measureLatency: AFC hdel is " + String(BTNRH_alg1.getAfcHdel()) + ", measured " + String(hdel));
+  if (apply_to_afc) BTNRH_alg1.setAfcHdel(hdel);
+  return true;
+}
+
 // /////////////////////////  Start the Arduino-standard functions: setup() and loop()
 
 void setup() { //this runs once at startup  
@@ -81,8 +205,23 @@ void setup() { //this runs once at startup
 
   // /////////////////////////////////////////////  do any setup of the algorithms
 
-  BTNRH_alg1.setup();           //in AudioEffectBTNRH.h
+  BTNRH_alg1.setArena(&btnrh_arena);
+  unsigned long start_usec = micros();
+  #if (USE_CHAPRO_DATA)
+    if (!BTNRH_alg1.setupFromDataBlob(chapro_data, sizeof(chapro_data))) BTNRH_alg1.setup();  //if the data doesn't fit, design it here
+  #else
+    BTNRH_alg1.setup();           //in AudioEffectBTNRH.h
+  #endif
+  Serial.println("setup: CHAPRO prepared in " + String(micros() - start_usec) + " usec.");
+  #if (PRINT_CHAPRO_DATA)
+    BTNRH_alg1.printDataBlobAsC(&Serial, "chapro_data");  //save this as CHAPRO_Data.h
+  #endif
   BTNRH_alg1.setEnabled(true);  //see AudioEffectBTNRH.h.  This could be done later in setup()
+  #if (RUN_BINAURAL)
+    BTNRH_alg2.setupBinaural(BTNRH_alg1, btnrh_arena);  //shares the left ear's filterbank and AGC coefficients
+    BTNRH_alg2.setEnabled(true);
+  #endif
+  Serial.println("setup: CHAPRO arena: " + String(btnrh_arena.getBytesUsed()) + " of " + String(btnrh_arena.getBytesTotal()) + " bytes used.");
  
   // //////////////////////////////////////////// End setup of the algorithms
 
@@ -0,0 +1,188 @@
+/*
+   FeedbackModelSnapshot_F32
+
+   Created: OpenAudio, 2022
+   Purpose: Lets loop() look at the AFC's estimated feedback impulse response (efbp) without reading
+       the coefficients while the audio interrupt is rewriting them.
+
+       The audio processing (the ISR) publishes a copy of the coefficients every N blocks.  It writes
+       into the back buffer and then flips the buffers and bumps a sequence counter.  loop() copies
+       the front buffer and then checks the sequence counter.  If the ISR published twice during the
+       copy (so the buffer might have been overwritten), the copy is simply done again.  The ISR never
+       waits on loop() and loop() never sees a half-updated vector.
+
+       The snapshot can also be sent as a compact binary packet (see writeBinary()), which is much
+       cheaper than formatting every coefficient as text.  The packet is, in little-endian order:
+           uint8   0xA5, 0x5A     sync bytes
+           uint8   version        (currently 1)
+           uint8   flags          (bit 0: the coefficients are int16, scaled by the float below)
+           uint16  n              number of coefficients
+           uint32  sequence       increments every time the ISR publishes
+           float32 scale          coefficient = int16 value * scale
+           int16   coeff[n]
+           uint8   checksum       sum of all of the preceding bytes after the sync bytes, modulo 256
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _FeedbackModelSnapshot_F32_h
+#define _FeedbackModelSnapshot_F32_h
+
+#include <arm_math.h> //for float32_t
+#include <Arduino.h>  //for Print, min(), max()
+
+#define FB_SNAPSHOT_SYNC1  0xA5
+#define FB_SNAPSHOT_SYNC2  0x5A
+#define FB_SNAPSHOT_VERSION  1
+
+//keep the compiler from moving the copying of the coefficients across the sequence/front accesses
+#define FB_SNAPSHOT_BARRIER()  __asm__ __volatile__ ("" ::: "memory")
+
+template <int MAX_LEN>
+class FeedbackModelSnapshot_F32 {
+  public:
+    FeedbackModelSnapshot_F32(void) {};
+
+    // ////////////////////////////// Called from the audio processing (the ISR)
+
+    //publish every n_blocks audio blocks (0 = never)
+    int setPeriod_blocks(int n_blocks) { return period_blocks = max(n_blocks, 0); }
+    int getPeriod_blocks(void) { return period_blocks; }
+
+    //call once per audio block.  Returns true when it is time to publish.
+    bool blockTick(void) {
+      if (period_blocks <= 0) return false;
+      if (++block_count < period_blocks) return false;
+      block_count = 0;
+      return true;
+    }
+
+    //the buffer that is not being read.  Fill it and then call commit().
+    float32_t* getBackBuffer(void) { return buff[1 - front]; }
+    static int getMaxLength(void) { return MAX_LEN; }
+
+    //make the back buffer visible to loop()
+    void commit(int n) {
+      len[1 - front] = min(max(n, 0), MAX_LEN);
+      updateChange();
+      FB_SNAPSHOT_BARRIER();
+      front = 1 - front;
+      sequence++;
+    }
+
+    //copy the given coefficients and make them visible to loop()
+    void publish(const float32_t *h, int n) {
+      n = min(max(n, 0), MAX_LEN);
+      float32_t *back = getBackBuffer();
+      for (int i = 0; i < n; i++) back[i] = h[i];
+      commit(n);
+    }
+
+    //how much the model changed between the last two snapshots: |h_new - h_old|^2 / |h_new|^2.
+    //Negative if it is not known (fewer than two snapshots, the length changed, or h_new is all zeros).
+    float32_t getLastChange(void) const { return last_change; }
+
+    // ////////////////////////////// Called from loop()
+
+    //sequence counter.  Zero means that nothing has been published yet.
+    uint32_t getSequence(void) const { return sequence; }
+
+    //copy the newest snapshot into h.  Returns the number of coefficients (0 if nothing has been published).
+    int read(float32_t *h, int n_max, uint32_t *seq_out = NULL) {
+      for (int Itry = 0; Itry < 4; Itry++) {
+        uint32_t seq = sequence;
+        int ind = front;
+        int n = min((int)len[ind], n_max);
+        FB_SNAPSHOT_BARRIER();
+        for (int i = 0; i < n; i++) h[i] = buff[ind][i];
+        FB_SNAPSHOT_BARRIER();
+        //the buffer being copied only gets overwritten on the second publish after we started
+        if ((uint32_t)(sequence - seq) < 2) {
+          if (seq_out) *seq_out = seq;
+          n_reads++;
+          return n;
+        }
+        n_retries++;
+      }
+      n_failed_reads++;  //the ISR is publishing faster than we can copy...should never happen
+      return 0;
+    }
+
+    //send the newest snapshot as a binary packet (see the format at the top of this file).
+    //Returns the number of bytes written.
+    int writeBinary(Print *p) {
+      float32_t h[MAX_LEN];
+      uint32_t seq = 0;
+      int n = read(h, MAX_LEN, &seq);
+      return writeBinary(p, h, n, seq);
+    }
+    static int writeBinary(Print *p, const float32_t *h, int n, uint32_t seq) {
+      float32_t max_abs = 0.0f;
+      for (int i = 0; i < n; i++) max_abs = max(max_abs, fabsf(h[i]));
+      float32_t scale = (max_abs > 0.0f) ? (max_abs / 32767.0f) : 1.0f;
+
+      uint8_t header[14];
+      header[0] = FB_SNAPSHOT_SYNC1; header[1] = FB_SNAPSHOT_SYNC2;
+      header[2] = FB_SNAPSHOT_VERSION; header[3] = 0x01;
+      header[4] = (uint8_t)(n & 0xFF); header[5] = (uint8_t)((n >> 8) & 0xFF);
+      for (int i = 0; i < 4; i++) header[6 + i] = (uint8_t)((seq >> (8*i)) & 0xFF);
+      memcpy(header + 10, &scale, 4);  //the Teensy is little-endian
+
+      uint8_t checksum = 0;
+      for (int i = 2; i < 14; i++) checksum += header[i];
+      int count = p->write(header, 14);
+
+      //send the coefficients a few at a time to keep the stack small
+      uint8_t chunk[64];
+      int n_chunk = 0;
+      float32_t inv_scale = 1.0f / scale;
+      for (int i = 0; i < n; i++) {
+        int16_t val = (int16_t)lroundf(h[i] * inv_scale);
+        chunk[n_chunk++] = (uint8_t)(val & 0xFF);
+        chunk[n_chunk++] = (uint8_t)((val >> 8) & 0xFF);
+        if ((n_chunk == 64) || (i == n-1)) {
+          for (int j = 0; j < n_chunk; j++) checksum += chunk[j];
+          count += p->write(chunk, n_chunk);
+          n_chunk = 0;
+        }
+      }
+      count += p->write(checksum);
+      return count;
+    }
+
+    void resetStats(void) { n_reads = 0; n_retries = 0; n_failed_reads = 0; }
+    void printStats(Print *p) {
+      p->print("FeedbackModelSnapshot: period = "); p->print(period_blocks);
+      p->print(" blocks, sequence = "); p->print(sequence);
+      p->print(", reads = "); p->print(n_reads);
+      p->print(", retries = "); p->print(n_retries);
+      p->print(", failed = "); p->println(n_failed_reads);
+    }
+
+  protected:
+    //compare the new snapshot (the back buffer) to the previous one (the front buffer)
+    void updateChange(void) {
+      const float32_t *h_new = buff[1 - front], *h_old = buff[front];
+      int n = len[1 - front];
+      last_change = -1.0f;
+      if ((sequence == 0) || (n == 0) || (n != len[front])) return;
+      float32_t diff = 0.0f, pow_new = 0.0f;
+      for (int i = 0; i < n; i++) {
+        float32_t d = h_new[i] - h_old[i];
+        diff += d * d;
+        pow_new += h_new[i] * h_new[i];
+      }
+      if (pow_new > 0.0f) last_change = diff / pow_new;
+    }
+
+    float32_t buff[2][MAX_LEN];
+    volatile int len[2] = {0, 0};
+    volatile int front = 0;          //the buffer that loop() should read
+    volatile uint32_t sequence = 0;  //number of snapshots published
+    int period_blocks = 64;
+    int block_count = 0;
+    float32_t last_change = -1.0f;
+    unsigned long n_reads = 0, n_retries = 0, n_failed_reads = 0;
+};
+
+#endif
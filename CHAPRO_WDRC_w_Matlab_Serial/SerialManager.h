@@ -16,6 +16,14 @@ extern AudioSDWriter_F32_UI audioSDWriter;
 extern AudioEffectBTNRH_F32 BTNRH_alg1; //, BTNRH_alg2;
 extern AudioEffectGain_F32 gain1;
 extern float setDigitalGain_dB(float);
+extern bool saveCHAPRODataToSD(const char *fname);
+extern bool loadCHAPRODataFromSD(const char *fname);
+extern int processWavFilesOnSD(void);
+extern int runParameterSweepOnSD(void);
+extern bool measureLatency(bool apply_to_afc);
+extern BTNRH_StateArena btnrh_arena;
+
+#define CHAPRO_DATA_FNAME "CHAPRO.bin"
 
 //
 // The purpose of this class is to be a central place to handle all of the interactions
@@ -144,6 +152,15 @@ void SerialManager::printHelp(void) {
   Serial.println("   d: Print DSL settings.");
   Serial.println("   g: Print AGC settings.");   
   Serial.println("   s: print AFC settings.");
+  Serial.println("   b: benchmark the per-block cost of the CHAPRO processing (with vs without global struct copies).");
+  Serial.println("   l/L: measure the algorithm and feedback-loop latency / and set the AFC's hdel to it (current hdel: " + String(BTNRH_alg1.getAfcHdel()) + ")");
+  Serial.println("   n/N: CHAPRO chunk size of 8 (low latency) / 32 (low CPU) (current: " + String(BTNRH_alg1.getChunkSize()) + ")");
+  Serial.println("   B: check and benchmark the fixed-size filterbank vs CHAPRO's (using it: " + String(BTNRH_alg1.getUseFixedPipeline() ? "yes" : "no") + ")");
+  Serial.println("   o/O: save/load the prepared CHAPRO data to/from the SD card (" + String(CHAPRO_DATA_FNAME) + ")");
+  Serial.println("   y: run every WAV file on the SD card through CHAPRO (writes OUT_xxx.wav)");
+  Serial.println("   Y: run every WAV file on the SD card through CHAPRO for a grid of AFC settings (writes SWEEP.CSV)");
+  Serial.println("   c: print the prepared CHAPRO data as a C header (for CHAPRO_Data.h)");
+  Serial.println("   u: print the memory used by the CHAPRO arrays (per prepare() stage, in the arena, and shared binaurally).");
   Serial.println(" Overall Gain: (no prefix)");
   Serial.println("   k/K: incr/decrease gain (current: " + String(gain1.getGain_dB(),1) + " dB)");
   Serial.println("   z/Z: mute/unmute");
@@ -322,6 +339,50 @@ bool SerialManager::processCharacter(char c) {  //this is called by SerialManage
       Serial.println("SerialManager: command received...print settings for LEFT AFC:");
       BTNRH_alg1.print_afc_params();
       break;
+    case 'b':
+      Serial.println("SerialManager: command received...benchmarking the LEFT algorithm (takes a few seconds)...");
+      BTNRH_alg1.benchmarkGlobalCopies(&Serial);
+      break;
+    case 'n':
+      BTNRH_alg1.setChunkSize(8);
+      break;
+    case 'N':
+      BTNRH_alg1.setChunkSize(32);
+      break;
+    case 'B':
+      Serial.println("SerialManager: command received...checking the fixed-size filterbank of the LEFT algorithm...");
+      BTNRH_alg1.checkFixedPipeline(&Serial);
+      BTNRH_alg1.benchmarkFixedPipeline(&Serial);
+      break;
+    case 'o':
+      saveCHAPRODataToSD(CHAPRO_DATA_FNAME);
+      break;
+    case 'O':
+      loadCHAPRODataFromSD(CHAPRO_DATA_FNAME);
+      break;
+    case 'l':
+      Serial.println("SerialManager: command received...measuring the latency...");
+      measureLatency(false);
+      break;
+    case 'L':
+      Serial.println("SerialManager: command received...measuring the latency and setting the AFC's hdel...");
+      measureLatency(true);
+      break;
+    case 'y':
+      Serial.println("SerialManager: command received...processing the WAV files on the SD card (the audio keeps running)...");
+      processWavFilesOnSD();
+      break;
+    case 'Y':
+      Serial.println("SerialManager: command received...sweeping the CHAPRO settings over the WAV files on the SD card...");
+      runParameterSweepOnSD();
+      break;
+    case 'c':
+      BTNRH_alg1.printDataBlobAsC(&Serial, "chapro_data");
+      break;
+    case 'u':
+      BTNRH_alg1.printMemoryUsage(&Serial);
+      AudioEffectBTNRH_F32::dryRunArenaBytes(btnrh_arena.getAlignment(), &Serial);
+      break;
     case 'S':
       //Serial.println("SerialManager: command received...print settings for RIGHT AFC:");
       //BTNRH_alg2.print_afc_params();
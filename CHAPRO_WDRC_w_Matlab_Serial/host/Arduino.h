@@ -0,0 +1,86 @@
+/*
+   Arduino.h (host)
+
+   Created: OpenAudio, 2022
+   Purpose: Just enough of the Arduino core for the sketch's CHAPRO headers (test_gha.h, translator.h,
+       BTNRH_StateArena.h, BTNRH_SweepGrid.h, BTNRH_DataBlob.h, AudioLatencyProbe_F32.h) to compile on a PC, for the tools
+       in this directory.  Serial (and any other Print) goes to stdout.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _host_Arduino_h
+#define _host_Arduino_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+
+#define F(s) (s)      //no flash strings here
+#define PROGMEM
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+//like the Teensy core, min() and max() are functions (not macros), so the standard headers still work
+template <class A, class B> constexpr auto min(const A &a, const B &b) -> decltype(a < b ? a : b) { return (a < b) ? a : b; }
+template <class A, class B> constexpr auto max(const A &a, const B &b) -> decltype(a < b ? a : b) { return (a > b) ? a : b; }
+
+//only what the sketch's headers use to build their messages
+class String {
+  public:
+    String(const char *s = "") : str(s) {}
+    String(const std::string &s) : str(s) {}
+    String(int val) : str(std::to_string(val)) {}
+    String(unsigned int val) : str(std::to_string(val)) {}
+    String(long val) : str(std::to_string(val)) {}
+    String(unsigned long val) : str(std::to_string(val)) {}
+    String(double val, int digits = 2) { char buf[64]; snprintf(buf, sizeof(buf), "%.*f", digits, val); str = buf; }
+    const char *c_str(void) const { return str.c_str(); }
+    unsigned int length(void) const { return (unsigned int)str.size(); }
+    friend String operator+(const String &a, const String &b) { return String(a.str + b.str); }
+  protected:
+    std::string str;
+};
+
+class Print {
+  public:
+    Print(FILE *_fid = stdout) : fid(_fid) {}
+    size_t write(uint8_t c) { return fputc(c, fid) == EOF ? 0 : 1; }
+    size_t write(const uint8_t *buf, size_t n) { return fwrite(buf, 1, n, fid); }
+    size_t print(const char *s) { return fputs(s, fid) == EOF ? 0 : strlen(s); }
+    size_t print(const String &s) { return print(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int val) { return fprintf(fid, "%d", val); }
+    size_t print(unsigned int val) { return fprintf(fid, "%u", val); }
+    size_t print(long val) { return fprintf(fid, "%ld", val); }
+    size_t print(unsigned long val) { return fprintf(fid, "%lu", val); }
+    size_t print(double val, int digits = 2) { return fprintf(fid, "%.*f", digits, val); }
+    size_t println(void) { return print('\n'); }
+    template <class T> size_t println(const T &val) { size_t n = print(val); return n + println(); }
+    size_t println(double val, int digits) { size_t n = print(val, digits); return n + println(); }
+    void flush(void) { fflush(fid); }
+  protected:
+    FILE *fid;
+};
+
+class Stream : public Print {
+  public:
+    int available(void) { return 0; }
+    int read(void) { return -1; }
+};
+
+inline Stream Serial;
+
+inline unsigned long micros(void) {
+  static const auto t0 = std::chrono::steady_clock::now();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+inline unsigned long millis(void) { return micros() / 1000UL; }
+
+#endif
@@ -0,0 +1,2 @@
+//AudioEffectCompWDRC_F32.h (host): GHA_Constants.h #includes this Tympan_Library header, but
+//doesn't use it (see the note there), so the tools in this directory only need it to exist.
@@ -0,0 +1,156 @@
+/*
+   WavFile (host)
+
+   Created: OpenAudio, 2022
+   Purpose: Read and write WAV files a block at a time, so that files of any length can be run
+       through CHAPRO without holding them in memory.  Same formats as BTNRH_OfflineProcessor (the
+       SD-card version): 16-bit PCM or 32-bit float in (only the first channel is used), 16-bit PCM
+       mono out.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _host_WavFile_h
+#define _host_WavFile_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WAV_FILE_MAX_CHAN 8   //most channels in an input file (only the first is used)
+
+class WavReader {
+  public:
+    ~WavReader(void) { close(); }
+
+    //returns false if the file can't be opened or is not 16-bit PCM or 32-bit float
+    bool open(const char *fname) {
+      close();
+      fid = fopen(fname, "rb");
+      if (fid == NULL) return false;
+      if (!readHeader()) { close(); return false; }
+      return true;
+    }
+    void close(void) { if (fid) fclose(fid); fid = NULL; }
+
+    //read up to n frames (first channel only) into x.  Returns the number read.
+    int readFrames(float *x, int n) {
+      if ((fid == NULL) || (n_left == 0)) return 0;
+      if ((uint32_t)n > n_left) n = (int)n_left;
+      int frame_bytes = n_chan * bits / 8;
+      int n_read = 0;
+      while (n_read < n) {
+        int n_now = n - n_read;
+        if (n_now > (int)(sizeof(buf) / frame_bytes)) n_now = (int)(sizeof(buf) / frame_bytes);
+        n_now = (int)(fread(buf, frame_bytes, n_now, fid));
+        if (n_now <= 0) break;
+        for (int i = 0; i < n_now; i++) {
+          const uint8_t *frame = buf + i * frame_bytes;
+          if (fmt == 1) {
+            int16_t val = (int16_t)(frame[0] | (frame[1] << 8));
+            x[n_read + i] = (float)val / 32768.0f;
+          } else {
+            memcpy(x + n_read + i, frame, 4);  //(assumes a little-endian PC, like the WAV file)
+          }
+        }
+        n_read += n_now;
+      }
+      n_left -= n_read;
+      return n_read;
+    }
+
+    float getSampleRate_Hz(void) { return fs_Hz; }
+    uint32_t getNumFrames(void) { return n_frames; }
+    int getNumChannels(void) { return n_chan; }
+
+  protected:
+    FILE *fid = NULL;
+    int fmt = 0, n_chan = 0, bits = 0;
+    float fs_Hz = 0.0f;
+    uint32_t n_frames = 0, n_left = 0;
+    uint8_t buf[1024 * WAV_FILE_MAX_CHAN * 4];
+
+    static uint32_t u32(const uint8_t *b) { return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24); }
+    static uint16_t u16(const uint8_t *b) { return (uint16_t)(b[0] | (b[1] << 8)); }
+    bool readHeader(void) {
+      uint8_t hdr[12], chunk_hdr[8], fmt_buf[16];
+      if ((fread(hdr, 1, 12, fid) != 12) || (memcmp(hdr, "RIFF", 4) != 0) || (memcmp(hdr + 8, "WAVE", 4) != 0)) return false;
+      bool have_fmt = false;
+      while (fread(chunk_hdr, 1, 8, fid) == 8) {
+        uint32_t len = u32(chunk_hdr + 4);
+        if (memcmp(chunk_hdr, "fmt ", 4) == 0) {
+          if ((len < 16) || (fread(fmt_buf, 1, 16, fid) != 16)) return false;
+          fmt = u16(fmt_buf);  n_chan = u16(fmt_buf + 2);  fs_Hz = (float)u32(fmt_buf + 4);  bits = u16(fmt_buf + 14);
+          if (fmt == 0xFFFE) fmt = (bits == 32) ? 3 : 1;  //WAVE_FORMAT_EXTENSIBLE (assume PCM or float by the bit depth)
+          have_fmt = true;
+          fseek(fid, len - 16 + (len & 1), SEEK_CUR);
+        } else if (memcmp(chunk_hdr, "data", 4) == 0) {
+          if (!have_fmt || (n_chan < 1) || (n_chan > WAV_FILE_MAX_CHAN)) return false;
+          if (!(((fmt == 1) && (bits == 16)) || ((fmt == 3) && (bits == 32)))) return false;
+          n_frames = n_left = len / (n_chan * bits / 8);
+          return true;
+        } else {
+          fseek(fid, len + (len & 1), SEEK_CUR);  //chunks are padded to an even length
+        }
+      }
+      return false;
+    }
+};
+
+class WavWriter {
+  public:
+    ~WavWriter(void) { close(); }
+
+    bool open(const char *fname, float _fs_Hz) {
+      close();
+      fid = fopen(fname, "wb");
+      if (fid == NULL) return false;
+      fs_Hz = _fs_Hz;  n_frames = 0;
+      writeHeader();  //the sizes are filled in by close()
+      return true;
+    }
+    void close(void) {
+      if (fid == NULL) return;
+      fseek(fid, 0, SEEK_SET);
+      writeHeader();
+      fclose(fid);
+      fid = NULL;
+    }
+
+    //write n samples (clipped to +/-1.0) as 16-bit PCM
+    bool writeFrames(const float *x, int n) {
+      int16_t out16[1024];
+      for (int i0 = 0; i0 < n; i0 += 1024) {
+        int n_now = (n - i0 < 1024) ? (n - i0) : 1024;
+        for (int i = 0; i < n_now; i++) {
+          float val = x[i0 + i];
+          val = (val > 1.0f) ? 1.0f : ((val < -1.0f) ? -1.0f : val);
+          out16[i] = (int16_t)(val * 32767.0f);
+        }
+        if (fwrite(out16, sizeof(int16_t), n_now, fid) != (size_t)n_now) return false;
+        n_frames += n_now;
+      }
+      return true;
+    }
+
+  protected:
+    FILE *fid = NULL;
+    float fs_Hz = 0.0f;
+    uint32_t n_frames = 0;
+
+    static void put32(uint8_t *b, uint32_t val) { b[0] = val & 0xFF;  b[1] = (val >> 8) & 0xFF;  b[2] = (val >> 16) & 0xFF;  b[3] = (val >> 24) & 0xFF; }
+    static void put16(uint8_t *b, uint16_t val) { b[0] = val & 0xFF;  b[1] = (val >> 8) & 0xFF; }
+    void writeHeader(void) {
+      uint32_t fs = (uint32_t)fs_Hz, data_bytes = n_frames * sizeof(int16_t);
+      uint8_t hdr[44];
+      memcpy(hdr, "RIFF", 4);  put32(hdr + 4, 36 + data_bytes);
+      memcpy(hdr + 8, "WAVEfmt ", 8);  put32(hdr + 16, 16);
+      put16(hdr + 20, 1);  put16(hdr + 22, 1);        //PCM, mono
+      put32(hdr + 24, fs);  put32(hdr + 28, fs * 2);  //sample rate, byte rate
+      put16(hdr + 32, 2);  put16(hdr + 34, 16);       //block align, bits
+      memcpy(hdr + 36, "data", 4);  put32(hdr + 40, data_bytes);
+      fwrite(hdr, 1, 44, fid);
+    }
+};
+
+#endif
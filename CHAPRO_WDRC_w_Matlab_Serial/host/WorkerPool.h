@@ -0,0 +1,61 @@
+/*
+   WorkerPool (host)
+
+   Created: OpenAudio, 2022
+   Purpose: Run n_jobs independent jobs on n_threads threads.  Each thread takes the next job as
+       soon as it finishes its last one, so long and short files balance out by themselves.
+
+       CHAPRO's processing only touches the context (cp) that it is given, so jobs with their own
+       contexts can run side by side.  Preparing a context is different: test_gha.h's prepare()
+       and configure() read and write globals (srate, chunk, the CHA_AFC/CHA_DSL/CHA_WDRC settings,
+       the filterbank design), so jobs must hold getPrepareMutex() while they set up a context.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _host_WorkerPool_h
+#define _host_WorkerPool_h
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+class WorkerPool {
+  public:
+    //n_threads <= 0 uses one thread per core
+    WorkerPool(int n_threads = 0) {
+      if (n_threads <= 0) n_threads = (int)std::thread::hardware_concurrency();
+      n_thread = (n_threads < 1) ? 1 : n_threads;
+    }
+
+    //call job(Ijob, Ithread) for every Ijob in [0, n_jobs).  Returns when all are done.
+    void run(int n_jobs, const std::function<void(int, int)> &job) {
+      std::atomic<int> next_job(0);
+      std::vector<std::thread> threads;
+      int n = (n_thread < n_jobs) ? n_thread : n_jobs;
+      for (int Ithread = 0; Ithread < n; Ithread++) {
+        threads.emplace_back([&, Ithread]() {
+          for (int Ijob = next_job++; Ijob < n_jobs; Ijob = next_job++) job(Ijob, Ithread);
+        });
+      }
+      for (auto &t : threads) t.join();
+    }
+
+    int getNumThreads(void) { return n_thread; }
+    static std::mutex &getPrepareMutex(void) { static std::mutex mtx; return mtx; }
+
+    //CPU time used by the calling thread (sec), for the real-time factor of each job
+    static double threadCpuSeconds(void) {
+      struct timespec ts;
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+      return (double)ts.tv_sec + 1.0e-9 * (double)ts.tv_nsec;
+    }
+
+  protected:
+    int n_thread;
+};
+
+#endif
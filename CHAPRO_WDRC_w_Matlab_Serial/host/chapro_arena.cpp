@@ -0,0 +1,79 @@
+/*
+   chapro_arena
+
+   Created: OpenAudio, 2022
+   Purpose: Find how big the sketch's CHAPRO arena (BTNRH_StateArena, BTNRH_ARENA_BYTES in CHAPRO_WDRC.ino)
+       needs to be, on a PC.  This is the host version of the sketch's 'u' command (AudioEffectBTNRH_F32::
+       dryRunArenaBytes()), but it runs prepare() (test_gha.h) into a real arena of the given size and
+       alignment, just like AudioEffectBTNRH_F32::setup() does, so the numbers are the ones the sketch
+       will see.  The CHAPRO arrays have the same sizes on the Tympan and on a PC.
+
+       The prescription is the one in GHA_Constants.h (as the sketch uses at boot).  The chunk size and the
+       AFC filter length can be changed from the command line.
+
+       Usage: chapro_arena [-align bytes] [-bytes arena_bytes] [-cs chunk] [-afl n]
+
+       Prints the bytes that each stage of prepare() puts in the arena, the total, and the size that the
+       sketch's dryRunArenaBytes() would ask for (which allows for an arena that is not aligned).  These
+       are per ear.  Exits non-zero if any array did not fit in an arena of the given size.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>           //host/Arduino.h
+#include "test_gha.h"          //the sketch's CHAPRO chain: configure(), prepare(), prepare_arena, prepare_stage_bytes[]
+#include "BTNRH_StateArena.h"
+
+//the sketch's arena (CHAPRO_WDRC.ino)
+#define DEFAULT_ARENA_BYTES 32768
+#define DEFAULT_ARENA_ALIGN 32
+
+int main(int argc, char **argv) {
+  int align = DEFAULT_ARENA_ALIGN, arena_bytes = DEFAULT_ARENA_BYTES, afl = -1;
+
+  //the settings from GHA_Constants.h, just like the sketch at boot, and then any changes
+  I_O io = {};
+  configure(&io);  //in test_gha.h
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-align") == 0) && (i + 1 < argc)) { align = atoi(argv[++i]); continue; }
+    if ((strcmp(argv[i], "-bytes") == 0) && (i + 1 < argc)) { arena_bytes = atoi(argv[++i]); continue; }
+    if ((strcmp(argv[i], "-cs") == 0) && (i + 1 < argc)) { chunk = atoi(argv[++i]); continue; }
+    if ((strcmp(argv[i], "-afl") == 0) && (i + 1 < argc)) { afl = atoi(argv[++i]); continue; }
+    printf("Usage: chapro_arena [-align bytes] [-bytes arena_bytes] [-cs chunk] [-afl n]\n");
+    return 1;
+  }
+  if ((align <= 0) || ((align & (align - 1)) != 0) || (arena_bytes <= 0) || (chunk <= 0)) {
+    printf("chapro_arena: *** ERROR ***: the alignment must be a power of 2, and the arena size and chunk must be positive.\n");
+    return 1;
+  }
+  if (afl >= 0) afc_global.afl = afl;
+
+  //prepare into the arena, as AudioEffectBTNRH_F32::setup() does
+  align = max(align, BTNRH_ARENA_ALIGN);
+  uint8_t *mem = (uint8_t *)aligned_alloc(align, ((arena_bytes + align - 1) / align) * align);
+  if (mem == NULL) { printf("chapro_arena: *** ERROR ***: out of memory.\n"); return 2; }
+  BTNRH_StateArena arena(mem, arena_bytes, align);
+  void *cp[NPTR] = {0};
+  prepare_arena = &arena;
+  prepare(&io, cp);  //in test_gha.h
+  prepare_arena = NULL;
+
+  //the size that dryRunArenaBytes() gives: every array padded, plus one alignment in case the arena is not aligned
+  int sizes[NPTR], n_arrays = 0, dry_run_bytes = align;
+  cp_sizes(cp, sizes);  //in test_gha.h
+  for (int idx = 0; idx < NPTR; idx++) {
+    if (cp[idx] == NULL) continue;
+    n_arrays++;
+    dry_run_bytes += arena.getPaddedSize(sizes[idx]);
+    if (!arena.contains(cp[idx])) free(cp[idx]);  //calloc'd by cha_allocate, and did not fit
+  }
+
+  printf("chapro_arena: fs = %.0f Hz, chunk = %d, %d channels, afl = %d, aligned to %d bytes (per ear):\n",
+         srate, chunk, dsl_global.nchannel, afc_global.afl, align);
+  for (int I = 0; I < N_PREP_STAGES; I++) printf("    : %-10s = %6d bytes\n", prepare_stage_names[I], prepare_stage_bytes[I]);
+  printf("    : total      = %6d bytes in the arena, %d arrays (the sketch's dry run asks for %d)\n", arena.getBytesUsed(), n_arrays, dry_run_bytes);
+  bool is_ok = (prepare_n_on_heap == 0);
+  printf("    : arena of %d bytes: %s\n", arena_bytes, is_ok ? "fits" : (String(prepare_n_on_heap) + " array(s) left on the heap: *** TOO SMALL ***").c_str());
+  free(mem);
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+/*
+   chapro_batch
+
+   Created: OpenAudio, 2022
+   Purpose: Run WAV files through the sketch's own CHAPRO chain (process_chunk_ctx() in test_gha.h, with
+       the prescription in GHA_Constants.h) on a PC, using every core.  This is the host version of
+       BTNRH_OfflineProcessor (which runs the files from the SD card on the Tympan, one at a time).
+
+       Each file is one job for the WorkerPool, with its own freshly-prepared CHAPRO context, so its
+       output does not depend on the other files.  A file is processed from start to end by one
+       thread (the AFC and the compressors carry their states from chunk to chunk), so the speedup
+       comes from running several files at once.  Files are streamed, so any length is fine.
+
+       Usage: chapro_batch [-j n_threads] [-o out_dir] input.wav|input_dir ...
+         Directories are searched (not recursively) for *.wav.  Each output is named OUT_<input name>
+         (in out_dir, if given, otherwise next to the input), and inputs named OUT_* are skipped.
+
+       The real-time factor (seconds of audio per second) is reported for each file (CHAPRO alone,
+       per CPU second of its thread) and for the whole batch (per second of wall-clock time).
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>           //host/Arduino.h
+#include "test_gha.h"          //the sketch's CHAPRO chain: configure(), prepare(), process_chunk_ctx()
+#include "WavFile.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#define BATCH_BLOCK  4096     //samples read at a time.  Must be a multiple of the chunk size.
+#define BATCH_PREFIX "OUT_"   //added to the name of each output file (and such files are not processed)
+
+typedef struct {
+  std::string in_fname, out_fname;
+  bool is_ok;
+  double audio_sec, dsp_cpu_sec, job_cpu_sec;
+} BatchJob;
+
+static bool endsWithWav(const std::string &name) {
+  return (name.size() > 4) && (strcasecmp(name.c_str() + name.size() - 4, ".wav") == 0);
+}
+static std::string baseName(const std::string &path) {
+  size_t ind = path.find_last_of('/');
+  return (ind == std::string::npos) ? path : path.substr(ind + 1);
+}
+
+//add the job for one input file (unless it is an earlier output)
+static void addJob(std::vector<BatchJob> &jobs, const std::string &in_fname, const char *out_dir) {
+  std::string name = baseName(in_fname);
+  if (strncasecmp(name.c_str(), BATCH_PREFIX, strlen(BATCH_PREFIX)) == 0) return;
+  std::string dir = out_dir ? std::string(out_dir) : in_fname.substr(0, in_fname.size() - name.size());
+  if (!dir.empty() && (dir.back() != '/')) dir += "/";
+  jobs.push_back({in_fname, dir + BATCH_PREFIX + name, false, 0.0, 0.0, 0.0});
+}
+
+static void addJobsFromPath(std::vector<BatchJob> &jobs, const char *path, const char *out_dir) {
+  struct stat st;
+  if ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) { printf("chapro_batch: *** ERROR ***: could not open %s\n", path); return; }
+    std::vector<std::string> names;
+    for (struct dirent *ent = readdir(dir); ent != NULL; ent = readdir(dir)) if (endsWithWav(ent->d_name)) names.push_back(ent->d_name);
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (auto &name : names) addJob(jobs, std::string(path) + "/" + name, out_dir);
+  } else {
+    addJob(jobs, path, out_dir);
+  }
+}
+
+//run one file through a fresh CHAPRO context
+static void processFile(BatchJob &job) {
+  double start_cpu = WorkerPool::threadCpuSeconds();
+  WavReader in;
+  WavWriter out;
+  if (!in.open(job.in_fname.c_str())) {
+    printf("chapro_batch: *** ERROR ***: %s could not be read as a 16-bit PCM or 32-bit float WAV file.\n", job.in_fname.c_str());
+    return;
+  }
+  if (!out.open(job.out_fname.c_str(), (float)srate)) {
+    printf("chapro_batch: *** ERROR ***: could not open %s\n", job.out_fname.c_str());
+    return;
+  }
+  if (in.getSampleRate_Hz() != (float)srate) {
+    printf("chapro_batch: *** WARNING ***: %s is %.0f Hz, but CHAPRO is prepared for %.0f Hz.  Processing it anyway.\n",
+           job.in_fname.c_str(), in.getSampleRate_Hz(), srate);
+  }
+
+  //a fresh CHAPRO context, prepared exactly like the live one.  prepare() uses globals, so one at a time.
+  void *cp[NPTR] = {0};
+  int cs;
+  {
+    std::lock_guard<std::mutex> lock(WorkerPool::getPrepareMutex());
+    I_O io = {};
+    prepare(&io, cp);  //in test_gha.h
+    cs = chunk;
+  }
+
+  static thread_local float x[BATCH_BLOCK];
+  double dsp_cpu_sec = 0.0;
+  uint64_t n_done = 0;
+  bool is_ok = true;
+  int n;
+  while ((n = in.readFrames(x, BATCH_BLOCK - (BATCH_BLOCK % cs))) > 0) {
+    int n_chunks = (n + cs - 1) / cs;
+    for (int i = n; i < n_chunks * cs; i++) x[i] = 0.0f;  //the last chunk is padded with silence
+
+    double start_dsp = WorkerPool::threadCpuSeconds();
+    for (int Ichunk = 0; Ichunk < n_chunks; Ichunk++) process_chunk_ctx(cp, 1, x + Ichunk*cs, x + Ichunk*cs, cs);
+    dsp_cpu_sec += WorkerPool::threadCpuSeconds() - start_dsp;
+
+    if (!out.writeFrames(x, n)) { is_ok = false; break; }
+    n_done += n;
+  }
+  out.close();
+  for (int idx = 0; idx < NPTR; idx++) { if (cp[idx]) free(cp[idx]); cp[idx] = NULL; }  //calloc'd by cha_allocate
+
+  job.is_ok = is_ok && (n_done == in.getNumFrames());
+  job.audio_sec = (double)n_done / in.getSampleRate_Hz();
+  job.dsp_cpu_sec = dsp_cpu_sec;
+  job.job_cpu_sec = WorkerPool::threadCpuSeconds() - start_cpu;
+  printf("chapro_batch: %s -> %s: %.2f sec of audio.  x real time: CHAPRO = %.1f, with file I/O = %.1f%s\n",
+         job.in_fname.c_str(), job.out_fname.c_str(), job.audio_sec, job.audio_sec / max(job.dsp_cpu_sec, 1.0e-9),
+         job.audio_sec / max(job.job_cpu_sec, 1.0e-9), job.is_ok ? "" : "  *** ERROR ***: incomplete");
+}
+
+int main(int argc, char **argv) {
+  int n_threads = 0;
+  const char *out_dir = NULL;
+  std::vector<BatchJob> jobs;
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) { n_threads = atoi(argv[++i]); continue; }
+    if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) { out_dir = argv[++i]; continue; }
+    addJobsFromPath(jobs, argv[i], out_dir);
+  }
+  if (jobs.empty()) {
+    printf("Usage: chapro_batch [-j n_threads] [-o out_dir] input.wav|input_dir ...\n");
+    return 1;
+  }
+
+  //the settings from GHA_Constants.h, just like the sketch at boot
+  I_O io = {};
+  configure(&io);  //in test_gha.h
+
+  WorkerPool pool(n_threads);
+  printf("chapro_batch: processing %d WAV files on %d threads (fs = %.0f Hz, chunk = %d)...\n", (int)jobs.size(), pool.getNumThreads(), srate, chunk);
+  unsigned long start_usec = micros();
+  pool.run((int)jobs.size(), [&](int Ijob, int) { processFile(jobs[Ijob]); });
+  double wall_sec = 1.0e-6 * (double)(micros() - start_usec);
+
+  int n_ok = 0;
+  double audio_sec = 0.0, dsp_cpu_sec = 0.0;
+  for (auto &job : jobs) { n_ok += job.is_ok ? 1 : 0;  audio_sec += job.audio_sec;  dsp_cpu_sec += job.dsp_cpu_sec; }
+  printf("chapro_batch: done.  %d of %d files, %.1f sec of audio in %.2f sec.  x real time: batch = %.1f, CHAPRO per thread = %.1f\n",
+         n_ok, (int)jobs.size(), audio_sec, wall_sec, audio_sec / max(wall_sec, 1.0e-9), audio_sec / max(dsp_cpu_sec, 1.0e-9));
+  return (n_ok == (int)jobs.size()) ? 0 : 2;
+}
@@ -0,0 +1,121 @@
+/*
+   chapro_datagen
+
+   Created: OpenAudio, 2022
+   Purpose: Make the sketch's CHAPRO_Data.h on a PC.  This is the host version of the sketch's 'c' command
+       (AudioEffectBTNRH_F32::printDataBlobAsC()): it runs the sketch's own configure() and prepare()
+       (test_gha.h) and saves all of the prepared CHAPRO arrays, plus the settings, as one data blob
+       (BTNRH_DataBlob.h), printed as a C header.  With USE_CHAPRO_DATA, the sketch then boots from
+       the blob instead of designing the filters itself.
+
+       The prescription is the one in GHA_Constants.h (as the sketch uses at boot).  The chunk size and
+       the AFC parameters can be changed from the command line.  If the configuration matches the
+       fixed-size filterbank (BTNRH_FIXED_xx in BTNRH_FixedCheck.h), its channel delays are measured
+       and it is checked against CHAPRO's filterbank here, with the same BTNRH_FixedCheck::check() as
+       the sketch, so that the sketch can use it without checking it again.
+
+       Usage: chapro_datagen [-o CHAPRO_Data.h] [-name chapro_data] [-cs chunk]
+                             [-afl n] [-wfl n] [-pfl n] [-pup n] [-hdel n] [-mu v] [-rho v] [-eps v] [-alf v]
+
+       Exits non-zero if the blob could not be made.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>           //host/Arduino.h
+#include "test_gha.h"          //the sketch's CHAPRO chain: configure(), prepare()
+#include "BTNRH_DataBlob.h"
+#include "BTNRH_BlobSettings.h"
+#include "BTNRH_FixedCheck.h"
+
+static void freeContext(void **cp) {
+  for (int idx = 0; idx < NPTR; idx++) { if (cp[idx]) free(cp[idx]); cp[idx] = NULL; }  //calloc'd by cha_allocate
+}
+
+//parse "-name value" for the AFC parameters.  Returns false if argv[i] is not one of them.
+static bool parseAfcParam(const char *flag, const char *val, CHA_AFC *afc) {
+  if (strcmp(flag, "-afl") == 0)  { afc->afl = atoi(val); return true; }
+  if (strcmp(flag, "-wfl") == 0)  { afc->wfl = atoi(val); return true; }
+  if (strcmp(flag, "-pfl") == 0)  { afc->pfl = atoi(val); return true; }
+  if (strcmp(flag, "-pup") == 0)  { afc->pup = atoi(val); return true; }
+  if (strcmp(flag, "-hdel") == 0) { afc->hdel = atoi(val); return true; }
+  if (strcmp(flag, "-mu") == 0)   { afc->mu = atof(val); return true; }
+  if (strcmp(flag, "-rho") == 0)  { afc->rho = atof(val); return true; }
+  if (strcmp(flag, "-eps") == 0)  { afc->eps = atof(val); return true; }
+  if (strcmp(flag, "-alf") == 0)  { afc->alf = atof(val); return true; }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  const char *out_fname = "CHAPRO_Data.h", *name = "chapro_data";
+
+  //the settings from GHA_Constants.h, just like the sketch at boot, and then any changes
+  I_O io = {};
+  configure(&io);  //in test_gha.h
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc) {
+      if (strcmp(argv[i], "-o") == 0) { out_fname = argv[++i]; continue; }
+      if (strcmp(argv[i], "-name") == 0) { name = argv[++i]; continue; }
+      if (strcmp(argv[i], "-cs") == 0) { chunk = atoi(argv[++i]); continue; }
+      if (parseAfcParam(argv[i], argv[i + 1], &afc_global)) { i++; continue; }
+    }
+    printf("Usage: chapro_datagen [-o CHAPRO_Data.h] [-name chapro_data] [-cs chunk]\n"
+           "                      [-afl n] [-wfl n] [-pfl n] [-pup n] [-hdel n] [-mu v] [-rho v] [-eps v] [-alf v]\n");
+    return 1;
+  }
+  if (chunk <= 0) { printf("chapro_datagen: *** ERROR ***: chunk must be positive.\n"); return 1; }
+
+  void *cp[NPTR] = {0};
+  prepare(&io, cp);  //in test_gha.h
+
+  //the same settings as AudioEffectBTNRH_F32::saveDataBlob()
+  BTNRH_BlobSettings settings;
+  memset(&settings, 0, sizeof(settings));
+  settings.srate = srate;
+  settings.chunk = ((int *)cp[_ivar])[_cs];
+  BTNRH_saveBlobAFC(&settings.afc, &afc_global);
+  memcpy(&settings.dsl, &dsl_global, sizeof(CHA_DSL));
+  memcpy(&settings.agc, &agc_global, sizeof(CHA_WDRC));
+  memcpy(settings.iirfb_z, iirfb_z, sizeof(iirfb_z));
+  memcpy(settings.iirfb_p, iirfb_p, sizeof(iirfb_p));
+  memcpy(settings.iirfb_g, iirfb_g, sizeof(iirfb_g));
+  memcpy(settings.iirfb_d, iirfb_d, sizeof(iirfb_d));
+
+  //the fixed-size filterbank, as in AudioEffectBTNRH_F32::setupFixedPipeline()
+  int nc = ((int *)cp[_ivar])[_nc], nz = agc_global.nz, cs = settings.chunk;
+  if ((nc == BTNRH_FIXED_NC) && (nz == BTNRH_FIXED_NZ) && (cs == BTNRH_FIXED_CS)) {
+    static BTNRH_FixedFB fb;  //(its delay lines are too big for the stack)
+    float err_dB[3] = {0.0f, 0.0f, 0.0f};
+    bool is_ok = fb.setCoeff(iirfb_z, iirfb_p, iirfb_g) && BTNRH_FixedCheck::check(cp, &fb, true, err_dB);
+    for (int k = 0; k < BTNRH_FIXED_NC; k++) settings.fixed_delays[k] = fb.getDelay(k);
+    settings.fixed_ok = is_ok ? 1 : 0;
+    printf("chapro_datagen: fixed-size filterbank %s the self-check: error vs CHAPRO = %.1f dB (impulse), %.1f dB (noise), %.1f dB (synthesized)\n",
+           is_ok ? "passed" : "FAILED", err_dB[0], err_dB[1], err_dB[2]);
+  } else {
+    printf("chapro_datagen: the sketch will use the generic filterbank (nc = %d, nz = %d, cs = %d)\n", nc, nz, cs);
+  }
+
+  int sizes[NPTR];
+  cp_sizes(cp, sizes);  //in test_gha.h
+  int n_bytes = BTNRH_DataBlob::getSize(cp, sizes, NPTR, sizeof(settings));
+  uint8_t *blob = (uint8_t *)malloc(n_bytes);
+  bool is_ok = (blob != NULL) && (BTNRH_DataBlob::write(blob, n_bytes, cp, sizes, NPTR, &settings, sizeof(settings)) == n_bytes) &&
+               BTNRH_DataBlob::isValid(blob, n_bytes);
+  freeContext(cp);
+  if (!is_ok) {
+    printf("chapro_datagen: *** ERROR ***: could not make the data blob.\n");
+    if (blob) free(blob);
+    return 2;
+  }
+
+  FILE *fid = fopen(out_fname, "w");
+  if (fid == NULL) { printf("chapro_datagen: *** ERROR ***: could not open %s\n", out_fname); free(blob); return 2; }
+  Print out(fid);
+  BTNRH_DataBlob::printAsC(blob, &out, name);
+  fclose(fid);
+  free(blob);
+
+  printf("chapro_datagen: wrote %s (%s[], %d bytes): fs = %.0f Hz, chunk = %d, %d channels, afl = %d, mu = %g, rho = %g, eps = %g, hdel = %d\n",
+         out_fname, name, n_bytes, srate, cs, nc, afc_global.afl, afc_global.mu, afc_global.rho, afc_global.eps, afc_global.hdel);
+  return 0;
+}
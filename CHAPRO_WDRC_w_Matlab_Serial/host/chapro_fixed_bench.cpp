@@ -0,0 +1,111 @@
+/*
+   chapro_fixed_bench
+
+   Created: OpenAudio, 2022
+   Purpose: Time the sketch's CHAPRO chain with CHAPRO's own filterbank (process_chunk_ctx() in test_gha.h)
+       against the same chain with the fixed-size filterbank (process_chunk_fixed(), BTNRH_FixedFilterbank.h),
+       on a PC, and check that the two give the same output.  This is the host version of the sketch's
+       'B' command (AudioEffectBTNRH_F32::checkFixedPipeline() and benchmarkFixedPipeline()), but for the
+       whole chain rather than just the filterbank.
+
+       The prescription is the one in GHA_Constants.h (as the sketch uses at boot).  Each chain gets its
+       own freshly-prepared CHAPRO context.  The fixed-size filterbank's channel delays are measured with
+       the sketch's own self-check (BTNRH_FixedCheck::check(), which runs on scratch filter states).  The
+       input is a colored (speech-like) noise.
+
+       Usage: chapro_fixed_bench [-sec seconds_of_audio]
+
+       Prints the ns/sample and the x real time of each chain, and the difference of their outputs in
+       dB (relative to the output of CHAPRO's chain).  Exits non-zero if the difference is more than
+       MAX_ERR_dB, or the prescription does not match the fixed-size filterbank, or it fails the self-check.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>           //host/Arduino.h
+#include "test_gha.h"          //the sketch's CHAPRO chain: configure(), prepare(), process_chunk_ctx(), process_chunk_fixed()
+#include "BTNRH_FixedCheck.h"  //BTNRH_FixedFB (as the sketch compiles it) and its self-check
+#include "WorkerPool.h"        //for threadCpuSeconds()
+#include <vector>
+
+#define MAX_ERR_dB (-40.0f)   //the filterbanks alone agree to better than -60 dB (see BTNRH_FixedCheck::check())
+
+static void freeContext(void **cp) {
+  for (int idx = 0; idx < NPTR; idx++) { if (cp[idx]) free(cp[idx]); cp[idx] = NULL; }  //calloc'd by cha_allocate
+}
+
+int main(int argc, char **argv) {
+  float dur_sec = 10.0f;
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-sec") == 0) && (i + 1 < argc)) { dur_sec = (float)atof(argv[++i]); continue; }
+    printf("Usage: chapro_fixed_bench [-sec seconds_of_audio]\n");
+    return 1;
+  }
+
+  //the settings from GHA_Constants.h, just like the sketch at boot
+  I_O io = {};
+  configure(&io);  //in test_gha.h
+  if ((dsl_global.nchannel != BTNRH_FIXED_NC) || (agc_global.nz != BTNRH_FIXED_NZ) || (chunk != BTNRH_FIXED_CS)) {
+    printf("chapro_fixed_bench: *** ERROR ***: the prescription has nc = %d, nz = %d, cs = %d, but the fixed-size filterbank is built for %d, %d, %d.\n",
+           dsl_global.nchannel, agc_global.nz, chunk, BTNRH_FIXED_NC, BTNRH_FIXED_NZ, BTNRH_FIXED_CS);
+    return 2;
+  }
+
+  //a context for each chain
+  void *cp_gen[NPTR] = {0}, *cp_fix[NPTR] = {0};
+  I_O io_gen = {}, io_fix = {};
+  prepare(&io_gen, cp_gen);  //in test_gha.h
+  prepare(&io_fix, cp_fix);
+  static BTNRH_FixedFB fb;  //(its delay lines are too big for the stack)
+  float check_dB[3] = {0.0f, 0.0f, 0.0f};
+  if (!fb.setCoeff(iirfb_z, iirfb_p, iirfb_g) || !BTNRH_FixedCheck::check(cp_fix, &fb, true, check_dB)) {  //the design from the last prepare_filterbank()
+    printf("chapro_fixed_bench: *** ERROR ***: the fixed-size filterbank failed the self-check: error vs CHAPRO = %.1f dB (impulse), %.1f dB (noise), %.1f dB (synthesized)\n",
+           check_dB[0], check_dB[1], check_dB[2]);
+    return 2;
+  }
+  fb.reset();
+  printf("chapro_fixed_bench: channel delays =");
+  for (int k = 0; k < BTNRH_FIXED_NC; k++) printf(" %d", fb.getDelay(k));
+  printf("\n");
+
+  //the input: colored noise at a conversational level, a whole number of chunks
+  const int cs = BTNRH_FIXED_CS;
+  int n_chunks = max((int)(dur_sec * srate) / cs, 1), n_samples = n_chunks * cs;
+  std::vector<float> x(n_samples), y_gen(n_samples), y_fix(n_samples);
+  uint32_t seed = 22222;
+  float s1 = 0.0f, s2 = 0.0f;
+  for (int i = 0; i < n_samples; i++) {
+    seed = seed * 1664525UL + 1013904223UL;
+    float w = ((float)(seed >> 8) / 16777216.0f) - 0.5f;
+    float s = w + 1.6f * s1 - 0.9f * s2;  s2 = s1; s1 = s;
+    x[i] = 0.01f * s;
+  }
+  y_gen = x;  y_fix = x;  //(both chains work in place, as in the sketch)
+
+  double start_cpu = WorkerPool::threadCpuSeconds();
+  for (int Ichunk = 0; Ichunk < n_chunks; Ichunk++) process_chunk_ctx(cp_gen, 1, &y_gen[Ichunk*cs], &y_gen[Ichunk*cs], cs);
+  double gen_sec = WorkerPool::threadCpuSeconds() - start_cpu;
+  start_cpu = WorkerPool::threadCpuSeconds();
+  for (int Ichunk = 0; Ichunk < n_chunks; Ichunk++) process_chunk_fixed(cp_fix, 1, fb, &y_fix[Ichunk*cs], &y_fix[Ichunk*cs], cs);
+  double fix_sec = WorkerPool::threadCpuSeconds() - start_cpu;
+  freeContext(cp_gen);
+  freeContext(cp_fix);
+
+  double err = 0.0, pow = 0.0;
+  float max_diff = 0.0f;
+  for (int i = 0; i < n_samples; i++) {
+    double d = y_gen[i] - y_fix[i];
+    err += d * d;  pow += (double)y_gen[i] * (double)y_gen[i];
+    max_diff = max(max_diff, fabsf((float)d));
+  }
+  float err_dB = 10.0f * log10f((float)(max(err, 1.0e-30) / max(pow, 1.0e-30)));
+  double audio_sec = (double)n_samples / srate;
+  bool is_ok = (err_dB <= MAX_ERR_dB);
+
+  printf("chapro_fixed_bench: %.1f sec of audio (fs = %.0f Hz, chunk = %d, %d channels):\n", audio_sec, srate, cs, BTNRH_FIXED_NC);
+  printf("    : CHAPRO's filterbank = %.1f ns/sample (x real time = %.1f)\n", 1.0e9 * gen_sec / n_samples, audio_sec / max(gen_sec, 1.0e-9));
+  printf("    : fixed-size          = %.1f ns/sample (x real time = %.1f), speedup = %.2f\n", 1.0e9 * fix_sec / n_samples,
+         audio_sec / max(fix_sec, 1.0e-9), gen_sec / max(fix_sec, 1.0e-9));
+  printf("    : output difference = %.1f dB (limit %.1f dB), largest = %.2e: %s\n", err_dB, MAX_ERR_dB, max_diff, is_ok ? "ok" : "*** FAIL ***");
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+/*
+   chapro_sweep
+
+   Created: OpenAudio, 2022
+   Purpose: Run WAV files through the sketch's CHAPRO chain for every setting of a BTNRH_SweepGrid (the
+       AFC's mu, rho, eps, afl and the compressor's ratios and gains) on a PC, using every core, and
+       write one CSV line per setting and file.  This is the host version of BTNRH_ParameterSweep
+       (which runs on the Tympan, one setting at a time, over the first seconds of each file).
+
+       Each (setting, file) pair is one job for the WorkerPool, with its own freshly-prepared CHAPRO
+       context, and the whole file is used unless -t is given.  The CSV has the same columns as the
+       SD-card version, except that the CPU load on the Tympan (cpu_pct) becomes the real-time factor
+       of the job's thread (x_real_time).
+
+       Usage: chapro_sweep [-j n_threads] [-o sweep.csv] [-t max_sec_per_file] [-fbg sim_feedback_gain]
+                           [-mu v,v,...] [-rho v,...] [-eps v,...] [-afl v,...] [-cr_scale v,...] [-gain_dB v,...]
+                           input.wav|input_dir ...
+         Parameters that are not given keep the default grid (mu and rho at x0.5, x1, x2 of
+         GHA_Constants.h, everything else as given there).
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>           //host/Arduino.h
+#include "test_gha.h"          //the sketch's CHAPRO chain: configure(), prepare(), process_chunk_ctx()
+#include "BTNRH_SweepGrid.h"
+#include "WavFile.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#define SWEEP_BLOCK 4096       //samples read at a time
+
+typedef struct {
+  int Isetting, Ifile;
+  bool is_ok;
+  double sum_sq_in, sum_sq_out, dsp_cpu_sec;
+  uint64_t n_samples;
+  float misalign_dB, asg_dB;
+} SweepJob;
+
+static bool endsWithWav(const char *name) {
+  size_t len = strlen(name);
+  return (len > 4) && (strcasecmp(name + len - 4, ".wav") == 0) && (strncasecmp(name, "OUT_", 4) != 0);
+}
+
+static void addFilesFromPath(std::vector<std::string> &fnames, const char *path) {
+  struct stat st;
+  if ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) { printf("chapro_sweep: *** ERROR ***: could not open %s\n", path); return; }
+    std::vector<std::string> names;
+    for (struct dirent *ent = readdir(dir); ent != NULL; ent = readdir(dir)) if (endsWithWav(ent->d_name)) names.push_back(ent->d_name);
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (auto &name : names) fnames.push_back(std::string(path) + "/" + name);
+  } else {
+    fnames.push_back(path);
+  }
+}
+
+//"0.001,0.002,0.004" -> the grid values for one parameter
+static void parseValues(BTNRH_SweepGrid &grid, int param, const char *str) {
+  float vals[BTNRH_SWEEP_MAX_VALS];
+  int n = 0;
+  for (const char *s = str; (s != NULL) && (*s != '\0') && (n < BTNRH_SWEEP_MAX_VALS); s = strchr(s, ',')) {
+    if (*s == ',') s++;
+    vals[n++] = (float)atof(s);
+  }
+  grid.setValues(param, vals, n);
+}
+
+//run one file through a fresh CHAPRO context prepared with one setting of the grid
+static void runJob(BTNRH_SweepGrid &grid, const std::string &fname, float max_sec, SweepJob &job) {
+  WavReader in;
+  if (!in.open(fname.c_str())) {
+    printf("chapro_sweep: *** ERROR ***: %s could not be read as a 16-bit PCM or 32-bit float WAV file.\n", fname.c_str());
+    return;
+  }
+
+  //prepare() and applySetting() use test_gha.h's globals, so one at a time
+  void *cp[NPTR] = {0};
+  int cs;
+  {
+    std::lock_guard<std::mutex> lock(WorkerPool::getPrepareMutex());
+    float setting[BTNRH_SweepGrid::N_PARAMS];
+    grid.getSetting(job.Isetting, setting);
+    grid.applySetting(setting);
+    I_O io = {};
+    prepare(&io, cp);  //in test_gha.h
+    cs = chunk;
+  }
+
+  uint64_t max_frames = in.getNumFrames();
+  if (max_sec > 0.0f) max_frames = min(max_frames, (uint64_t)(max_sec * in.getSampleRate_Hz()));
+  static thread_local float x[SWEEP_BLOCK];
+  int n;
+  while ((job.n_samples < max_frames) && ((n = in.readFrames(x, (int)min((uint64_t)(SWEEP_BLOCK - (SWEEP_BLOCK % cs)), max_frames - job.n_samples))) > 0)) {
+    int n_chunks = (n + cs - 1) / cs;
+    for (int i = n; i < n_chunks * cs; i++) x[i] = 0.0f;
+    for (int i = 0; i < n; i++) job.sum_sq_in += (double)(x[i] * x[i]);
+
+    double start_dsp = WorkerPool::threadCpuSeconds();
+    for (int Ichunk = 0; Ichunk < n_chunks; Ichunk++) process_chunk_ctx(cp, 1, x + Ichunk*cs, x + Ichunk*cs, cs);
+    job.dsp_cpu_sec += WorkerPool::threadCpuSeconds() - start_dsp;
+
+    for (int i = 0; i < n; i++) job.sum_sq_out += (double)(x[i] * x[i]);
+    job.n_samples += n;
+  }
+  BTNRH_SweepGrid::feedbackMetrics(cp, &job.misalign_dB, &job.asg_dB);
+  for (int idx = 0; idx < NPTR; idx++) { if (cp[idx]) free(cp[idx]); cp[idx] = NULL; }  //calloc'd by cha_allocate
+  job.is_ok = (job.n_samples > 0);
+}
+
+int main(int argc, char **argv) {
+  static const char *param_flags[BTNRH_SweepGrid::N_PARAMS] = { "-mu", "-rho", "-eps", "-afl", "-cr_scale", "-gain_dB" };
+  int n_threads = 0;
+  const char *csv_fname = "SWEEP.CSV";
+  float max_sec = 0.0f;
+
+  //the settings from GHA_Constants.h, just like the sketch at boot (and the default grid is built from them)
+  I_O io = {};
+  configure(&io);  //in test_gha.h
+  BTNRH_SweepGrid grid;
+
+  std::vector<std::string> fnames;
+  for (int i = 1; i < argc; i++) {
+    bool is_param = false;
+    for (int Iparam = 0; Iparam < BTNRH_SweepGrid::N_PARAMS; Iparam++) {
+      if ((strcmp(argv[i], param_flags[Iparam]) == 0) && (i + 1 < argc)) { parseValues(grid, Iparam, argv[++i]); is_param = true; break; }
+    }
+    if (is_param) continue;
+    if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc)) { n_threads = atoi(argv[++i]); continue; }
+    if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) { csv_fname = argv[++i]; continue; }
+    if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) { max_sec = (float)atof(argv[++i]); continue; }
+    if ((strcmp(argv[i], "-fbg") == 0) && (i + 1 < argc)) { grid.setSimulatedFeedbackGain((float)atof(argv[++i])); continue; }
+    addFilesFromPath(fnames, argv[i]);
+  }
+  if (fnames.empty()) {
+    printf("Usage: chapro_sweep [-j n_threads] [-o sweep.csv] [-t max_sec_per_file] [-fbg sim_feedback_gain]\n"
+           "                    [-mu v,v,...] [-rho v,...] [-eps v,...] [-afl v,...] [-cr_scale v,...] [-gain_dB v,...]\n"
+           "                    input.wav|input_dir ...\n");
+    return 1;
+  }
+  FILE *csv = fopen(csv_fname, "w");
+  if (csv == NULL) { printf("chapro_sweep: *** ERROR ***: could not open %s\n", csv_fname); return 1; }
+
+  int n_settings = grid.getNumSettings(), n_files = (int)fnames.size();
+  std::vector<SweepJob> jobs(n_settings * n_files);
+  for (int Ijob = 0; Ijob < (int)jobs.size(); Ijob++) jobs[Ijob] = { Ijob / n_files, Ijob % n_files, false, 0.0, 0.0, 0.0, 0, 0.0f, 0.0f };
+
+  WorkerPool pool(n_threads);
+  printf("chapro_sweep: %d settings x %d files on %d threads -> %s\n", n_settings, n_files, pool.getNumThreads(), csv_fname);
+  unsigned long start_usec = micros();
+  std::atomic<int> n_done(0);
+  pool.run((int)jobs.size(), [&](int Ijob, int) {
+    runJob(grid, fnames[jobs[Ijob].Ifile], max_sec, jobs[Ijob]);
+    int n = ++n_done;
+    if ((n % n_files) == 0) printf("chapro_sweep: %d of %d runs done (%.1f sec)\n", n, (int)jobs.size(), 1.0e-6 * (double)(micros() - start_usec));
+  });
+  double wall_sec = 1.0e-6 * (double)(micros() - start_usec);
+
+  //in order of setting, then file, whatever order the threads finished in
+  fprintf(csv, "setting,file,mu,rho,eps,afl,cr_scale,gain_dB,in_dBFS,out_dBFS,misalign_dB,asg_dB,x_real_time\n");
+  int n_lines = 0;
+  double audio_sec = 0.0;
+  for (auto &job : jobs) {
+    if (!job.is_ok) continue;
+    float setting[BTNRH_SweepGrid::N_PARAMS];
+    grid.getSetting(job.Isetting, setting);
+    double n_samp = (double)job.n_samples, job_sec = n_samp / srate;
+    fprintf(csv, "%d,%s,%.9f,%.9f,%.9f,%d,%.3f,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f\n", job.Isetting, fnames[job.Ifile].c_str(),
+            setting[BTNRH_SweepGrid::MU], setting[BTNRH_SweepGrid::RHO], setting[BTNRH_SweepGrid::EPS], (int)(setting[BTNRH_SweepGrid::AFL] + 0.5f),
+            setting[BTNRH_SweepGrid::CR_SCALE], setting[BTNRH_SweepGrid::GAIN_dB],
+            10.0 * log10(max(job.sum_sq_in / n_samp, 1.0e-20)), 10.0 * log10(max(job.sum_sq_out / n_samp, 1.0e-20)),
+            job.misalign_dB, job.asg_dB, job_sec / max(job.dsp_cpu_sec, 1.0e-9));
+    n_lines++;
+    audio_sec += job_sec;
+  }
+  fclose(csv);
+  printf("chapro_sweep: done.  Wrote %d lines to %s.  %.1f sec of audio in %.2f sec (x real time = %.1f)\n",
+         n_lines, csv_fname, audio_sec, wall_sec, audio_sec / max(wall_sec, 1.0e-9));
+  return (n_lines == (int)jobs.size()) ? 0 : 2;
+}
@@ -0,0 +1,66 @@
+/*
+   test_feedback_metrics
+
+   Created: OpenAudio, 2022
+   Purpose: Check BTNRH_SweepGrid::feedbackMetrics() (the misalignment and added stable gain columns of
+       the sweeps) on made-up feedback paths, where the answers are known:
+         * an estimate of a*(true path) has misalignment 20*log10(1-a) and an added stable gain of
+           -20*log10(1-a), at every frequency
+         * an exact estimate behind a hardware delay (hdel) is still exact
+
+   Usage: test_feedback_metrics   (returns 0 if every check passes)
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>           //host/Arduino.h
+#include "BTNRH_SweepGrid.h"
+
+#define TEST_FBL 100
+#define TEST_AFL 42
+
+static int n_fail = 0;
+static void check(const char *name, float val, float expected, float tol) {
+  bool is_ok = fabsf(val - expected) <= tol;
+  printf("test_feedback_metrics: %-34s = %8.2f dB (expected %8.2f) %s\n", name, val, expected, is_ok ? "ok" : "*** FAIL ***");
+  if (!is_ok) n_fail++;
+}
+
+int main(void) {
+  static int sizes[NPTR] = {0}, ivar[64] = {0};
+  static float sfbp[TEST_FBL], efbp[64];
+  void *cp[NPTR] = {0};
+  cp[_size] = sizes;  cp[_ivar] = ivar;  cp[_sfbp] = sfbp;  cp[_efbp] = efbp;
+  sizes[_sfbp] = sizeof(sfbp);  sizes[_efbp] = sizeof(efbp);
+  ivar[_afl] = TEST_AFL;
+
+  //a decaying, ringing path that fits within afl
+  for (int j = 0; j < TEST_FBL; j++) sfbp[j] = ((j >= 5) && (j < 30)) ? 0.1f * expf(-(j - 5) / 5.0f) * cosf((float)j) : 0.0f;
+
+  float misalign_dB, asg_dB;
+  char name[64];
+  ivar[_hdel] = 0;
+  const float fracs[3] = {0.5f, 0.9f, 0.99f};
+  for (float frac : fracs) {
+    for (int j = 0; j < 64; j++) efbp[j] = (j < TEST_AFL) ? frac * sfbp[j] : 0.0f;
+    BTNRH_SweepGrid::feedbackMetrics(cp, &misalign_dB, &asg_dB);
+    sprintf(name, "estimate = %.2f x true: misalign", frac);  check(name, misalign_dB, 20.0f * log10f(1.0f - frac), 0.05f);
+    sprintf(name, "estimate = %.2f x true: ASG", frac);       check(name, asg_dB, -20.0f * log10f(1.0f - frac), 0.05f);
+  }
+
+  //no estimate: nothing gained
+  memset(efbp, 0, sizeof(efbp));
+  BTNRH_SweepGrid::feedbackMetrics(cp, &misalign_dB, &asg_dB);
+  check("no estimate: misalign", misalign_dB, 0.0f, 0.01f);
+  check("no estimate: ASG", asg_dB, 0.0f, 0.01f);
+
+  //exact, but the estimate starts after a hardware delay of 5 samples
+  ivar[_hdel] = 5;
+  for (int j = 0; j < 64; j++) efbp[j] = (j < TEST_AFL) ? sfbp[j + 5] : 0.0f;
+  BTNRH_SweepGrid::feedbackMetrics(cp, &misalign_dB, &asg_dB);
+  check("hdel = 5, exact: misalign", misalign_dB, -200.0f, 0.01f);  //(the floor, for a perfect estimate)
+  check("hdel = 5, exact: ASG (capped at 100)", min(asg_dB, 100.0f), 100.0f, 0.01f);
+
+  printf("test_feedback_metrics: %s\n", (n_fail == 0) ? "all passed" : "*** FAILED ***");
+  return (n_fail == 0) ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+/*
+   test_latency_probe
+
+   Created: OpenAudio, 2022
+   Purpose: Checks AudioLatencyProbe_F32 on a PC (no CHAPRO needed):
+         * findLag() on the probe's own MLS, delayed and added to noise, for delays from 0 to
+           LATENCY_PROBE_MAX_LAG, with either polarity.  Each lag must be found to within 0.02
+           samples at 0 dB SNR (per sample) and 0.1 samples at -10 dB, with its peak at least 15 dB
+           above the rest.  Half-sample delays (at +10 dB) must come out within 0.1 samples: the
+           parabola through the correlation peak is all that finds them.
+         * findLag() on noise alone must not pass the 15 dB test.
+         * the whole probe, block by block, in a simulated hearing aid: an algorithm that delays the
+           audio (0 to 97 samples) and an acoustic loop back to the mic (40 to 350 samples) with
+           some feedback gain and mic noise.  analyze() must find both latencies.
+       Exits non-zero on failure.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>                //host/Arduino.h
+#include "AudioLatencyProbe_F32.h"
+
+#define FS_HZ        24000.0f
+#define BLOCK_LEN    32
+#define MIN_CONF_dB  15.0f
+#define MAX_ERR_SAMPLES  0.02f
+
+//opens up the probe's correlation for testing
+class TestProbe : public AudioLatencyProbe_F32 {
+  public:
+    TestProbe(const AudioSettings_F32 &settings) : AudioLatencyProbe_F32(settings) {}
+    using AudioLatencyProbe_F32::findLag;
+    int8_t getMLS(int i) { return mls[i]; }
+};
+
+static uint32_t seed = 12345;
+static float noise(void) {  //uniform, rms = 1
+  seed = seed * 1664525UL + 1013904223UL;
+  return 3.4641016f * (((float)(seed >> 8) / 16777216.0f) - 0.5f);
+}
+
+//the MLS at delay (whole or half samples) with the given gain, plus unit-rms noise
+static void makeRecording(TestProbe &probe, float32_t *rec, int n_rec, float delay, float gain) {
+  int d = (int)delay;
+  bool is_half = (delay - (float)d) > 0.25f;
+  for (int i = 0; i < n_rec; i++) {
+    float s = 0.0f;
+    int k = i - d;
+    if ((k >= 0) && (k < LATENCY_PROBE_MLS_LEN)) s += probe.getMLS(k);
+    if (is_half) {  //halfway between this sample and the one before it
+      float s_prev = ((k - 1 >= 0) && (k - 1 < LATENCY_PROBE_MLS_LEN)) ? (float)probe.getMLS(k - 1) : 0.0f;
+      s = 0.5f * (s + s_prev);
+    }
+    rec[i] = gain * s + noise();
+  }
+}
+
+typedef struct { const char *name; float gain; float max_err; bool is_half; } LagCase;
+static const LagCase lag_cases[] = {
+  { "0 dB SNR",                   1.0f,   0.02f, false },
+  { "-10 dB SNR",                 0.316f, 0.1f,  false },
+  { "+10 dB SNR, half samples",   3.16f,  0.1f,  true },
+};
+
+static int testFindLag(TestProbe &probe) {
+  static float32_t rec[LATENCY_PROBE_CAPTURE_LEN];
+  const float delays[] = { 0.0f, 1.0f, 37.0f, 97.0f, 350.0f, 511.0f, 1000.0f, (float)LATENCY_PROBE_MAX_LAG - 1.0f };
+  const int n_delays = sizeof(delays) / sizeof(delays[0]);
+  int n_fail = 0;
+  for (const LagCase &lc : lag_cases) {
+    float max_err = 0.0f, min_conf_dB = 1.0e6f;
+    int n_case_fail = 0;
+    for (int Idelay = 0; Idelay < n_delays; Idelay++) {
+      if (lc.is_half && ((Idelay == 0) || (Idelay == n_delays - 1))) continue;  //no neighbours to interpolate with at the ends
+      float delay = delays[Idelay] + (lc.is_half ? 0.5f : 0.0f);
+      for (int polarity = 1; polarity >= -1; polarity -= 2) {
+        makeRecording(probe, rec, LATENCY_PROBE_CAPTURE_LEN, delay, polarity * lc.gain);
+        float conf_dB;
+        float err = fabsf(probe.findLag(rec, LATENCY_PROBE_CAPTURE_LEN, &conf_dB) - delay);
+        max_err = max(max_err, err);  min_conf_dB = min(min_conf_dB, conf_dB);
+        if ((err > lc.max_err) || (conf_dB < MIN_CONF_dB)) {
+          printf("test_latency_probe: findLag: %s: *** FAIL ***: delay %.1f (polarity %d): error %.3f, peak %.1f dB\n", lc.name, delay, polarity, err, conf_dB);
+          n_case_fail++;
+        }
+      }
+    }
+    printf("test_latency_probe: findLag: %s: %d delays x 2 polarities: max error = %.4f samples (limit %.2f), lowest peak = %.1f dB: %s\n",
+           lc.name, lc.is_half ? n_delays - 2 : n_delays, max_err, lc.max_err, min_conf_dB, n_case_fail ? "FAIL" : "ok");
+    n_fail += n_case_fail;
+  }
+
+  //noise alone
+  float max_noise_conf_dB = 0.0f;
+  for (int Itry = 0; Itry < 20; Itry++) {
+    makeRecording(probe, rec, LATENCY_PROBE_CAPTURE_LEN, 0.0f, 0.0f);
+    float conf_dB;
+    probe.findLag(rec, LATENCY_PROBE_CAPTURE_LEN, &conf_dB);
+    max_noise_conf_dB = max(max_noise_conf_dB, conf_dB);
+  }
+  bool is_ok = (max_noise_conf_dB < MIN_CONF_dB);
+  printf("test_latency_probe: findLag: noise alone: highest peak = %.1f dB: %s\n", max_noise_conf_dB, is_ok ? "ok" : "*** FAIL ***");
+  return n_fail + (is_ok ? 0 : 1);
+}
+
+//a delay line, for the simulated algorithm and acoustic loop
+class SimDelay {
+  public:
+    SimDelay(int _delay) : delay(_delay) { for (int i = 0; i < LEN; i++) buf[i] = 0.0f; }
+    void process(const float *x, float *y, int n) {
+      for (int i = 0; i < n; i++) {
+        buf[ind] = x[i];
+        y[i] = buf[(ind - delay + LEN) % LEN];
+        ind = (ind + 1) % LEN;
+      }
+    }
+  protected:
+    static const int LEN = 512;
+    float buf[LEN];
+    int delay, ind = 0;
+};
+
+//the whole probe: mic -> probe -> algorithm (delay) -> tap -> loop (delay, feedback gain) -> mic
+static int testLoop(int alg_delay, int loop_delay, float *max_err) {
+  AudioSettings_F32 audio_settings(FS_HZ, BLOCK_LEN);
+  AudioLatencyProbe_F32 *probe = new AudioLatencyProbe_F32(audio_settings);  //(too big for the stack)
+  AudioLatencyProbeTap_F32 *tap = new AudioLatencyProbeTap_F32(audio_settings, *probe);
+  SimDelay alg(alg_delay), loop(loop_delay - BLOCK_LEN);  //the loop's output reaches the mic one block later
+  float loop_out[BLOCK_LEN];
+  for (int i = 0; i < BLOCK_LEN; i++) loop_out[i] = 0.0f;
+
+  probe->start(0.05f);
+  for (int Iblock = 0; (Iblock < 200) && !probe->isDone(); Iblock++) {
+    AudioStream_F32::host_releaseAll();
+    audio_block_f32_t *mic = AudioStream_F32::allocate_f32(), *out = AudioStream_F32::allocate_f32();
+    mic->length = out->length = BLOCK_LEN;
+    for (int i = 0; i < BLOCK_LEN; i++) mic->data[i] = 0.3f * loop_out[i] + 0.01f * noise();  //feedback, plus the mic's noise
+
+    AudioStream_F32::host_in[0] = mic;
+    probe->update();                                               //adds the marker
+    alg.process(AudioStream_F32::host_out[0]->data, out->data, BLOCK_LEN);
+    AudioStream_F32::host_in[0] = out;
+    tap->update();                                                 //records the output
+    loop.process(out->data, loop_out, BLOCK_LEN);                  //back to the mic, for the next block
+  }
+  bool is_ok = probe->isDone() && probe->analyze();
+  float alg_err = fabsf(probe->getAlgorithmLatency_samples() - (float)alg_delay);
+  float loop_err = fabsf(probe->getLoopLatency_samples() - (float)loop_delay);
+  *max_err = max(*max_err, max(alg_err, loop_err));
+  is_ok = is_ok && (alg_err <= MAX_ERR_SAMPLES) && (loop_err <= MAX_ERR_SAMPLES);
+  if (!is_ok) {
+    printf("test_latency_probe: loop: *** FAIL ***: algorithm %d, loop %d: found %.3f (peak %.1f dB), %.3f (peak %.1f dB)\n",
+           alg_delay, loop_delay, probe->getAlgorithmLatency_samples(), probe->getAlgorithmConfidence_dB(),
+           probe->getLoopLatency_samples(), probe->getLoopConfidence_dB());
+  }
+  delete tap;  delete probe;
+  return is_ok ? 0 : 1;
+}
+
+int main(void) {
+  AudioSettings_F32 audio_settings(FS_HZ, BLOCK_LEN);
+  static TestProbe probe(audio_settings);
+  int n_fail = testFindLag(probe);
+
+  const int alg_delays[] = { 0, 8, 40, 97 }, loop_delays[] = { 40, 100, 233, 350 };
+  int n_loop_fail = 0;
+  float max_err = 0.0f;
+  for (int alg_delay : alg_delays) for (int loop_delay : loop_delays) n_loop_fail += testLoop(alg_delay, loop_delay, &max_err);
+  printf("test_latency_probe: loop: algorithm 0-97 samples x loop 40-350 samples: max error = %.4f samples (limit %.2f): %s\n",
+         max_err, MAX_ERR_SAMPLES, n_loop_fail ? "FAIL" : "ok");
+
+  return (n_fail + n_loop_fail) ? 1 : 0;
+}
@@ -7,6 +7,7 @@
 
 
 #include <chapro.h>
+#include "BTNRH_StateArena.h"
 #define MAX_MSG 256
 
 typedef struct
@@ -53,10 +54,14 @@ CHA_AFC afc_global = {     // Here are the settings for the adaptive feedback ca
 
 /***********************************************************/
 
+// Re-entrant version of process_chunk.  All of the parameters and states of the CHAPRO
+// stages are reached through cp (CHA_IVAR, CHA_DVAR, and the arrays in cp[]), so the
+// only other state that is needed is whether this cp has been prepared.  Nothing global
+// is read or written, so each instance (left, right) simply passes its own context.
 static void
-process_chunk(CHA_PTR cp, float *x, float *y, int cs)
+process_chunk_ctx(CHA_PTR cp, int is_prepared, float *x, float *y, int cs)
 {
-    if (prepared)
+    if (is_prepared)
     {
         // next line switches to compiled data
         //cp = (CHA_PTR) cha_data;
@@ -73,6 +78,31 @@ process_chunk(CHA_PTR cp, float *x, float *y, int cs)
     }
 }
 
+static void __attribute__((unused))  // (not every program that includes this file calls all of these)
+process_chunk(CHA_PTR cp, float *x, float *y, int cs)
+{
+    process_chunk_ctx(cp, prepared, x, y, cs);
+}
+
+// Same as process_chunk_ctx, but with a filterbank whose channel count, order, and chunk
+// size are fixed at compile time (see BTNRH_FixedFilterbank.h).  cs must equal FB's chunk size.
+template <class FB>
+static void
+process_chunk_fixed(CHA_PTR cp, int is_prepared, FB &fb, float *x, float *y, int cs)
+{
+    if (is_prepared)
+    {
+        float *z = CHA_CB;
+        cha_afc_input(cp, x, x, cs); 
+        cha_agc_input(cp, x, x, cs);
+        fb.analyze(x, z);
+        cha_agc_channel(cp, z, z, cs);
+        fb.synthesize(z, y);
+        cha_agc_output(cp, y, y, cs);
+        cha_afc_output(cp, y, cs); 
+    }
+}
+
 // prepare input/output
 
 static int
@@ -95,15 +125,18 @@ prepare_io(I_O *io)
     return (0);
 }
 
+// zeros, poles, gains, & delays of the filterbank (kept for BTNRH_FixedFilterbank)
+static float iirfb_z[64], iirfb_p[64], iirfb_g[8];
+static int iirfb_d[8];
+
 // prepare IIR filterbank
 static void
 prepare_filterbank(CHA_PTR cp)
 {
     double td, sr, *cf;
     int cs, nc, nz;
-    // zeros, poles, gains, & delays
-    float z[64], p[64], g[8];
-    int d[8];
+    float *z = iirfb_z, *p = iirfb_p, *g = iirfb_g;
+    int *d = iirfb_d;
 
     sr = srate;
     cs = chunk;
@@ -136,19 +169,56 @@ prepare_feedback(CHA_PTR cp)
     cha_afc_prepare(cp, &afc_global);
 }
 
+// Optional: if prepare_arena is set, the arrays that each stage calloc's (via cha_allocate)
+// are moved into the arena right after that stage, so they don't stay on the heap.  Either
+// way, the bytes added by each stage are kept in prepare_stage_bytes[] for reporting.
+
+enum { PREP_FILTERBANK = 0, PREP_COMPRESSOR, PREP_FEEDBACK, N_PREP_STAGES };
+static const char *prepare_stage_names[N_PREP_STAGES] __attribute__((unused)) = {"filterbank", "compressor", "feedback"};
+static BTNRH_StateArena *prepare_arena = NULL;
+static int prepare_stage_bytes[N_PREP_STAGES] = {0};
+static int prepare_n_on_heap = 0;  // arrays that did not fit in the arena
+
+static int
+cp_sizes(CHA_PTR cp, int *sizes)
+{
+    int total = 0;
+    for (int idx = 0; idx < NPTR; idx++) {
+        sizes[idx] = (cp[_size] == NULL) ? 0 : ((idx == _size) ? NPTR * (int) sizeof(int) : ((int *)cp[_size])[idx]);
+        if (cp[idx] != NULL) total += (prepare_arena ? prepare_arena->getPaddedSize(sizes[idx]) : sizes[idx]);
+    }
+    return (total);
+}
+
+static int
+prepare_stage_done(CHA_PTR cp, int stage, int prev_total)
+{
+    int sizes[NPTR];
+    int total = cp_sizes(cp, sizes);
+    prepare_stage_bytes[stage] = total - prev_total;
+    if (prepare_arena)
+        prepare_n_on_heap += prepare_arena->adopt(cp, sizes, NPTR);
+    return (total);
+}
+
 // prepare signal processing
 
-static void
+static void __attribute__((unused))
 prepare(I_O *io, CHA_PTR cp)
 {
+    int total = 0;
     prepare_io(io);
     srate = io->rate;
     chunk = io->cs;
+    prepare_n_on_heap = 0;
     prepare_filterbank(cp);
+    total = prepare_stage_done(cp, PREP_FILTERBANK, total);
     prepare_compressor(cp);
+    total = prepare_stage_done(cp, PREP_COMPRESSOR, total);
     if (afc_global.sqm)
         afc_global.nqm = io->nsmp * io->nrep;      
     prepare_feedback(cp);
+    total = prepare_stage_done(cp, PREP_FEEDBACK, total);
     prepared++;
     // generate C code from prepared data
     //cha_data_gen(cp, DATA_HDR);
@@ -252,7 +322,7 @@ configure_feedback()
       afc_global.fbg = 0;  //zero synthetic feedback
 }
 
-static void
+static void __attribute__((unused))
 configure(I_O *io)
 {
 //    static char *ifn = "test/carrots.wav";
@@ -0,0 +1,208 @@
+/*
+   AFC_FeedbackSim_F32
+
+   Created: OpenAudio, 2022
+   Purpose: Simulated feedback paths for measuring how well (and how fast) the adaptive feedback
+       canceler (AudioEffectFeedbackCancel_Local_F32 or AudioEffectAFC_BTNRH_F32) converges, without
+       needing a real earpiece.  The AFC's cha_afc() and addNewAudio() are called directly, block by
+       block, so the simulation runs much faster than real time (from loop(), not from the audio ISR).
+
+       The simulated hearing aid is a closed loop: the microphone gets a colored (speech-like) noise
+       plus the output audio passed through the feedback path.  The AFC removes its estimate of the
+       feedback, and the result is amplified to make the output audio.
+
+       For each scenario (feedback path and mu/rho/eps), the benchmark reports the misalignment of the
+       feedback model in dB versus time (more negative is better), the CPU time of the AFC in nsec
+       per sample, and how many times faster than real time the AFC runs.  The misalignment is tracked
+       sample by sample by the AFC itself (see setTrueFeedbackPath()).
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _AFC_FeedbackSim_F32_h
+#define _AFC_FeedbackSim_F32_h
+
+#include <arm_math.h> //ARM DSP extensions.  https://www.keil.com/pack/doc/CMSIS/DSP/html/index.html
+#include <Arduino.h>
+#include "AudioEffectFeedbackCancel_Local_F32.h"
+#include "DelayHistory_F32.h"
+
+#define AFC_SIM_MAX_PATH_LEN  (MAX_AFC_HDEL + MAX_AFC_FILT_LEN)
+
+//the built-in feedback paths.  Each is a delay followed by a decaying resonance.
+enum AFC_SIM_PATH { AFC_SIM_PATH_BTE = 0, AFC_SIM_PATH_OPEN_FIT, AFC_SIM_PATH_PHONE, AFC_SIM_N_PATHS };
+
+// ///////////////////////////////////////////////// AFC_FeedbackPathSim_F32
+
+class AFC_FeedbackPathSim_F32 {
+  public:
+    AFC_FeedbackPathSim_F32(void) { reset(); }
+
+    //use a measured impulse response.  h[k] is the response k samples after the output.  It should
+    //be zero for k < the AFC's hardware delay (and so, for at least one audio block).
+    int setPath(const float32_t *h, int n) {
+      path_len = min(max(n, 0), AFC_SIM_MAX_PATH_LEN);
+      for (int k = 0; k < AFC_SIM_MAX_PATH_LEN; k++) path[k] = (k < path_len) ? h[k] : 0.0f;
+      reset();
+      return path_len;
+    }
+
+    //use one of the built-in paths, starting after delay_samps samples (the hardware delay)
+    int setBuiltInPath(int which, float32_t fs_Hz, int delay_samps) {
+      const char *names[] = {"BTE", "open fit", "phone at ear"};
+      //                               BTE    open   phone
+      const float32_t gain[] =       {0.03f, 0.10f, 0.15f};  //peak of the envelope
+      const float32_t decay_msec[] = {0.4f,  1.5f,  2.5f};   //time constant of the decay
+      const float32_t freq_Hz[] =    {3500., 2500., 1200.};  //resonant frequency
+      const float32_t len_msec[] =   {2.0f,  6.0f,  10.0f};  //length of the response (after the delay)
+      which = min(max(which, 0), (int)AFC_SIM_N_PATHS-1);
+      path_name = names[which];
+      path_len = min(delay_samps + (int)(len_msec[which] * 0.001f * fs_Hz), AFC_SIM_MAX_PATH_LEN);
+      for (int k = 0; k < AFC_SIM_MAX_PATH_LEN; k++) {
+        float32_t t = (float32_t)(k - delay_samps) / fs_Hz;
+        if ((k < delay_samps) || (k >= path_len)) {
+          path[k] = 0.0f;
+        } else {
+          path[k] = gain[which] * expf(-t / (decay_msec[which] * 0.001f)) * sinf(2.0f * (float32_t)PI * freq_Hz[which] * t + 0.3f);
+        }
+      }
+      reset();
+      return path_len;
+    }
+
+    void reset(void) { history.clear(); }
+    const float32_t* getPath(void) { return path; }
+    int getPathLength(void) { return path_len; }
+    const char* getPathName(void) { return path_name; }
+
+    //Compute the feedback for the next block, from the output audio given so far.  fbs_total is what
+    //the microphone gets.  fbs_window is the part from path[win_start] to path[win_start + win_len - 1],
+    //which is what the AFC's model (with hdel = win_start, afl = win_len) is trying to match.
+    void computeFeedback(float32_t *fbs_total, float32_t *fbs_window, int cs, int win_start, int win_len) {
+      const float32_t *u = history.getNewest();  //u[m] is the output audio from m+1 samples before this block
+      int win_end = min(win_start + win_len, path_len);
+      for (int i = 0; i < cs; i++) {
+        //output audio from k samples before sample i is u[k - i - 1], so k must be > i
+        int k0 = i + 1;
+        float32_t before = 0.0f, window = 0.0f, after = 0.0f;
+        if (win_start > k0) arm_dot_prod_f32(path + k0, u + (k0 - i - 1), win_start - k0, &before);
+        int ks = max(win_start, k0);
+        if (win_end > ks) arm_dot_prod_f32(path + ks, u + (ks - i - 1), win_end - ks, &window);
+        ks = max(win_end, k0);
+        if (path_len > ks) arm_dot_prod_f32(path + ks, u + (ks - i - 1), path_len - ks, &after);
+        fbs_window[i] = window;
+        fbs_total[i] = before + window + after;
+      }
+    }
+
+    //add the newest block of output audio
+    void addOutputAudio(const float32_t *u, int cs) { history.push(u, cs); }
+
+  protected:
+    float32_t path[AFC_SIM_MAX_PATH_LEN];
+    int path_len = 0;
+    const char *path_name = "measured";
+    DelayHistory_F32<AFC_SIM_MAX_PATH_LEN + AUDIO_BLOCK_SAMPLES> history;
+};
+
+// ///////////////////////////////////////////////// Benchmark
+
+typedef struct {
+  float32_t mu, rho, eps;
+} AFC_SimParams;
+
+//Run the AFC on each built-in feedback path for each set of parameters.  The given AFC object should
+//not be connected to the audio system (its settings and states are overwritten).  Note that the
+//simulation itself (the feedback path and the source) is not included in the timing.  Needs the AFC's
+//misalignment metric, which is only compiled in when USE_AFC_SIM_METRIC is true.
+#if (USE_AFC_SIM_METRIC)
+#define AFC_SIM_BLOCK  AUDIO_BLOCK_SAMPLES
+#define AFC_SIM_MAX_REPORTS  20
+static inline void afc_convergenceBenchmark(AudioEffectFeedbackCancel_Local_F32 *afc, Print *p,
+      float32_t fs_Hz, int cs, const AFC_SimParams *all_params, int n_params,
+      float32_t dur_sec = 4.0f, float32_t report_sec = 0.5f, float32_t forward_gain_dB = 10.0f)
+{
+  static AFC_FeedbackPathSim_F32 sim;
+  float32_t x[AFC_SIM_BLOCK], y[AFC_SIM_BLOCK], u[AFC_SIM_BLOCK];
+  float32_t fbs[AFC_SIM_BLOCK], fbs_win[AFC_SIM_BLOCK], merr[AFC_SIM_BLOCK];
+  float32_t report_dB[AFC_SIM_MAX_REPORTS];
+  cs = min(max(cs, 1), AFC_SIM_BLOCK);
+  int n_blocks = (int)(dur_sec * fs_Hz / (float32_t)cs);
+  int blocks_per_report = max((int)(report_sec * fs_Hz / (float32_t)cs), 1);
+  int n_reports = min(n_blocks / blocks_per_report, AFC_SIM_MAX_REPORTS);
+  n_blocks = n_reports * blocks_per_report;
+  float32_t fwd_gain = powf(10.0f, forward_gain_dB / 20.0f);
+  int afl = afc->getAfl();
+  if (afc->getHdel() < 0) afc->setHdel(cs);  //"one block" is not known until a block is processed, so be explicit
+  int hdel = afc->getEffectiveHdel();
+
+  p->print("AFC Convergence Benchmark: afl = "); p->print(afl);
+  p->print(", hdel = "); p->print(hdel);
+  p->print(", forward gain = "); p->print(forward_gain_dB, 1); p->println(" dB");
+  p->print("    : path, mu, rho, eps, misalignment (dB) every "); p->print(report_sec, 2);
+  p->println(" sec..., nsec/sample, x real time, metric drift (dB)");
+
+  for (int Ipath = 0; Ipath < AFC_SIM_N_PATHS; Ipath++) {
+    for (int Iparam = 0; Iparam < n_params; Iparam++) {
+      //reset everything
+      sim.setBuiltInPath(Ipath, fs_Hz, hdel);
+      afc->setParams(all_params[Iparam].mu, all_params[Iparam].rho, all_params[Iparam].eps, afl);
+      afc->initializeStates();
+      afc->initializeRingBuffer();
+      afc->setTrueFeedbackPath(sim.getPath() + hdel, afl);
+      uint32_t seed = 22222;
+      float32_t s1 = 0.0f, s2 = 0.0f;
+      unsigned long dT_usec = 0;
+      double merr_sum = 0.0;
+      for (int i = 0; i < cs; i++) u[i] = 0.0f;
+
+      for (int Iblock = 0; Iblock < n_blocks; Iblock++) {
+        //microphone: colored noise (a resonance at about fs/10) plus the feedback
+        sim.computeFeedback(fbs, fbs_win, cs, hdel, afl);
+        for (int i = 0; i < cs; i++) {
+          seed = seed * 1664525UL + 1013904223UL;
+          float32_t w = ((float32_t)(seed >> 8) / 16777216.0f) - 0.5f;
+          float32_t s = w + 1.6f * s1 - 0.9f * s2;  s2 = s1; s1 = s;
+          x[i] = 0.05f * s + fbs[i];
+        }
+
+        //the AFC
+        afc->setSimulatedFeedback(fbs_win, merr);
+        unsigned long t0 = micros();
+        afc->cha_afc(x, y, cs);
+        for (int i = 0; i < cs; i++) u[i] = min(max(fwd_gain * y[i], -1.0f), 1.0f);  //the rest of the hearing aid
+        afc->addNewAudio(u, cs);
+        dT_usec += micros() - t0;
+        sim.addOutputAudio(u, cs);
+
+        //average the misalignment over each reporting period
+        for (int i = 0; i < cs; i++) merr_sum += merr[i];
+        if (((Iblock + 1) % blocks_per_report) == 0) {
+          report_dB[Iblock / blocks_per_report] = 10.0f * log10f((float)max(merr_sum / (double)(blocks_per_report * cs), 1.0e-20));
+          merr_sum = 0.0;
+        }
+      }
+      float32_t drift = afc->resyncMisalignment();  //how far the incremental metric wandered from the exact value
+
+      p->print("    : "); p->print(sim.getPathName());
+      p->print(", "); p->print(all_params[Iparam].mu, 6);
+      p->print(", "); p->print(all_params[Iparam].rho, 4);
+      p->print(", "); p->print(all_params[Iparam].eps, 6);
+      for (int I = 0; I < n_reports; I++) { p->print(", "); p->print(report_dB[I], 1); }
+      float32_t n_samples = (float32_t)n_blocks * (float32_t)cs;
+      p->print(", "); p->print(1000.0f * (float32_t)dT_usec / n_samples, 0);
+      p->print(", "); p->print((n_samples / fs_Hz) / max(1.0e-6f * (float32_t)dT_usec, 1.0e-6f), 1);
+      p->print(", "); p->println(10.0f * log10f(max(fabsf(drift), 1.0e-20f) / max(afc->getMisalignment(), 1.0e-20f)), 1);
+    }
+  }
+  afc->clearTrueFeedbackPath();
+}
+
+//the default scenarios: the BTNRH defaults, and then faster and slower adaptation
+static inline void afc_convergenceBenchmark(AudioEffectFeedbackCancel_Local_F32 *afc, Print *p, float32_t fs_Hz, int cs) {
+  const AFC_SimParams all_params[] = { {1.0e-3f, 0.9f, 0.008f}, {4.0e-3f, 0.9f, 0.008f}, {2.5e-4f, 0.9f, 0.008f} };
+  afc_convergenceBenchmark(afc, p, fs_Hz, cs, all_params, sizeof(all_params)/sizeof(all_params[0]));
+}
+#endif
+
+#endif
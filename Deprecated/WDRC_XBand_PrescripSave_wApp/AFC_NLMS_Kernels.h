@@ -0,0 +1,309 @@
+/*
+   AFC_NLMS_Kernels
+
+   Created: OpenAudio, 2022
+   Purpose: Inner loops for the NLMS adaptive feedback canceler (AFC) in AudioEffectFeedbackCancel_Local_F32.
+
+     The original BTNRH cha_afc() makes three passes over the afl coefficients for every sample:
+     a dot product (to estimate the feedback), a scale, and an add (to update the coefficients).
+     The "fused" kernel here does the coefficient update for sample i-1 in the same pass as the
+     dot product for sample i, so that the ring buffer and the coefficients are only read once per sample.
+
+     The ring buffer layout is the same as used by AudioEffectFeedbackCancel_Local_F32: the newest
+     audio sample is at index 0 and the oldest is at the end.  So, for sample i of a block of length cs,
+     the history used by the filter starts at ring + (cs-1) - i.  The history for the previous
+     sample (i-1) is therefore the same pointer advanced by one.
+
+     There are also short-FIR kernels and a Levinson-Durbin recursion for the optional prewhitening
+     and band-limit filters of AudioEffectFeedbackCancel_Local_F32.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _AFC_NLMS_Kernels_h
+#define _AFC_NLMS_Kernels_h
+
+#include <arm_math.h> //ARM DSP extensions.  https://www.keil.com/pack/doc/CMSIS/DSP/html/index.html
+#include <Arduino.h>
+
+//Set to 0 to force the portable (scalar, one accumulator) version of the fused kernel
+#ifndef AFC_NLMS_USE_UNROLLED_KERNEL
+  #if defined(__ARM_ARCH_7EM__)  //Cortex-M4F (Teensy 3.6) and Cortex-M7 (Teensy 4.x)
+    #define AFC_NLMS_USE_UNROLLED_KERNEL 1
+  #else
+    #define AFC_NLMS_USE_UNROLLED_KERNEL 0
+  #endif
+#endif
+
+// ///////////////////////////////////////////////// Ring buffer helper
+
+//Store new audio in reverse order so that the newest is at index 0 and the oldest is at the end.
+//Only the first afl+cs samples of the ring buffer are used.
+static inline void afc_ring_push_reversed(float32_t *ring, int afl, const float32_t *x, int cs) {
+  //slide the data to the older end of the buffer (overwriting the very oldest data)
+  int Idst = afl + cs - 1; //start with the destination at the end of the buffer
+  for (int Isrc = (afl - 1); Isrc > -1; Isrc--) ring[Idst--] = ring[Isrc];
+
+  //add new data to front (we're also reversing it)
+  Idst = cs - 1;
+  for (int Isrc = 0; Isrc < cs; Isrc++) ring[Idst--] = x[Isrc];
+}
+
+// ///////////////////////////////////////////////// Original (three pass) kernel
+
+//This is the original processing from AudioEffectFeedbackCancel_Local_F32::cha_afc().  It is kept
+//so that it can be selected at run time and so that the fused kernel can be checked against it.
+static inline void afc_nlms_threepass(const float32_t *x, float32_t *y, int cs,
+      const float32_t *ring, float32_t *efbp, float32_t *scratch, int afl, int n_coeff_to_zero,
+      float32_t mu, float32_t rho, float32_t eps, float32_t *pwr_state)
+{
+  float32_t fbe, mum, s0, s1, ipwr;
+  float32_t pwr = *pwr_state;
+  for (int i = 0; i < cs; i++) {
+    s0 = x[i];  //current waveform sample
+    const float32_t *offset_ringbuff = ring + (cs - 1) - i;
+
+    arm_dot_prod_f32(offset_ringbuff, efbp, afl, &fbe); // estimate feedback
+    s1 = s0 - fbe;                                      // remove estimated feedback from the signal
+    ipwr = s0 * s0 + s1 * s1;                           // calculate instantaneous power
+    pwr = rho * pwr + ipwr;                             // low-pass filter the instantaneous power
+    mum = mu / (eps + pwr);                             // modified mu
+
+    // update adaptive feedback coefficients
+    arm_scale_f32(offset_ringbuff, mum * s1, scratch, afl);
+    arm_add_f32(efbp, scratch, efbp, afl);
+    for (int j = 0; j < n_coeff_to_zero; j++) efbp[j] = 0.0f;
+
+    y[i] = s1; // copy AFC signal to output
+  }
+  *pwr_state = pwr;
+}
+
+// ///////////////////////////////////////////////// Fused kernel
+
+//One pass over the coefficients: apply the pending update from the previous sample (using p[j+1])
+//and then use the freshly-updated coefficient in the dot product for the current sample (using p[j]).
+//Coefficients below j0 are held at zero (see n_coeff_to_zero), so the loop starts at j0.
+static inline float32_t afc_nlms_fused_step_ref(float32_t *efbp, const float32_t *p, int j0, int afl, float32_t g_prev) {
+  float32_t fbe = 0.0f;
+  for (int j = j0; j < afl; j++) {
+    float32_t e = efbp[j] + g_prev * p[j + 1];
+    efbp[j] = e;
+    fbe += p[j] * e;
+  }
+  return fbe;
+}
+
+//Same as above, but unrolled by four with independent accumulators so that the FPU pipeline on
+//the Cortex-M4F/M7 is kept busy (this is the same trick used inside CMSIS-DSP's arm_dot_prod_f32)
+static inline float32_t afc_nlms_fused_step_unrolled(float32_t *efbp, const float32_t *p, int j0, int afl, float32_t g_prev) {
+  float32_t acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+  float32_t *e = efbp + j0;
+  const float32_t *pc = p + j0;
+  int n = afl - j0;
+  while (n >= 4) {
+    float32_t e0 = e[0] + g_prev * pc[1];
+    float32_t e1 = e[1] + g_prev * pc[2];
+    float32_t e2 = e[2] + g_prev * pc[3];
+    float32_t e3 = e[3] + g_prev * pc[4];
+    e[0] = e0; e[1] = e1; e[2] = e2; e[3] = e3;
+    acc0 += pc[0] * e0;
+    acc1 += pc[1] * e1;
+    acc2 += pc[2] * e2;
+    acc3 += pc[3] * e3;
+    e += 4; pc += 4; n -= 4;
+  }
+  while (n > 0) {
+    float32_t e0 = e[0] + g_prev * pc[1];
+    e[0] = e0;
+    acc0 += pc[0] * e0;
+    e++; pc++; n--;
+  }
+  return (acc0 + acc1) + (acc2 + acc3);
+}
+
+static inline float32_t afc_nlms_fused_step(float32_t *efbp, const float32_t *p, int j0, int afl, float32_t g_prev) {
+  #if AFC_NLMS_USE_UNROLLED_KERNEL
+    return afc_nlms_fused_step_unrolled(efbp, p, j0, afl, g_prev);
+  #else
+    return afc_nlms_fused_step_ref(efbp, p, j0, afl, g_prev);
+  #endif
+}
+
+//Process a whole block with the fused kernel.  Gives the same result as afc_nlms_threepass() except
+//for floating-point rounding (the order of the summation in the dot product is different).
+static inline void afc_nlms_fused(const float32_t *x, float32_t *y, int cs,
+      const float32_t *ring, float32_t *efbp, int afl, int n_coeff_to_zero,
+      float32_t mu, float32_t rho, float32_t eps, float32_t *pwr_state)
+{
+  float32_t fbe, mum, s0, s1, ipwr;
+  float32_t pwr = *pwr_state;
+  float32_t g = 0.0f;  //the coefficient update from the previous sample that has not yet been applied
+  int j0 = min(max(n_coeff_to_zero, 0), afl);
+  for (int j = 0; j < j0; j++) efbp[j] = 0.0f;
+
+  for (int i = 0; i < cs; i++) {
+    s0 = x[i];
+    const float32_t *offset_ringbuff = ring + (cs - 1) - i;
+
+    fbe = afc_nlms_fused_step(efbp, offset_ringbuff, j0, afl, g); //finish last sample's update, estimate feedback
+    s1 = s0 - fbe;
+    ipwr = s0 * s0 + s1 * s1;
+    pwr = rho * pwr + ipwr;
+    mum = mu / (eps + pwr);
+    g = mum * s1;  //save the update to be applied during the next pass
+
+    y[i] = s1;
+  }
+
+  //apply the update from the last sample of the block
+  for (int j = j0; j < afl; j++) efbp[j] += g * ring[j];
+  *pwr_state = pwr;
+}
+
+// ///////////////////////////////////////////////// Stereo fused kernel
+
+//Same as afc_nlms_fused(), but for two ears at once.  The loopback history and the coefficients are
+//interleaved (left, right, left, right, ...) so that both ears share one pass through memory and one
+//set of loop overhead.  ring[2*j] is the left audio from j samples ago and ring[2*j+1] is the right.
+static inline void afc_nlms_fused_stereo(const float32_t *xL, const float32_t *xR, float32_t *yL, float32_t *yR, int cs,
+      const float32_t *ring, float32_t *efbp, int afl,
+      float32_t mu, float32_t rho, float32_t eps, float32_t *pwrL_state, float32_t *pwrR_state)
+{
+  float32_t pwrL = *pwrL_state, pwrR = *pwrR_state;
+  float32_t gL = 0.0f, gR = 0.0f;  //the coefficient updates from the previous sample that have not yet been applied
+
+  for (int i = 0; i < cs; i++) {
+    const float32_t *p = ring + 2 * ((cs - 1) - i);  //p + 2 is the history for the previous sample
+
+    //finish last sample's update and estimate the feedback for both ears
+    float32_t fbeL = 0.0f, fbeR = 0.0f;
+    for (int j = 0; j < 2*afl; j += 2) {
+      float32_t eL = efbp[j]   + gL * p[j + 2];
+      float32_t eR = efbp[j+1] + gR * p[j + 3];
+      efbp[j] = eL;  efbp[j+1] = eR;
+      fbeL += p[j] * eL;
+      fbeR += p[j+1] * eR;
+    }
+
+    float32_t s0 = xL[i], s1 = s0 - fbeL;
+    pwrL = rho * pwrL + s0 * s0 + s1 * s1;
+    gL = (mu / (eps + pwrL)) * s1;
+    yL[i] = s1;
+
+    s0 = xR[i]; s1 = s0 - fbeR;
+    pwrR = rho * pwrR + s0 * s0 + s1 * s1;
+    gR = (mu / (eps + pwrR)) * s1;
+    yR[i] = s1;
+  }
+
+  //apply the updates from the last sample of the block
+  for (int j = 0; j < 2*afl; j += 2) {
+    efbp[j]   += gL * ring[j];
+    efbp[j+1] += gR * ring[j+1];
+  }
+  *pwrL_state = pwrL;  *pwrR_state = pwrR;
+}
+
+// ///////////////////////////////////////////////// Short-FIR kernels (prewhitening and band-limit filters)
+
+//Apply a short FIR filter to one sample of a newest-first history: sum of h[j] * hist[j].
+//arm_dot_prod_f32 is already unrolled (and uses the SIMD loads) on the Cortex-M4F/M7.
+static inline float32_t afc_fir_newest_first(const float32_t *hist, const float32_t *h, int n) {
+  float32_t acc = 0.0f;
+  if (n > 0) arm_dot_prod_f32(hist, h, n, &acc);
+  return acc;
+}
+
+//Coefficient update: w[j] += g * p[j].  Unrolled by four, like afc_nlms_fused_step_unrolled().
+static inline void afc_axpy(float32_t *w, float32_t g, const float32_t *p, int n) {
+  int j = 0;
+  for (; j + 3 < n; j += 4) {
+    float32_t w0 = w[j] + g * p[j], w1 = w[j+1] + g * p[j+1];
+    float32_t w2 = w[j+2] + g * p[j+2], w3 = w[j+3] + g * p[j+3];
+    w[j] = w0; w[j+1] = w1; w[j+2] = w2; w[j+3] = w3;
+  }
+  for (; j < n; j++) w[j] += g * p[j];
+}
+
+//Levinson-Durbin recursion.  Given the autocorrelation R[0..order], find the prediction-error
+//(whitening) filter a[0..order], with a[0] = 1.  Returns false, and leaves a[] unchanged, if R is
+//not positive definite (for example, during silence).
+#define AFC_MAX_LPC_ORDER 32
+static inline bool afc_levinson(const float32_t *R, float32_t *a, int order) {
+  float32_t a_new[AFC_MAX_LPC_ORDER + 1], tmp[AFC_MAX_LPC_ORDER + 1];
+  order = min(max(order, 0), AFC_MAX_LPC_ORDER);
+  float32_t err = R[0] * 1.0001f;  //a tiny bit of white noise keeps the recursion well conditioned
+  if (!(err > 0.0f)) return false;
+  a_new[0] = 1.0f;
+  for (int m = 1; m <= order; m++) {
+    float32_t acc = R[m];
+    for (int j = 1; j < m; j++) acc += a_new[j] * R[m - j];
+    float32_t k = -acc / err;
+    for (int j = 1; j < m; j++) tmp[j] = a_new[j] + k * a_new[m - j];
+    for (int j = 1; j < m; j++) a_new[j] = tmp[j];
+    a_new[m] = k;
+    err *= (1.0f - k * k);
+    if (!(err > 0.0f)) return false;
+  }
+  for (int j = 0; j <= order; j++) a[j] = a_new[j];
+  return true;
+}
+
+// ///////////////////////////////////////////////// Benchmark
+
+//Run the original and the fused kernels on the same (pseudo-random) audio and report the time per
+//sample and the largest difference between the two.  This runs in loop(), so it is interrupted by
+//the audio processing, which makes the timing a little pessimistic for both kernels.
+#define AFC_BENCH_MAX_LEN 256
+#define AFC_BENCH_BLOCK 24
+static inline void afc_benchmarkKernels(Print *p, int n_blocks = 200) {
+  static float32_t ring[AFC_BENCH_MAX_LEN + AFC_BENCH_BLOCK + 1];
+  static float32_t efbp_ref[AFC_BENCH_MAX_LEN], efbp_fused[AFC_BENCH_MAX_LEN], scratch[AFC_BENCH_MAX_LEN];
+  float32_t x[AFC_BENCH_BLOCK], out[AFC_BENCH_BLOCK], y_ref[AFC_BENCH_BLOCK], y_fused[AFC_BENCH_BLOCK];
+  const float32_t mu = 1.0e-3f, rho = 0.9f, eps = 0.008f;
+  const int cs = AFC_BENCH_BLOCK;
+  const int all_afl[] = {32, 64, 100, 128, 256};
+
+  p->println("AFC Kernel Benchmark: afl, 3-pass (ns/samp), fused (ns/samp), speedup, max err y, max err efbp");
+  for (unsigned int Itest = 0; Itest < sizeof(all_afl) / sizeof(all_afl[0]); Itest++) {
+    int afl = all_afl[Itest];
+    unsigned long dT_ref_micros = 0, dT_fused_micros = 0;
+    float32_t max_err_y = 0.0f, max_err_efbp = 0.0f, pwr_ref = 0.0f, pwr_fused = 0.0f;
+    uint32_t seed = 12345;
+    for (int i = 0; i < AFC_BENCH_MAX_LEN + AFC_BENCH_BLOCK + 1; i++) ring[i] = 0.0f;
+    for (int i = 0; i < AFC_BENCH_MAX_LEN; i++) { efbp_ref[i] = 0.0f; efbp_fused[i] = 0.0f; }
+
+    for (int Iblock = 0; Iblock < n_blocks; Iblock++) {
+      //white noise for the output (loopback) and a little-bit-delayed copy of it as the input
+      for (int i = 0; i < cs; i++) {
+        seed = seed * 1664525UL + 1013904223UL;
+        out[i] = ((float32_t)(seed >> 8) / 16777216.0f) - 0.5f;
+        x[i] = 0.1f * ring[min(afl / 2, afl + cs - 1)] + 0.5f * out[i];
+      }
+
+      unsigned long t0 = micros();
+      afc_nlms_threepass(x, y_ref, cs, ring, efbp_ref, scratch, afl, 0, mu, rho, eps, &pwr_ref);
+      unsigned long t1 = micros();
+      afc_nlms_fused(x, y_fused, cs, ring, efbp_fused, afl, 0, mu, rho, eps, &pwr_fused);
+      unsigned long t2 = micros();
+      dT_ref_micros += (t1 - t0);  dT_fused_micros += (t2 - t1);
+
+      for (int i = 0; i < cs; i++) max_err_y = max(max_err_y, fabsf(y_ref[i] - y_fused[i]));
+      afc_ring_push_reversed(ring, afl, out, cs);
+    }
+    for (int j = 0; j < afl; j++) max_err_efbp = max(max_err_efbp, fabsf(efbp_ref[j] - efbp_fused[j]));
+
+    float n_samps = (float)(n_blocks * cs);
+    float ref_ns = 1000.0f * (float)dT_ref_micros / n_samps;
+    float fused_ns = 1000.0f * (float)dT_fused_micros / n_samps;
+    p->print("    : "); p->print(afl); p->print(", ");
+    p->print(ref_ns, 1); p->print(", ");
+    p->print(fused_ns, 1); p->print(", ");
+    p->print(ref_ns / max(fused_ns, 1.0e-3f), 2); p->print(", ");
+    p->print(max_err_y, 8); p->print(", ");
+    p->println(max_err_efbp, 8);
+  }
+}
+
+#endif
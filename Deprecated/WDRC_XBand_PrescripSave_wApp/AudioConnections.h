@@ -7,13 +7,25 @@ AudioMixer4_F32               leftRightMixer[2];        //mixers to control mono
 AudioFilterBiquad_F32         preFilter(audio_settings), preFilterR(audio_settings);  //remove low frequencies near DC
 AudioTestSignalGenerator_F32  audioTestGenerator(audio_settings); //keep this to be *after* the creation of the i2s_in object
 
-AudioEffectAFC_BTNRH_F32   feedbackCancel(audio_settings), feedbackCancelR(audio_settings);  //original adaptive feedback cancelation from BTNRH
-AudioFilterBiquad_F32      bpFilt[2][N_CHAN_MAX];         //here are the filters to break up the audio into multiple bands
+#if 1  //set to zero to use the frequency-domain feedback canceler (allows much longer afl for the same CPU)
+  AudioEffectAFC_BTNRH_F32   feedbackCancel(audio_settings), feedbackCancelR(audio_settings);  //original adaptive feedback cancelation from BTNRH
+#else
+  AudioEffectFeedbackCancel_PBFDAF_F32 feedbackCancel(audio_settings), feedbackCancelR(audio_settings);  //partitioned-block frequency-domain AFC
+#endif
+#if (USE_STEREO_AFC)
+  AudioEffectFeedbackCancel_Stereo_F32 feedbackCancelStereo(audio_settings);  //both ears in one object
+  AudioEffectFeedbackCancel_LoopBack_Stereo_F32 feedbackLoopBackStereo(audio_settings);
+#endif
 AudioConfigIIRFilterBank_F32 filterBankCalculator(audio_settings);  //this computes the filter coefficients
-//AudioFilterIIR_F32         bpFilt[2][N_CHAN_MAX];           //here are the filters to break up the audio into multiple bands
-AudioEffectDelay_F32       postFiltDelay[2][N_CHAN_MAX];  //Here are the delay modules that we'll use to time-align the output of the filters
-AudioEffectCompWDRC_F32    expCompLim[2][N_CHAN_MAX];     //here are the per-band compressors
-AudioSummer8_F32            mixerFilterBank[2];                     //mixer to reconstruct the broadband audio
+AudioEffectCompWDRC_F32    expCompLim[2][N_CHAN_MAX];     //here are the per-band compressors (with USE_MULTIBAND_WDRC, they only hold the settings and states)
+#if (USE_MULTIBAND_WDRC)
+  AudioEffectMultiBandWDRC_F32 multiBandWDRC[2] = {{audio_settings}, {audio_settings}};  //filterbank + per-band compressors + mixer in one object
+#else
+  AudioFilterBiquad_F32      bpFilt[2][N_CHAN_MAX];         //here are the filters to break up the audio into multiple bands
+  //AudioFilterIIR_F32         bpFilt[2][N_CHAN_MAX];           //here are the filters to break up the audio into multiple bands
+  AudioEffectDelay_F32       postFiltDelay[2][N_CHAN_MAX];  //Here are the delay modules that we'll use to time-align the output of the filters
+  AudioSummer8_F32            mixerFilterBank[2];                     //mixer to reconstruct the broadband audio
+#endif
 AudioEffectCompWDRC_F32    compBroadband[2];              //broad band compressor
 AudioEffectFeedbackCancel_LoopBack_Local_F32 feedbackLoopBack(audio_settings), feedbackLoopBackR(audio_settings);
 AudioSDWriter_F32             audioSDWriter(audio_settings); //this is stereo by default
@@ -29,6 +41,9 @@ AudioControlTestFreqSweep_F32    freqSweepTester_perBand(audio_settings, audioTe
 //make the audio connections
 #define N_MAX_CONNECTIONS 150  //some large number greater than the number of connections that we'll make
 AudioConnection_F32 *patchCord[N_MAX_CONNECTIONS];
+#if (!USE_MULTIBAND_WDRC)
+  AudioConnection_F32 *bandInputCord[2][N_CHAN_MAX] = {{NULL}}, *bandOutputCord[2][N_CHAN_MAX] = {{NULL}};  //per-band cords (see setActiveBands())
+#endif
 int makeAudioConnections(void) { //call this in setup() or somewhere like that
   int count = 0;
 
@@ -82,14 +97,35 @@ int makeAudioConnections(void) { //call this in setup() or somewhere like that
   patchCord[count++] = new AudioConnection_F32(audioTestGenerator, 0, audioTestMeasurement_filterbank, 0); //connect test generator to the test measurement filterbank
 
   //start the algorithms with the feedback cancallation block
-  #if 1  //set to zero to discable the adaptive feedback cancelation
+  #if (USE_STEREO_AFC)
+    patchCord[count++] = new AudioConnection_F32(audioTestGenerator, 0, feedbackCancelStereo, LEFT); //remember, even the normal audio is coming through the audioTestGenerator
+    patchCord[count++] = new AudioConnection_F32(preFilterR, 0, feedbackCancelStereo, RIGHT);
+  #elif 1  //set to zero to discable the adaptive feedback cancelation
     patchCord[count++] = new AudioConnection_F32(audioTestGenerator, 0, feedbackCancel, 0); //remember, even the normal audio is coming through the audioTestGenerator
   #endif
 
   //make per-channel connections: filterbank -> delay -> WDRC Compressor -> mixer (synthesis)
   for (int Iear = 0; Iear < N_EARPIECES; Iear++) { //loop over channels
+    #if (USE_MULTIBAND_WDRC)
+      //all of the bands are in one object (it uses expCompLim[Iear][] for the compressor settings, but they're not connected)
+      if (USE_STEREO_AFC) {
+        #if (USE_STEREO_AFC)
+          patchCord[count++] = new AudioConnection_F32(feedbackCancelStereo, Iear, multiBandWDRC[Iear], 0); //connect to the binaural Feedback canceler
+        #endif
+      } else if (Iear == LEFT) {
+        patchCord[count++] = new AudioConnection_F32(feedbackCancel, 0, multiBandWDRC[Iear], 0); //connect to Feedback canceler
+      } else {
+        patchCord[count++] = new AudioConnection_F32(feedbackCancelR, 0, multiBandWDRC[Iear], 0); //connect to Feedback canceler
+      }
+      patchCord[count++] = new AudioConnection_F32(multiBandWDRC[Iear], 0, compBroadband[Iear], 0);  //connect to final limiter
+      //(the per-band test measurements need the separate filters, so they are not available)
+    #else
     for (int Iband = 0; Iband < N_CHAN_MAX; Iband++) {
-      if (Iear == LEFT) {
+      if (USE_STEREO_AFC) {
+        #if (USE_STEREO_AFC)
+          patchCord[count++] = new AudioConnection_F32(feedbackCancelStereo, Iear, bpFilt[Iear][Iband], 0); //connect to the binaural Feedback canceler
+        #endif
+      } else if (Iear == LEFT) {
         #if 1  //set to zero to disable the adaptive feedback cancelation
           patchCord[count++] = new AudioConnection_F32(feedbackCancel, 0, bpFilt[Iear][Iband], 0); //connect to Feedback canceler //perhaps 
         #else
@@ -102,6 +138,7 @@ int makeAudioConnections(void) { //call this in setup() or somewhere like that
           patchCord[count++] = new AudioConnection_F32(preFilterR, 0, bpFilt[Iear][Iband], 0); //input is coming directly from i2s_in
         #endif
       }
+      bandInputCord[Iear][Iband] = patchCord[count-1];
       #if 0
         //use the post-filter delays
         patchCord[count++] = new AudioConnection_F32(bpFilt[Iear][Iband], 0, postFiltDelay[Iear][Iband], 0);  //connect to delay
@@ -111,6 +148,7 @@ int makeAudioConnections(void) { //call this in setup() or somewhere like that
         patchCord[count++] = new AudioConnection_F32(bpFilt[Iear][Iband], 0, expCompLim[Iear][Iband], 0); //connect to per-band compressor
       #endif
       patchCord[count++] = new AudioConnection_F32(expCompLim[Iear][Iband], 0, mixerFilterBank[Iear], Iband); //connect to mixer
+      bandOutputCord[Iear][Iband] = patchCord[count-1];
 
       //make the connection for the audio test measurements
       if (Iear == LEFT) {
@@ -120,13 +158,18 @@ int makeAudioConnections(void) { //call this in setup() or somewhere like that
 
     //connect the output of the mixers to the final broadband compressor
     patchCord[count++] = new AudioConnection_F32(mixerFilterBank[Iear], 0, compBroadband[Iear], 0);  //connect to final limiter
+    #endif
   }
 
   //connect the loop back to the adaptive feedback canceller
   feedbackLoopBack.setTargetAFC(&feedbackCancel);   //left ear
   if (RUN_STEREO) feedbackLoopBackR.setTargetAFC(&feedbackCancelR); //right ear
   
-  #if 1  // set to zero to disable the adaptive feedback canceler
+  #if (USE_STEREO_AFC)
+    feedbackLoopBackStereo.setTargetAFC(&feedbackCancelStereo);
+    patchCord[count++] = new AudioConnection_F32(compBroadband[LEFT], 0, feedbackLoopBackStereo, LEFT); //loopback to the binaural feedback canceler
+    patchCord[count++] = new AudioConnection_F32(compBroadband[RIGHT], 0, feedbackLoopBackStereo, RIGHT);
+  #elif 1  // set to zero to disable the adaptive feedback canceler
     patchCord[count++] = new AudioConnection_F32(compBroadband[LEFT], 0, feedbackLoopBack, 0); //loopback to the adaptive feedback canceler
     patchCord[count++] = new AudioConnection_F32(compBroadband[RIGHT], 0, feedbackLoopBackR, 0); //loopback to the adaptive feedback canceler
   #endif
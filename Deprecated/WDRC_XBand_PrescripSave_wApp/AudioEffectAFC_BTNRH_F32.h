@@ -18,7 +18,7 @@ class AudioEffectAFC_BTNRH_F32 : public AudioEffectFeedbackCancel_Local_F32 {
                          int cs) //"chunk size"...the length of the audio array
     {
       float32_t fbe, mum, s0, s1, ipwr;
-      int i,ii,j,ij;
+      int i,j;
       //float32_t *offset_ringbuff;
       float32_t foo;
 
@@ -41,13 +41,36 @@ class AudioEffectAFC_BTNRH_F32 : public AudioEffectFeedbackCancel_Local_F32 {
 //      merr = (float *) cp[_merr];
 
 
-      int rsz = max_afc_ringbuff_len;  //length of ring buffer
-      int mask = rsz - 1;
+      //the ring buffer is mirrored, so the history for each sample is contiguous (no index wrapping needed)
+      const float32_t *ring = getAlignedRing(cs);  //also lines up the loopback audio using hdel
+      if (ring == NULL) {
+        //the ring buffer was sized for a smaller block, so pass the audio through
+        for (i = 0; i < cs; i++) y[i] = x[i];
+        return;
+      }
+      #if (USE_AFC_SIM_METRIC)
+        if (isTrackingMisalignment()) {
+          //simulation only: the quality metric (sfbp, merr) from BTNRH, updated incrementally
+          cha_afc_with_metric(x, y, cs, ring);
+          return;
+        }
+      #endif
+      if (isFiltered()) {
+        //prewhitening (wfl) and/or band-limit filter (pfl), like CHAPRO
+        cha_afc_filtered(x, y, cs, ring);
+        return;
+      }
+      if (isAdaptScheduled()) {
+        //only adapt some of the time (or some of the coefficients)
+        cha_afc_scheduled(x, y, cs, ring);
+        return;
+      }
+      n_coeff_updates_possible += cs * afl;  n_coeff_updates_done += cs * afl;
 
       // subtract estimated feedback signal
       for (i = 0; i < cs; i++) {  //step through WAV sample-by-sample
         s0 = x[i];  //current waveform sample
-        ii = rhd + i;
+        const float32_t *ring_i = ring + (cs - 1) - i;  //ring_i[j] is the loopback audio from j samples before this sample
 
         // // simulate feedback [don't need this in the real-time system?]
         //fbs = 0;
@@ -59,8 +82,7 @@ class AudioEffectAFC_BTNRH_F32 : public AudioEffectFeedbackCancel_Local_F32 {
         // using our estimated feedback model (efbp), let's estimate feedback signal that we think that we should be receiving
         fbe = 0; //initialize to zero
         for (j = 0; j < afl; j++) {    //loop over each AFC filter indices
-          ij = (ii - j + rsz) & mask;  //compute index into ring buffer of previous audio data
-          fbe += ring[ij] * efbp[j];   //apply the estimated feedback model (efbp) to the audio data to estimate the current feedback signal
+          fbe += ring_i[j] * efbp[j];  //apply the estimated feedback model (efbp) to the audio data to estimate the current feedback signal
         }
 
         // apply the simulated feedback to input signal and remove the estimated feedback signal
@@ -76,12 +98,9 @@ class AudioEffectAFC_BTNRH_F32 : public AudioEffectFeedbackCancel_Local_F32 {
         pwr = rho * pwr + ipwr;
         mum = mu / (eps + pwr);  // modified mu
         foo = mum * s1;
-        int ii_rsz = ii + rsz;
         for (j = 0; j < afl; j++) {
-          //ij = (ii - j + rsz) & mask;
-          ij = (ii_rsz - j) & mask;     //calc index into ringbuffer
           //efbp[j] += mum * ring[ij] * s1;  //update the estimated feedback coefficients
-          efbp[j] += foo * ring[ij];  //update the estimated feedback coefficients
+          efbp[j] += foo * ring_i[j];  //update the estimated feedback coefficients
         }
 
         // // save quality metrics
@@ -110,34 +129,6 @@ class AudioEffectAFC_BTNRH_F32 : public AudioEffectFeedbackCancel_Local_F32 {
     }
 
 
-    virtual void addNewAudio(audio_block_f32_t *in_block) {
-      newest_ring_audio_block_id = in_block->id; 
-      addNewAudio(in_block->data, in_block->length);
-    }
-    virtual void addNewAudio(float *x, //input audio block
-                       int cs)   //number of samples in this audio block
-    {
-      //float *ring;
-      int i, j;
-
-      int rsz = max_afc_ringbuff_len;
-  
-      //rsz = CHA_IVAR[_rsz];    //size of ring buffer
-      //rhd = CHA_IVAR[_rhd];    //where to start in the target ring buffer.  Overwritten!
-      //rtl = CHA_IVAR[_rtl];    //where it last ended in the target ring buffer
-      //ring = (float *) cp[_ring];
-      int mask = rsz - 1;          //what sample to jump back to zero?
-      
-      rhd = rtl;   //where to start in the target ring buffer
-      // copy chunk to ring buffer
-      for (i = 0; i < cs; i++) {  //loop over each sample in the audio chunk
-          j = (rhd + i) & mask;  //get index into target array.  This a fast way of doing modulo?
-          ring[j] = x[i];   //save sample into ring buffer
-      }
-      rtl = (rhd + cs) % rsz;  //save the last write point in the ring buffer
-      //CHA_IVAR[_rhd] = rhd;   //save the start point 
-      //CHA_IVAR[_rtl] = rtl;   //save the end point
-    }
   protected:
 
     
@@ -18,10 +18,66 @@
 #include <AudioStream_F32.h>
 #include <BTNRH_WDRC_Types.h> //from Tympan_Library
 #include <Arduino.h>  //for Serial.println()
+#include "AFC_NLMS_Kernels.h"
+#include "DelayHistory_F32.h"
+#include "FeedbackModelSnapshot_F32.h"
 
 #ifndef MAX_AFC_FILT_LEN
 #define MAX_AFC_FILT_LEN  256  //must be longer than afl
 #endif
+#ifndef MAX_AFC_HDEL
+#define MAX_AFC_HDEL  (2*AUDIO_BLOCK_SAMPLES)  //longest allowed delay (samples) from the output back to the input
+#endif
+#ifndef MAX_AFC_SNAPSHOT_LEN
+#define MAX_AFC_SNAPSHOT_LEN  MAX_AFC_FILT_LEN  //longest feedback model that can be exported to loop() (the PBFDAF has its own)
+#endif
+#define MAX_AFC_WFL  16   //longest whitening filter (must be no longer than AFC_MAX_LPC_ORDER+1)
+#define MAX_AFC_PFL  64   //longest band-limit filter (must be no shorter than MAX_AFC_WFL)
+#ifndef USE_AFC_SIM_METRIC
+#define USE_AFC_SIM_METRIC (false)  //set true to compile in the misalignment metric for simulations (see setTrueFeedbackPath())
+#endif
+
+//How often to adapt the AFC coefficients.  The estimated feedback is always removed from every sample.
+enum AFC_ADAPT_MODE { AFC_ADAPT_EVERY_SAMPLE=0, AFC_ADAPT_EVERY_NTH, AFC_ADAPT_ROUND_ROBIN, AFC_ADAPT_N_MODES };
+typedef struct {
+  int mode = AFC_ADAPT_EVERY_SAMPLE;  //see AFC_ADAPT_MODE
+  int n = 1;                  //EVERY_NTH: adapt on every nth sample.  ROUND_ROBIN: adapt 1/n of the coefficients on each sample.
+  float32_t pwr_thresh = 0.0; //skip the adaptation when the AFC's power estimate (pwr) is below this value (0 = never skip)
+} AFC_AdaptSchedule;
+
+//Prewhitening and band-limit filters, as in CHAPRO's AFC (wfl, pfl, alf, pup).  The Tympan version of
+//CHA_AFC does not have these fields, so they are set separately.  Leave wfl and pfl at zero for the
+//original BTNRH processing.  CHAPRO's own defaults are wfl = 9, pfl = 20, alf = 1.0658e-5, and pup = 8.
+typedef struct {
+  int wfl = 0;          //whitening filter length (0 = no prewhitening)
+  int pfl = 0;          //band-limit filter length (0 = no band-limit filter)
+  float32_t alf = 0.0;  //band-limit filter step size
+  int pup = 1;          //band-limit filter is updated every pup samples
+} AFC_FilterParams;
+
+//The converged state of the AFC, for a warm start after the next boot (see getWarmState()).  The
+//key (preset, earpiece, ear) is filled in by whoever saves it, so that a state is only restored to
+//the same configuration that it was learned in.
+#define AFC_WARM_STATE_MAGIC    0x57434641  //"AFCW"
+#define AFC_WARM_STATE_VERSION  1
+#define AFC_WARM_MAX_RING  (MAX_AFC_FILT_LEN + MAX_AFC_HDEL + AUDIO_BLOCK_SAMPLES)
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  int16_t preset, earpiece, ear;      //key
+  int16_t afl, hdel, n_ring;          //hdel is the effective hdel (samples)
+  float32_t pwr;
+  float32_t efbp[MAX_AFC_FILT_LEN];
+  float32_t ring[AFC_WARM_MAX_RING];  //loopback history, newest first
+  uint32_t checksum;                  //sum of all of the preceding 32-bit words
+} AFC_WarmState;
+
+static inline uint32_t afc_warmStateChecksum(const AFC_WarmState *s) {
+  const uint32_t *words = (const uint32_t *)s;
+  uint32_t sum = 0;
+  for (unsigned int i = 0; i < offsetof(AFC_WarmState, checksum) / sizeof(uint32_t); i++) sum += words[i];
+  return sum;
+}
 
 class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
 {
@@ -36,6 +92,7 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
     }
     AudioEffectFeedbackCancel_Local_F32(const AudioSettings_F32 &settings) : AudioStream_F32(1, inputQueueArray_f32) {
       //do any setup activities here
+      block_len = settings.audio_block_samples;  //so that getEffectiveHdel() is right before the first block
       setDefaultValues();
       initializeStates();
       initializeRingBuffer();
@@ -59,19 +116,20 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
       setNCoeffToZero(0);
       setEnable(cha.default_to_active);
     }
+    virtual void setParams(BTNRH_WDRC::CHA_AFC cha, AFC_AdaptSchedule sched) {
+      setParams(cha);
+      setAdaptSchedule(sched);
+    }
+    virtual void setParams(BTNRH_WDRC::CHA_AFC cha, AFC_FilterParams filt) {
+      setParams(cha);
+      setFilterParams(filt);
+    }
     virtual void setParams(float _mu, float _rho, float _eps, int _afl) {
       //AFC parameters
       setMu(_mu);     // AFC step size
       setRho(_rho);   // AFC forgetting factor
       setEps (_eps);   // AFC tolerance for setting a floor on the smallest signal level (thereby avoiding divide-by-near-zero)
-      setAfl(_afl);  // AFC adaptive filter length
-      if (_afl > max_afc_ringbuff_len) {
-        Serial.println(F("AudioEffectFeedbackCancel_F32: *** ERROR ***"));
-        Serial.print(F("    : Adaptive filter length (")); Serial.print(afl);
-        Serial.print(F(") too long for ring buffer (")); Serial.print(max_afc_ringbuff_len); Serial.println(")");
-        afl = setAfl(max_afc_ringbuff_len);
-        Serial.print(F("    : Limiting filter length to ")); Serial.println(afl);
-      }
+      setAfl(_afl);  // AFC adaptive filter length (the ring buffer is sized to match)
     }
 
     virtual float setMu(float _mu) {
@@ -103,6 +161,7 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
         };
       }
 
+      resizeHistories();
       return  afl;
     };
     virtual int getAfl(void) {
@@ -119,23 +178,49 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
       return enable;
     };
 
-    //ring buffer
-    //static const int max_afc_ringbuff_len = MAX_AFC_FILT_LEN;
-    static const int max_afc_ringbuff_len = 2 * MAX_AFC_FILT_LEN;
-    float32_t ring[max_afc_ringbuff_len];
-    int rhd, rtl;
+    //ring buffer (newest first).  Holds hdel+afl samples plus one block, for the current settings.
+    DelayHistoryHeap_F32 ring_history;
     unsigned long newest_ring_audio_block_id = 999999;
     void initializeRingBuffer(void) {
-      rhd = 0;  rtl = 0;
-      for (int i = 0; i < max_afc_ringbuff_len; i++) ring[i] = 0.0;
+      resizeHistories();
+      AudioNoInterrupts();
+      ring_history.clear();
+      AudioInterrupts();
+    }
+
+    //Size the loopback history for the current afl, hdel, and block size, and the histories of the
+    //prewhitening and band-limit filters for the current wfl and pfl (zero, and no memory, when they are
+    //not used).  Called whenever one of those settings changes.  A history whose length changes is
+    //reallocated and cleared, so this is done from loop() (or setup()), with the audio interrupt held off.
+    virtual void resizeHistories(void) {
+      const int wfl = filt_params.wfl, pfl = filt_params.pfl;
+      const bool is_filt = isFiltered(), is_white = is_filt && (wfl > 0);
+      int ring_len = afl + getEffectiveHdel() + block_len;
+      int x_len = is_white ? wfl : 0, e_len = is_white ? (wfl + block_len) : 0;  //(e_hist also holds the block for updateWhiteningFilter())
+      int v_len = is_filt ? max(afl, wfl) : 0, vw_len = is_white ? afl : 0;
+      int w_len = (is_filt && (pfl > 0)) ? max(pfl, wfl) : 0, ww_len = (is_white && (pfl > 0)) ? pfl : 0;
+      if ((ring_len == ring_history.getLength()) && (x_len == x_hist.getLength()) && (e_len == e_hist.getLength()) &&
+          (v_len == v_hist.getLength()) && (vw_len == vw_hist.getLength()) && (w_len == w_hist.getLength()) &&
+          (ww_len == ww_hist.getLength())) return;
+
+      AudioNoInterrupts();
+      if (ring_history.setLength(ring_len) < ring_len) {
+        //not enough memory, so shorten the filter to fit
+        afl = max(ring_history.getLength() - getEffectiveHdel() - block_len, 1);
+        Serial.print(F("AudioEffectFeedbackCancel_F32: *** ERROR ***: limiting the filter length to ")); Serial.println(afl);
+      }
+      x_hist.setLength(x_len);  e_hist.setLength(e_len);
+      v_hist.setLength(v_len);  vw_hist.setLength(vw_len);
+      w_hist.setLength(w_len);  ww_hist.setLength(ww_len);
+      AudioInterrupts();
     }
-    //int rsz = max_afc_ringbuff_len;  //"ring buffer size"...variable name inherited from original BTNRH code
-    //int mask = rsz - 1;
 
     //initializeStates
     virtual void initializeStates(void) {
       pwr = 0.0;
       for (int i = 0; i < MAX_AFC_FILT_LEN; i++) efbp[i] = 0.0;
+      initializeFilterStates();
+      startConvergenceTimer(false);
     }
 
     //here's the method that is called automatically by the Teensy Audio Library
@@ -152,14 +237,10 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
         return;
       }
 
-      //check to see if we're outpacing our feedback data
-      if ((in_block->id > 100) && (newest_ring_audio_block_id > 0)) { //ignore startup period
-        if (abs(in_block->id - newest_ring_audio_block_id) > 1) {  //is the difference more than one block counter?
-          //the data in the ring buffer is older than expected!
-          Serial.print("AudioEffectFeedbackCancel_F32: falling behind?  in_block = ");
-          Serial.print(in_block->id); Serial.print(", ring block = "); Serial.println(newest_ring_audio_block_id);
-        }
-      }
+      //remember which block this is so that the loopback audio can be lined up with it (see getAlignedRing())
+      current_block_id = in_block->id;
+      out_block->id = in_block->id;
+      out_block->length = in_block->length;
 
       //do the work
       if (enable) {
@@ -169,6 +250,9 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
         for (int i = 0; i < in_block->length; i++) out_block->data[i] = in_block->data[i];
       }
 
+      //every so often, give loop() a copy of the feedback model (see getFeedbackModel())
+      if (fb_snapshot.blockTick()) updateConvergence(publishFeedbackModel());
+
       // transmit the block and release memory
       AudioStream_F32::transmit(out_block); // send the FIR output
       AudioStream_F32::release(out_block);
@@ -179,64 +263,312 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
                          float32_t *y, //output audio array
                          int cs) //"chunk size"...the length of the audio array
     {
-      float32_t fbe, mum, s0, s1, ipwr;
-      int i;
-      float32_t *offset_ringbuff;
-      //float32_t foo;
-
-      // subtract estimated feedback signal
-      for (i = 0; i < cs; i++) {  //step through WAV sample-by-sample
-        s0 = x[i];  //current waveform sample
-        //ii = rhd + i;
-        offset_ringbuff = ring + (cs - 1) - i;
-
-        // estimate feedback
-#if 1
-        //is this faster?  Tested on Teensy 3.6.  Yes, this is faster.
-        arm_dot_prod_f32(offset_ringbuff, efbp, afl, &fbe); //from CMSIS-DSP library for ARM chips
-#else
-        fbe = 0;
-        for (int j = 0; j < afl; j++) {
-          //ij = (ii - j + rsz) & mask;
-          //fbe += ring[ij] * efbp[j];
-          fbe += offset_ringbuff[j] * efbp[j];
+      const float32_t *ring = getAlignedRing(cs);
+      if (ring == NULL) {
+        //the ring buffer was sized for a smaller block (see resizeHistories()), so pass the audio through
+        for (int i = 0; i < cs; i++) y[i] = x[i];
+        return;
+      }
+      #if (USE_AFC_SIM_METRIC)
+        if (nqm > 0) {
+          //simulation only: also measure how close the model is to the true feedback path
+          cha_afc_with_metric(x, y, cs, ring);
+          return;
         }
-#endif
-
-        // remove estimated feedback from the signal
-        s1 = s0 - fbe;
+      #endif
+      if (isFiltered()) {
+        //prewhitening and/or band-limit filter (like CHAPRO)
+        cha_afc_filtered(x, y, cs, ring);
+        return;
+      }
+      if (isAdaptScheduled()) {
+        //only adapt some of the time (or some of the coefficients)
+        cha_afc_scheduled(x, y, cs, ring);
+        return;
+      }
+      n_coeff_updates_possible += cs * afl;  n_coeff_updates_done += cs * afl;
+      if (use_fused_kernel) {
+        //single pass over the coefficients per sample (see AFC_NLMS_Kernels.h)
+        afc_nlms_fused(x, y, cs, ring, efbp, afl, n_coeff_to_zero, mu, rho, eps, &pwr);
+      } else {
+        //original three-pass processing (dot product, scale, add) using CMSIS-DSP
+        afc_nlms_threepass(x, y, cs, ring, efbp, foo_float_array, afl, n_coeff_to_zero, mu, rho, eps, &pwr);
+      }
+    }
 
-        // calculate instantaneous power
+    //Same as the original (three pass) processing, except that the coefficients are only adapted when
+    //the adaptation schedule says so.  The feedback is still estimated and removed from every sample.
+    virtual void cha_afc_scheduled(float32_t *x, float32_t *y, int cs, const float32_t *ring) {
+      float32_t fbe, mum, s0, s1, ipwr;
+      int n = adapt_sched.n;
+      int seg_len = (afl + n - 1) / n;  //for round-robin
+      for (int j = 0; j < n_coeff_to_zero; j++) efbp[j] = 0.0f;
+
+      for (int i = 0; i < cs; i++) {
+        s0 = x[i];
+        const float32_t *offset_ringbuff = ring + (cs - 1) - i;
+        arm_dot_prod_f32(offset_ringbuff, efbp, afl, &fbe); // estimate feedback
+        s1 = s0 - fbe;                                      // remove estimated feedback from the signal
         ipwr = s0 * s0 + s1 * s1;
+        pwr = rho * pwr + ipwr;
+        y[i] = s1;
 
-        // estimate magnitude of the signal (low-pass filter the instantaneous signal power)
-        pwr = rho * pwr + ipwr; //original
+        adapt_counter++;
+        n_coeff_updates_possible += afl;
+        if (pwr < adapt_sched.pwr_thresh) continue;  //too quiet to be worth adapting
+
+        int j_start = 0, j_end = afl;
+        if (adapt_sched.mode == AFC_ADAPT_EVERY_NTH) {
+          if ((adapt_counter % n) != 0) continue;  //not this sample
+        } else if (adapt_sched.mode == AFC_ADAPT_ROUND_ROBIN) {
+          j_start = (adapt_counter % n) * seg_len;  //just this segment of the coefficients
+          j_end = min(j_start + seg_len, afl);
+        }
 
         // update adaptive feedback coefficients
-        mum = mu / (eps + pwr);  // modified mu
-#if 1
-        //is this faster?  Tested on Teensy 3.6.  It is not faster
-        arm_scale_f32(offset_ringbuff, mum * s1, foo_float_array, afl);
-        arm_add_f32(efbp, foo_float_array, efbp, afl);
-#else
-        foo = mum * s1;
-        for (int j = 0; j < afl; j++) {
-          //ij = (ii - j + rsz) & mask;
-          //efbp[j] += mum * ring[ij] * s1;  //update the estimated feedback coefficients
-          efbp[j] += foo * offset_ringbuff[j];  //update the estimated feedback coefficients
+        mum = mu / (eps + pwr);
+        float32_t foo = mum * s1;
+        for (int j = max(j_start, n_coeff_to_zero); j < j_end; j++) efbp[j] += foo * offset_ringbuff[j];
+        n_coeff_updates_done += max(j_end - j_start, 0);
+      }
+    }
+
+    //Quality metric for simulations, like BTNRH's sfbp/nqm/merr: the misalignment is the squared error
+    //between the model (efbp) and the true feedback path (sfbp), relative to the power of sfbp.
+    //Instead of looping over all of the coefficients for every sample, the squared error is updated
+    //incrementally.  For the NLMS update efbp += g * r, the squared error changes by
+    //      2 * g * (efbp . r  -  sfbp . r)  +  g^2 * (r . r)
+    //efbp . r is the estimated feedback (already computed), sfbp . r is the simulated feedback (given
+    //by the simulator via setSimulatedFeedback()), and r . r is a running sum.  So, this costs O(1)
+    //per sample.  The true path starts at the hardware delay (ie, sfbp[0] lines up with efbp[0]).
+    //Only compiled in when USE_AFC_SIM_METRIC is true, so that the AFCs in the hearing aid don't carry it.
+  #if (USE_AFC_SIM_METRIC)
+    void setTrueFeedbackPath(const float32_t *h, int n) {
+      n = min(max(n, 0), MAX_AFC_FILT_LEN);
+      for (int j = 0; j < MAX_AFC_FILT_LEN; j++) sfbp[j] = (j < n) ? h[j] : 0.0f;
+      nqm = (n > 0) ? afl : 0;
+      resyncMisalignment();
+    }
+    void clearTrueFeedbackPath(void) { nqm = 0; sim_fbs = NULL; merr_out = NULL; }
+    bool isTrackingMisalignment(void) { return nqm > 0; }
+
+    //For the next call to cha_afc(): fbs[i] is the part of the simulated feedback for sample i that
+    //comes from the first afl samples of the true path (ie, sfbp . r).  Optionally, also give an array
+    //to receive the misalignment after each sample (like BTNRH's merr).  Both are used for one block.
+    void setSimulatedFeedback(const float32_t *fbs, float32_t *merr = NULL) { sim_fbs = fbs; merr_out = merr; }
+
+    //misalignment (relative squared error, not dB) as tracked sample-by-sample
+    float32_t getMisalignment(void) { return (float32_t)(merr_D / max(sfbp_pow, 1.0e-30)); }
+    //re-compute the misalignment exactly.  Returns the difference from the tracked value.
+    float32_t resyncMisalignment(void) {
+      double D = 0.0, P = 0.0;
+      for (int j = 0; j < afl; j++) { double d = efbp[j] - sfbp[j];  D += d * d;  P += (double)sfbp[j] * sfbp[j]; }
+      float32_t drift = (float32_t)((merr_D - D) / max(P, 1.0e-30));
+      merr_D = D; sfbp_pow = P; nqm = (nqm > 0) ? afl : 0;
+      return drift;
+    }
+
+    //The incremental metric is for the plain NLMS.  For the other kinds of processing (which update
+    //the coefficients differently), the misalignment is instead re-computed exactly once per block.
+    virtual void cha_afc_with_metric(float32_t *x, float32_t *y, int cs, const float32_t *ring) {
+      if ((sim_fbs == NULL) || isFiltered() || isAdaptScheduled() || (n_coeff_to_zero > 0) || (nqm != afl)) {
+        if (isFiltered()) {
+          cha_afc_filtered(x, y, cs, ring);
+        } else if (isAdaptScheduled()) {
+          cha_afc_scheduled(x, y, cs, ring);
+        } else {
+          afc_nlms_threepass(x, y, cs, ring, efbp, foo_float_array, afl, n_coeff_to_zero, mu, rho, eps, &pwr);
         }
-#endif
+        resyncMisalignment();
+        if (merr_out) for (int i = 0; i < cs; i++) merr_out[i] = getMisalignment();
+        sim_fbs = NULL; merr_out = NULL;
+        return;
+      }
 
-        if (n_coeff_to_zero > 0) {
-          //zero out the first feedback coefficients
-          for (int j=0; j < n_coeff_to_zero; j++) {
-            efbp[j] = 0.0;
-          }
+      //same as the original (three pass) processing, plus the metric
+      float32_t fbe, mum, s0, s1, g;
+      double rr = 0.0;  //r . r
+      n_coeff_updates_possible += cs * afl;  n_coeff_updates_done += cs * afl;
+      for (int i = 0; i < cs; i++) {
+        s0 = x[i];
+        const float32_t *r = ring + (cs - 1) - i;
+        if (i == 0) {
+          for (int j = 0; j < afl; j++) rr += (double)r[j] * r[j];
+        } else {
+          rr += (double)r[0] * r[0] - (double)r[afl] * r[afl];  //slide the window by one sample
         }
 
-        // copy AFC signal to output
+        arm_dot_prod_f32(r, efbp, afl, &fbe);
+        s1 = s0 - fbe;
+        pwr = rho * pwr + s0 * s0 + s1 * s1;
+        mum = mu / (eps + pwr);
+        g = mum * s1;
+
+        merr_D += 2.0 * g * ((double)fbe - sim_fbs[i]) + (double)g * g * rr;
+        if (merr_D < 0.0) merr_D = 0.0;  //rounding
+        if (merr_out) merr_out[i] = getMisalignment();
+
+        afc_axpy(efbp, g, r, afl);
         y[i] = s1;
       }
+      sim_fbs = NULL; merr_out = NULL;
+    }
+  #else
+    bool isTrackingMisalignment(void) { return false; }
+  #endif
+
+    //Like CHAPRO, the feedback model can be the adaptive filter (efbp) followed by a short band-limit
+    //filter (pfrp), which is adapted slowly (step size alf, every pup samples).  Also like CHAPRO, the
+    //adaptation can be driven by prewhitened signals: the error signal and the loopback audio are both
+    //passed through a prediction-error filter (wfrp) so that the strongly-colored speech does not bias
+    //the feedback estimate.  The whitening filter is re-computed once per block from the error signal.
+    //The adaptation schedule (see setAdaptSchedule()) is not used here.
+    virtual void cha_afc_filtered(float32_t *x, float32_t *y, int cs, const float32_t *ring) {
+      const int wfl = filt_params.wfl, pfl = filt_params.pfl;
+      float32_t fbe, w, v, s0, s1, xw, ee, vw, ww, mum;
+      int j0 = min(n_coeff_to_zero, afl);
+      for (int j = 0; j < j0; j++) efbp[j] = 0.0f;
+
+      for (int i = 0; i < cs; i++) {
+        s0 = x[i];
+        const float32_t *r = ring + (cs - 1) - i;  //r[j] is the loopback audio from j samples before this sample
+
+        //estimate and remove the feedback
+        w = afc_fir_newest_first(r, efbp, afl);  //output of the adaptive filter
+        if (pfl > 0) {
+          w_hist.push(&w, 1);
+          fbe = afc_fir_newest_first(w_hist.getNewest(), pfrp, pfl);  //...followed by the band-limit filter
+          v = afc_fir_newest_first(r, pfrp, pfl);  //band-limited loopback, for adapting efbp
+        } else {
+          fbe = w;
+          v = r[0];
+        }
+        s1 = s0 - fbe;
+        y[i] = s1;
+        v_hist.push(&v, 1);
+
+        //prewhiten the signals that drive the adaptation
+        if (wfl > 0) {
+          x_hist.push(&s0, 1); e_hist.push(&s1, 1);
+          xw = afc_fir_newest_first(x_hist.getNewest(), wfrp, wfl);
+          ee = afc_fir_newest_first(e_hist.getNewest(), wfrp, wfl);
+          vw = afc_fir_newest_first(v_hist.getNewest(), wfrp, wfl);
+          vw_hist.push(&vw, 1);
+          if (pfl > 0) {
+            ww = afc_fir_newest_first(w_hist.getNewest(), wfrp, wfl);
+            ww_hist.push(&ww, 1);
+          }
+        } else {
+          xw = s0; ee = s1;
+        }
+
+        //update the adaptive filter
+        pwr = rho * pwr + xw * xw + ee * ee;
+        mum = mu / (eps + pwr);
+        const float32_t *v_reg = (wfl > 0) ? vw_hist.getNewest() : v_hist.getNewest();
+        afc_axpy(efbp + j0, mum * ee, v_reg + j0, afl - j0);
+        n_coeff_updates_possible += afl;  n_coeff_updates_done += afl;
+
+        //update the band-limit filter
+        if ((pfl > 0) && (++band_limit_counter >= filt_params.pup)) {
+          band_limit_counter = 0;
+          const float32_t *w_reg = (wfl > 0) ? ww_hist.getNewest() : w_hist.getNewest();
+          afc_axpy(pfrp, (filt_params.alf / (eps + pwr)) * ee, w_reg, pfl);
+        }
+      }
+
+      if (wfl > 0) updateWhiteningFilter(cs);
+    }
+
+    //Smooth the autocorrelation of the error signal (from the block just processed) and then find the
+    //prediction-error filter for it.  If that fails (such as during silence), the old filter is kept.
+    void updateWhiteningFilter(int cs) {
+      const int wfl = filt_params.wfl;
+      const float32_t *e = e_hist.getNewest();
+      cs = min(cs, e_hist.getLength() - wfl);
+      for (int k = 0; k < wfl; k++) {
+        float32_t acc = afc_fir_newest_first(e, e + k, cs);
+        wf_acorr[k] = wf_smooth * wf_acorr[k] + (1.0f - wf_smooth) * acc;
+      }
+      afc_levinson(wf_acorr, wfrp, wfl - 1);
+    }
+
+    virtual void setFilterParams(AFC_FilterParams filt) {
+      filt.wfl = min(max(filt.wfl, 0), MAX_AFC_WFL);
+      filt.pfl = min(max(filt.pfl, 0), MAX_AFC_PFL);
+      filt.alf = max(filt.alf, 0.0f);
+      filt.pup = max(filt.pup, 1);
+      filt_params = filt;
+      resizeHistories();
+      initializeFilterStates();
+    }
+    virtual void setFilterParams(int wfl, int pfl, float32_t alf, int pup) {
+      AFC_FilterParams filt; filt.wfl = wfl; filt.pfl = pfl; filt.alf = alf; filt.pup = pup;
+      setFilterParams(filt);
+    }
+    AFC_FilterParams getFilterParams(void) { return filt_params; }
+    bool isFiltered(void) { return (filt_params.wfl > 0) || (filt_params.pfl > 0); }
+
+    //both filters start as a pass-through (a unit impulse)
+    void initializeFilterStates(void) {
+      for (int i = 0; i < MAX_AFC_WFL; i++) { wfrp[i] = 0.0f; wf_acorr[i] = 0.0f; }
+      for (int i = 0; i < MAX_AFC_PFL; i++) pfrp[i] = 0.0f;
+      wfrp[0] = 1.0f;  pfrp[0] = 1.0f;
+      x_hist.clear(); e_hist.clear(); v_hist.clear(); vw_hist.clear(); w_hist.clear(); ww_hist.clear();
+      band_limit_counter = 0;
+    }
+    virtual void printFilterParams(Print *p) {
+      p->print("AudioEffectFeedbackCancel_F32: wfl = "); p->print(filt_params.wfl);
+      p->print(", pfl = "); p->print(filt_params.pfl);
+      p->print(", alf = "); p->print(filt_params.alf, 8);
+      p->print(", pup = "); p->println(filt_params.pup);
+    }
+
+    //Hardware delay (samples) from the output audio to the input audio.  The feedback at input sample n
+    //is modeled from the output samples n-hdel, n-hdel-1, ... n-hdel-(afl-1).  The loopback audio always
+    //arrives (at least) one block later, so hdel should be at least one block.  If hdel is set to the
+    //true delay, no filter taps are wasted on the delay and afl can be shorter.
+    //Set to -1 (the default) to use exactly one audio block, which is what this class always did.
+    int setHdel(int _hdel) { hdel = min(max(_hdel, -1), MAX_AFC_HDEL); resizeHistories(); return hdel; }
+    int getHdel(void) { return hdel; }
+    int getEffectiveHdel(void) { return (hdel < 0) ? block_len : hdel; }
+    int getBlockLength(void) { return block_len; }
+
+    //Find the loopback history for the current block.  Each audio block carries a counter (id), so
+    //the absolute sample index of the input audio and of the loopback audio are both known.  If the
+    //loopback audio is not where it should be (it has not arrived yet, or it is too old), the block
+    //is counted as misaligned (see printAlignmentStats()).  Returns NULL if the ring buffer is too
+    //short for this block (it is sized for the block size that it was given, see resizeHistories()).
+    const float32_t* getAlignedRing(int cs) {
+      block_len = cs;
+      int eff_hdel = getEffectiveHdel();
+      long max_offset = ring_history.getLength() - (afl + cs);
+      long in_sync_offset = eff_hdel - cs;  //offset into the history for the last sample of the block, if in sync
+      long base_offset = in_sync_offset;
+      n_blocks_aligned++;
+      if (max_offset < 0) { n_blocks_misaligned++; return NULL; }
+      if ((current_block_id > 0) && (newest_ring_audio_block_id != 999999)) {
+        //the newest loopback sample is normally from the end of the previous block
+        long block_diff = (long)newest_ring_audio_block_id - ((long)current_block_id - 1);
+        last_block_diff = block_diff;
+        if (block_diff != 0) n_blocks_out_of_sequence++;
+        base_offset += block_diff * cs;
+      }
+      if ((base_offset < 0) || (base_offset > max_offset)) {
+        //the needed loopback audio is not available (or the block counters are not trustworthy), so
+        //fall back to assuming that the loopback is in sync, like this class has always done
+        n_blocks_misaligned++;
+        base_offset = min(max(in_sync_offset, 0L), max_offset);
+      }
+      return ring_history.getNewest() + base_offset;
+    }
+    void resetAlignmentStats(void) { n_blocks_aligned = 0; n_blocks_out_of_sequence = 0; n_blocks_misaligned = 0; }
+    virtual void printAlignmentStats(Print *p) {
+      p->print("AudioEffectFeedbackCancel_F32: Loopback: hdel = "); p->print(hdel);
+      p->print(", blocks = "); p->print(n_blocks_aligned);
+      p->print(", out of sequence = "); p->print(n_blocks_out_of_sequence);
+      p->print(" (last offset = "); p->print(last_block_diff);
+      p->print(" blocks), misaligned = "); p->println(n_blocks_misaligned);
     }
 
     virtual void addNewAudio(audio_block_f32_t *in_block) {
@@ -246,26 +578,127 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
     virtual void addNewAudio(float *x, //input audio block
                              int cs)   //number of samples in this audio block
     {
-      int Isrc, Idst;
-      //we're going to store the audio data in reverse order so that
-      //the newest is at index 0 and the oldest is at the end
-      //the only part of the buffer that we're using is [0 afl+cs-1]
-
-      //slide the data to the older end of the buffer (overwriting the very oldest data)
-      Idst = afl + cs - 1; //start with the destination at the end of the buffer
-      for (int Isrc = (afl - 1); Isrc > -1; Isrc--) {
-        ring[Idst] = ring[Isrc];
-        Idst--;
-      }
+      //the history is stored newest-first without needing to move the older data (see DelayHistory_F32.h)
+      ring_history.push(x, cs);
+    }
+
+    virtual void setAdaptSchedule(AFC_AdaptSchedule sched) {
+      sched.mode = min(max(sched.mode, (int)AFC_ADAPT_EVERY_SAMPLE), (int)AFC_ADAPT_N_MODES-1);
+      sched.n = max(sched.n, 1);
+      sched.pwr_thresh = max(sched.pwr_thresh, 0.0f);
+      adapt_sched = sched;
+      resetAdaptStats();
+    }
+    virtual void setAdaptSchedule(int mode, int n, float32_t pwr_thresh) {
+      AFC_AdaptSchedule sched; sched.mode = mode; sched.n = n; sched.pwr_thresh = pwr_thresh;
+      setAdaptSchedule(sched);
+    }
+    AFC_AdaptSchedule getAdaptSchedule(void) { return adapt_sched; }
+    bool isAdaptScheduled(void) { return (adapt_sched.mode != AFC_ADAPT_EVERY_SAMPLE) || (adapt_sched.pwr_thresh > 0.0f); }
+    void resetAdaptStats(void) { n_coeff_updates_possible = 0; n_coeff_updates_done = 0; }
+
+    //report what fraction of the coefficient updates were skipped (ie, the CPU saved in the adaptation)
+    virtual void printAdaptStats(Print *p) {
+      const char *mode_names[] = {"every sample", "every Nth sample", "round-robin"};
+      p->print("AudioEffectFeedbackCancel_F32: Adaptation: "); p->print(mode_names[adapt_sched.mode]);
+      p->print(", N = "); p->print(adapt_sched.n);
+      p->print(", pwr_thresh = "); p->println(adapt_sched.pwr_thresh, 6);
+      float frac_done = 1.0f;
+      if (n_coeff_updates_possible > 0) frac_done = (float)((double)n_coeff_updates_done / (double)n_coeff_updates_possible);
+      p->print("    : Coefficient updates skipped = "); p->print(100.0f*(1.0f - frac_done), 1); p->println("%");
+      p->print("    : AFC CPU (this object) = "); p->print(processorUsage(), 1);
+      p->print("%, max = "); p->print(processorUsageMax(), 1); p->println("%");
+    }
 
-      //add new data to front (we're also reversing it)
-      Idst = cs - 1; //the given data is only "cs" long
-      for (Isrc = 0; Isrc < cs; Isrc++) { //the given data is in normal order (oldest first, newest last) so start at index 0
-        ring[Idst] = x[Isrc];
-        Idst--;
+    bool setUseFusedKernel(bool _use) { return use_fused_kernel = _use; }
+    bool getUseFusedKernel(void) { return use_fused_kernel; }
+
+
+    //Snapshot of the feedback model for use in loop().  It is copied by the audio processing every
+    //N blocks, so loop() never sees coefficients that are half-way through being updated.
+    //publishFeedbackModel() returns the change of the model since the last snapshot (see updateConvergence()).
+    virtual float32_t publishFeedbackModel(void) { fb_snapshot.publish(efbp, afl); return fb_snapshot.getLastChange(); }
+    int setFeedbackModelPeriod_blocks(int n_blocks) { return fb_snapshot.setPeriod_blocks(n_blocks); }
+    int getFeedbackModelPeriod_blocks(void) { return fb_snapshot.getPeriod_blocks(); }
+    virtual int getFeedbackModel(float32_t *h, int n_max, uint32_t *seq = NULL) { return fb_snapshot.read(h, n_max, seq); }
+    virtual uint32_t getFeedbackModelSequence(void) { return fb_snapshot.getSequence(); }
+    virtual int writeFeedbackModelBinary(Print *p) { return fb_snapshot.writeBinary(p); }  //see FeedbackModelSnapshot_F32.h for the format
+
+    //Warm start.  getWarmState() copies the feedback model, the power estimate, and the loopback
+    //history so that they can be saved (to SD, for example).  setWarmState() puts them back, but only if
+    //they were saved with the same filter length and hardware delay.  Both are called from loop(), so the
+    //audio interrupt is held off while copying.  The key (preset, earpiece, ear) is left to the caller.
+    virtual bool getWarmState(AFC_WarmState *s) {
+      AudioNoInterrupts();
+      s->afl = afl;
+      s->hdel = getEffectiveHdel();
+      s->n_ring = min(afl + s->hdel + block_len, min(ring_history.getLength(), AFC_WARM_MAX_RING));
+      s->pwr = pwr;
+      for (int i = 0; i < MAX_AFC_FILT_LEN; i++) s->efbp[i] = (i < afl) ? efbp[i] : 0.0f;
+      const float32_t *ring = ring_history.getNewest();
+      for (int i = 0; i < AFC_WARM_MAX_RING; i++) s->ring[i] = (i < s->n_ring) ? ring[i] : 0.0f;
+      AudioInterrupts();
+      s->magic = AFC_WARM_STATE_MAGIC;
+      s->version = AFC_WARM_STATE_VERSION;
+      s->checksum = afc_warmStateChecksum(s);
+      return true;
+    }
+    virtual bool setWarmState(const AFC_WarmState *s) {
+      if ((s->magic != AFC_WARM_STATE_MAGIC) || (s->version != AFC_WARM_STATE_VERSION) || (s->checksum != afc_warmStateChecksum(s))) {
+        Serial.println(F("AudioEffectFeedbackCancel_F32: setWarmState: *** ERROR ***: not a valid AFC state."));
+        return false;
+      }
+      if ((s->afl != afl) || (s->hdel != getEffectiveHdel()) || (s->n_ring > ring_history.getLength())) {
+        Serial.println(F("AudioEffectFeedbackCancel_F32: setWarmState: *** ERROR ***"));
+        Serial.print(F("    : Saved afl, hdel (")); Serial.print(s->afl); Serial.print(", "); Serial.print(s->hdel);
+        Serial.print(F(") do not match the current (")); Serial.print(afl); Serial.print(", "); Serial.print(getEffectiveHdel());
+        Serial.println(F(").  Not restoring."));
+        return false;
       }
+      AudioNoInterrupts();
+      pwr = s->pwr;
+      for (int i = 0; i < afl; i++) efbp[i] = s->efbp[i];
+      ring_history.clear();
+      for (int i = s->n_ring-1; i >= 0; i--) ring_history.push(&(s->ring[i]), 1);  //push() wants oldest first
+      initializeFilterStates();
+      startConvergenceTimer(true);
+      AudioInterrupts();
+      return true;
     }
 
+    //Time to convergence: from startConvergenceTimer() (at boot, at initializeStates(), and at a warm
+    //start) until the feedback model stops settling.  The change of the model from one snapshot to the
+    //next (see setFeedbackModelPeriod_blocks()) shrinks as the AFC converges, down to a floor that is set
+    //by mu and the audio.  Once the (smoothed) change has not improved by conv_margin_dB for
+    //conv_n_needed snapshots, the AFC is converged, as of the last improvement.
+    void startConvergenceTimer(bool is_warm) {
+      conv_start_millis = millis();
+      conv_improved_millis = conv_start_millis;
+      conv_millis = 0;
+      conv_n_quiet = 0;
+      conv_smooth_dB = 0.0f;
+      conv_best_dB = 0.0f;
+      conv_has_change = false;
+      conv_is_warm = is_warm;
+      conv_is_converged = false;
+    }
+    float32_t setConvergenceMargin_dB(float32_t margin_dB) { return conv_margin_dB = max(margin_dB, 0.0f); }
+    float32_t getConvergenceMargin_dB(void) { return conv_margin_dB; }
+    int setConvergenceSnapshots(int n) { return conv_n_needed = max(n, 1); }
+    bool isConverged(void) { return conv_is_converged; }
+    unsigned long getConvergenceTime_msec(void) { return conv_millis; }  //zero if not yet converged
+    bool isWarmStarted(void) { return conv_is_warm; }
+    virtual void printConvergence(Print *p) {
+      p->print("AudioEffectFeedbackCancel_F32: "); p->print(conv_is_warm ? "warm" : "cold");
+      if (conv_is_converged) {
+        p->print(" start, converged in "); p->print(conv_millis); p->println(" msec");
+      } else {
+        p->print(" start, not yet converged after "); p->print(millis() - conv_start_millis); p->println(" msec");
+      }
+      p->print("    : model change per snapshot = "); p->print(conv_smooth_dB, 1);
+      p->print(" dB (smoothed), margin = "); p->print(conv_margin_dB, 1);
+      p->print(" dB for "); p->print(conv_n_needed); p->println(" snapshots");
+    }
 
     virtual void printEstimatedFeedbackImpulseResponse(void) {
       printEstimatedFeedbackImpulseResponse(&Serial, false);
@@ -277,11 +710,16 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
       printEstimatedFeedbackImpulseResponse(p, false);
     }
     virtual void printEstimatedFeedbackImpulseResponse(Print *p, bool flag_eachOnNewLine) {
+      static float32_t h[MAX_AFC_SNAPSHOT_LEN];
+      int n = getFeedbackModel(h, MAX_AFC_SNAPSHOT_LEN);
+      printImpulseResponse(p, h, n, flag_eachOnNewLine);
+    }
+    static void printImpulseResponse(Print *p, const float32_t *h, int n, bool flag_eachOnNewLine) {
       p->println("AudioEffectFeedbacCancel_F32: estimated feedback impulse response:");
       float scale = 1.0;
       if (flag_eachOnNewLine) scale = 20.0;
-      for (int i = 0; i < afl; i++) {
-        p->print(efbp[i]*scale, 4);
+      for (int i = 0; i < n; i++) {
+        p->print(h[i]*scale, 4);
         if (flag_eachOnNewLine) {
           p->println();
         } else {
@@ -295,6 +733,17 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
     //state-related variables
     audio_block_f32_t *inputQueueArray_f32[1]; //memory pointer for the input to this module
     bool enable = true;
+    bool use_fused_kernel = true;  //set false to use the original (three pass) NLMS processing
+    AFC_AdaptSchedule adapt_sched;
+    unsigned long adapt_counter = 0;
+    uint64_t n_coeff_updates_possible = 0, n_coeff_updates_done = 0;
+
+    //loopback alignment
+    int hdel = -1;  //see setHdel()
+    int block_len = AUDIO_BLOCK_SAMPLES;  //updated with each block that is processed
+    unsigned long current_block_id = 0;
+    unsigned long n_blocks_aligned = 0, n_blocks_out_of_sequence = 0, n_blocks_misaligned = 0;
+    long last_block_diff = 0;
 
     //AFC parameters
     float32_t mu;    // AFC scale factor for how fast the filter adapts (bigger is faster)
@@ -308,6 +757,51 @@ class AudioEffectFeedbackCancel_Local_F32 : public AudioStream_F32
     float32_t efbp[MAX_AFC_FILT_LEN];  //vector holding the estimated feedback impulse response
     float32_t foo_float_array[MAX_AFC_FILT_LEN];
 
+    //prewhitening and band-limit filters (see cha_afc_filtered())
+    AFC_FilterParams filt_params;
+    float32_t wfrp[MAX_AFC_WFL];     //whitening (prediction-error) filter
+    float32_t wf_acorr[MAX_AFC_WFL]; //smoothed autocorrelation of the error signal
+    float32_t wf_smooth = 0.95;      //smoothing of the autocorrelation, per block
+    float32_t pfrp[MAX_AFC_PFL];     //band-limit filter
+    int band_limit_counter = 0;
+    DelayHistoryHeap_F32 x_hist, e_hist;   //input and error signals (sized by resizeHistories())
+    DelayHistoryHeap_F32 v_hist, vw_hist;  //band-limited loopback audio (and whitened)
+    DelayHistoryHeap_F32 w_hist, ww_hist;  //output of the adaptive filter (and whitened)
+
+    FeedbackModelSnapshot_F32<MAX_AFC_SNAPSHOT_LEN> fb_snapshot;
+
+    //time to convergence (see startConvergenceTimer())
+    void updateConvergence(float32_t change) {
+      if (change < 0.0f) return;  //not known (such as a model that is all zeros)
+      float32_t change_dB = 10.0f * log10f(max(change, 1.0e-10f));
+      conv_smooth_dB = conv_has_change ? (0.5f * conv_smooth_dB + 0.5f * change_dB) : change_dB;
+      conv_has_change = true;
+      if (conv_is_converged) return;
+      if (conv_smooth_dB < conv_best_dB - conv_margin_dB) {
+        //still settling
+        conv_best_dB = conv_smooth_dB;
+        conv_improved_millis = millis();
+        conv_n_quiet = 0;
+      } else if (++conv_n_quiet >= conv_n_needed) {
+        conv_is_converged = true;
+        conv_millis = max(conv_improved_millis - conv_start_millis, 1UL);
+      }
+    }
+    unsigned long conv_start_millis = 0, conv_improved_millis = 0, conv_millis = 0;
+    float32_t conv_smooth_dB = 0.0f, conv_best_dB = 0.0f;  //smoothed change of the model, and its best (lowest) so far
+    float32_t conv_margin_dB = 1.0;
+    int conv_n_quiet = 0, conv_n_needed = 8;
+    bool conv_has_change = false, conv_is_warm = false, conv_is_converged = false;
+
+    //quality metric for simulations (see setTrueFeedbackPath())
+  #if (USE_AFC_SIM_METRIC)
+    float32_t sfbp[MAX_AFC_FILT_LEN];  //true (simulated) feedback path
+    int nqm = 0;                       //number of coefficients in the metric (0 = off)
+    double merr_D = 0.0, sfbp_pow = 0.0;  //squared error of the model and the power of the true path
+    const float32_t *sim_fbs = NULL;   //simulated feedback for the current block
+    float32_t *merr_out = NULL;        //where to put the misalignment for each sample of the current block
+  #endif
+
 };  //end class definition
 
 
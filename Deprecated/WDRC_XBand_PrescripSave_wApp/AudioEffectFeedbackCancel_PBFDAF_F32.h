@@ -0,0 +1,402 @@
+/*
+   AudioEffectFeedbackCancel_PBFDAF_F32
+
+   Created: OpenAudio, 2022
+   Purpose: Adaptive feedback cancelation using a partitioned-block frequency-domain adaptive
+       filter (PBFDAF).  The time-domain NLMS of AudioEffectFeedbackCancel_Local_F32 costs O(afl) per
+       sample, which limits the feedback model to about 100 taps.  Here, the feedback model is split
+       into partitions that are each one audio block long.  The filtering and the adaptation are done
+       with FFTs (overlap-save), so the cost grows much more slowly with afl.  This allows feedback
+       models of 512 taps (21 msec at 24kHz), which is needed for open-fit earpieces.
+
+       The class derives from AudioEffectFeedbackCancel_Local_F32 so that it has the same interface
+       (setParams(CHA_AFC), setMu/Rho/Eps, addNewAudio) and so that it works with the same
+       AudioEffectFeedbackCancel_LoopBack_Local_F32 object for receiving the loopback audio.
+
+       mu, rho, and eps have the same meaning as for the time-domain NLMS.  They are converted into a
+       per-frequency-bin normalized step size internally.  Note that the adaptation is normalized by
+       the power of the loopback (output) audio in each bin, as is usual for a frequency-domain
+       adaptive filter, whereas the BTNRH NLMS normalizes by the power of the input audio.
+
+       The coefficient gradient is constrained (the circular-convolution part is removed) for only
+       one partition per audio block, in round-robin order, which saves most of the FFTs.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _AudioEffectFeedbackCancel_PBFDAF_F32_h
+#define _AudioEffectFeedbackCancel_PBFDAF_F32_h
+
+#include <arm_math.h> //ARM DSP extensions.  https://www.keil.com/pack/doc/CMSIS/DSP/html/index.html
+#include <AudioStream_F32.h>
+#include <Arduino.h>  //for Serial.println()
+#include "AudioEffectFeedbackCancel_Local_F32.h"
+
+#ifndef MAX_PBFDAF_FILT_LEN
+#define MAX_PBFDAF_FILT_LEN  512   //longest allowed adaptive filter (afl)
+#endif
+#define MAX_PBFDAF_NFFT  256   //largest FFT.  Allows audio blocks up to 128 samples
+#define MIN_PBFDAF_NFFT  32    //smallest FFT supported by arm_rfft_fast_f32
+#define MAX_PBFDAF_STORAGE (4*MAX_PBFDAF_FILT_LEN + 2*MAX_PBFDAF_NFFT)  //n_partitions * N_FFT, in the worst case
+
+// ///////////////////////////////////////////////// PBFDAF_F32
+//
+// The signal processing, without any of the AudioStream_F32 stuff, so that it can also be run offline.
+// All spectra are in the packed format of arm_rfft_fast_f32: [DC, Nyquist, re(1), im(1), re(2), im(2), ...]
+class PBFDAF_F32 {
+  public:
+    PBFDAF_F32(void) {};
+
+    //configure for the given audio block size (which is also the partition length) and filter length.
+    //returns the filter length (rounded up to a whole number of partitions), or -1 on error.
+    int setup(int _block_len, int _afl) {
+      if ((_block_len < 1) || (2*_block_len > MAX_PBFDAF_NFFT)) {
+        Serial.println(F("PBFDAF_F32: *** ERROR ***"));
+        Serial.print(F("    : Block length (")); Serial.print(_block_len);
+        Serial.print(F(") must be between 1 and ")); Serial.println(MAX_PBFDAF_NFFT/2);
+        n_part = 0;
+        return -1;
+      }
+      block_len = _block_len;
+      N_FFT = MIN_PBFDAF_NFFT; while (N_FFT < 2*block_len) N_FFT *= 2;  //overlap-save needs at least 2x the partition length
+      n_part = (min(max(_afl, 1), MAX_PBFDAF_FILT_LEN) + block_len - 1) / block_len;
+      while ((n_part * N_FFT) > MAX_PBFDAF_STORAGE) n_part--;  //should never happen
+      arm_rfft_fast_init_f32(&fft_inst, N_FFT);
+      reset();
+      return getAfl();
+    }
+
+    void reset(void) {
+      for (int i = 0; i < MAX_PBFDAF_STORAGE; i++) { W[i] = 0.0f; U[i] = 0.0f; }
+      for (int i = 0; i < MAX_PBFDAF_NFFT; i++) u_frame[i] = 0.0f;
+      for (int i = 0; i <= MAX_PBFDAF_NFFT/2; i++) binPwr[i] = 0.0f;
+      newest_part = 0; next_part_to_constrain = 0;
+      n_wrong_block_len = 0;
+    }
+
+    //add the newest output (loopback) audio.  Call once per audio block, before process().
+    void addLoopbackAudio(const float32_t *u, int cs, float32_t rho) {
+      if ((n_part == 0) || (cs != block_len)) return;
+
+      //slide the time-domain frame and add the new audio at the end
+      for (int i = 0; i < N_FFT - block_len; i++) u_frame[i] = u_frame[i + block_len];
+      for (int i = 0; i < block_len; i++) u_frame[N_FFT - block_len + i] = u[i];
+
+      //transform into the newest slot of the frequency-domain delay line
+      newest_part = (newest_part + 1) % n_part;
+      float32_t *Unew = U + newest_part * N_FFT;
+      for (int i = 0; i < N_FFT; i++) buff1[i] = u_frame[i];  //the FFT overwrites its input
+      arm_rfft_fast_f32(&fft_inst, buff1, Unew, 0);
+
+      //smoothed power in each bin.  Use the same time constant as the NLMS, but no faster than 2 blocks
+      float32_t a = max(powf(rho, (float32_t)block_len), 0.5f);
+      binPwr[0] = a*binPwr[0] + (1.0f-a)*(Unew[0]*Unew[0]);
+      binPwr[N_FFT/2] = a*binPwr[N_FFT/2] + (1.0f-a)*(Unew[1]*Unew[1]);
+      for (int k = 1; k < N_FFT/2; k++) {
+        binPwr[k] = a*binPwr[k] + (1.0f-a)*(Unew[2*k]*Unew[2*k] + Unew[2*k+1]*Unew[2*k+1]);
+      }
+    }
+
+    //remove the estimated feedback from x (giving y) and then adapt the filter
+    void process(const float32_t *x, float32_t *y, int cs, float32_t mu, float32_t rho, float32_t eps) {
+      if ((n_part == 0) || (cs != block_len)) {
+        n_wrong_block_len++;
+        for (int i = 0; i < cs; i++) y[i] = x[i];
+        return;
+      }
+
+      //estimate the feedback: sum over all partitions of W_k * U_{newest-k}
+      for (int i = 0; i < N_FFT; i++) buff1[i] = 0.0f;
+      for (int k = 0; k < n_part; k++) cmac(buff1, W + k*N_FFT, getU(k), false);
+      arm_rfft_fast_f32(&fft_inst, buff1, buff2, 1);  //inverse FFT
+
+      //remove the estimated feedback.  Only the last block_len samples are valid (overlap-save).
+      int offset = N_FFT - block_len;
+      for (int i = 0; i < block_len; i++) y[i] = x[i] - buff2[offset + i];
+
+      //transform the error signal (zero-padded at the front)
+      for (int i = 0; i < offset; i++) buff1[i] = 0.0f;
+      for (int i = 0; i < block_len; i++) buff1[offset + i] = y[i];
+      arm_rfft_fast_f32(&fft_inst, buff1, buff2, 0);
+
+      //normalize by the power in each bin.  See the comments at the top regarding mu and eps.
+      float32_t c = 0.5f * (float32_t)N_FFT * max(1.0f - rho, 0.01f);
+      float32_t mu_f = mu * c, eps_f = eps * c;
+      buff2[0] *= mu_f / (eps_f + binPwr[0]);
+      buff2[1] *= mu_f / (eps_f + binPwr[N_FFT/2]);
+      for (int k = 1; k < N_FFT/2; k++) {
+        float32_t scale = mu_f / (eps_f + binPwr[k]);
+        buff2[2*k] *= scale; buff2[2*k+1] *= scale;
+      }
+
+      //update every partition with the unconstrained gradient: W_k += conj(U_{newest-k}) * E
+      for (int k = 0; k < n_part; k++) cmac(W + k*N_FFT, buff2, getU(k), true);
+
+      //constrain one partition: go to the time domain and zero everything beyond the partition length
+      float32_t *Wk = W + next_part_to_constrain * N_FFT;
+      for (int i = 0; i < N_FFT; i++) buff1[i] = Wk[i];
+      arm_rfft_fast_f32(&fft_inst, buff1, buff2, 1);
+      for (int i = block_len; i < N_FFT; i++) buff2[i] = 0.0f;
+      arm_rfft_fast_f32(&fft_inst, buff2, Wk, 0);
+      next_part_to_constrain = (next_part_to_constrain + 1) % n_part;
+    }
+
+    //get the time-domain impulse response of the feedback model.  Returns the number of values written.
+    //If called from loop(), the values might be from two different audio blocks, so it is better to use
+    //the snapshot from AudioEffectFeedbackCancel_PBFDAF_F32::getFeedbackModel().
+    int getImpulseResponse(float32_t *h, int n_max) { return getImpulseResponse(W, n_part, h, n_max); }
+
+    //same, but for a copy of the partitions (see getPartitions())
+    int getImpulseResponse(const float32_t *W_parts, int n_parts, float32_t *h, int n_max) {
+      float32_t tmp1[MAX_PBFDAF_NFFT], tmp2[MAX_PBFDAF_NFFT];
+      int count = 0;
+      for (int k = 0; k < n_parts; k++) {
+        for (int i = 0; i < N_FFT; i++) tmp1[i] = W_parts[k*N_FFT + i];
+        arm_rfft_fast_f32(&fft_inst, tmp1, tmp2, 1);
+        for (int i = 0; (i < block_len) && (count < n_max); i++) h[count++] = tmp2[i];
+      }
+      return count;
+    }
+
+    //the spectra of the partitions of the feedback model (n_part * N_FFT values)
+    const float32_t* getPartitions(void) { return W; }
+    int getPartitionsLength(void) { return n_part * N_FFT; }
+
+    int getAfl(void) { return n_part * block_len; }
+    int getBlockLen(void) { return block_len; }
+    int getNFFT(void) { return N_FFT; }
+    int getNPartitions(void) { return n_part; }
+    unsigned long getNWrongBlockLen(void) { return n_wrong_block_len; }
+
+  protected:
+    arm_rfft_fast_instance_f32 fft_inst;
+    int block_len = 0, N_FFT = 0, n_part = 0;
+    int newest_part = 0, next_part_to_constrain = 0;
+    unsigned long n_wrong_block_len = 0;
+    float32_t W[MAX_PBFDAF_STORAGE];  //spectra of the partitions of the feedback model
+    float32_t U[MAX_PBFDAF_STORAGE];  //spectra of the loopback audio (frequency-domain delay line)
+    float32_t binPwr[MAX_PBFDAF_NFFT/2+1];
+    float32_t u_frame[MAX_PBFDAF_NFFT], buff1[MAX_PBFDAF_NFFT], buff2[MAX_PBFDAF_NFFT];
+
+    //spectrum of the loopback audio from k blocks ago
+    float32_t* getU(int k) { return U + ((newest_part - k + n_part) % n_part) * N_FFT; }
+
+    //acc += A * B (or A * conj(B)), all in the packed format of arm_rfft_fast_f32
+    void cmac(float32_t *acc, const float32_t *A, const float32_t *B, bool conj_B) {
+      acc[0] += A[0] * B[0];  //DC
+      acc[1] += A[1] * B[1];  //Nyquist
+      float32_t sgn = conj_B ? -1.0f : 1.0f;
+      for (int i = 2; i < N_FFT; i += 2) {
+        float32_t br = B[i], bi = sgn * B[i+1];
+        acc[i]   += A[i] * br - A[i+1] * bi;
+        acc[i+1] += A[i] * bi + A[i+1] * br;
+      }
+    }
+};
+
+// ///////////////////////////////////////////////// AudioEffectFeedbackCancel_PBFDAF_F32
+
+class AudioEffectFeedbackCancel_PBFDAF_F32 : public AudioEffectFeedbackCancel_Local_F32
+{
+    //GUI: inputs:1, outputs:1  //this line used for automatic generation of GUI node
+    //GUI: shortName: FB_Cancel_PBFDAF
+  public:
+    //constructor
+    AudioEffectFeedbackCancel_PBFDAF_F32(void) : AudioEffectFeedbackCancel_Local_F32() {
+      resizeHistories();
+      setBlockSize(AUDIO_BLOCK_SAMPLES);
+    }
+    AudioEffectFeedbackCancel_PBFDAF_F32(const AudioSettings_F32 &settings) : AudioEffectFeedbackCancel_Local_F32(settings) {
+      resizeHistories();
+      setBlockSize(settings.audio_block_samples);
+    }
+
+    virtual void setParams(BTNRH_WDRC::CHA_AFC cha) {
+      AudioEffectFeedbackCancel_Local_F32::setParams(cha);
+    }
+    virtual void setParams(float _mu, float _rho, float _eps, int _afl) {
+      setMu(_mu); setRho(_rho); setEps(_eps);
+      setAfl(_afl);  //no need to check against the time-domain ring buffer
+    }
+
+    //changing the filter length (or block size) resets the feedback model.  The PBFDAF is rebuilt with
+    //the audio interrupt held off, so this is done from loop() (or setup()), like resizeHistories().
+    virtual int setAfl(int _afl) {
+      if (_afl > MAX_PBFDAF_FILT_LEN) {
+        Serial.println(F("AudioEffectFeedbackCancel_PBFDAF_F32: *** ERROR ***"));
+        Serial.print(F("    : Adaptive filter length (")); Serial.print(_afl);
+        Serial.print(F(") too long.  Limiting to ")); Serial.println(MAX_PBFDAF_FILT_LEN);
+      }
+      target_afl = min(max(_afl, 1), MAX_PBFDAF_FILT_LEN);
+      AudioNoInterrupts();
+      afl = max(pbfdaf.setup(block_len, target_afl), 0);
+      AudioInterrupts();
+      return afl;
+    }
+    virtual int setBlockSize(int _block_len) {
+      block_len = _block_len;
+      setAfl(target_afl);
+      return block_len;
+    }
+
+    virtual void initializeStates(void) {
+      AudioEffectFeedbackCancel_Local_F32::initializeStates();
+      pbfdaf.reset();
+    }
+
+    //the loopback audio is kept by the PBFDAF (in the frequency domain), so the time-domain ring
+    //buffer and filter histories are not needed
+    virtual void resizeHistories(void) {
+      ring_history.setLength(0);
+      x_hist.setLength(0); e_hist.setLength(0); v_hist.setLength(0); vw_hist.setLength(0); w_hist.setLength(0); ww_hist.setLength(0);
+    }
+
+    virtual void cha_afc(float32_t *x, float32_t *y, int cs) {
+      pbfdaf.process(x, y, cs, mu, rho, eps);
+    }
+
+    using AudioEffectFeedbackCancel_Local_F32::addNewAudio;
+    virtual void addNewAudio(float *x, int cs) {
+      pbfdaf.addLoopbackAudio(x, cs, rho);
+    }
+
+    //The model is in the frequency domain.  The audio processing only copies the partitions, and the
+    //inverse FFTs to get the impulse response are done by loop() when it reads the model.  The change of
+    //the model (for the time to convergence) is measured on the spectra, which (by Parseval) tracks the
+    //change of the impulse response.
+    virtual float32_t publishFeedbackModel(void) {
+      W_snapshot.publish(pbfdaf.getPartitions(), pbfdaf.getPartitionsLength());
+      return W_snapshot.getLastChange();
+    }
+    virtual int getFeedbackModel(float32_t *h, int n_max, uint32_t *seq = NULL) {
+      for (int Itry = 0; Itry < 4; Itry++) {
+        int n;
+        uint32_t s;
+        const float32_t *W_parts = W_snapshot.beginRead(&n, &s);
+        int count = pbfdaf.getImpulseResponse(W_parts, n / max(pbfdaf.getNFFT(), 1), h, n_max);
+        if (W_snapshot.endRead(s)) {
+          if (seq) *seq = s;
+          return count;
+        }
+      }
+      return 0;  //the audio processing is publishing faster than loop() can read...should never happen
+    }
+    virtual uint32_t getFeedbackModelSequence(void) { return W_snapshot.getSequence(); }
+    virtual int writeFeedbackModelBinary(Print *p) {
+      float32_t h[MAX_PBFDAF_FILT_LEN];
+      uint32_t seq = 0;
+      int n = getFeedbackModel(h, MAX_PBFDAF_FILT_LEN, &seq);
+      return FeedbackModelSnapshot_F32<MAX_PBFDAF_FILT_LEN>::writeBinary(p, h, n, seq);
+    }
+    virtual void printEstimatedFeedbackImpulseResponse(Print *p, bool flag_eachOnNewLine) {
+      static float32_t h[MAX_PBFDAF_FILT_LEN];
+      printImpulseResponse(p, h, getFeedbackModel(h, MAX_PBFDAF_FILT_LEN), flag_eachOnNewLine);
+    }
+    using AudioEffectFeedbackCancel_Local_F32::printEstimatedFeedbackImpulseResponse;
+
+    //the warm start only knows about the time-domain state (efbp, pwr, and the ring buffer)
+    virtual bool getWarmState(AFC_WarmState *s) {
+      Serial.println(F("AudioEffectFeedbackCancel_PBFDAF_F32: getWarmState: not supported."));
+      return false;
+    }
+    virtual bool setWarmState(const AFC_WarmState *s) {
+      Serial.println(F("AudioEffectFeedbackCancel_PBFDAF_F32: setWarmState: not supported."));
+      return false;
+    }
+
+    PBFDAF_F32 pbfdaf;
+
+  protected:
+    int block_len = AUDIO_BLOCK_SAMPLES;
+    int target_afl = 100;
+    FeedbackModelSnapshot_F32<MAX_PBFDAF_STORAGE> W_snapshot;  //the partitions, for loop() (see publishFeedbackModel())
+};
+
+// ///////////////////////////////////////////////// Benchmark
+
+#define PBFDAF_BENCH_BLOCK 24
+#define PBFDAF_BENCH_PATH_LEN 400
+
+//the benchmark itself, on the objects and buffers from pbfdaf_benchmarkVsNLMS()
+static inline void pbfdaf_benchmarkVsNLMS_run(Print *p, PBFDAF_F32 &pbfdaf, float32_t *sim_ring, float32_t *h_true, float32_t *nlms_ring, float32_t *nlms_efbp, int n_blocks) {
+  float32_t u[PBFDAF_BENCH_BLOCK], x[PBFDAF_BENCH_BLOCK], y[PBFDAF_BENCH_BLOCK];
+  const int cs = PBFDAF_BENCH_BLOCK;
+  const float32_t mu = 1.0e-3f, rho = 0.9f, eps = 0.008f;
+  const int all_afl[] = {128, 256, 512};
+
+  //simulated feedback path: a few msec of delay and then a decaying resonance
+  for (int j = 0; j < PBFDAF_BENCH_PATH_LEN; j++) {
+    h_true[j] = (j < 40) ? 0.0f : 0.05f * expf(-(float)(j-40)/60.0f) * sinf(2.0f*(float)PI*0.11f*(float)(j-40));
+  }
+
+  p->println("PBFDAF Benchmark: afl, NLMS (usec/block), PBFDAF (usec/block), NLMS ERLE (dB), PBFDAF ERLE (dB)");
+  for (unsigned int Itest = 0; Itest < sizeof(all_afl)/sizeof(all_afl[0]); Itest++) {
+    int afl = all_afl[Itest];
+    unsigned long dT_nlms = 0, dT_pbfdaf = 0;
+    double x_pow = 0.0, e_nlms_pow = 0.0, e_pbfdaf_pow = 0.0;
+    float32_t pwr = 0.0f;
+    uint32_t seed = 12345;
+    for (int i = 0; i < PBFDAF_BENCH_PATH_LEN + cs + 1; i++) sim_ring[i] = 0.0f;
+    for (int i = 0; i < MAX_PBFDAF_FILT_LEN + cs + 1; i++) nlms_ring[i] = 0.0f;
+    for (int i = 0; i < MAX_PBFDAF_FILT_LEN; i++) nlms_efbp[i] = 0.0f;
+    pbfdaf.setup(cs, afl);
+
+    for (int Iblock = 0; Iblock < n_blocks; Iblock++) {
+      //simulate the microphone signal: the previous output through the feedback path
+      for (int i = 0; i < cs; i++) {
+        const float32_t *r = sim_ring + (cs - 1) - i;
+        float32_t acc = 0.0f;
+        for (int j = 0; j < PBFDAF_BENCH_PATH_LEN; j++) acc += r[j] * h_true[j];
+        x[i] = acc;
+      }
+
+      unsigned long t0 = micros();
+      afc_nlms_fused(x, y, cs, nlms_ring, nlms_efbp, afl, 0, mu, rho, eps, &pwr);
+      unsigned long t1 = micros();
+      if (Iblock >= 3*n_blocks/4) for (int i = 0; i < cs; i++) { x_pow += x[i]*x[i];  e_nlms_pow += y[i]*y[i]; }
+      pbfdaf.process(x, y, cs, mu, rho, eps);
+      unsigned long t2 = micros();
+      if (Iblock >= 3*n_blocks/4) for (int i = 0; i < cs; i++) e_pbfdaf_pow += y[i]*y[i];
+
+      //new output audio (white noise) goes to the loopback
+      for (int i = 0; i < cs; i++) {
+        seed = seed * 1664525UL + 1013904223UL;
+        u[i] = ((float32_t)(seed >> 8) / 16777216.0f) - 0.5f;
+      }
+      unsigned long t3 = micros();
+      afc_ring_push_reversed(nlms_ring, afl, u, cs);
+      unsigned long t4 = micros();
+      pbfdaf.addLoopbackAudio(u, cs, rho);
+      unsigned long t5 = micros();
+      afc_ring_push_reversed(sim_ring, PBFDAF_BENCH_PATH_LEN, u, cs);
+      dT_nlms += (t1 - t0) + (t4 - t3);  dT_pbfdaf += (t2 - t1) + (t5 - t4);
+    }
+
+    p->print("    : "); p->print(afl); p->print(", ");
+    p->print((float)dT_nlms / (float)n_blocks, 1); p->print(", ");
+    p->print((float)dT_pbfdaf / (float)n_blocks, 1); p->print(", ");
+    p->print(10.0f*log10f((float)(x_pow / max(e_nlms_pow, 1.0e-20))), 1); p->print(", ");
+    p->println(10.0f*log10f((float)(x_pow / max(e_pbfdaf_pow, 1.0e-20))), 1);
+  }
+}
+
+//Compare the PBFDAF to the time-domain NLMS (the fused kernel from AFC_NLMS_Kernels.h) on a simulated
+//feedback path.  Reports the CPU time per audio block and the echo return loss enhancement (ERLE, how
+//much the feedback is reduced) over the last quarter of the test.  Runs in loop(), so it gets
+//interrupted by the audio processing, which makes the timing a little pessimistic.  The PBFDAF and the
+//buffers are created only for the benchmark (and destroyed after), so their memory is not tied up the
+//rest of the time.
+static inline void pbfdaf_benchmarkVsNLMS(Print *p, int n_blocks = 1000) {
+  PBFDAF_F32 *pbfdaf_ptr = new PBFDAF_F32;
+  float32_t *sim_ring = new float32_t[PBFDAF_BENCH_PATH_LEN + PBFDAF_BENCH_BLOCK + 1], *h_true = new float32_t[PBFDAF_BENCH_PATH_LEN];
+  float32_t *nlms_ring = new float32_t[MAX_PBFDAF_FILT_LEN + PBFDAF_BENCH_BLOCK + 1], *nlms_efbp = new float32_t[MAX_PBFDAF_FILT_LEN];
+  if ((pbfdaf_ptr == NULL) || (sim_ring == NULL) || (h_true == NULL) || (nlms_ring == NULL) || (nlms_efbp == NULL)) {
+    p->println("pbfdaf_benchmarkVsNLMS: *** ERROR ***: not enough memory for the benchmark.");
+  } else {
+    pbfdaf_benchmarkVsNLMS_run(p, *pbfdaf_ptr, sim_ring, h_true, nlms_ring, nlms_efbp, n_blocks);
+  }
+  delete pbfdaf_ptr;
+  delete[] sim_ring;  delete[] h_true;  delete[] nlms_ring;  delete[] nlms_efbp;
+}
+
+#endif
@@ -0,0 +1,320 @@
+/*
+   AudioEffectFeedbackCancel_Stereo_F32
+
+   Created: OpenAudio, 2022
+   Purpose: Adaptive feedback cancelation for both ears in one audio object.  Same NLMS algorithm
+       (from BTNRH) as AudioEffectFeedbackCancel_Local_F32, but it has two inputs and two outputs.
+       The left and right coefficients (and the left and right loopback audio) are interleaved so
+       that both ears are processed in the same inner loop.
+
+       Instead of two AFC objects and two loopback objects, the stereo system needs only one
+       AudioEffectFeedbackCancel_Stereo_F32 and one AudioEffectFeedbackCancel_LoopBack_Stereo_F32.
+
+       Both ears use the same mu, rho, eps, afl, and hdel.  Each ear has its own power estimate and its
+       own feedback model.  The loopback audio is lined up with the input audio using the audio block
+       counters, exactly as in AudioEffectFeedbackCancel_Local_F32 (see getAlignedRing()).
+
+       If an input does not receive audio (for example, the right side when running mono), that
+       input is treated as silence.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _AudioEffectFeedbackCancel_Stereo_F32_h
+#define _AudioEffectFeedbackCancel_Stereo_F32_h
+
+#include <arm_math.h> //ARM DSP extensions.  https://www.keil.com/pack/doc/CMSIS/DSP/html/index.html
+#include <AudioStream_F32.h>
+#include <BTNRH_WDRC_Types.h> //from Tympan_Library
+#include <Arduino.h>  //for Serial.println()
+#include "AFC_NLMS_Kernels.h"
+#include "DelayHistory_F32.h"
+
+#ifndef MAX_AFC_FILT_LEN
+#define MAX_AFC_FILT_LEN  256  //must be longer than afl
+#endif
+#ifndef MAX_AFC_HDEL
+#define MAX_AFC_HDEL  (2*AUDIO_BLOCK_SAMPLES)  //longest allowed delay (samples) from the output back to the input
+#endif
+
+class AudioEffectFeedbackCancel_Stereo_F32 : public AudioStream_F32
+{
+    //GUI: inputs:2, outputs:2  //this line used for automatic generation of GUI node
+    //GUI: shortName: FB_Cancel_Stereo
+  public:
+    enum EAR { LEFT_EAR = 0, RIGHT_EAR = 1 };
+
+    //constructor
+    AudioEffectFeedbackCancel_Stereo_F32(void) : AudioStream_F32(2, inputQueueArray_f32) {
+      setDefaultValues();
+      initializeStates();
+      initializeRingBuffer();
+    }
+    AudioEffectFeedbackCancel_Stereo_F32(const AudioSettings_F32 &settings) : AudioStream_F32(2, inputQueueArray_f32) {
+      block_len = settings.audio_block_samples;  //so that getEffectiveHdel() is right before the first block
+      setDefaultValues();
+      initializeStates();
+      initializeRingBuffer();
+    }
+
+    virtual void setDefaultValues(void) {
+      //same defaults as AudioEffectFeedbackCancel_Local_F32
+      setParams(1.E-3, 0.9, 0.008, 100);
+    }
+    virtual void setParams(BTNRH_WDRC::CHA_AFC cha) {
+      setParams(cha.mu, cha.rho, cha.eps, cha.afl);
+      setEnable(cha.default_to_active);
+    }
+    virtual void setParams(float _mu, float _rho, float _eps, int _afl) {
+      setMu(_mu);     // AFC step size
+      setRho(_rho);   // AFC forgetting factor
+      setEps(_eps);   // AFC tolerance for setting a floor on the smallest signal level
+      if (_afl > MAX_AFC_FILT_LEN) {
+        Serial.println(F("AudioEffectFeedbackCancel_Stereo_F32: *** ERROR ***"));
+        Serial.print(F("    : Adaptive filter length (")); Serial.print(_afl);
+        Serial.print(F(") too long.  Limiting to ")); Serial.println(MAX_AFC_FILT_LEN);
+      }
+      setAfl(_afl);
+    }
+
+    virtual float setMu(float _mu) { return mu = _mu; }
+    virtual float setRho(float _rho) { return rho = min(max(_rho, 0.0), 1.0); };
+    virtual float setEps(float _eps) { return eps = min(max(_eps, 1e-30), 1.0); };
+    virtual float getMu(void) { return mu; };
+    virtual float getRho(void) { return rho; };
+    virtual float getEps(void) { return eps; };
+    virtual int setAfl(int _afl) {
+      afl = min(max(_afl, 1), MAX_AFC_FILT_LEN);
+      for (int i = 2*afl; i < 2*MAX_AFC_FILT_LEN; i++) efbp[i] = 0.0;  //clear out the upper coefficients
+      resizeHistory();
+      return afl;
+    };
+    virtual int getAfl(void) { return afl; };
+    virtual void setEnable(bool _enable) { enable = _enable; };
+    virtual bool getEnable(void) { return enable; };
+
+    //Hardware delay (samples) from the output audio to the input audio, the same for both ears.  Set to
+    //-1 (the default) to use exactly one audio block.  See AudioEffectFeedbackCancel_Local_F32::setHdel().
+    int setHdel(int _hdel) { hdel = min(max(_hdel, -1), MAX_AFC_HDEL); resizeHistory(); return hdel; }
+    int getHdel(void) { return hdel; }
+    int getEffectiveHdel(void) { return (hdel < 0) ? block_len : hdel; }
+    int getBlockLength(void) { return block_len; }
+
+    virtual void initializeStates(void) {
+      pwr[LEFT_EAR] = 0.0;  pwr[RIGHT_EAR] = 0.0;
+      for (int i = 0; i < 2*MAX_AFC_FILT_LEN; i++) efbp[i] = 0.0;
+    }
+    void initializeRingBuffer(void) {
+      resizeHistory();
+      AudioNoInterrupts();
+      ring_history.clear();
+      AudioInterrupts();
+    }
+
+    //Size the loopback history for the current afl, hdel, and block size (afl + hdel + one block for each
+    //ear, interleaved).  A history whose length changes is reallocated and cleared, so this is done from
+    //loop() (or setup()), with the audio interrupt held off.
+    virtual void resizeHistory(void) {
+      int ring_len = afl + getEffectiveHdel() + block_len;
+      if (2*ring_len == ring_history.getLength()) return;
+      AudioNoInterrupts();
+      if (ring_history.setLength(2*ring_len) < 2*ring_len) {
+        //not enough memory, so shorten the filter to fit
+        afl = max(ring_history.getLength()/2 - getEffectiveHdel() - block_len, 1);
+        Serial.print(F("AudioEffectFeedbackCancel_Stereo_F32: *** ERROR ***: limiting the filter length to ")); Serial.println(afl);
+      }
+      AudioInterrupts();
+    }
+
+    //estimated feedback coefficient for the given ear
+    float32_t getCoeff(int ear, int j) { return efbp[2*j + ear]; }
+
+    //here's the method that is called automatically by the Teensy Audio Library
+    virtual void update(void) {
+      //receive the input audio data
+      audio_block_f32_t *in_block[2];
+      in_block[LEFT_EAR] = AudioStream_F32::receiveReadOnly_f32(LEFT_EAR);
+      in_block[RIGHT_EAR] = AudioStream_F32::receiveReadOnly_f32(RIGHT_EAR);
+      if ((!in_block[LEFT_EAR]) && (!in_block[RIGHT_EAR])) return;
+
+      //allocate memory for the output of our algorithm
+      audio_block_f32_t *out_block[2];
+      out_block[LEFT_EAR] = AudioStream_F32::allocate_f32();
+      out_block[RIGHT_EAR] = AudioStream_F32::allocate_f32();
+      if ((!out_block[LEFT_EAR]) || (!out_block[RIGHT_EAR])) {
+        for (int Iear = 0; Iear < 2; Iear++) {
+          if (out_block[Iear]) AudioStream_F32::release(out_block[Iear]);
+          if (in_block[Iear]) AudioStream_F32::release(in_block[Iear]);
+        }
+        return;
+      }
+
+      //a missing input is treated as silence
+      audio_block_f32_t *in_any = in_block[LEFT_EAR] ? in_block[LEFT_EAR] : in_block[RIGHT_EAR];
+      int cs = in_any->length;
+      current_block_id = in_any->id;  //so that the loopback audio can be lined up with it (see getAlignedRing())
+      float32_t *x[2];
+      for (int Iear = 0; Iear < 2; Iear++) {
+        if (in_block[Iear]) {
+          x[Iear] = in_block[Iear]->data;
+        } else {
+          for (int i = 0; i < cs; i++) zeros[i] = 0.0f;
+          x[Iear] = zeros;
+        }
+        out_block[Iear]->id = in_any->id;
+        out_block[Iear]->length = cs;
+      }
+
+      //do the work
+      const float32_t *ring = enable ? getAlignedRing(cs) : NULL;
+      if (ring != NULL) {
+        afc_nlms_fused_stereo(x[LEFT_EAR], x[RIGHT_EAR], out_block[LEFT_EAR]->data, out_block[RIGHT_EAR]->data, cs,
+            ring, efbp, afl, mu, rho, eps, &(pwr[LEFT_EAR]), &(pwr[RIGHT_EAR]));
+      } else {
+        //disabled, or the ring buffer was sized for a smaller block (see resizeHistory()), so
+        //simply copy input to output
+        for (int Iear = 0; Iear < 2; Iear++) {
+          for (int i = 0; i < cs; i++) out_block[Iear]->data[i] = x[Iear][i];
+        }
+      }
+
+      // transmit the blocks and release memory
+      for (int Iear = 0; Iear < 2; Iear++) {
+        AudioStream_F32::transmit(out_block[Iear], Iear);
+        AudioStream_F32::release(out_block[Iear]);
+        if (in_block[Iear]) AudioStream_F32::release(in_block[Iear]);
+      }
+    }
+
+    //Find the loopback history for the current block, the same way as AudioEffectFeedbackCancel_Local_F32::
+    //getAlignedRing(), except that the history holds both ears (so every offset is twice as far into it).
+    //Returns NULL if the ring buffer is too short for this block.
+    const float32_t* getAlignedRing(int cs) {
+      block_len = cs;
+      int eff_hdel = getEffectiveHdel();
+      long max_offset = ring_history.getLength()/2 - (afl + cs);
+      long in_sync_offset = eff_hdel - cs;  //offset (per ear) into the history for the last sample of the block, if in sync
+      long base_offset = in_sync_offset;
+      n_blocks_aligned++;
+      if (max_offset < 0) { n_blocks_misaligned++; return NULL; }
+      if ((current_block_id > 0) && (newest_ring_audio_block_id != 999999)) {
+        //the newest loopback sample is normally from the end of the previous block
+        long block_diff = (long)newest_ring_audio_block_id - ((long)current_block_id - 1);
+        last_block_diff = block_diff;
+        if (block_diff != 0) n_blocks_out_of_sequence++;
+        base_offset += block_diff * cs;
+      }
+      if ((base_offset < 0) || (base_offset > max_offset)) {
+        //the needed loopback audio is not available, so fall back to assuming that the loopback is in sync
+        n_blocks_misaligned++;
+        base_offset = min(max(in_sync_offset, 0L), max_offset);
+      }
+      return ring_history.getNewest() + 2*base_offset;
+    }
+    void resetAlignmentStats(void) { n_blocks_aligned = 0; n_blocks_out_of_sequence = 0; n_blocks_misaligned = 0; }
+    virtual void printAlignmentStats(Print *p) {
+      p->print("AudioEffectFeedbackCancel_Stereo_F32: Loopback: hdel = "); p->print(hdel);
+      p->print(", blocks = "); p->print(n_blocks_aligned);
+      p->print(", out of sequence = "); p->print(n_blocks_out_of_sequence);
+      p->print(" (last offset = "); p->print(last_block_diff);
+      p->print(" blocks), misaligned = "); p->println(n_blocks_misaligned);
+    }
+
+    //add the newest output audio for both ears (either pointer may be NULL, meaning silence)
+    virtual void addNewAudio(const float32_t *uL, const float32_t *uR, int cs) {
+      cs = min(cs, AUDIO_BLOCK_SAMPLES);
+      for (int i = 0; i < cs; i++) {
+        //the history is newest-first, so push the right before the left to end up with left at the even indices
+        interleaved[2*i]   = uR ? uR[i] : 0.0f;
+        interleaved[2*i+1] = uL ? uL[i] : 0.0f;
+      }
+      ring_history.push(interleaved, 2*cs);
+    }
+
+    virtual void printEstimatedFeedbackImpulseResponse(Print *p, int ear, bool flag_eachOnNewLine) {
+      p->print("AudioEffectFeedbackCancel_Stereo_F32: estimated feedback impulse response, ");
+      p->println((ear == LEFT_EAR) ? "left:" : "right:");
+      float scale = 1.0;
+      if (flag_eachOnNewLine) scale = 20.0;
+      for (int i = 0; i < afl; i++) {
+        p->print(getCoeff(ear, i)*scale, 4);
+        if (flag_eachOnNewLine) {
+          p->println();
+        } else {
+          p->print(", ");
+        }
+      }
+      if (!flag_eachOnNewLine) p->println();
+    }
+
+    unsigned long newest_ring_audio_block_id = 999999;
+
+  protected:
+    //state-related variables
+    audio_block_f32_t *inputQueueArray_f32[2]; //memory pointer for the inputs to this module
+    bool enable = true;
+
+    //AFC parameters (same for both ears)
+    float32_t mu;    // AFC scale factor for how fast the filter adapts (bigger is faster)
+    float32_t rho;   // AFC averaging factor for estimating audio envelope (bigger is longer averaging)
+    float32_t eps;   // AFC when estimating audio level, this is the min value allowed (avoid divide-by-near-zero)
+    int afl;         // AFC adaptive filter length
+
+    //loopback alignment
+    int hdel = -1;  //see setHdel()
+    int block_len = AUDIO_BLOCK_SAMPLES;  //updated with each block that is processed
+    unsigned long current_block_id = 0;
+    unsigned long n_blocks_aligned = 0, n_blocks_out_of_sequence = 0, n_blocks_misaligned = 0;
+    long last_block_diff = 0;
+
+    //AFC states
+    float32_t pwr[2];   // AFC estimate of error power for each ear
+    float32_t efbp[2*MAX_AFC_FILT_LEN];  //estimated feedback impulse responses, interleaved left and right
+
+    //loopback history (newest first), interleaved left and right.  Holds afl+hdel samples plus one block
+    //for each ear, for the current settings (see resizeHistory()).
+    DelayHistoryHeap_F32 ring_history;
+    float32_t interleaved[2*AUDIO_BLOCK_SAMPLES];
+    float32_t zeros[AUDIO_BLOCK_SAMPLES];
+};
+
+
+class AudioEffectFeedbackCancel_LoopBack_Stereo_F32 : public AudioStream_F32
+{
+    //GUI: inputs:2, outputs:0  //this line used for automatic generation of GUI node
+    //GUI: shortName: FB_Cancel_LoopBack_Stereo
+  public:
+    //constructor
+    AudioEffectFeedbackCancel_LoopBack_Stereo_F32(void) : AudioStream_F32(2, inputQueueArray_f32) { }
+    AudioEffectFeedbackCancel_LoopBack_Stereo_F32(const AudioSettings_F32 &settings) : AudioStream_F32(2, inputQueueArray_f32) { };
+
+    void setTargetAFC(AudioEffectFeedbackCancel_Stereo_F32 *_afc) {
+      AFC_obj = _afc;
+    }
+
+    //here's the method that is called automatically by the Teensy Audio Library
+    void update(void) {
+      if (AFC_obj == NULL) return;
+
+      //receive the input audio data
+      audio_block_f32_t *in_L = AudioStream_F32::receiveReadOnly_f32(0);
+      audio_block_f32_t *in_R = AudioStream_F32::receiveReadOnly_f32(1);
+      if ((!in_L) && (!in_R)) return;
+
+      //do the work
+      audio_block_f32_t *in_any = in_L ? in_L : in_R;
+      AFC_obj->newest_ring_audio_block_id = in_any->id;
+      AFC_obj->addNewAudio(in_L ? in_L->data : NULL, in_R ? in_R->data : NULL, in_any->length);
+
+      //release memory
+      if (in_L) AudioStream_F32::release(in_L);
+      if (in_R) AudioStream_F32::release(in_R);
+    }
+
+  private:
+    //state-related variables
+    audio_block_f32_t *inputQueueArray_f32[2]; //memory pointer for the inputs to this module
+    AudioEffectFeedbackCancel_Stereo_F32 *AFC_obj = NULL;
+};
+
+#endif
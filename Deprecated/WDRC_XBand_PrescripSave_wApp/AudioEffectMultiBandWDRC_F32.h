@@ -0,0 +1,366 @@
+/*
+   AudioEffectMultiBandWDRC_F32
+
+   Created: OpenAudio, 2022
+   Purpose: The whole per-band part of the WDRC (filterbank, per-band compressors, and the summing
+       mixer) in one audio object.  Normally, each band is three audio objects (bpFilt -> expCompLim ->
+       mixerFilterBank), and every hop allocates, transmits, and releases an audio block.  Here, each
+       band is filtered, compressed, and added to the output in one update(), using scratch memory
+       inside this object.  Only the one output block comes from the audio memory pool.
+
+       The filters take the same SOS coefficients as AudioFilterBiquad_F32::setFilterCoeff_Matlab_sos()
+       (as computed by AudioConfigIIRFilterBank_F32::createFilterCoeff_SOS()).  The compressors are the
+       sketch's usual AudioEffectCompWDRC_F32 objects: this object uses their envelope and gain
+       calculators directly, so all of the code that sets (and reads) the per-band WDRC parameters
+       works as before.  Those compressors should not also be connected to the audio.
+
+       By default, the bands are filtered four at a time by the lockstep kernel in
+       MultiBandBiquad_Kernels.h.  setUseBandParallel(false) goes back to arm_biquad_cascade_df1_f32(),
+       one band at a time.
+
+       Each band can be delayed after its filter (setBand()'s delay), to line up the bands before they
+       are summed, as the postFiltDelay objects do in the unfused chain.  The delays are part of the
+       filterbank: they are staged, crossfaded, and carried over with the filter states.
+
+       New filters (setBand() and setNumBands()) are staged, and they take effect together when
+       applyBands() is called, at the next block boundary.  The old filters keep running for a short
+       crossfade (setCrossfadeLength_samples()), so a new filterbank (a preset change, say) doesn't click.
+       The new filters start from the old filters' states.  An applyBands() during a crossfade is queued
+       (isApplyPending()) until that crossfade ends.  Staging more filters before then cancels it, until
+       the next applyBands().
+
+       By default, the gains come from WDRC_FastGain_F32 (a table of the gain curve and a fast log2)
+       instead of the compressors' own calcGain.  setUseFastGain(false) goes back to calcGain.
+
+       The per-band scratch for update() is sized for the audio block (from the AudioSettings_F32), and
+       it is shared by every instance (the left and right ears).  It holds nothing from one block to the
+       next, and the audio objects are updated one at a time, so one copy is enough.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _AudioEffectMultiBandWDRC_F32_h
+#define _AudioEffectMultiBandWDRC_F32_h
+
+#include <arm_math.h> //ARM DSP extensions.  https://www.keil.com/pack/doc/CMSIS/DSP/html/index.html
+#include <AudioStream_F32.h>
+#include <AudioEffectCompWDRC_F32.h>  //from Tympan_Library
+#include "MultiBandBiquad_Kernels.h"
+#include "WDRC_FastGain_F32.h"
+#include <Arduino.h>  //for Serial.println()
+
+#define MULTIBAND_WDRC_MAX_BANDS   8
+#define MULTIBAND_WDRC_MAX_BIQUADS MB_BIQUAD_MAX_STAGES    //per band
+#define MULTIBAND_WDRC_MAX_GROUPS  ((MULTIBAND_WDRC_MAX_BANDS + MB_BIQUAD_LANES - 1) / MB_BIQUAD_LANES)
+#define MULTIBAND_WDRC_COEFF_PER_BIQUAD_MATLAB 6   //b0 b1 b2 a0 a1 a2
+#define MULTIBAND_WDRC_COEFF_PER_BIQUAD_ARM    5   //b0 b1 b2 -a1 -a2
+#define MULTIBAND_WDRC_MAX_DELAY   128   //longest per-band delay (samples) + 1.  Must be a power of 2.
+
+//one complete set of filters for the bands (the object has two, so that it can crossfade between them)
+typedef struct {
+  int n_bands = 0;
+  int n_biquads[MULTIBAND_WDRC_MAX_BANDS] = {0};
+  float32_t coeff[MULTIBAND_WDRC_MAX_BANDS][MULTIBAND_WDRC_MAX_BIQUADS * MULTIBAND_WDRC_COEFF_PER_BIQUAD_ARM];
+  float32_t state[MULTIBAND_WDRC_MAX_BANDS][MULTIBAND_WDRC_MAX_BIQUADS * 4];
+  arm_biquad_casd_df1_inst_f32 iir[MULTIBAND_WDRC_MAX_BANDS];
+  MB_BiquadGroup groups[MULTIBAND_WDRC_MAX_GROUPS];  //the same filters, MB_BIQUAD_LANES bands per group
+  int delay[MULTIBAND_WDRC_MAX_BANDS] = {0};          //samples, after each band's filter
+  float32_t dline[MULTIBAND_WDRC_MAX_BANDS][MULTIBAND_WDRC_MAX_DELAY];  //each band's recent filter output
+  int dline_head = 0;                                 //where the next sample goes in every band's dline
+} MultiBandWDRC_FilterBank;
+
+//scratch for update(), shared by all of the instances.  band and fade have one row of block_len per band.
+typedef struct {
+  float32_t *band = NULL, *fade = NULL, *env = NULL, *gain = NULL, *sum = NULL;
+  int block_len = 0;
+} MultiBandWDRC_Scratch;
+
+class AudioEffectMultiBandWDRC_F32 : public AudioStream_F32
+{
+  //GUI: inputs:1, outputs:1  //this line used for automatic generation of GUI node
+  public:
+    AudioEffectMultiBandWDRC_F32(void) : AudioStream_F32(1, inputQueueArray) { allocateScratch(AUDIO_BLOCK_SAMPLES); }
+    AudioEffectMultiBandWDRC_F32(const AudioSettings_F32 &settings) : AudioStream_F32(1, inputQueueArray) { allocateScratch(settings.audio_block_samples); }
+
+    //stage one band's filter (Matlab-style SOS: b0 b1 b2 a0 a1 a2 for each biquad), its delay (samples,
+    //such as the filter_delay from createFilterCoeff_SOS()), and give it its compressor.  The filter and
+    //the delay are used once applyBands() is called.
+    bool setBand(int Iband, const float *sos, int n_biquad, AudioEffectCompWDRC_F32 *comp, int delay_samples = 0) {
+      if ((Iband < 0) || (Iband >= MULTIBAND_WDRC_MAX_BANDS) || (n_biquad < 1) || (n_biquad > MULTIBAND_WDRC_MAX_BIQUADS)) {
+        Serial.println("AudioEffectMultiBandWDRC_F32: setBand: *** ERROR ***: band or number of biquads is out of range.");
+        return false;
+      }
+      if ((delay_samples < 0) || (delay_samples >= MULTIBAND_WDRC_MAX_DELAY)) {
+        Serial.print(F("AudioEffectMultiBandWDRC_F32: setBand: *** ERROR ***: delay (samples) is out of range: ")); Serial.println(delay_samples);
+        return false;
+      }
+      apply_pending = false;  //don't let update() take a half-staged filterbank (see applyBands())
+      for (int Ibiquad = 0; Ibiquad < n_biquad; Ibiquad++) {
+        const float *in = sos + Ibiquad * MULTIBAND_WDRC_COEFF_PER_BIQUAD_MATLAB;
+        float32_t *out = next_coeff[Iband] + Ibiquad * MULTIBAND_WDRC_COEFF_PER_BIQUAD_ARM;
+        float a0 = (in[3] != 0.0f) ? in[3] : 1.0f;
+        out[0] = in[0] / a0;  out[1] = in[1] / a0;  out[2] = in[2] / a0;
+        out[3] = -in[4] / a0;  out[4] = -in[5] / a0;  //the ARM biquad wants the feedback coefficients negated
+      }
+      next_n_biquads[Iband] = n_biquad;
+      next_delay[Iband] = delay_samples;
+      comps[Iband] = comp;  //(the compressors keep their state, so they can change right away)
+      return true;
+    }
+    int setNumBands(int n) { apply_pending = false; return next_n_bands = max(0, min(n, MULTIBAND_WDRC_MAX_BANDS)); }  //staged, like setBand()
+    int getNumBands(void) { return banks[active].n_bands; }
+
+    //Start using the staged filters.  If they differ from the ones running now, the swap happens at the
+    //next block boundary, and the output crossfades from the old filters to the new ones.  If the last
+    //crossfade is still going, the swap is queued instead, and update() does it as soon as that crossfade
+    //ends (cutting it short would click).  Returns true if the swap was done or queued.  Pass
+    //hold_audio = false if the caller already has the audio interrupt held off (AudioNoInterrupts()
+    //does not nest, so the AudioInterrupts() here would end the caller's hold early).
+    bool applyBands(bool hold_audio = true) {
+      apply_pending = false;  //(so that update() doesn't swap while this runs)
+      if (isSameAsStaged(&banks[active])) return false;  //nothing to do
+      if (fade_from >= 0) {
+        apply_pending = true;  //the idle bank is still being faded out
+        return true;
+      }
+      swapToStaged(hold_audio);
+      return true;
+    }
+    bool isApplyPending(void) { return apply_pending; }
+    int setCrossfadeLength_samples(int n) { return crossfade_len = max(0, n); }
+    int getCrossfadeLength_samples(void) { return crossfade_len; }
+    bool isCrossfading(void) { return fade_from >= 0; }
+
+    void resetStates(void) {
+      AudioNoInterrupts();
+      for (int Ibank = 0; Ibank < 2; Ibank++) {
+        memset(banks[Ibank].state, 0, sizeof(banks[Ibank].state));
+        memset(banks[Ibank].dline, 0, sizeof(banks[Ibank].dline));
+        for (int Igroup = 0; Igroup < MULTIBAND_WDRC_MAX_GROUPS; Igroup++) mb_biquad_group_reset(&banks[Ibank].groups[Igroup]);
+      }
+      AudioInterrupts();
+    }
+
+    //filter the bands four at a time (true) or one at a time with arm_biquad_cascade_df1_f32() (false).
+    //The two keep separate filter states, so the states are cleared when switching.
+    bool setUseBandParallel(bool val) {
+      if (val != use_band_parallel) { resetStates(); use_band_parallel = val; }
+      return use_band_parallel;
+    }
+    bool getUseBandParallel(void) { return use_band_parallel; }
+
+    //get the gains from WDRC_FastGain_F32 (true) or from the compressors' own calcGain (false)
+    bool setUseFastGain(bool val) { return use_fast_gain = val; }
+    bool getUseFastGain(void) { return use_fast_gain; }
+    int setGainDecimation(int K) {  //compute the fast gain every K samples
+      for (int Iband = 0; Iband < MULTIBAND_WDRC_MAX_BANDS; Iband++) K = fast_gain[Iband].setDecimation(K);
+      return K;
+    }
+    int getGainDecimation(void) { return fast_gain[0].getDecimation(); }
+
+    virtual void update(void) {
+      audio_block_f32_t *block = AudioStream_F32::receiveWritable_f32();
+      if (!block) return;
+      const int n = block->length;
+      if (n > scratch->block_len) {  //the scratch is too small for this block (see allocateScratch()), so output silence
+        for (int i = 0; i < n; i++) block->data[i] = 0.0f;
+        AudioStream_F32::transmit(block);
+        AudioStream_F32::release(block);
+        return;
+      }
+      if (apply_pending && (fade_from < 0)) { swapToStaged(false); apply_pending = false; }  //queued by applyBands()
+      const int len = scratch->block_len;
+      float32_t *band_buf = scratch->band, *fade_buf = scratch->fade;
+      float32_t *env_buf = scratch->env, *gain_buf = scratch->gain, *sum_buf = scratch->sum;
+      for (int i = 0; i < n; i++) sum_buf[i] = 0.0f;
+
+      //filter
+      MultiBandWDRC_FilterBank *cur = &banks[active];
+      filterBands(cur, block->data, band_buf, len, n);
+      delayBands(cur, band_buf, len, n);
+      int n_bands = cur->n_bands;
+      if (fade_from >= 0) {  //crossfade from the old filters
+        MultiBandWDRC_FilterBank *old = &banks[fade_from];
+        filterBands(old, block->data, fade_buf, len, n);
+        delayBands(old, fade_buf, len, n);
+        n_bands = max(n_bands, old->n_bands);
+        const float32_t inv_len = 1.0f / (float32_t)crossfade_len;
+        for (int Iband = 0; Iband < n_bands; Iband++) {
+          bool in_new = (Iband < cur->n_bands), in_old = (Iband < old->n_bands);
+          float32_t *y_new = band_buf + Iband * len, *y_old = fade_buf + Iband * len;
+          for (int i = 0; i < n; i++) {
+            float32_t w = min(1.0f, (float32_t)(fade_pos + i + 1) * inv_len);
+            float32_t a = in_old ? y_old[i] : 0.0f, b = in_new ? y_new[i] : 0.0f;
+            y_new[i] = a + w * (b - a);
+          }
+        }
+        fade_pos += n;
+        if (fade_pos >= crossfade_len) fade_from = -1;
+      }
+
+      for (int Iband = 0; Iband < n_bands; Iband++) {
+        if (comps[Iband] == NULL) continue;
+        float32_t *y = band_buf + Iband * len;
+        comps[Iband]->calcEnvelope.smooth_env(y, env_buf, n);         //compress
+        if (use_fast_gain) {
+          fast_gain[Iband].syncTo(*comps[Iband]);  //picks up any change to the compressor's settings
+          fast_gain[Iband].calcGainFromEnvelope(env_buf, gain_buf, n);
+        } else {
+          comps[Iband]->calcGain.calcGainFromEnvelope(env_buf, gain_buf, n);
+        }
+        for (int i = 0; i < n; i++) sum_buf[i] += y[i] * gain_buf[i]; //sum
+      }
+
+      for (int i = 0; i < n; i++) block->data[i] = sum_buf[i];
+      AudioStream_F32::transmit(block);
+      AudioStream_F32::release(block);
+    }
+
+  protected:
+    audio_block_f32_t *inputQueueArray[1];
+    AudioEffectCompWDRC_F32 *comps[MULTIBAND_WDRC_MAX_BANDS] = {NULL};
+    bool use_band_parallel = true;
+    bool use_fast_gain = true;
+    WDRC_FastGain_F32 fast_gain[MULTIBAND_WDRC_MAX_BANDS];
+
+    //the filters: the staged ones (from setBand()), and the two banks that the audio runs
+    int next_n_bands = 0;
+    int next_n_biquads[MULTIBAND_WDRC_MAX_BANDS] = {0};
+    int next_delay[MULTIBAND_WDRC_MAX_BANDS] = {0};
+    float32_t next_coeff[MULTIBAND_WDRC_MAX_BANDS][MULTIBAND_WDRC_MAX_BIQUADS * MULTIBAND_WDRC_COEFF_PER_BIQUAD_ARM];
+    MultiBandWDRC_FilterBank banks[2];
+    volatile int active = 0;      //the bank in use
+    volatile int fade_from = -1;  //the bank being faded out (or -1)
+    volatile bool apply_pending = false;  //applyBands() was called during a crossfade
+    int fade_pos = 0, crossfade_len = 96;  //96 samples is 4 msec at 24 kHz
+
+    bool isSameAsStaged(const MultiBandWDRC_FilterBank *bank) {
+      if (bank->n_bands != next_n_bands) return false;
+      for (int Iband = 0; Iband < next_n_bands; Iband++) {
+        if ((bank->n_biquads[Iband] != next_n_biquads[Iband]) || (bank->delay[Iband] != next_delay[Iband])) return false;
+        if (memcmp(bank->coeff[Iband], next_coeff[Iband], next_n_biquads[Iband] * MULTIBAND_WDRC_COEFF_PER_BIQUAD_ARM * sizeof(float32_t)) != 0) return false;
+      }
+      return true;
+    }
+
+    //build the idle bank from the staged filters and swap to it.  Only when no crossfade is going (the
+    //idle bank is free).  Called by applyBands() or, for a queued swap, by update().
+    void swapToStaged(bool hold_audio) {
+      MultiBandWDRC_FilterBank *cur = &banks[active];
+      int next = 1 - active;
+      MultiBandWDRC_FilterBank *bank = &banks[next];
+      bank->n_bands = next_n_bands;
+      for (int Iband = 0; Iband < MULTIBAND_WDRC_MAX_BANDS; Iband++) {
+        bank->n_biquads[Iband] = next_n_biquads[Iband];
+        bank->delay[Iband] = next_delay[Iband];
+        memcpy(bank->coeff[Iband], next_coeff[Iband], sizeof(bank->coeff[Iband]));
+        arm_biquad_cascade_df1_init_f32(&bank->iir[Iband], max(1, bank->n_biquads[Iband]), bank->coeff[Iband], bank->state[Iband]);
+      }
+      for (int Igroup = 0; Igroup < MULTIBAND_WDRC_MAX_GROUPS; Igroup++) updateGroup(bank, Igroup);
+
+      if (hold_audio) AudioNoInterrupts();
+      //start the new filters from the old filters' states (where the shapes match), then swap
+      for (int Iband = 0; Iband < MULTIBAND_WDRC_MAX_BANDS; Iband++) {
+        if (bank->n_biquads[Iband] == cur->n_biquads[Iband]) {
+          memcpy(bank->state[Iband], cur->state[Iband], sizeof(bank->state[Iband]));
+        } else {
+          memset(bank->state[Iband], 0, sizeof(bank->state[Iband]));
+        }
+      }
+      for (int Igroup = 0; Igroup < MULTIBAND_WDRC_MAX_GROUPS; Igroup++) {
+        if (bank->groups[Igroup].n_stages == cur->groups[Igroup].n_stages) {
+          memcpy(bank->groups[Igroup].state, cur->groups[Igroup].state, sizeof(bank->groups[Igroup].state));
+        } else {
+          mb_biquad_group_reset(&bank->groups[Igroup]);
+        }
+      }
+      memcpy(bank->dline, cur->dline, sizeof(bank->dline));  //the recent outputs, whatever the new delays are
+      bank->dline_head = cur->dline_head;
+      fade_pos = 0;
+      fade_from = (crossfade_len > 0) ? active : -1;
+      active = next;
+      if (hold_audio) AudioInterrupts();
+    }
+
+    //run one bank's filters into y (one row of row_len per band).  Bands without a filter come out silent.
+    void filterBands(MultiBandWDRC_FilterBank *bank, const float32_t *x, float32_t *y, int row_len, int n) {
+      if (use_band_parallel) {
+        for (int Igroup = 0; Igroup * MB_BIQUAD_LANES < bank->n_bands; Igroup++) {
+          float32_t *y_group[MB_BIQUAD_LANES];
+          for (int lane = 0; lane < MB_BIQUAD_LANES; lane++) y_group[lane] = y + (Igroup * MB_BIQUAD_LANES + lane) * row_len;
+          mb_biquad_group_process(&bank->groups[Igroup], x, y_group, n);
+        }
+      } else {
+        for (int Iband = 0; Iband < bank->n_bands; Iband++) {
+          float32_t *y_band = y + Iband * row_len;
+          if (bank->n_biquads[Iband] > 0) {
+            arm_biquad_cascade_df1_f32(&bank->iir[Iband], (float32_t *)x, y_band, n);
+          } else {
+            for (int i = 0; i < n; i++) y_band[i] = 0.0f;
+          }
+        }
+      }
+    }
+
+    //delay each of the bank's bands (in y, one row of row_len per band) by the bank's delay for that band.
+    //Every band goes through its delay line, even with no delay, so that the lines are always up to date
+    //for the next filterbank (which may have other delays).
+    void delayBands(MultiBandWDRC_FilterBank *bank, float32_t *y, int row_len, int n) {
+      const int mask = MULTIBAND_WDRC_MAX_DELAY - 1;
+      for (int Iband = 0; Iband < bank->n_bands; Iband++) {
+        float32_t *y_band = y + Iband * row_len, *dline = bank->dline[Iband];
+        const int d = bank->delay[Iband];
+        int head = bank->dline_head;
+        for (int i = 0; i < n; i++, head++) {
+          dline[head & mask] = y_band[i];
+          y_band[i] = dline[(head - d) & mask];
+        }
+      }
+      bank->dline_head = (bank->dline_head + n) & mask;
+    }
+
+    //(re)build one group from the per-band coefficients.  Bands without a filter are silent lanes.
+    void updateGroup(MultiBandWDRC_FilterBank *bank, int Igroup) {
+      const float32_t silent[MULTIBAND_WDRC_COEFF_PER_BIQUAD_ARM] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+      MB_BiquadGroup *g = &bank->groups[Igroup];
+      g->n_stages = 0;
+      for (int lane = 0; lane < MB_BIQUAD_LANES; lane++) {
+        int Iband = Igroup * MB_BIQUAD_LANES + lane;
+        if (bank->n_biquads[Iband] > 0) {
+          mb_biquad_group_set_lane(g, lane, bank->coeff[Iband], bank->n_biquads[Iband]);
+        } else {
+          mb_biquad_group_set_lane(g, lane, silent, 1);
+        }
+      }
+    }
+
+    //the scratch for update(), shared by every instance
+    MultiBandWDRC_Scratch *scratch = NULL;
+    static MultiBandWDRC_Scratch* sharedScratch(void) { static MultiBandWDRC_Scratch s; return &s; }
+
+    //make sure the shared scratch holds blocks of n samples.  Called by the constructors (before the
+    //audio starts).  If the memory runs out, update() outputs silence for any block that doesn't fit.
+    bool allocateScratch(int n) {
+      scratch = sharedScratch();
+      if (n <= scratch->block_len) return true;
+      const int n_rows = MULTIBAND_WDRC_MAX_GROUPS * MB_BIQUAD_LANES;  //the lockstep filters write whole groups
+      float32_t *buf = new float32_t[(2 * n_rows + 3) * n];
+      if (buf == NULL) {
+        Serial.print(F("AudioEffectMultiBandWDRC_F32: *** ERROR ***: could not allocate the scratch for blocks of ")); Serial.println(n);
+        return false;
+      }
+      AudioNoInterrupts();
+      float32_t *old_buf = scratch->band;
+      scratch->band = buf;
+      scratch->fade = scratch->band + n_rows * n;
+      scratch->env = scratch->fade + n_rows * n;
+      scratch->gain = scratch->env + n;
+      scratch->sum = scratch->gain + n;
+      scratch->block_len = n;
+      AudioInterrupts();
+      delete[] old_buf;
+      return true;
+    }
+};
+
+#endif
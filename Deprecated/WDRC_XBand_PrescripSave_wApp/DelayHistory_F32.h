@@ -0,0 +1,142 @@
+/*
+   DelayHistory_F32
+
+   Created: OpenAudio, 2022
+   Purpose: Holds the recent history of an audio stream for FIR-style processing (such as the adaptive
+       feedback cancelation), where each output sample needs the last N input samples.
+
+       Each new sample is written twice (a "mirrored" ring buffer), once at the head of the buffer
+       and once at head + N.  As a result, the newest N samples are always contiguous in memory, so
+       the inner loops of the FIR-style filters can simply step through an array.  There is no
+       sliding of the old data each block and there is no wrapping of the index for each filter tap.
+
+       The history is stored newest-first: getNewest()[0] is the newest sample, getNewest()[k] is
+       the sample from k samples ago, up to k = getLength()-1.  This is the same layout as was used
+       by the ring buffer in AudioEffectFeedbackCancel_Local_F32.
+
+       The buffer is either a fixed-size array (DelayHistory_F32) or allocated for the length that is
+       needed (DelayHistoryHeap_F32).  Both use the same ring buffer code (DelayHistoryRing_F32).
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _DelayHistory_F32_h
+#define _DelayHistory_F32_h
+
+#include <arm_math.h> //for float32_t
+#include <Arduino.h>  //for min(), max()
+
+//The ring buffer itself, over a buffer of 2*getLength() samples that is owned by the derived class
+//(DelayHistory_F32 or DelayHistoryHeap_F32), so that both use the same code to add and read samples.
+class DelayHistoryRing_F32 {
+  public:
+    int getLength(void) { return len; }
+
+    void clear(void) {
+      for (int i = 0; i < 2*len; i++) buff[i] = 0.0f;
+      head = 0;
+    }
+
+    //add new samples (given oldest first, as in a normal audio block)
+    void push(const float32_t *x, int n) {
+      if (len == 0) return;
+      for (int i = 0; i < n; i++) {
+        if (--head < 0) head = len - 1;
+        buff[head] = x[i];
+        buff[head + len] = x[i];  //the mirror
+      }
+    }
+
+    //pointer to the newest sample.  The next getLength()-1 samples are progressively older.
+    const float32_t* getNewest(void) const { return buff + head; }
+    float32_t getSample(int samples_ago) const { return buff[head + samples_ago]; }
+
+  protected:
+    DelayHistoryRing_F32(void) {}
+
+    //use the given buffer (which must hold at least 2*_len samples) and clear the history
+    void setBuffer(float32_t *_buff, int _len) {
+      buff = _buff;
+      len = (_buff == NULL) ? 0 : _len;
+      clear();
+    }
+
+    float32_t *buff = NULL;
+    int len = 0;
+    int head = 0;  //index of the newest sample
+};
+
+//The history in a fixed-size array, for the longest length that could ever be needed
+template <int MAX_LEN>
+class DelayHistory_F32 : public DelayHistoryRing_F32 {
+  public:
+    DelayHistory_F32(void) { setLength(MAX_LEN); }
+
+    //a copy gets its own copy of the samples (and not a pointer into the original's array)
+    DelayHistory_F32(const DelayHistory_F32 &other) : DelayHistoryRing_F32(other) { copySamples(other); }
+    DelayHistory_F32& operator=(const DelayHistory_F32 &other) {
+      DelayHistoryRing_F32::operator=(other);
+      copySamples(other);
+      return *this;
+    }
+
+    //set how many samples of history are needed.  Clears the history.
+    int setLength(int n) {
+      setBuffer(storage, min(max(n, 1), MAX_LEN));
+      return len;
+    }
+    static int getMaxLength(void) { return MAX_LEN; }
+
+  protected:
+    float32_t storage[2*MAX_LEN];
+
+    void copySamples(const DelayHistory_F32 &other) {
+      for (int i = 0; i < 2*MAX_LEN; i++) storage[i] = other.storage[i];
+      buff = storage;
+    }
+};
+
+//Same, but the buffer is allocated on the heap for the length that is actually needed (such as afl+hdel
+//plus one block, for an AFC), instead of for the longest length that could ever be needed.  setLength()
+//reallocates when the history grows (so call it from loop() or setup(), not from the audio processing).
+//A length of zero frees the buffer.
+class DelayHistoryHeap_F32 : public DelayHistoryRing_F32 {
+  public:
+    DelayHistoryHeap_F32(void) {}
+    ~DelayHistoryHeap_F32(void) { delete[] buff; }
+
+    //it owns its buffer, so it cannot be copied
+    DelayHistoryHeap_F32(const DelayHistoryHeap_F32 &) = delete;
+    DelayHistoryHeap_F32& operator=(const DelayHistoryHeap_F32 &) = delete;
+
+    //set how many samples of history are needed.  Clears the history.  Returns the length, which is
+    //shorter than asked for if there was not enough memory.
+    int setLength(int n) {
+      n = max(n, 0);
+      float32_t *new_buff = buff;
+      if (n > capacity) {
+        new_buff = new float32_t[2*n];
+        if (new_buff == NULL) {
+          Serial.print(F("DelayHistoryHeap_F32: *** ERROR ***: could not allocate ")); Serial.print(n);
+          Serial.print(F(" samples.  Keeping ")); Serial.println(capacity);
+          n = capacity;
+          new_buff = buff;
+        } else {
+          delete[] buff;
+          capacity = n;
+        }
+      } else if ((n == 0) && (buff != NULL)) {
+        delete[] buff;
+        new_buff = NULL;
+        capacity = 0;
+      }
+      setBuffer(new_buff, n);
+      return len;
+    }
+    int getCapacity(void) { return capacity; }
+
+  protected:
+    int capacity = 0;  //allocated length (the buffer holds 2*capacity samples)
+};
+
+#endif
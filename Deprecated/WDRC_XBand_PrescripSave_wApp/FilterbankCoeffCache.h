@@ -0,0 +1,107 @@
+/*
+   FilterbankCoeffCache
+
+   Created: OpenAudio, 2022
+   Purpose: Keep the filterbank coefficients (from AudioConfigIIRFilterBank_F32::createFilterCoeff_SOS())
+       for the last few designs, so that switching between presets doesn't re-design the filters.  The
+       design takes milliseconds, and it is the same every time for the same crossovers.
+
+       A design is found again only if everything that goes into it matches: the number of bands, the
+       filter order, the sample rate, the allowed delay, and the crossover frequencies (compared exactly).
+       When the cache is full, the design used longest ago is replaced.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _FilterbankCoeffCache_h
+#define _FilterbankCoeffCache_h
+
+#include <Arduino.h>  //for Serial.println()
+
+#define FB_CACHE_MAX_CHAN          8
+#define FB_CACHE_MAX_IIR_ORDER     8                                 //so, up to 4 biquads per band
+#define FB_CACHE_COEFF_PER_BIQUAD  6                                 //b0 b1 b2 a0 a1 a2 (Matlab-style SOS)
+#define FB_CACHE_MAX_COEFF         (FB_CACHE_MAX_CHAN * (FB_CACHE_MAX_IIR_ORDER / 2) * FB_CACHE_COEFF_PER_BIQUAD)
+#define FB_CACHE_N_SLOTS           6
+
+class FilterbankCoeffCache {
+  public:
+    FilterbankCoeffCache(void) { clear(); }
+
+    void clear(void) {
+      for (int i = 0; i < FB_CACHE_N_SLOTS; i++) slots[i].is_used = false;
+      n_hits = 0;  n_misses = 0;
+    }
+
+    //If this design is in the cache, copy its coefficients (n_chan * (n_iir/2) * 6 values, the same layout
+    //as createFilterCoeff_SOS()) into sos and its per-band delays into delay, and return true.
+    bool lookup(int n_chan, int n_iir, float fs_Hz, float td_msec, const float *cross_freq, float *sos, int *delay) {
+      int ind = find(n_chan, n_iir, fs_Hz, td_msec, cross_freq);
+      if (ind < 0) { n_misses++; return false; }
+      Slot *s = &slots[ind];
+      memcpy(sos, s->sos, n_chan * coeffPerChan(n_iir) * sizeof(float));
+      memcpy(delay, s->delay, n_chan * sizeof(int));
+      s->last_used = ++use_counter;
+      n_hits++;
+      return true;
+    }
+    bool contains(int n_chan, int n_iir, float fs_Hz, float td_msec, const float *cross_freq) {
+      return find(n_chan, n_iir, fs_Hz, td_msec, cross_freq) >= 0;
+    }
+
+    //add a design to the cache (replacing the design used longest ago, if full)
+    bool store(int n_chan, int n_iir, float fs_Hz, float td_msec, const float *cross_freq, const float *sos, const int *delay) {
+      if ((n_chan < 1) || (n_chan > FB_CACHE_MAX_CHAN) || (n_iir < 2) || (n_iir > FB_CACHE_MAX_IIR_ORDER)) {
+        Serial.println("FilterbankCoeffCache: store: *** ERROR ***: n_chan or n_iir is too big for the cache.  Not cached.");
+        return false;
+      }
+      int ind = find(n_chan, n_iir, fs_Hz, td_msec, cross_freq);
+      if (ind < 0) {
+        ind = 0;
+        for (int i = 0; i < FB_CACHE_N_SLOTS; i++) {
+          if (!slots[i].is_used) { ind = i; break; }
+          if (slots[i].last_used < slots[ind].last_used) ind = i;
+        }
+      }
+      Slot *s = &slots[ind];
+      s->n_chan = n_chan;  s->n_iir = n_iir;  s->fs_Hz = fs_Hz;  s->td_msec = td_msec;
+      for (int i = 0; i < n_chan - 1; i++) s->cross_freq[i] = cross_freq[i];  //the crossovers between the bands
+      memcpy(s->sos, sos, n_chan * coeffPerChan(n_iir) * sizeof(float));
+      memcpy(s->delay, delay, n_chan * sizeof(int));
+      s->last_used = ++use_counter;
+      s->is_used = true;
+      return true;
+    }
+
+    int getNumHits(void) { return n_hits; }
+    int getNumMisses(void) { return n_misses; }
+    int getNumUsed(void) { int n = 0; for (int i = 0; i < FB_CACHE_N_SLOTS; i++) if (slots[i].is_used) n++; return n; }
+
+  protected:
+    typedef struct {
+      bool is_used;
+      uint32_t last_used;
+      int n_chan, n_iir;
+      float fs_Hz, td_msec;
+      float cross_freq[FB_CACHE_MAX_CHAN];
+      float sos[FB_CACHE_MAX_COEFF];
+      int delay[FB_CACHE_MAX_CHAN];
+    } Slot;
+    Slot slots[FB_CACHE_N_SLOTS];
+    uint32_t use_counter = 0;
+    int n_hits = 0, n_misses = 0;
+
+    static int coeffPerChan(int n_iir) { return (n_iir / 2) * FB_CACHE_COEFF_PER_BIQUAD; }
+    int find(int n_chan, int n_iir, float fs_Hz, float td_msec, const float *cross_freq) {
+      for (int i = 0; i < FB_CACHE_N_SLOTS; i++) {
+        const Slot *s = &slots[i];
+        if (!s->is_used || (s->n_chan != n_chan) || (s->n_iir != n_iir) || (s->fs_Hz != fs_Hz) || (s->td_msec != td_msec)) continue;
+        bool same = true;
+        for (int k = 0; k < n_chan - 1; k++) if (s->cross_freq[k] != cross_freq[k]) { same = false; break; }
+        if (same) return i;
+      }
+      return -1;
+    }
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*
+   MultiBandBiquad_Kernels
+
+   Created: OpenAudio, 2022
+   Purpose: Biquad cascades for the bands of the filterbank in AudioEffectMultiBandWDRC_F32.
+
+     arm_biquad_cascade_df1_f32() runs one band at a time.  Within a band, every output sample needs
+     the output before it, so the FPU mostly waits on its own results.  The kernel here runs
+     MB_BIQUAD_LANES bands in lockstep instead: one band per "lane", interleaved in scalar code (the
+     Cortex-M4F and M7 have no floating-point SIMD).  The lanes don't depend on each other, so the FPU
+     always has independent work to do.
+
+     The coefficients and states are kept by stage, then by coefficient, then by lane ("structure of
+     arrays"), so each stage loads the values for all of its lanes from one place.  The math is the
+     same Direct Form I as arm_biquad_cascade_df1_f32(), with the same coefficient order
+     (b0 b1 b2 -a1 -a2), so the two can be checked against each other (see mb_biquad_benchmark()).
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _MultiBandBiquad_Kernels_h
+#define _MultiBandBiquad_Kernels_h
+
+#include <arm_math.h> //ARM DSP extensions.  https://www.keil.com/pack/doc/CMSIS/DSP/html/index.html
+#include <Arduino.h>
+
+#define MB_BIQUAD_LANES      4   //bands processed in lockstep
+#define MB_BIQUAD_MAX_STAGES 4   //biquads per band
+#define MB_BIQUAD_N_COEFF    5   //b0 b1 b2 -a1 -a2 (same as arm_biquad_cascade_df1_f32)
+
+typedef struct {
+  int n_stages = 0;
+  float32_t coeff[MB_BIQUAD_MAX_STAGES][MB_BIQUAD_N_COEFF][MB_BIQUAD_LANES];
+  float32_t state[MB_BIQUAD_MAX_STAGES][4][MB_BIQUAD_LANES];  //x[n-1], x[n-2], y[n-1], y[n-2]
+} MB_BiquadGroup;
+
+//give one lane its coefficients (ARM order, n_stages*5 values).  If the lanes of a group have different
+//numbers of stages, the shorter ones are padded with pass-through stages.
+static inline void mb_biquad_group_set_lane(MB_BiquadGroup *g, int lane, const float32_t *arm_coeff, int n_stages) {
+  for (int s = 0; s < MB_BIQUAD_MAX_STAGES; s++) {
+    for (int c = 0; c < MB_BIQUAD_N_COEFF; c++) {
+      if (s < n_stages) {
+        g->coeff[s][c][lane] = arm_coeff[s * MB_BIQUAD_N_COEFF + c];
+      } else {
+        g->coeff[s][c][lane] = (c == 0) ? 1.0f : 0.0f;
+      }
+    }
+  }
+  g->n_stages = max(g->n_stages, n_stages);
+}
+
+static inline void mb_biquad_group_reset(MB_BiquadGroup *g) { memset(g->state, 0, sizeof(g->state)); }
+
+#define MB_BQ_LOAD(k) \
+  const float32_t b0_##k = c[0][k], b1_##k = c[1][k], b2_##k = c[2][k], a1_##k = c[3][k], a2_##k = c[4][k]; \
+  float32_t xm1_##k = st[0][k], xm2_##k = st[1][k], ym1_##k = st[2][k], ym2_##k = st[3][k]; \
+  const float32_t *in_##k = (s == 0) ? x : out_##k;
+#define MB_BQ_STEP(k) { \
+  float32_t xn = in_##k[i]; \
+  float32_t yn = b0_##k * xn + b1_##k * xm1_##k + b2_##k * xm2_##k + a1_##k * ym1_##k + a2_##k * ym2_##k; \
+  xm2_##k = xm1_##k;  xm1_##k = xn;  ym2_##k = ym1_##k;  ym1_##k = yn; \
+  out_##k[i] = yn; }
+#define MB_BQ_SAVE(k) { st[0][k] = xm1_##k;  st[1][k] = xm2_##k;  st[2][k] = ym1_##k;  st[3][k] = ym2_##k; }
+
+//filter the same input x through all of the lanes of the group.  y[lane] is each lane's output.
+static inline void mb_biquad_group_process(MB_BiquadGroup *g, const float32_t *x, float32_t **y, int n) {
+  float32_t *out_0 = y[0], *out_1 = y[1], *out_2 = y[2], *out_3 = y[3];
+  for (int s = 0; s < g->n_stages; s++) {
+    const float32_t (*c)[MB_BIQUAD_LANES] = g->coeff[s];
+    float32_t (*st)[MB_BIQUAD_LANES] = g->state[s];
+    MB_BQ_LOAD(0)  MB_BQ_LOAD(1)  MB_BQ_LOAD(2)  MB_BQ_LOAD(3)  //stage 0 reads x.  The others work in place on y.
+    for (int i = 0; i < n; i++) {
+      MB_BQ_STEP(0)  MB_BQ_STEP(1)  MB_BQ_STEP(2)  MB_BQ_STEP(3)
+    }
+    MB_BQ_SAVE(0)  MB_BQ_SAVE(1)  MB_BQ_SAVE(2)  MB_BQ_SAVE(3)
+  }
+}
+
+// ///////////////////////////////////////////////// Benchmark
+
+//Run arm_biquad_cascade_df1_f32() (one band at a time) and the lockstep kernel on the same
+//(pseudo-random) audio with the same bandpass filters, and report the cycles per sample per band
+//and the largest difference between the two.  This runs in loop(), so it is interrupted by the
+//audio processing, which makes the timing a little pessimistic for both.
+#define MB_BENCH_BLOCK 24
+static inline void mb_biquad_benchmark(Print *p, int n_stages = 3, int n_blocks = 500) {
+  const int n_bands = 2 * MB_BIQUAD_LANES;
+  static float32_t coeff[2 * MB_BIQUAD_LANES][MB_BIQUAD_MAX_STAGES * MB_BIQUAD_N_COEFF];
+  static float32_t arm_state[2 * MB_BIQUAD_LANES][MB_BIQUAD_MAX_STAGES * 4];
+  static float32_t y_ref[2 * MB_BIQUAD_LANES][MB_BENCH_BLOCK], y_lock[2 * MB_BIQUAD_LANES][MB_BENCH_BLOCK];
+  static MB_BiquadGroup groups[2];
+  arm_biquad_casd_df1_inst_f32 iir[2 * MB_BIQUAD_LANES];
+  float32_t x[MB_BENCH_BLOCK];
+  n_stages = max(1, min(n_stages, MB_BIQUAD_MAX_STAGES));
+
+  //bandpass biquads (RBJ cookbook), log-spaced across the band, slightly detuned per stage
+  for (int Iband = 0; Iband < n_bands; Iband++) {
+    for (int s = 0; s < n_stages; s++) {
+      float w0 = 2.0f * PI * (250.0f * powf(2.0f, 0.6f * Iband) * (1.0f + 0.05f * s)) / 24000.0f;
+      float alpha = sinf(w0) / (2.0f * 1.5f), a0 = 1.0f + alpha;
+      float32_t *c = coeff[Iband] + s * MB_BIQUAD_N_COEFF;
+      c[0] = alpha / a0;  c[1] = 0.0f;  c[2] = -alpha / a0;
+      c[3] = 2.0f * cosf(w0) / a0;  c[4] = -(1.0f - alpha) / a0;
+    }
+    memset(arm_state[Iband], 0, sizeof(arm_state[Iband]));
+    arm_biquad_cascade_df1_init_f32(&iir[Iband], n_stages, coeff[Iband], arm_state[Iband]);
+  }
+  for (int Igroup = 0; Igroup < 2; Igroup++) {
+    groups[Igroup].n_stages = 0;
+    for (int lane = 0; lane < MB_BIQUAD_LANES; lane++) mb_biquad_group_set_lane(&groups[Igroup], lane, coeff[Igroup * MB_BIQUAD_LANES + lane], n_stages);
+    mb_biquad_group_reset(&groups[Igroup]);
+  }
+
+  uint32_t cycles_ref = 0, cycles_lock = 0;
+  float32_t max_err = 0.0f;
+  uint32_t seed = 12345;
+  for (int Iblock = 0; Iblock < n_blocks; Iblock++) {
+    for (int i = 0; i < MB_BENCH_BLOCK; i++) {
+      seed = seed * 1664525UL + 1013904223UL;
+      x[i] = ((float32_t)(seed >> 8) / 16777216.0f) - 0.5f;
+    }
+
+    uint32_t t0 = ARM_DWT_CYCCNT;
+    for (int Iband = 0; Iband < n_bands; Iband++) arm_biquad_cascade_df1_f32(&iir[Iband], x, y_ref[Iband], MB_BENCH_BLOCK);
+    uint32_t t1 = ARM_DWT_CYCCNT;
+    for (int Igroup = 0; Igroup < 2; Igroup++) {
+      float32_t *y[MB_BIQUAD_LANES];
+      for (int lane = 0; lane < MB_BIQUAD_LANES; lane++) y[lane] = y_lock[Igroup * MB_BIQUAD_LANES + lane];
+      mb_biquad_group_process(&groups[Igroup], x, y, MB_BENCH_BLOCK);
+    }
+    uint32_t t2 = ARM_DWT_CYCCNT;
+    cycles_ref += (t1 - t0);  cycles_lock += (t2 - t1);
+
+    for (int Iband = 0; Iband < n_bands; Iband++) {
+      for (int i = 0; i < MB_BENCH_BLOCK; i++) max_err = max(max_err, fabsf(y_ref[Iband][i] - y_lock[Iband][i]));
+    }
+  }
+
+  float n_samp_bands = (float)n_blocks * MB_BENCH_BLOCK * n_bands;
+  float ref_cyc = (float)cycles_ref / n_samp_bands, lock_cyc = (float)cycles_lock / n_samp_bands;
+  p->print("Filterbank Biquad Benchmark: "); p->print(n_bands); p->print(" bands, "); p->print(n_stages); p->println(" biquads per band");
+  p->print("    : arm_biquad_cascade_df1_f32 (cycles/sample/band) = "); p->println(ref_cyc, 2);
+  p->print("    : lockstep, "); p->print(MB_BIQUAD_LANES); p->print(" bands per pass (cycles/sample/band) = "); p->println(lock_cyc, 2);
+  p->print("    : speedup = "); p->print(ref_cyc / max(lock_cyc, 1.0e-3f), 2); p->print(", max difference = "); p->println(max_err, 8);
+}
+
+#endif
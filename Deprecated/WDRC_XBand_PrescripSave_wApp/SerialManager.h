@@ -48,6 +48,17 @@ float updateDSL_compressionRatio(int,float);
 float updateDSL_compressionKnee(int,float);
 float updateDSL_limitter(int,float);
 extern void updateGHA(BTNRH_WDRC::CHA_WDRC &);
+extern void syncStereoAFCParams(void);
+extern bool usingSeparateAFCs(const char *);
+extern void printAFCImpulseResponse(void);
+extern void printAFCAlignmentStats(Print *);
+extern void runAFCConvergenceBenchmark(void);
+extern bool toggleMultiBandFilterMethod(void);
+extern int setNumberOfBands(int);
+extern bool toggleMultiBandFastGain(void);
+extern int cycleMultiBandGainDecimation(void);
+extern void runFastGainBenchmark(void);
+extern void saveAFCWarmStartToSD(void);
 extern void updateAFC(BTNRH_WDRC::CHA_AFC &);
 extern int configureFrontRearMixer(int);
 extern int setTargetRearDelay_samps(int);
@@ -192,8 +203,23 @@ void SerialManager::printHelp(void) {
   //myTympan.print(" u,U: Increase or Decrease Cutoff Frequency of HP Prefilter (currently "); myTympan.print(myTympan.getHPCutoff_Hz()); myTympan.println(" Hz).");
   myTympan.print(  " z,Z: Increase or Decrease AFC N_Coeff_To_Zero (currently "); myTympan.print(feedbackCanceler.getNCoeffToZero()) ; myTympan.println(").");  
   myTympan.println(" ?: Print estimated feedback impulse response.");
+  myTympan.println(" o: Benchmark the AFC NLMS kernels (original vs fused).");
+  myTympan.println(" O: Benchmark the frequency-domain AFC versus the NLMS AFC.");
+  myTympan.println(" 9: Benchmark the filterbank biquads (one band at a time vs four bands at a time).");
+  myTympan.println(" 0: Toggle the multi-band WDRC's filterbank between four bands at a time and one at a time.");
+  myTympan.println(" /: Benchmark the fast WDRC gain (log2 and table, with decimation) against the compressor's calcGain.");
+  myTympan.println(" ,: Toggle the multi-band WDRC's gains between the fast gain and the compressors' calcGain.");
+  myTympan.println(" .: Cycle how often the multi-band WDRC computes its fast gain (every 1, 2, 4, or 8 samples).");
+  myTympan.print(  " +,-: Increase or Decrease the number of bands (currently "); myTympan.print(myState.getNChan()); myTympan.println(").  Re-select the preset to restore.");
+  myTympan.println(" =: Measure the AFC convergence (misalignment vs time) on simulated feedback paths.");
+  myTympan.println(" v,V: Cycle the AFC adaptation schedule, or print the adaptation stats.");
+  myTympan.print(  " x,X: Increase or Decrease AFC hardware delay hdel (currently "); myTympan.print(feedbackCanceler.getHdel()); myTympan.println(", -1 = one block).");
+  myTympan.println(" b: Print the AFC loopback alignment stats.");
+  myTympan.println(" :: Print the AFC time to convergence (cold start or warm start from SD).");
+  myTympan.print(  " j: Toggle the AFC prewhitening and band-limit filters (currently wfl = "); myTympan.print(feedbackCanceler.getFilterParams().wfl); myTympan.print(", pfl = "); myTympan.print(feedbackCanceler.getFilterParams().pfl); myTympan.println(").");
   //myTympan.println(" J: Print the JSON config object, for the Tympan Remote app");
   myTympan.println(" ],}: Enable/Disable printing of data to plot.");
+  myTympan.println(" (,): Enable/Disable binary output of the AFC feedback model (10 Hz, USB only).");
   myTympan.println(" `,~,|: SD: begin/stop/deleteAll recording");  
   myTympan.println();
 }
@@ -427,6 +453,15 @@ void SerialManager::processSingleCharacter(char c) {
       myTympan.println("Received: stopping printing plot data.");
       myState.flag_printPlottableData = false;
       setButtonState("printStart",false);
+      break;
+    case '(':
+      if (!usingSeparateAFCs("AFC feedback model output")) break;
+      myTympan.println("Received: starting binary output of the AFC feedback model (USB only).");
+      myState.flag_printFeedbackModelBinary = true;
+      break;
+    case ')':
+      myState.flag_printFeedbackModelBinary = false;
+      myTympan.println("Received: stopping binary output of the AFC feedback model.");
       break;        
     case 'd':
       myTympan.println("Received: changing to WDRC Preset");
@@ -476,6 +511,7 @@ void SerialManager::processSingleCharacter(char c) {
     case '[':
       myTympan.println("Received: save preset to SD");
       myState.saveCurrentAlgPresetToSD(true); //true says to write it to SD
+      saveAFCWarmStartToSD(); //also save the AFC's converged feedback model, for a warm start next time
       break;
     case '{':
       {
@@ -658,44 +694,140 @@ void SerialManager::processSingleCharacter(char c) {
       setButtonState_afc();
       break;
     case '?':
-      feedbackCanceler.printEstimatedFeedbackImpulseResponse();
+      printAFCImpulseResponse();
+      break;
+    case 'o':
+      myTympan.println("Received: benchmarking the AFC NLMS kernels...");
+      afc_benchmarkKernels(&myTympan);
+      break;
+    case 'v':
+      if (!usingSeparateAFCs("AFC adaptation schedule")) break;
+      {
+        //cycle through: every sample, every 2nd sample, every 4th sample, round-robin 1/4 of the coefficients
+        const int modes[] = {AFC_ADAPT_EVERY_SAMPLE, AFC_ADAPT_EVERY_NTH, AFC_ADAPT_EVERY_NTH, AFC_ADAPT_ROUND_ROBIN};
+        const int all_n[] = {1, 2, 4, 4};
+        static int ind = 0;
+        ind = (ind + 1) % 4;
+        AFC_AdaptSchedule sched = feedbackCanceler.getAdaptSchedule();
+        sched.mode = modes[ind]; sched.n = all_n[ind];
+        feedbackCanceler.setAdaptSchedule(sched);  feedbackCancelerR.setAdaptSchedule(sched);
+        myTympan.print("Received: changing AFC adaptation schedule.  ");
+        feedbackCanceler.printAdaptStats(&myTympan);
+      }
+      break;
+    case 'V':
+      if (!usingSeparateAFCs("AFC adaptation schedule")) break;
+      feedbackCanceler.printAdaptStats(&myTympan);
+      break;
+    case 'O':
+      myTympan.println("Received: benchmarking the frequency-domain AFC...");
+      pbfdaf_benchmarkVsNLMS(&myTympan);
+      break;
+    case '9':
+      myTympan.println("Received: benchmarking the filterbank biquads...");
+      mb_biquad_benchmark(&myTympan);
+      break;
+    case '0':
+      if (toggleMultiBandFilterMethod()) {
+        myTympan.println("Received: multi-band WDRC filterbank now runs four bands at a time.");
+      } else {
+        myTympan.println("Received: multi-band WDRC filterbank now runs one band at a time (CMSIS).");
+      }
+      break;
+    case '/':
+      myTympan.println("Received: benchmarking the fast WDRC gain (band 1)...");
+      runFastGainBenchmark();
+      break;
+    case ',':
+      if (toggleMultiBandFastGain()) {
+        myTympan.println("Received: multi-band WDRC now uses the fast gain.");
+      } else {
+        myTympan.println("Received: multi-band WDRC now uses the compressors' calcGain.");
+      }
+      break;
+    case '.':
+      myTympan.print("Received: multi-band WDRC now computes the fast gain every "); myTympan.print(cycleMultiBandGainDecimation()); myTympan.println(" samples.");
+      break;
+    case '+': case '-':
+      {
+        int prev_Nchan = myState.getNChan();
+        int new_Nchan = setNumberOfBands(prev_Nchan + ((c == '+') ? 1 : -1));
+        myTympan.print("Received: changing the number of bands to "); myTympan.println(new_Nchan);
+        if (new_Nchan != prev_Nchan) {
+          printTympanRemoteLayout();  //the number of DSL channels has changed, so re-send the whole GUI
+          sendStreamDSL(myState.wdrc_perBand);
+        }
+      }
+      break;
+    case '=':
+      myTympan.println("Received: measuring the AFC convergence on simulated feedback paths...");
+      runAFCConvergenceBenchmark();
       break;
     case 'm':
       old_val = feedbackCanceler.getMu(); new_val = old_val * 2.0;
       myTympan.print("Received: increasing AFC mu to ");
       myTympan.println(feedbackCanceler.setMu(new_val),6);
-      feedbackCancelerR.setMu(new_val);
+      feedbackCancelerR.setMu(new_val); syncStereoAFCParams();
       break;
     case 'M':
       old_val = feedbackCanceler.getMu(); new_val = old_val / 2.0;
       myTympan.print("Received: decreasing AFC mu to "); 
       myTympan.println(feedbackCanceler.setMu(new_val),6);
-      feedbackCancelerR.setMu(new_val);
+      feedbackCancelerR.setMu(new_val); syncStereoAFCParams();
       break;
     case 'r':
       old_val = feedbackCanceler.getRho(); new_val = 1.0-((1.0-old_val)/sqrt(2.0));
       myTympan.print("Received: increasing AFC rho to "); 
       myTympan.println(feedbackCanceler.setRho(new_val),6);
-      feedbackCancelerR.setRho(new_val);
+      feedbackCancelerR.setRho(new_val); syncStereoAFCParams();
       break;
     case 'R':
       old_val = feedbackCanceler.getRho(); new_val = 1.0-((1.0-old_val)*sqrt(2.0));
       myTympan.print("Received: increasing AFC rho to "); 
       myTympan.println(feedbackCanceler.setRho(new_val),6);
-      feedbackCancelerR.setRho(new_val);
+      feedbackCancelerR.setRho(new_val); syncStereoAFCParams();
       break;
     case 'n':
       old_val = feedbackCanceler.getEps(); new_val = old_val*sqrt(10.0);
       myTympan.print("Received: increasing AFC eps to "); 
       myTympan.println(feedbackCanceler.setEps(new_val),6);
-      feedbackCancelerR.setEps(new_val);
+      feedbackCancelerR.setEps(new_val); syncStereoAFCParams();
       break;
     case 'N':
       old_val = feedbackCanceler.getEps(); new_val = old_val/sqrt(10.0);
       myTympan.print("Received: increasing AFC eps to ");
       myTympan.println(feedbackCanceler.setEps(new_val),6);
-      feedbackCancelerR.setEps(new_val);
+      feedbackCancelerR.setEps(new_val); syncStereoAFCParams();
       break;    
+    case 'x':
+      old_val = feedbackCanceler.getEffectiveHdel(); new_val = old_val + 4;
+      myTympan.print("Received: increasing AFC hdel to "); myTympan.println(feedbackCanceler.setHdel(new_val));
+      feedbackCancelerR.setHdel(new_val); syncStereoAFCParams();
+      break;
+    case 'X':
+      old_val = feedbackCanceler.getEffectiveHdel(); new_val = old_val - 4;
+      if (new_val < feedbackCanceler.getBlockLength()) new_val = -1;  //less than one block is not possible
+      myTympan.print("Received: decreasing AFC hdel to "); myTympan.println(feedbackCanceler.setHdel(new_val));
+      feedbackCancelerR.setHdel(new_val); syncStereoAFCParams();
+      break;
+    case 'b':
+      printAFCAlignmentStats(&myTympan);
+      break;
+    case ':':
+      if (!usingSeparateAFCs("AFC convergence")) break;
+      feedbackCanceler.printConvergence(&myTympan);
+      break;
+    case 'j':
+      if (!usingSeparateAFCs("AFC prewhitening and band-limit filters")) break;
+      {
+        //toggle between no filters and CHAPRO's default prewhitening and band-limit filters
+        AFC_FilterParams filt;
+        if (!feedbackCanceler.isFiltered()) { filt.wfl = 9; filt.pfl = 20; filt.alf = 1.0658e-5; filt.pup = 8; }
+        feedbackCanceler.setFilterParams(filt);  feedbackCancelerR.setFilterParams(filt);
+        myTympan.print("Received: changing AFC prewhitening and band-limit filters.  ");
+        feedbackCanceler.printFilterParams(&myTympan);
+      }
+      break;
 //    case 'x':
 //      old_val = feedbackCanceler.getAfl(); new_val = old_val + 5;
 //      myTympan.print("Received: increasing AFC filter length to ");
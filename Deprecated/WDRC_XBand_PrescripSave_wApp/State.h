@@ -106,6 +106,7 @@ class State {
 //    }
 
     bool flag_printPlottableData = false;
+    bool flag_printFeedbackModelBinary = false;  //send the AFC's feedback model as binary packets (see FeedbackModelSnapshot_F32.h)
 
 
     const char *preset_fnames[N_PRESETS] = {"GHA_Constants.txt", "GHA_FullOn.txt", "GHA_RTS.txt"};  //filenames for reading off SD
@@ -0,0 +1,207 @@
+/*
+   WDRC_FastGain_F32
+
+   Created: OpenAudio, 2022
+   Purpose: A faster way to get the WDRC gain from the envelope, for AudioEffectMultiBandWDRC_F32.
+
+     The compressor's own calcGain converts every sample of the envelope to dB SPL, applies the
+     BTNRH gain rule (expansion, linear, compression, limiting), and converts the gain back from
+     dB, which is a log and an exp per sample per band.  Here:
+
+       * wdrc_fast_log2() and wdrc_fast_exp2() replace the log and the exp.  They are cubic
+         polynomials on the float's mantissa, with max errors of 6.4e-4 (log2) and 7.5e-5
+         (exp2, relative), which is under 0.004 dB and 0.001 dB.
+       * MODE_TABLE (the default) precomputes the whole gain curve, as linear gain, every 0.5 dB
+         of level.  Per sample, the level is found with wdrc_fast_log2() and the gain is
+         interpolated from the table, so there is no exp at all.  The interpolation adds under
+         0.01 dB of error, except within half a step of a knee (about 0.05 dB).  If a prescription
+         has its expansion knee above its compression knee, the gain rule itself jumps there, and
+         levels right at the jump can land on either side.
+       * setDecimation(K) computes the gain only every K samples and ramps linearly between them.
+         The envelope is smooth (its attack is several milliseconds), so small K cost little.
+
+     syncTo() copies the parameters from the band's AudioEffectCompWDRC_F32, and rebuilds the
+     table if they changed.  It is cheap enough to call every block, so the usual code that
+     changes the compressor settings keeps working.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _WDRC_FastGain_F32_h
+#define _WDRC_FastGain_F32_h
+
+#include <arm_math.h> //ARM DSP extensions.  https://www.keil.com/pack/doc/CMSIS/DSP/html/index.html
+#include <AudioEffectCompWDRC_F32.h>  //from Tympan_Library
+#include <Arduino.h>
+
+#define WDRC_FASTGAIN_TABLE_MIN_dBFS (-120.0f)  //levels below this use the first entry
+#define WDRC_FASTGAIN_TABLE_STEP_dB  (0.5f)
+#define WDRC_FASTGAIN_TABLE_LEN      (253)      //up to +6 dBFS
+#define WDRC_FASTGAIN_MAX_DECIMATION (32)
+#define WDRC_DB_PER_LOG2 (6.0205999f)           //20*log10(2)
+#define WDRC_LOG2_PER_DB (0.16609640f)          //1/WDRC_DB_PER_LOG2
+
+//log2(x), x > 0.  Max error 6.4e-4.
+static inline float32_t wdrc_fast_log2(float32_t x) {
+  union { float32_t f; uint32_t i; } u;
+  u.f = x;
+  float32_t e = (float32_t)((int32_t)((u.i >> 23) & 0xFF) - 127);
+  u.i = (u.i & 0x007FFFFF) | 0x3F800000;  //the mantissa, as a float in [1, 2)
+  float32_t m = u.f;
+  return e + (-2.15361595f + m * (3.04787421f + m * (-1.05186808f + m * 0.158247158f)));
+}
+
+//2^x.  Max relative error 7.5e-5.
+static inline float32_t wdrc_fast_exp2(float32_t x) {
+  x = max(-126.0f, min(x, 126.0f));
+  float32_t fl = floorf(x), f = x - fl;
+  union { float32_t f; uint32_t i; } u;
+  u.i = (uint32_t)((int32_t)fl + 127) << 23;  //2^floor(x)
+  return u.f * (0.999925196f + f * (0.695833802f + f * (0.226066351f + f * 0.0780251026f)));
+}
+
+class WDRC_FastGain_F32 {
+  public:
+    enum MODE { MODE_FAST_MATH = 0, MODE_TABLE };
+
+    WDRC_FastGain_F32(void) { setParams(115.0f, 1.0f, 0.0f, 0.0f, 100.0f, 1.0f, 200.0f); }
+
+    //same parameters (and meanings) as AudioEffectCompWDRC_F32::setParams()
+    void setParams(float _maxdB, float _exp_cr, float _exp_end_knee, float _tkgain, float _tk, float _cr, float _bolt) {
+      maxdB = _maxdB;  exp_cr = _exp_cr;  exp_end_knee = _exp_end_knee;  tkgain = _tkgain;  tk = _tk;  cr = _cr;  bolt = _bolt;
+
+      //from BTNRH's WDRC_circuit_gain()
+      tk_eff = tk;
+      if ((tk_eff + tkgain) > bolt) tk_eff = bolt - tkgain;
+      float tkgo = tkgain + tk_eff * (1.0f - 1.0f / cr);
+      pblt = cr * (bolt - tkgo);
+      comp_slope = (1.0f / cr) - 1.0f;
+      exp_slope = (exp_cr > 0.0f) ? ((1.0f / exp_cr) - 1.0f) : 0.0f;
+
+      //table index = log2(env) * idx_per_log2 + idx_offset
+      idx_per_log2 = WDRC_DB_PER_LOG2 / WDRC_FASTGAIN_TABLE_STEP_dB;
+      idx_offset = -WDRC_FASTGAIN_TABLE_MIN_dBFS / WDRC_FASTGAIN_TABLE_STEP_dB;
+      for (int i = 0; i < WDRC_FASTGAIN_TABLE_LEN; i++) {
+        float level_dB = maxdB + WDRC_FASTGAIN_TABLE_MIN_dBFS + WDRC_FASTGAIN_TABLE_STEP_dB * (float)i;
+        table[i] = wdrc_fast_exp2(WDRC_LOG2_PER_DB * calcGain_dB(level_dB));
+      }
+    }
+
+    //copy the parameters from the compressor (if they changed).  Returns true if they changed.
+    bool syncTo(AudioEffectCompWDRC_F32 &comp) {
+      float new_maxdB = comp.getMaxdB(), new_exp_cr = comp.getExpansionCompRatio(), new_exp_end_knee = comp.getKneeExpansion_dBSPL();
+      float new_tkgain = comp.getGain_dB(), new_tk = comp.getKneeCompressor_dBSPL(), new_cr = comp.getCompRatio(), new_bolt = comp.getKneeLimiter_dBSPL();
+      if ((new_maxdB == maxdB) && (new_exp_cr == exp_cr) && (new_exp_end_knee == exp_end_knee) && (new_tkgain == tkgain) &&
+          (new_tk == tk) && (new_cr == cr) && (new_bolt == bolt)) return false;
+      setParams(new_maxdB, new_exp_cr, new_exp_end_knee, new_tkgain, new_tk, new_cr, new_bolt);
+      return true;
+    }
+
+    int setMode(int val) { return mode = (val == MODE_FAST_MATH) ? MODE_FAST_MATH : MODE_TABLE; }
+    int getMode(void) { return mode; }
+    int setDecimation(int val) { return decimation = max(1, min(val, WDRC_FASTGAIN_MAX_DECIMATION)); }
+    int getDecimation(void) { return decimation; }
+
+    //the gain rule itself (dB in, dB out), as in BTNRH's WDRC_circuit_gain()
+    float calcGain_dB(float level_dB) {
+      if ((level_dB < exp_end_knee) && (exp_cr < 1.0f)) {
+        return tkgain + exp_slope * (level_dB - exp_end_knee);  //expansion
+      } else if ((level_dB > tk_eff) && (level_dB < pblt)) {
+        return tkgain + comp_slope * (level_dB - tk_eff);       //compression
+      } else if (level_dB >= pblt) {  //(BTNRH has ">", which gives the linear gain at exactly pblt)
+        return bolt + ((level_dB - pblt) / 10.0f) - level_dB;  //limiting
+      }
+      return tkgain;                                          //linear
+    }
+
+    //linear gain for one (linear) envelope value
+    float32_t calcGainFromEnvelope(float32_t env) {
+      float32_t log2_env = wdrc_fast_log2(max(env, 1.0e-12f));
+      if (mode == MODE_FAST_MATH) return wdrc_fast_exp2(WDRC_LOG2_PER_DB * calcGain_dB(maxdB + WDRC_DB_PER_LOG2 * log2_env));
+      float32_t x = max(0.0f, min(log2_env * idx_per_log2 + idx_offset, (float32_t)(WDRC_FASTGAIN_TABLE_LEN - 1) - 0.001f));
+      int i = (int)x;
+      float32_t frac = x - (float32_t)i;
+      return table[i] + frac * (table[i + 1] - table[i]);
+    }
+
+    //same as the compressor's calcGain.calcGainFromEnvelope()
+    void calcGainFromEnvelope(const float32_t *env, float32_t *gain_out, int n) {
+      if (decimation <= 1) {
+        for (int i = 0; i < n; i++) gain_out[i] = calcGainFromEnvelope(env[i]);
+        return;
+      }
+      for (int i0 = 0; i0 < n; i0 += decimation) {
+        int len = min(decimation, n - i0);
+        float32_t g = calcGainFromEnvelope(env[i0 + len - 1]);
+        float32_t step = (g - last_gain) / (float32_t)len;
+        for (int i = 0; i < len; i++) gain_out[i0 + i] = last_gain + step * (float32_t)(i + 1);
+        last_gain = g;
+      }
+    }
+
+  protected:
+    float maxdB, exp_cr, exp_end_knee, tkgain, tk, cr, bolt;
+    float tk_eff, pblt, comp_slope, exp_slope;
+    float idx_per_log2, idx_offset;
+    float32_t table[WDRC_FASTGAIN_TABLE_LEN];
+    int mode = MODE_TABLE;
+    int decimation = 1;
+    float32_t last_gain = 1.0f;
+};
+
+// ///////////////////////////////////////////////// Benchmark
+
+//Compare the compressor's own calcGain (the reference) with WDRC_FastGain_F32 in each mode, on an
+//envelope that sweeps from -100 to 0 dBFS while moving +/-10 dB at a syllabic rate.  Reports the
+//cycles per sample and the largest gain error (dB).  Only comp's calcGain is used (it has no state).
+#define WDRC_FASTGAIN_BENCH_BLOCK 24
+static inline void wdrc_fastGainBenchmark(Print *p, AudioEffectCompWDRC_F32 *comp, float fs_Hz, int n_blocks = 500) {
+  const int n_cases = 5;
+  const int modes[n_cases] = { -1, WDRC_FastGain_F32::MODE_FAST_MATH, WDRC_FastGain_F32::MODE_TABLE, WDRC_FastGain_F32::MODE_TABLE, WDRC_FastGain_F32::MODE_TABLE };
+  const int decims[n_cases] = { 1, 1, 1, 4, 8 };
+  const char *names[n_cases] = { "calcGain (reference)", "fast log2/exp2", "table", "table, every 4th", "table, every 8th" };
+  static WDRC_FastGain_F32 fast[n_cases];
+  float32_t env[WDRC_FASTGAIN_BENCH_BLOCK], gain_ref[WDRC_FASTGAIN_BENCH_BLOCK], gain[WDRC_FASTGAIN_BENCH_BLOCK];
+  uint32_t cycles[n_cases] = {0};
+  float max_err_dB[n_cases] = {0.0f};
+
+  for (int Icase = 1; Icase < n_cases; Icase++) {
+    fast[Icase].syncTo(*comp);
+    fast[Icase].setMode(modes[Icase]);
+    fast[Icase].setDecimation(decims[Icase]);
+  }
+  const int n_total = n_blocks * WDRC_FASTGAIN_BENCH_BLOCK;
+  for (int Iblock = 0; Iblock < n_blocks; Iblock++) {
+    for (int i = 0; i < WDRC_FASTGAIN_BENCH_BLOCK; i++) {
+      int ind = Iblock * WDRC_FASTGAIN_BENCH_BLOCK + i;
+      float level_dBFS = -100.0f + 100.0f * (float)ind / (float)n_total + 10.0f * sinf(2.0f * PI * 4.0f * (float)ind / fs_Hz);
+      env[i] = powf(10.0f, min(level_dBFS, 0.0f) / 20.0f);
+    }
+
+    uint32_t t0 = ARM_DWT_CYCCNT;
+    comp->calcGain.calcGainFromEnvelope(env, gain_ref, WDRC_FASTGAIN_BENCH_BLOCK);
+    cycles[0] += (ARM_DWT_CYCCNT - t0);
+    for (int Icase = 1; Icase < n_cases; Icase++) {
+      t0 = ARM_DWT_CYCCNT;
+      fast[Icase].calcGainFromEnvelope(env, gain, WDRC_FASTGAIN_BENCH_BLOCK);
+      cycles[Icase] += (ARM_DWT_CYCCNT - t0);
+      for (int i = 0; i < WDRC_FASTGAIN_BENCH_BLOCK; i++) {
+        float err_dB = fabsf(20.0f * log10f(max(gain[i], 1.0e-12f) / max(gain_ref[i], 1.0e-12f)));
+        if (Iblock > 0) max_err_dB[Icase] = max(max_err_dB[Icase], err_dB);  //skip the first block (the decimated ramps start from 0 dB)
+      }
+    }
+  }
+
+  p->print("WDRC Fast Gain Benchmark: "); p->print(n_total); p->println(" samples");
+  for (int Icase = 0; Icase < n_cases; Icase++) {
+    float cyc = (float)cycles[Icase] / (float)n_total;
+    p->print("    : "); p->print(names[Icase]); p->print(": cycles/sample = "); p->print(cyc, 1);
+    if (Icase > 0) {
+      p->print(", speedup = "); p->print(((float)cycles[0] / (float)n_total) / max(cyc, 1.0e-3f), 2);
+      p->print(", max error (dB) = "); p->print(max_err_dB[Icase], 4);
+    }
+    p->println();
+  }
+}
+
+#endif
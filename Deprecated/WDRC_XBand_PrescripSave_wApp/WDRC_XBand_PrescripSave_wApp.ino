@@ -48,6 +48,9 @@ int USE_VOLUME_KNOB = 0;  //set to 1 to use volume knob to override the default
 #else
 #define N_EARPIECES 1
 #endif
+#define USE_STEREO_AFC (false)  //set true to use one binaural AFC object instead of separate left and right AFC objects
+#define USE_MULTIBAND_WDRC (true)  //set true to do the filterbank, per-band compressors, and mixer in one audio object (less audio memory and overhead)
+#define USE_AFC_SIM_METRIC (false)  //set true to compile in the AFC's misalignment metric, which is needed for the AFC convergence benchmark ('=')
 const int LEFT = 0, RIGHT = (LEFT+1);
 const int FRONT = 0, REAR = 1;
 const int PDM_RIGHT_FRONT = 3, PDM_RIGHT_REAR = 2, PDM_LEFT_FRONT = 1, PDM_LEFT_REAR = 0;  //Front/Rear is weird.  Left/Right matches the enclosure labeling.
@@ -59,6 +62,11 @@ const int ANALOG_IN = 0, PDM_IN = 1;
 //local files
 #include "AudioEffectFeedbackCancel_F32.h"
 #include "AudioEffectAFC_BTNRH_F32.h"
+#include "AudioEffectFeedbackCancel_PBFDAF_F32.h"
+#include "AudioEffectFeedbackCancel_Stereo_F32.h"
+#include "AFC_FeedbackSim_F32.h"
+#include "AudioEffectMultiBandWDRC_F32.h"
+#include "FilterbankCoeffCache.h"
 #include "SerialManager.h"
 
 //define the sample rate and audio block size
@@ -221,6 +229,7 @@ void setupAudioProcessing(void) {
   
   //load various algorithm settings
   myState.defineAlgorithmPresets(true); //"true" loads from SD and back-fills with hardwired values if SD doesn't work.
+  prewarmFilterbankCache();  //design every preset's filterbank now, so that switching presets later is quick
   setAlgorithmPreset(myState.current_alg_config); //sets the Per Band, the Broad Band, and the AFC parameters using a preset
   
 }
@@ -232,6 +241,57 @@ void setupAudioProcessing(void) {
 #define COEFF_PER_BIQUAD  6                         //3 "b" coefficients and 3 "a" coefficients per biquad
 float  filter_sos[N_CHAN_MAX][N_BIQUAD_PER_FILT * COEFF_PER_BIQUAD];   //this holds all the biquad filter coefficients
 int    filter_delay[N_CHAN_MAX];                    //added delay (samples) for each filter (int[8])
+#define FILTERBANK_TD_MSEC 2.5f                     //allowed time delay (msec) for the filterbank design
+FilterbankCoeffCache filterbankCache;               //filterbanks already designed (one per preset, plus a few)
+
+//get the filterbank for this DSL into filter_sos and filter_delay.  It is only designed (which takes
+//milliseconds) if the same design isn't already in the cache.  Returns true if it came from the cache.
+bool getFilterbankCoeff(const BTNRH_WDRC::CHA_DSL &this_dsl, int n_chan, float sample_rate_Hz) {
+  const float *crossover_freq = this_dsl.cross_freq;  //crossover frequencies (Hz)
+  if (filterbankCache.lookup(n_chan, MAX_IIR_FILT_ORDER, sample_rate_Hz, FILTERBANK_TD_MSEC, crossover_freq, (float *)filter_sos, filter_delay)) return true;
+  filterBankCalculator.createFilterCoeff_SOS(n_chan, MAX_IIR_FILT_ORDER, sample_rate_Hz, FILTERBANK_TD_MSEC, (float *)crossover_freq,  // these are the inputs
+        (float *)filter_sos, filter_delay);  //these are the outputs
+  filterbankCache.store(n_chan, MAX_IIR_FILT_ORDER, sample_rate_Hz, FILTERBANK_TD_MSEC, crossover_freq, (float *)filter_sos, filter_delay);
+  return false;
+}
+
+void prewarmFilterbankCache(void) {
+  for (int Ipreset = 0; Ipreset < N_PRESETS; Ipreset++) {
+    const BTNRH_WDRC::CHA_DSL &this_dsl = myState.presets[Ipreset].wdrc_perBand;
+    getFilterbankCoeff(this_dsl, max(1, min(N_CHAN_MAX, this_dsl.nchannel)), audio_settings.sample_rate_Hz);
+  }
+  Serial.print("prewarmFilterbankCache: "); Serial.print(filterbankCache.getNumUsed()); Serial.println(" filterbank(s) designed.");
+}
+
+//Only the first n_chan bands of the filterbank run.  The bands above that are switched off (so that
+//update_all() skips them and they use no CPU) and are disconnected from their input and from the summing
+//mixer.  With the fused multi-band WDRC, the separate band objects are not compiled in, and its
+//compressors (which only hold the settings) are all off.
+//Call this with the audio interrupt held off, so that all of the bands change at the same block boundary.
+void setActiveBands(int n_chan) {
+  #if (USE_MULTIBAND_WDRC)
+  for (int Iear = 0; Iear < N_EARPIECES; Iear++) {
+    for (int Iband = 0; Iband < N_CHAN_MAX; Iband++) expCompLim[Iear][Iband].setActive(false);
+  }
+  #else
+  static bool is_disconnected[2][N_CHAN_MAX] = {{false}};
+  for (int Iear = 0; Iear < N_EARPIECES; Iear++) {
+    for (int Iband = 0; Iband < N_CHAN_MAX; Iband++) {
+      bool active = (Iband < n_chan);
+      bpFilt[Iear][Iband].setActive(active);
+      expCompLim[Iear][Iband].setActive(active);
+      if ((bandInputCord[Iear][Iband] == NULL) || (bandOutputCord[Iear][Iband] == NULL)) continue;  //not connected at all
+      if (active && is_disconnected[Iear][Iband]) {
+        bandInputCord[Iear][Iband]->connect();  bandOutputCord[Iear][Iband]->connect();
+        is_disconnected[Iear][Iband] = false;
+      } else if (!active && !is_disconnected[Iear][Iband]) {
+        bandInputCord[Iear][Iband]->disconnect();  bandOutputCord[Iear][Iband]->disconnect();
+        is_disconnected[Iear][Iband] = true;
+      }
+    }
+  }
+  #endif
+}
 
 // setup the per-band processing
 void setupFromDSL(BTNRH_WDRC::CHA_DSL &this_dsl, float gha_tk, const int n_chan_max, const AudioSettings_F32 &settings) {
@@ -241,15 +301,14 @@ void setupFromDSL(BTNRH_WDRC::CHA_DSL &this_dsl, float gha_tk, const int n_chan_
 
   // filterbank parameters
   int n_chan = this_dsl.nchannel;
-  int n_iir = MAX_IIR_FILT_ORDER;  //filter order
   float sample_rate_Hz = audio_settings.sample_rate_Hz; //sample rate Hz)
-  float td_msec = 2.5f;          //allowed time delay (msec)
-  float *crossover_freq = this_dsl.cross_freq;  //crossover frequencies (Hz)
  
-  // //compute the per-channel filter coefficients
-  Serial.println("setupFromDSL: computing SOS filter coefficients...");
-  filterBankCalculator.createFilterCoeff_SOS(n_chan, n_iir, sample_rate_Hz, td_msec, crossover_freq,  // these are the inputs
-        (float *)filter_sos, filter_delay);  //these are the outputs
+  // //compute the per-channel filter coefficients (or get them from the cache)
+  if (getFilterbankCoeff(this_dsl, n_chan, sample_rate_Hz)) {
+    Serial.println("setupFromDSL: using cached SOS filter coefficients...");
+  } else {
+    Serial.println("setupFromDSL: computed SOS filter coefficients...");
+  }
 
   #if 0
     //plot coefficients (for debugging)
@@ -263,9 +322,12 @@ void setupFromDSL(BTNRH_WDRC::CHA_DSL &this_dsl, float gha_tk, const int n_chan_
     }
   #endif
   
-  // Loop over each ear
+  // Loop over each ear.  Everything from here to AudioInterrupts() takes effect at the same block boundary,
+  // so that a change in the number of bands never runs with half of the bands changed.
   Serial.println("setupFromDSL: deploying SOS filter coefficients to the filter objects...");
+  AudioNoInterrupts();
   for (int Iear = 0; Iear < N_EARPIECES; Iear++) {
+    #if (!USE_MULTIBAND_WDRC)
     //give the pre-computed coefficients to the IIR filters
     for (int Iband = 0; Iband < n_chan_max; Iband++) {
       //Serial.print("    : SOS ear, band: "); Serial.print(Iear); Serial.print(", "); Serial.println(Iband);
@@ -286,10 +348,25 @@ void setupFromDSL(BTNRH_WDRC::CHA_DSL &this_dsl, float gha_tk, const int n_chan_
         postFiltDelay[Iear][Iband].delay(0, 0); //from filter_coeff_sos.h.  milliseconds!!!
       }
     }
+    #endif
   
     //setup all of the per-channel compressors
     configurePerBandWDRCs(n_chan, settings.sample_rate_Hz, this_dsl, gha_tk, expCompLim[Iear]);
+
+    //the fused filterbank uses the same filter coefficients, the same per-band delays (in place of
+    //postFiltDelay), and the same compressors.  It crossfades from its old filters to the new ones, so
+    //that changing presets doesn't click.
+    #if (USE_MULTIBAND_WDRC)
+      for (int Iband = 0; Iband < n_chan; Iband++) {
+        multiBandWDRC[Iear].setBand(Iband, &(filter_sos[Iband][0]), N_BIQUAD_PER_FILT, &(expCompLim[Iear][Iband]), filter_delay[Iband]);
+      }
+      multiBandWDRC[Iear].setNumBands(n_chan);
+      multiBandWDRC[Iear].applyBands(false);  //false: we already hold off the audio interrupt
+    #endif
   }
+  setActiveBands(n_chan);
+  AudioInterrupts();
+  
   //overwrite the one-point calibration based on the dsl data structure
   overall_cal_dBSPL_at0dBFS = this_dsl.maxdB;
   
@@ -306,6 +383,87 @@ void setupFromDSL(BTNRH_WDRC::CHA_DSL &this_dsl, float gha_tk, const int n_chan_
 
 }
 
+//the fused multi-band WDRC gets its gains from WDRC_FastGain_F32 (default) or from the compressors' calcGain
+bool toggleMultiBandFastGain(void) {
+  #if (USE_MULTIBAND_WDRC)
+    bool use_fast_gain = !multiBandWDRC[LEFT].getUseFastGain();
+    for (int Iear = LEFT; Iear <= RIGHT; Iear++) multiBandWDRC[Iear].setUseFastGain(use_fast_gain);
+    return use_fast_gain;
+  #else
+    Serial.println("toggleMultiBandFastGain: not available.  Set USE_MULTIBAND_WDRC to true and recompile.");
+    return false;
+  #endif
+}
+int cycleMultiBandGainDecimation(void) {  //1, 2, 4, 8, then back to 1
+  #if (USE_MULTIBAND_WDRC)
+    int K = multiBandWDRC[LEFT].getGainDecimation() * 2;
+    if (K > 8) K = 1;
+    for (int Iear = LEFT; Iear <= RIGHT; Iear++) multiBandWDRC[Iear].setGainDecimation(K);
+    return K;
+  #else
+    Serial.println("cycleMultiBandGainDecimation: not available.  Set USE_MULTIBAND_WDRC to true and recompile.");
+    return 1;
+  #endif
+}
+void runFastGainBenchmark(void) {
+  wdrc_fastGainBenchmark(&myTympan, &(expCompLim[LEFT][0]), audio_settings.sample_rate_Hz);
+}
+
+//Change the number of bands, keeping the rest of the prescription.  The crossover frequencies are
+//re-spaced (evenly in log frequency) over the same range as before, and the filterbank is re-designed.
+//Each new band takes the compressor settings of the old band that holds its center frequency.
+//Re-selecting the preset brings back its original bands.
+int setNumberOfBands(int new_n_chan) {
+  const BTNRH_WDRC::CHA_DSL &old_dsl = myState.wdrc_perBand;
+  int old_n_chan = old_dsl.nchannel;
+  new_n_chan = max(1, min(N_CHAN_MAX, new_n_chan));
+  if (new_n_chan == old_n_chan) return old_n_chan;
+
+  //range of the crossovers
+  float low_Hz = 500.0f, high_Hz = 5000.0f;  //if there were no crossovers before
+  if (old_n_chan > 1) { low_Hz = old_dsl.cross_freq[0]; high_Hz = old_dsl.cross_freq[old_n_chan - 2]; }
+  if (high_Hz <= low_Hz) { low_Hz *= 0.5f; high_Hz = 4.0f * low_Hz; }  //only one crossover before: spread an octave either side
+  
+  BTNRH_WDRC::CHA_DSL new_dsl = old_dsl;  //shallow copy
+  new_dsl.nchannel = new_n_chan;
+  for (int k = 0; k < new_n_chan - 1; k++) {
+    float frac = (new_n_chan > 2) ? ((float)k / (float)(new_n_chan - 2)) : 0.5f;
+    new_dsl.cross_freq[k] = low_Hz * powf(high_Hz / low_Hz, frac);
+  }
+  for (int Iband = 0; Iband < new_n_chan; Iband++) {
+    float center_Hz;
+    if (new_n_chan == 1) {
+      center_Hz = sqrtf(low_Hz * high_Hz);
+    } else if (Iband == 0) {
+      center_Hz = new_dsl.cross_freq[0] * 0.7071f;  //half an octave below the first crossover
+    } else if (Iband == new_n_chan - 1) {
+      center_Hz = new_dsl.cross_freq[new_n_chan - 2] * 1.4142f;  //half an octave above the last crossover
+    } else {
+      center_Hz = sqrtf(new_dsl.cross_freq[Iband - 1] * new_dsl.cross_freq[Iband]);
+    }
+    int Iold = 0;
+    while ((Iold < old_n_chan - 1) && (old_dsl.cross_freq[Iold] < center_Hz)) Iold++;
+    new_dsl.exp_cr[Iband] = old_dsl.exp_cr[Iold];  new_dsl.exp_end_knee[Iband] = old_dsl.exp_end_knee[Iold];
+    new_dsl.tkgain[Iband] = old_dsl.tkgain[Iold];  new_dsl.cr[Iband] = old_dsl.cr[Iold];
+    new_dsl.tk[Iband] = old_dsl.tk[Iold];          new_dsl.bolt[Iband] = old_dsl.bolt[Iold];
+  }
+
+  setupFromDSL(new_dsl, (float)myState.wdrc_broadband.tk, N_CHAN_MAX, audio_settings);  //also saves new_dsl to myState
+  return myState.wdrc_perBand.nchannel;
+}
+
+//the fused multi-band WDRC filters its bands four at a time (default) or one at a time (CMSIS biquads)
+bool toggleMultiBandFilterMethod(void) {
+  #if (USE_MULTIBAND_WDRC)
+    bool use_band_parallel = !multiBandWDRC[LEFT].getUseBandParallel();
+    for (int Iear = LEFT; Iear <= RIGHT; Iear++) multiBandWDRC[Iear].setUseBandParallel(use_band_parallel);
+    return use_band_parallel;
+  #else
+    Serial.println("toggleMultiBandFilterMethod: not available.  Set USE_MULTIBAND_WDRC to true and recompile.");
+    return false;
+  #endif
+}
+
 void setupFromDSLandGHAandAFC(BTNRH_WDRC::CHA_DSL &this_dsl, BTNRH_WDRC::CHA_WDRC &this_gha,
                               BTNRH_WDRC::CHA_AFC &this_afc, const int n_chan_max, const AudioSettings_F32 &settings)
 {
@@ -319,10 +477,16 @@ void setupFromDSLandGHAandAFC(BTNRH_WDRC::CHA_DSL &this_dsl, BTNRH_WDRC::CHA_WDR
     } else {
       feedbackCancelR.setParams(this_afc);
     }
+    #if (USE_STEREO_AFC)
+      if (Iear == LEFT) feedbackCancelStereo.setParams(this_afc);
+    #endif
     
       //setup the broad band compressor (limiter)
       configureBroadbandWDRCs(settings.sample_rate_Hz, this_gha, vol_knob_gain_dB, compBroadband[Iear]);
   }
+
+  //start the AFC from where it was when this preset was last saved (if it was saved)
+  loadAFCWarmStartFromSD();
   
   //save the state
   myState.wdrc_broadband = this_gha; //shallow copy into wdrc_broadband
@@ -551,10 +715,149 @@ int configureLeftRightMixer(int val) {  //call this if you want to change left-r
   return myState.input_mixer_config;
 }
 
+//copy the AFC parameters from the (left) AFC to the binaural AFC, if it is being used
+void syncStereoAFCParams(void) {
+  #if (USE_STEREO_AFC)
+    feedbackCancelStereo.setParams(feedbackCancel.getMu(), feedbackCancel.getRho(), feedbackCancel.getEps(), feedbackCancel.getAfl());
+    feedbackCancelStereo.setHdel(feedbackCancel.getHdel());
+  #endif
+}
+
+//true if the separate left and right AFCs are the ones in the audio path.  With the binaural AFC
+//(USE_STEREO_AFC), says that the caller's AFC feature is not available and returns false.
+bool usingSeparateAFCs(const char *caller) {
+  #if (USE_STEREO_AFC)
+    Serial.print(caller); Serial.println(": not available with the binaural AFC.  Set USE_STEREO_AFC to false and recompile.");
+    return false;
+  #else
+    return true;
+  #endif
+}
+
+//print the feedback model of the AFC that is in the audio path
+void printAFCImpulseResponse(void) {
+  #if (USE_STEREO_AFC)
+    feedbackCancelStereo.printEstimatedFeedbackImpulseResponse(&Serial, AudioEffectFeedbackCancel_Stereo_F32::LEFT_EAR, false);
+    feedbackCancelStereo.printEstimatedFeedbackImpulseResponse(&Serial, AudioEffectFeedbackCancel_Stereo_F32::RIGHT_EAR, false);
+  #else
+    feedbackCancel.printEstimatedFeedbackImpulseResponse();
+  #endif
+}
+
+//print how well the loopback audio lines up with the input audio, for the AFC that is in the audio path
+void printAFCAlignmentStats(Print *p) {
+  #if (USE_STEREO_AFC)
+    feedbackCancelStereo.printAlignmentStats(p);
+  #else
+    feedbackCancel.printAlignmentStats(p);
+  #endif
+}
+
+//Measure the AFC's convergence on simulated feedback paths.  Uses a separate AFC (not connected to
+//the audio) with the same filter length and hardware delay as the real one.  Runs from loop().
+//The AFC is created only for the benchmark (and destroyed after), so its memory is not tied up the rest of the time.
+void runAFCConvergenceBenchmark(void) {
+  #if (USE_AFC_SIM_METRIC)
+    AudioEffectAFC_BTNRH_F32 *afcBenchmark = new AudioEffectAFC_BTNRH_F32(audio_settings);
+    if (afcBenchmark == NULL) { Serial.println("runAFCConvergenceBenchmark: *** ERROR ***: not enough memory for the benchmark AFC."); return; }
+    afcBenchmark->setAfl(feedbackCancel.getAfl());
+    afcBenchmark->setHdel(feedbackCancel.getEffectiveHdel());
+    afc_convergenceBenchmark(afcBenchmark, &myTympan, audio_settings.sample_rate_Hz, audio_settings.audio_block_samples);
+    delete afcBenchmark;
+  #else
+    Serial.println("runAFCConvergenceBenchmark: not available.  Set USE_AFC_SIM_METRIC to true and recompile.");
+  #endif
+}
+
+// ///////////////// AFC warm start: the converged AFC state is saved to SD along with the preset
+//(only for the separate left and right AFCs.  The binaural AFC (USE_STEREO_AFC) has no warm start.)
+
+//the saved state is specific to the preset, the earpiece (analog or PDM mics), and the ear
+void getAFCWarmStartFname(int Iear, char *fname) {
+  sprintf(fname, "AFC_P%d_E%d_%c.bin", myState.current_alg_config, myState.input_analogVsPDM, (Iear == LEFT) ? 'L' : 'R');
+}
+AudioEffectFeedbackCancel_Local_F32* getAFC(int Iear) {  //the AFC in the audio path (unless USE_STEREO_AFC)
+  if (Iear == LEFT) return &feedbackCancel;
+  return &feedbackCancelR;
+}
+AFC_WarmState afc_warm_state;  //too big for the stack
+
+//The warm start uses the SD writer's own SdFs (a second SdFs on the same card would fight with it over
+//the card).  Returns NULL, after saying why, if the card cannot be used right now.
+SdFs* beginAFCWarmStartSD(const char *caller) {
+  if (audioSDWriter.getState() == AudioSDWriter::STATE::RECORDING) {
+    Serial.print(caller); Serial.println(": SD is busy recording audio.  Skipping the AFC state.");
+    return NULL;
+  }
+  if (audioSDWriter.getState() == AudioSDWriter::STATE::UNPREPARED) audioSDWriter.prepareSDforRecording();  //begins the SD card
+  SdFs *sd = audioSDWriter.getSdPtr();
+  if ((sd == NULL) || (audioSDWriter.getState() == AudioSDWriter::STATE::UNPREPARED)) {
+    Serial.print(caller); Serial.println(": *** ERROR ***: could not open the SD card.");
+    return NULL;
+  }
+  return sd;
+}
+
+void saveAFCWarmStartToSD(void) {
+  #if (!USE_STEREO_AFC)
+    SdFs *sd = beginAFCWarmStartSD("saveAFCWarmStartToSD");
+    if (sd == NULL) return;
+    char fname[24];
+    for (int Iear = 0; Iear < N_EARPIECES; Iear++) {
+      if (!getAFC(Iear)->getWarmState(&afc_warm_state)) continue;
+      afc_warm_state.preset = myState.current_alg_config;
+      afc_warm_state.earpiece = myState.input_analogVsPDM;
+      afc_warm_state.ear = Iear;
+      afc_warm_state.checksum = afc_warmStateChecksum(&afc_warm_state);  //the key changed
+
+      getAFCWarmStartFname(Iear, fname);
+      FsFile file = sd->open(fname, O_WRITE | O_CREAT | O_TRUNC);
+      if (!file) { Serial.print("saveAFCWarmStartToSD: *** ERROR ***: could not open "); Serial.println(fname); continue; }
+      int n_bytes = file.write((const uint8_t *)&afc_warm_state, sizeof(afc_warm_state));
+      file.close();
+      Serial.print("saveAFCWarmStartToSD: wrote "); Serial.print(n_bytes); Serial.print(" bytes to "); Serial.println(fname);
+    }
+  #else
+    //the left and right AFCs are not in the audio path, so their states would be meaningless
+    Serial.println("saveAFCWarmStartToSD: not available with the binaural AFC.  Set USE_STEREO_AFC to false and recompile.");
+  #endif
+}
+
+void loadAFCWarmStartFromSD(void) {
+  #if (!USE_STEREO_AFC)  //(otherwise the binaural AFC just starts cold.  No message, since this runs on every preset change.)
+    static int prev_key = -1;  //only when the preset or earpiece changes (not on every change of the AFC or GHA settings)
+    int key = 2*myState.current_alg_config + myState.input_analogVsPDM;
+    if (key == prev_key) return;
+    prev_key = key;
+    SdFs *sd = beginAFCWarmStartSD("loadAFCWarmStartFromSD");
+    if (sd == NULL) return;
+
+    char fname[24];
+    for (int Iear = 0; Iear < N_EARPIECES; Iear++) {
+      getAFCWarmStartFname(Iear, fname);
+      FsFile file = sd->open(fname, O_RDONLY);
+      if (!file) { Serial.print("loadAFCWarmStartFromSD: no saved AFC state in "); Serial.println(fname); continue; }
+      int n_bytes = file.read((uint8_t *)&afc_warm_state, sizeof(afc_warm_state));
+      file.close();
+      if ((n_bytes != (int)sizeof(afc_warm_state)) || (afc_warm_state.preset != myState.current_alg_config) ||
+          (afc_warm_state.earpiece != myState.input_analogVsPDM) || (afc_warm_state.ear != Iear)) {
+        Serial.print("loadAFCWarmStartFromSD: *** WARNING ***: ignoring "); Serial.print(fname); Serial.println(" (wrong size or key)");
+        continue;
+      }
+      if (getAFC(Iear)->setWarmState(&afc_warm_state)) {
+        Serial.print("loadAFCWarmStartFromSD: AFC warm start from "); Serial.println(fname);
+      }
+    }
+  #endif
+}
+
 bool enableAFC(bool enable) {
   myState.afc.default_to_active = enable;
   feedbackCancel.setEnable(enable);
   feedbackCancelR.setEnable(enable);
+  #if (USE_STEREO_AFC)
+    feedbackCancelStereo.setEnable(enable);
+  #endif
   return myState.afc.default_to_active ;
 }
 
@@ -652,6 +955,7 @@ void loop() {
   //print plottable data
   //if (myState.flag_printPlottableData) printPlottableData(millis(), 250);  //print values every 250msec
   if (myState.flag_printPlottableData) printPlottableData(millis(), 1000);  //print values every 250msec
+  if (myState.flag_printFeedbackModelBinary) serviceFeedbackModelBinary(millis(), 100);  //send the AFC model at 10 Hz
 
 } //end loop()
 
@@ -973,6 +1277,22 @@ void printPlottableData(unsigned long curTime_millis, unsigned long updatePeriod
   } // end if
 } //end printPlottableData
 
+//send the newest snapshot of the AFC feedback model as a compact binary packet (only if it has changed)
+void serviceFeedbackModelBinary(unsigned long curTime_millis, unsigned long updatePeriod_millis) {
+  static unsigned long lastUpdate_millis = 0;
+  static uint32_t last_seq = 0;
+
+  //has enough time passed to update everything?
+  if (curTime_millis < lastUpdate_millis) lastUpdate_millis = 0; //handle wrap-around of the clock
+  if ((curTime_millis - lastUpdate_millis) >= updatePeriod_millis) {
+    if (feedbackCancel.getFeedbackModelSequence() != last_seq) {
+      last_seq = feedbackCancel.getFeedbackModelSequence();
+      feedbackCancel.writeFeedbackModelBinary(&Serial);
+    }
+    lastUpdate_millis = curTime_millis; //we will use this value the next time around.
+  }
+}
+
 void printData(Print *s, bool printLeadingChar, int counter) {
   if (printLeadingChar)  s->print("P");          //Let's assume that all plottable data starts with a "P"
   #if 0
@@ -984,7 +1304,11 @@ void printData(Print *s, bool printLeadingChar, int counter) {
     s->println();
   #else
     s->println(-2);s->println(2); //put a blip in the data so that you know when new data is being sent
-    feedbackCancel.printEstimatedFeedbackImpulseResponse(s,true);  //the true puts a line feed after each datapoint
+    #if (USE_STEREO_AFC)
+      feedbackCancelStereo.printEstimatedFeedbackImpulseResponse(s,AudioEffectFeedbackCancel_Stereo_F32::LEFT_EAR,true);  //the true puts a line feed after each datapoint
+    #else
+      feedbackCancel.printEstimatedFeedbackImpulseResponse(s,true);  //the true puts a line feed after each datapoint
+    #endif
   #endif
 }
 
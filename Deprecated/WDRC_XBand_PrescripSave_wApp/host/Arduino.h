@@ -0,0 +1,73 @@
+/*
+   Arduino.h (host)
+
+   Created: OpenAudio, 2022
+   Purpose: Just enough of the Arduino (Teensy) core for the sketch's DSP headers (the AFCs, the
+       multi-band WDRC, the fast gain) to compile on a PC, for the tests in this directory.
+       Serial (and any other Print) goes to stdout, unless a test overrides write() to capture it.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _host_Arduino_h
+#define _host_Arduino_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#define F(str) (str)  //no flash strings on a PC
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+//like the Teensy core, min() and max() are functions (not macros), so the standard headers still work
+template <class A, class B> constexpr auto min(const A &a, const B &b) -> decltype(a < b ? a : b) { return (a < b) ? a : b; }
+template <class A, class B> constexpr auto max(const A &a, const B &b) -> decltype(a < b ? a : b) { return (a > b) ? a : b; }
+
+class Print {
+  public:
+    Print(FILE *_fid = stdout) : fid(_fid) {}
+    virtual ~Print(void) {}
+    virtual size_t write(uint8_t c) { return fputc(c, fid) == EOF ? 0 : 1; }
+    size_t write(const uint8_t *buf, size_t n) { size_t count = 0; for (size_t i = 0; i < n; i++) count += write(buf[i]); return count; }
+    size_t print(const char *s) { size_t count = 0; while (*s) count += write((uint8_t)*s++); return count; }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int val) { return printf_("%d", val); }
+    size_t print(unsigned int val) { return printf_("%u", val); }
+    size_t print(long val) { return printf_("%ld", val); }
+    size_t print(unsigned long val) { return printf_("%lu", val); }
+    size_t print(double val, int digits = 2) { return printf_("%.*f", digits, val); }
+    size_t println(void) { return print('\n'); }
+    template <class T> size_t println(T val) { size_t n = print(val); return n + println(); }
+    size_t println(double val, int digits) { size_t n = print(val, digits); return n + println(); }
+    void flush(void) { fflush(fid); }
+  protected:
+    FILE *fid;
+    template <class... T> size_t printf_(const char *fmt, T... vals) { char buf[64]; snprintf(buf, sizeof(buf), fmt, vals...); return print((const char *)buf); }
+};
+
+class Stream : public Print {
+  public:
+    int available(void) { return 0; }
+    int read(void) { return -1; }
+};
+
+inline Stream Serial;
+
+inline unsigned long micros(void) {
+  static const auto t0 = std::chrono::steady_clock::now();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+inline unsigned long millis(void) { return micros() / 1000UL; }
+inline void delay(unsigned long msec) { unsigned long t0 = millis(); while (millis() - t0 < msec) {} }
+
+//the Teensy's cycle counter, here counting nanoseconds (as if the CPU ran at 1 GHz)
+#define F_CPU_ACTUAL 1000000000UL
+#define ARM_DWT_CYCCNT ((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count())
+
+#endif
@@ -0,0 +1,138 @@
+/*
+   AudioEffectCompWDRC_F32.h (host)
+
+   Created: OpenAudio, 2022
+   Purpose: Stand-in for the Tympan_Library's AudioEffectCompWDRC_F32, with the parts that the sketch's
+       AudioEffectMultiBandWDRC_F32 and WDRC_FastGain_F32 use: the envelope (calcEnvelope), the gain
+       (calcGain), setParams(), and the getters.  The envelope and the gain rule are transcribed from
+       the Tympan_Library's AudioCalcEnvelope_F32 and AudioCalcGainWDRC_F32 (which come from BTNRH's
+       WDRC_circuit_gain()), including its log2 approximation, so that the fast gain is tested against
+       what the Tympan actually runs.  There is no update(): the sketch's headers don't need it here.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _host_AudioEffectCompWDRC_F32_h
+#define _host_AudioEffectCompWDRC_F32_h
+
+#include <Arduino.h>
+#include <AudioStream_F32.h>
+
+class AudioCalcEnvelope_F32 {
+  public:
+    AudioCalcEnvelope_F32(float _fs_Hz = AUDIO_SAMPLE_RATE_EXACT) : fs_Hz(_fs_Hz) { setAttackRelease_msec(5.0f, 300.0f); }
+
+    void setSampleRate_Hz(float _fs_Hz) { fs_Hz = _fs_Hz; setAttackRelease_msec(attack_msec, release_msec); }
+    void setAttackRelease_msec(float atk_msec, float rel_msec) {
+      attack_msec = atk_msec;  release_msec = rel_msec;
+      float ansi_atk = 0.001f * attack_msec * fs_Hz / 2.425f;  //ANSI attack and release times, in samples
+      float ansi_rel = 0.001f * release_msec * fs_Hz / 1.782f;
+      alfa = (float)(ansi_atk / (1.0f + ansi_atk));
+      beta = (float)(ansi_rel / (10.0f + ansi_rel));
+    }
+    void resetStates(void) { state_ppk = 1.0f; }
+
+    //the peak envelope of x (the signal, not its power)
+    void smooth_env(float *x, float *y, int n) {
+      float xab, xpk = state_ppk;
+      for (int k = 0; k < n; k++) {
+        xab = (x[k] >= 0.0f) ? x[k] : -x[k];
+        if (xab >= xpk) {
+          xpk = alfa * xpk + (1.0f - alfa) * xab;
+        } else {
+          xpk = beta * xpk;
+        }
+        y[k] = xpk;
+      }
+      state_ppk = xpk;
+    }
+
+  protected:
+    float fs_Hz, attack_msec, release_msec;
+    float alfa, beta;
+    float state_ppk = 1.0f;
+};
+
+class AudioCalcGainWDRC_F32 {
+  public:
+    AudioCalcGainWDRC_F32(void) { setParams(115.0f, 1.0f, 0.0f, 0.0f, 1.0f, 100.0f, 200.0f); }
+
+    //(note the order: cr before tk, as in the Tympan_Library)
+    void setParams(float _maxdB, float _exp_cr, float _exp_end_knee, float _tkgain, float _cr, float _tk, float _bolt) {
+      maxdB = _maxdB;  exp_cr = _exp_cr;  exp_end_knee = _exp_end_knee;  tkgain = _tkgain;  cr = _cr;  tk = _tk;  bolt = _bolt;
+    }
+
+    //env is the signal's envelope (not its power).  gain_out is the linear gain.
+    void calcGainFromEnvelope(float *env, float *gain_out, const int n) {
+      float env_dB[n];
+      for (int k = 0; k < n; k++) env_dB[k] = maxdB + db2(env[k]);
+      WDRC_circuit_gain(env_dB, gain_out, n, exp_cr, exp_end_knee, tkgain, tk, cr, bolt);
+    }
+
+    void WDRC_circuit_gain(float *env_dB, float *gain_out, const int n,
+        const float exp_cr, const float exp_end_knee, const float tkgain, const float tk, const float cr, const float bolt) {
+      float gdb, tkgo, pblt;
+      float *pdb = env_dB;
+      float tk_tmp = tk;
+      if ((tk_tmp + tkgain) > bolt) tk_tmp = bolt - tkgain;
+      tkgo = tkgain + tk_tmp * (1.0f - 1.0f / cr);
+      pblt = cr * (bolt - tkgo);
+      const float cr_const = ((1.0f / cr) - 1.0f);
+      for (int k = 0; k < n; k++) {
+        if ((pdb[k] < exp_end_knee) && (exp_cr < 1.0f)) {
+          gdb = tkgain - ((exp_end_knee - pdb[k]) / exp_cr) + (exp_end_knee - pdb[k]);  //expansion
+        } else if ((pdb[k] > tk_tmp) && (pdb[k] < pblt)) {
+          gdb = tkgain + (pdb[k] - tk_tmp) * cr_const;                                 //compression
+        } else if (pdb[k] > pblt) {
+          gdb = bolt + ((pdb[k] - pblt) / 10.0f) - pdb[k];                              //limiting
+        } else {
+          gdb = tkgain;                                                                 //linear
+        }
+        gain_out[k] = undb2(gdb);
+      }
+    }
+
+    static float fast_log2(float X) {  //the Tympan_Library's log2f_approx()
+      float Y, F;
+      int E;
+      F = frexpf(fabsf(X), &E);
+      Y = 1.23149591368684f;
+      Y *= F;
+      Y += -4.11852516267426f;
+      Y *= F;
+      Y += 6.02197014179219f;
+      Y *= F;
+      Y += -3.13396450166353f;
+      Y += E;
+      return Y;
+    }
+    static float db2(float x) { return 6.020599913279624f * fast_log2(x); }     //20*log10(x)
+    static float undb2(float x) { return expf(0.11512925464970228420089957273422f * x); }  //10^(x/20)
+
+    float maxdB, exp_cr, exp_end_knee, tkgain, cr, tk, bolt;
+};
+
+class AudioEffectCompWDRC_F32 {
+  public:
+    AudioEffectCompWDRC_F32(void) {}
+    AudioEffectCompWDRC_F32(const AudioSettings_F32 &settings) { setSampleRate_Hz(settings.sample_rate_Hz); }
+
+    void setSampleRate_Hz(float fs_Hz) { calcEnvelope.setSampleRate_Hz(fs_Hz); }
+    void setParams(float attack_ms, float release_ms, float maxdB, float exp_cr, float exp_end_knee, float tkgain, float comp_ratio, float tk, float bolt) {
+      calcEnvelope.setAttackRelease_msec(attack_ms, release_ms);
+      calcGain.setParams(maxdB, exp_cr, exp_end_knee, tkgain, comp_ratio, tk, bolt);
+    }
+
+    float getMaxdB(void) { return calcGain.maxdB; }
+    float getExpansionCompRatio(void) { return calcGain.exp_cr; }
+    float getKneeExpansion_dBSPL(void) { return calcGain.exp_end_knee; }
+    float getGain_dB(void) { return calcGain.tkgain; }
+    float getCompRatio(void) { return calcGain.cr; }
+    float getKneeCompressor_dBSPL(void) { return calcGain.tk; }
+    float getKneeLimiter_dBSPL(void) { return calcGain.bolt; }
+
+    AudioCalcEnvelope_F32 calcEnvelope;
+    AudioCalcGainWDRC_F32 calcGain;
+};
+
+#endif
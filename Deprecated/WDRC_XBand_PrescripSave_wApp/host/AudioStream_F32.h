@@ -0,0 +1,72 @@
+/*
+   AudioStream_F32.h (host)
+
+   Created: OpenAudio, 2022
+   Purpose: Stand-in for the Tympan_Library's AudioStream_F32, so that the sketch's audio classes can
+       be built and their update() called on a PC.  There is no audio system: a test puts a block in
+       AudioStream_F32::host_in[] (one per input channel), calls update(), and finds what was
+       transmitted in AudioStream_F32::host_out[].  Blocks come from a small pool.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _host_AudioStream_F32_h
+#define _host_AudioStream_F32_h
+
+#include <Arduino.h>
+#include <arm_math.h>
+
+#define AUDIO_BLOCK_SAMPLES  128
+#define AUDIO_SAMPLE_RATE_EXACT  44117.64706f
+#define HOST_AUDIO_POOL  16
+#define HOST_AUDIO_CHANNELS  4
+
+typedef struct {
+  float32_t data[AUDIO_BLOCK_SAMPLES];
+  int length = AUDIO_BLOCK_SAMPLES, full_length = AUDIO_BLOCK_SAMPLES;
+  float fs_Hz = AUDIO_SAMPLE_RATE_EXACT;
+  unsigned long id = 0;
+  bool in_use = false;
+} audio_block_f32_t;
+
+class AudioSettings_F32 {
+  public:
+    AudioSettings_F32(float fs_Hz, int block_size) : sample_rate_Hz(fs_Hz), audio_block_samples(block_size) {}
+    float sample_rate_Hz;
+    int audio_block_samples;
+};
+
+class AudioStream_F32 {
+  public:
+    AudioStream_F32(int n_inputs, audio_block_f32_t **input_queue) { (void)n_inputs; (void)input_queue; }
+    virtual ~AudioStream_F32(void) {}
+    virtual void update(void) = 0;
+    float processorUsage(void) { return 0.0f; }
+    float processorUsageMax(void) { return 0.0f; }
+
+    //the host's "audio system": the blocks for the next update(), and what it transmitted
+    static inline audio_block_f32_t *host_in[HOST_AUDIO_CHANNELS] = { NULL };
+    static inline audio_block_f32_t *host_out[HOST_AUDIO_CHANNELS] = { NULL };
+
+    static audio_block_f32_t* allocate_f32(void) {
+      for (int i = 0; i < HOST_AUDIO_POOL; i++) {
+        if (!pool[i].in_use) { pool[i].in_use = true; pool[i].length = AUDIO_BLOCK_SAMPLES; return &pool[i]; }
+      }
+      return NULL;
+    }
+    static void release(audio_block_f32_t *block) { (void)block; }  //the test owns the blocks
+    static void host_releaseAll(void) { for (int i = 0; i < HOST_AUDIO_POOL; i++) pool[i].in_use = false; }
+
+  protected:
+    audio_block_f32_t* receiveReadOnly_f32(int chan = 0) { return ((chan >= 0) && (chan < HOST_AUDIO_CHANNELS)) ? host_in[chan] : NULL; }
+    audio_block_f32_t* receiveWritable_f32(int chan = 0) { return receiveReadOnly_f32(chan); }
+    void transmit(audio_block_f32_t *block, int chan = 0) { if ((chan >= 0) && (chan < HOST_AUDIO_CHANNELS)) host_out[chan] = block; }
+
+    static inline audio_block_f32_t pool[HOST_AUDIO_POOL];
+};
+
+//no interrupts on the host
+#define AudioNoInterrupts() do {} while (0)
+#define AudioInterrupts() do {} while (0)
+
+#endif
@@ -0,0 +1,29 @@
+/*
+   BTNRH_WDRC_Types.h (host)
+
+   Created: OpenAudio, 2022
+   Purpose: Stand-in for the Tympan_Library header of the same name, for the tests in this directory.
+       The AFCs only need BTNRH_WDRC::CHA_AFC (with its fields in the same order as the Tympan_Library
+       version) and DSL_MXCH.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _host_BTNRH_WDRC_Types_h
+#define _host_BTNRH_WDRC_Types_h
+
+#ifndef DSL_MXCH
+#define DSL_MXCH 8
+#endif
+
+namespace BTNRH_WDRC {
+  struct CHA_AFC {
+    int default_to_active;  //enable AFC at startup?
+    int afl;                //length (samples) of adaptive filter for modeling feedback path
+    float mu;               //scale factor for how fast the adaptive filter adapts
+    float rho;              //smoothing factor for how fast the audio's envelope is tracked
+    float eps;              //minimum allowed level when estimating the audio envelope
+  };
+}
+
+#endif
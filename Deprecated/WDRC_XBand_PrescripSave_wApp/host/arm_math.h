@@ -0,0 +1,114 @@
+/*
+   arm_math.h (host)
+
+   Created: OpenAudio, 2022
+   Purpose: Plain-C++ versions of the few CMSIS-DSP functions that the sketch's DSP headers use, so
+       they can be tested on a PC.  They follow the CMSIS definitions (including the packing of the
+       real FFT and its 1/N scaling on the inverse), but make no attempt to be fast.
+
+   MIT License.  use at your own risk.
+*/
+
+#ifndef _host_arm_math_h
+#define _host_arm_math_h
+
+#include <stdint.h>
+#include <math.h>
+#include <complex>
+#include <vector>
+
+typedef float float32_t;
+
+inline void arm_dot_prod_f32(const float32_t *a, const float32_t *b, uint32_t n, float32_t *result) {
+  float32_t sum = 0.0f;
+  for (uint32_t i = 0; i < n; i++) sum += a[i] * b[i];
+  *result = sum;
+}
+inline void arm_scale_f32(const float32_t *src, float32_t scale, float32_t *dst, uint32_t n) { for (uint32_t i = 0; i < n; i++) dst[i] = src[i] * scale; }
+inline void arm_add_f32(const float32_t *a, const float32_t *b, float32_t *dst, uint32_t n) { for (uint32_t i = 0; i < n; i++) dst[i] = a[i] + b[i]; }
+
+// ///////////////////////////////// biquads (direct form 1, state of 4 per stage: x[n-1], x[n-2], y[n-1], y[n-2])
+
+typedef struct {
+  uint32_t numStages;
+  float32_t *pState;
+  const float32_t *pCoeffs;  //b0, b1, b2, a1, a2 per stage (CMSIS sign convention: y += a1*y[n-1] + a2*y[n-2])
+} arm_biquad_casd_df1_inst_f32;
+
+inline void arm_biquad_cascade_df1_init_f32(arm_biquad_casd_df1_inst_f32 *S, uint8_t numStages, const float32_t *pCoeffs, float32_t *pState) {
+  S->numStages = numStages;  S->pCoeffs = pCoeffs;  S->pState = pState;
+  for (uint32_t i = 0; i < 4U * numStages; i++) pState[i] = 0.0f;
+}
+
+inline void arm_biquad_cascade_df1_f32(const arm_biquad_casd_df1_inst_f32 *S, const float32_t *pSrc, float32_t *pDst, uint32_t blockSize) {
+  const float32_t *in = pSrc;
+  for (uint32_t Istage = 0; Istage < S->numStages; Istage++) {
+    const float32_t *c = S->pCoeffs + 5 * Istage;
+    float32_t *st = S->pState + 4 * Istage;
+    float32_t x1 = st[0], x2 = st[1], y1 = st[2], y2 = st[3];
+    for (uint32_t i = 0; i < blockSize; i++) {
+      float32_t x0 = in[i];
+      float32_t y0 = c[0] * x0 + c[1] * x1 + c[2] * x2 + c[3] * y1 + c[4] * y2;
+      x2 = x1;  x1 = x0;  y2 = y1;  y1 = y0;
+      pDst[i] = y0;
+    }
+    st[0] = x1;  st[1] = x2;  st[2] = y1;  st[3] = y2;
+    in = pDst;  //later stages work in place
+  }
+}
+
+// ///////////////////////////////// real FFT
+//forward: pOut = [X0.re, X(N/2).re, X1.re, X1.im, ..., X(N/2-1).re, X(N/2-1).im]
+//inverse: pIn in that packing, pOut = the time signal (scaled by 1/N).  Like CMSIS, pIn is overwritten.
+
+typedef struct { uint16_t fftLenRFFT; } arm_rfft_fast_instance_f32;
+typedef int arm_status;
+#define ARM_MATH_SUCCESS  0
+#define ARM_MATH_ARGUMENT_ERROR  (-1)
+
+inline arm_status arm_rfft_fast_init_f32(arm_rfft_fast_instance_f32 *S, uint16_t fftLen) {
+  if ((fftLen < 32) || (fftLen & (fftLen - 1))) return ARM_MATH_ARGUMENT_ERROR;
+  S->fftLenRFFT = fftLen;
+  return ARM_MATH_SUCCESS;
+}
+
+//in-place radix-2 complex FFT (sign = -1 forward, +1 inverse, unscaled)
+inline void host_cfft(std::vector<std::complex<double>> &X, int sign) {
+  int N = (int)X.size();
+  for (int i = 1, j = 0; i < N; i++) {
+    int bit = N >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) std::swap(X[i], X[j]);
+  }
+  for (int len = 2; len <= N; len <<= 1) {
+    std::complex<double> w_len = std::polar(1.0, sign * 2.0 * M_PI / len);
+    for (int i = 0; i < N; i += len) {
+      std::complex<double> w = 1.0;
+      for (int k = 0; k < len / 2; k++) {
+        std::complex<double> u = X[i + k], v = X[i + k + len / 2] * w;
+        X[i + k] = u + v;  X[i + k + len / 2] = u - v;
+        w *= w_len;
+      }
+    }
+  }
+}
+
+inline void arm_rfft_fast_f32(const arm_rfft_fast_instance_f32 *S, float32_t *pIn, float32_t *pOut, uint8_t ifftFlag) {
+  int N = S->fftLenRFFT;
+  std::vector<std::complex<double>> X(N);
+  if (!ifftFlag) {
+    for (int n = 0; n < N; n++) X[n] = pIn[n];
+    host_cfft(X, -1);
+    pOut[0] = (float32_t)X[0].real();  pOut[1] = (float32_t)X[N/2].real();
+    for (int k = 1; k < N/2; k++) { pOut[2*k] = (float32_t)X[k].real();  pOut[2*k+1] = (float32_t)X[k].imag(); }
+  } else {
+    X[0] = pIn[0];  X[N/2] = pIn[1];
+    for (int k = 1; k < N/2; k++) { X[k] = std::complex<double>(pIn[2*k], pIn[2*k+1]);  X[N-k] = std::conj(X[k]); }
+    host_cfft(X, +1);
+    for (int n = 0; n < N; n++) pOut[n] = (float32_t)(X[n].real() / N);
+  }
+  for (int i = 0; i < N; i++) pIn[i] = 0.0f;  //CMSIS uses pIn as scratch, so callers must not count on it
+}
+
+#endif
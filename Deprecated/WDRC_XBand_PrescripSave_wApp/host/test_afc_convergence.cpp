@@ -0,0 +1,92 @@
+/*
+   test_afc_convergence
+
+   Created: OpenAudio, 2022
+   Purpose: Runs the sketch's AFC convergence benchmark ('=', afc_convergenceBenchmark() in
+       AFC_FeedbackSim_F32.h) on a PC, on the same AudioEffectAFC_BTNRH_F32 that the sketch uses,
+       and checks its results:
+         * the incremental misalignment metric stays within -40 dB of the exact value (its drift)
+         * every misalignment is a number, and in each run some scenario gets below -6 dB
+       It is run twice: with the default AFC (afl = 100, hdel = one block) and with the whitening and
+       band-limiting filters on.  The table is printed as the sketch prints it, including the AFC's
+       nsec/sample on this PC.  Exits non-zero on failure.
+
+   MIT License.  use at your own risk.
+*/
+
+#define USE_AFC_SIM_METRIC (true)   //the benchmark needs the AFC's misalignment metric
+#include <Arduino.h>                //host/Arduino.h
+#include "AudioEffectAFC_BTNRH_F32.h"
+#include "AFC_FeedbackSim_F32.h"
+#include <string>
+#include <vector>
+
+#define FS_HZ        24000.0f
+#define BLOCK_LEN    24
+#define MAX_DRIFT_dB (-40.0f)
+#define GOOD_MISALIGN_dB (-6.0f)
+
+//keep what the benchmark prints (and echo it)
+class CapturePrint : public Print {
+  public:
+    size_t write(uint8_t c) { text += (char)c; return fputc(c, stdout) == EOF ? 0 : 1; }
+    std::string text;
+};
+
+//check the rows of the benchmark's table ("    : path, mu, rho, eps, misalign..., nsec/sample, x real time, drift")
+static int checkTable(const std::string &text, const char *name) {
+  int n_fail = 0, n_rows = 0;
+  float best_final_dB = 1.0e6f, worst_drift_dB = -1.0e6f;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) end = text.size();
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+    if ((line.compare(0, 6, "    : ") != 0) || (line.compare(6, 4, "path") == 0)) continue;
+
+    std::vector<std::string> fields;
+    for (size_t pos = 6, comma; pos <= line.size(); pos = comma + 2) {
+      comma = line.find(", ", pos);
+      if (comma == std::string::npos) comma = line.size();
+      fields.push_back(line.substr(pos, comma - pos));
+    }
+    int n = (int)fields.size();
+    if (n < 8) { printf("test_afc_convergence: %s: *** FAIL ***: could not read: %s\n", name, line.c_str()); n_fail++; continue; }
+    n_rows++;
+    for (int I = 4; I < n - 3; I++) {
+      if (!isfinite(atof(fields[I].c_str()))) { printf("test_afc_convergence: %s: *** FAIL ***: bad misalignment in: %s\n", name, line.c_str()); n_fail++; break; }
+    }
+    float final_dB = (float)atof(fields[n - 4].c_str()), drift_dB = (float)atof(fields[n - 1].c_str());
+    best_final_dB = min(best_final_dB, final_dB);
+    worst_drift_dB = max(worst_drift_dB, drift_dB);
+    if (!(drift_dB < MAX_DRIFT_dB)) { printf("test_afc_convergence: %s: *** FAIL ***: metric drift %.1f dB in: %s\n", name, drift_dB, line.c_str()); n_fail++; }
+  }
+  if (n_rows != AFC_SIM_N_PATHS * 3) { printf("test_afc_convergence: %s: *** FAIL ***: %d rows in the table\n", name, n_rows); n_fail++; }
+  if (!(best_final_dB < GOOD_MISALIGN_dB)) { printf("test_afc_convergence: %s: *** FAIL ***: no scenario converged (best %.1f dB)\n", name, best_final_dB); n_fail++; }
+  printf("test_afc_convergence: %s: best final misalignment = %.1f dB, worst metric drift = %.1f dB: %s\n",
+         name, best_final_dB, worst_drift_dB, n_fail ? "FAIL" : "ok");
+  return n_fail;
+}
+
+int main(void) {
+  AudioSettings_F32 audio_settings(FS_HZ, BLOCK_LEN);
+  int n_fail = 0;
+
+  //as the sketch's '=' does: an unconnected AFC, created just for the benchmark
+  AudioEffectAFC_BTNRH_F32 *afc = new AudioEffectAFC_BTNRH_F32(audio_settings);
+  afc->setAfl(100);
+  afc->setHdel(BLOCK_LEN);
+  CapturePrint p1;
+  afc_convergenceBenchmark(afc, &p1, FS_HZ, BLOCK_LEN);
+  n_fail += checkTable(p1.text, "default AFC");
+
+  //with the whitening (prediction-error) and band-limiting filters
+  afc->setFilterParams(9, 20, 1.0658e-5f, 8);
+  CapturePrint p2;
+  afc_convergenceBenchmark(afc, &p2, FS_HZ, BLOCK_LEN);
+  n_fail += checkTable(p2.text, "filtered AFC");
+  delete afc;
+
+  return n_fail ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/*
+   test_afc_stereo
+
+   Created: OpenAudio, 2022
+   Purpose: Checks the binaural AFC (AudioEffectFeedbackCancel_Stereo_F32) against a separate
+       AudioEffectFeedbackCancel_Local_F32 for each ear, on a PC.  Each ear has its own simulated
+       feedback path, with a hardware delay that is not a whole number of blocks.  The loopback audio
+       is given to the AFCs with its block counters, as in the sketch, and now and then one loopback
+       block arrives late (together with the next one), so the alignment (getAlignedRing()) has to
+       find it.  For several hdel:
+         * the binaural AFC's outputs match the two separate AFCs' to within MAX_ERR_Y
+         * its alignment counts (out of sequence, misaligned) are the same as the left AFC's
+         * the feedback in both ears is canceled by at least MIN_CANCEL_dB over the second half
+           (every hdel tested puts the whole feedback path inside the adaptive filter)
+       Exits non-zero on failure.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>                //host/Arduino.h
+#include "AudioEffectFeedbackCancel_Local_F32.h"
+#include "AudioEffectFeedbackCancel_Stereo_F32.h"
+#include <string>
+
+#define FS_HZ         24000.0f
+#define BLOCK_LEN     24
+#define N_BLOCKS      3000
+#define AFL           64
+#define TRUE_DELAY    40          //samples from the output back to the input (more than one block)
+#define FB_LEN        16          //length of each simulated feedback path
+#define LATE_EVERY    97          //one loopback block in this many arrives a block late
+#define MAX_ERR_Y     (1.0e-5f)
+#define MIN_CANCEL_dB (6.0f)       //the AFC's error signal is the (loud) input noise, so it does not get much further
+
+//keep what is printed
+class CapturePrint : public Print {
+  public:
+    size_t write(uint8_t c) { text += (char)c; return 1; }
+    std::string text;
+};
+
+//newest-first history of one ear's output, for the simulated feedback
+class OutputHistory {
+  public:
+    void push(const float32_t *u, int n) { for (int i = 0; i < n; i++) { head = (head + LEN - 1) % LEN; buff[head] = u[i]; } }
+    float32_t get(int samples_ago) const { return buff[(head + samples_ago) % LEN]; }
+  private:
+    static const int LEN = 256;
+    float32_t buff[LEN] = {0.0f};
+    int head = 0;
+};
+
+static float32_t noise(uint32_t *seed) {
+  *seed = *seed * 1664525UL + 1013904223UL;
+  return ((float32_t)(*seed >> 8) / 16777216.0f) - 0.5f;
+}
+
+static int testHdel(int hdel) {
+  AudioSettings_F32 audio_settings(FS_HZ, BLOCK_LEN);
+  AudioEffectFeedbackCancel_Local_F32 afc[2] = {{audio_settings}, {audio_settings}};
+  AudioEffectFeedbackCancel_Stereo_F32 afc_stereo(audio_settings);
+  const float32_t mu = 0.001f, rho = 0.9f, eps = 0.008f;
+  for (int Iear = 0; Iear < 2; Iear++) { afc[Iear].setParams(mu, rho, eps, AFL); afc[Iear].setHdel(hdel); }
+  afc_stereo.setParams(mu, rho, eps, AFL);
+  afc_stereo.setHdel(hdel);
+
+  //a different feedback path for each ear
+  float32_t h[2][FB_LEN];
+  for (int j = 0; j < FB_LEN; j++) {
+    h[0][j] = 0.2f * expf(-0.3f * j) * ((j % 2) ? -1.0f : 1.0f);
+    h[1][j] = 0.15f * expf(-0.2f * j) * cosf(0.7f * j);
+  }
+
+  audio_block_f32_t in[2], loop[2], late_loop[2];
+  OutputHistory out_hist[2];
+  uint32_t seed = 4321;
+  float max_err = 0.0f;
+  double fb_pow[2] = {0.0, 0.0}, resid_pow[2] = {0.0, 0.0};
+  bool have_late = false;
+  for (int Iblock = 0; Iblock < N_BLOCKS; Iblock++) {
+    //the input: noise plus the feedback from the earlier outputs
+    float32_t fb[2][BLOCK_LEN];
+    for (int Iear = 0; Iear < 2; Iear++) {
+      in[Iear].id = Iblock + 1;  in[Iear].length = BLOCK_LEN;
+      for (int i = 0; i < BLOCK_LEN; i++) {
+        float32_t f = 0.0f;
+        for (int j = 0; j < FB_LEN; j++) {
+          int samples_ago = TRUE_DELAY + j - i;  //from the output sample that was at (this sample - TRUE_DELAY - j)
+          if (samples_ago > 0) f += h[Iear][j] * out_hist[Iear].get(samples_ago - 1);
+        }
+        fb[Iear][i] = f;
+        in[Iear].data[i] = noise(&seed) + f;
+      }
+    }
+
+    //each ear on its own, and then both ears together
+    float32_t y[2][BLOCK_LEN];
+    for (int Iear = 0; Iear < 2; Iear++) {
+      AudioStream_F32::host_releaseAll();
+      AudioStream_F32::host_in[0] = &in[Iear];
+      afc[Iear].update();
+      for (int i = 0; i < BLOCK_LEN; i++) y[Iear][i] = AudioStream_F32::host_out[0]->data[i];
+    }
+    AudioStream_F32::host_releaseAll();
+    AudioStream_F32::host_in[0] = &in[0];  AudioStream_F32::host_in[1] = &in[1];
+    afc_stereo.update();
+    for (int Iear = 0; Iear < 2; Iear++) {
+      audio_block_f32_t *out = AudioStream_F32::host_out[Iear];
+      if (out->id != in[Iear].id) { printf("test_afc_stereo: hdel = %d: *** FAIL ***: output block id %lu, not %lu\n", hdel, out->id, in[Iear].id); return 1; }
+      for (int i = 0; i < BLOCK_LEN; i++) {
+        max_err = max(max_err, fabsf(out->data[i] - y[Iear][i]));
+        if (Iblock >= N_BLOCKS/2) {
+          //how much of the feedback is left in the output (the output is the noise plus what is left)
+          float32_t resid = fb[Iear][i] - (in[Iear].data[i] - out->data[i]);
+          fb_pow[Iear] += (double)fb[Iear][i] * fb[Iear][i];  resid_pow[Iear] += (double)resid * resid;
+        }
+      }
+    }
+    AudioStream_F32::host_in[1] = NULL;
+
+    //the outputs go to the speakers (the feedback simulation) and, via the loopback, to the AFCs
+    for (int Iear = 0; Iear < 2; Iear++) {
+      out_hist[Iear].push(y[Iear], BLOCK_LEN);
+      loop[Iear].id = Iblock + 1;  loop[Iear].length = BLOCK_LEN;
+      for (int i = 0; i < BLOCK_LEN; i++) loop[Iear].data[i] = y[Iear][i];
+    }
+    if ((Iblock % LATE_EVERY) == LATE_EVERY - 1) {
+      //this loopback block is late: it arrives with the next one
+      late_loop[0] = loop[0];  late_loop[1] = loop[1];  have_late = true;
+      continue;
+    }
+    for (int I = have_late ? 0 : 1; I < 2; I++) {
+      audio_block_f32_t *u = (I == 0) ? late_loop : loop;
+      for (int Iear = 0; Iear < 2; Iear++) afc[Iear].addNewAudio(&u[Iear]);
+      afc_stereo.newest_ring_audio_block_id = u[0].id;
+      afc_stereo.addNewAudio(u[0].data, u[1].data, u[0].length);
+    }
+    have_late = false;
+  }
+
+  int n_fail = 0;
+  if (!(max_err <= MAX_ERR_Y)) { printf("test_afc_stereo: hdel = %d: *** FAIL ***: outputs differ from the separate AFCs by %.2e\n", hdel, max_err); n_fail++; }
+
+  //the alignment counts, as printed by the 'b' command
+  CapturePrint stats_mono, stats_stereo;
+  afc[0].printAlignmentStats(&stats_mono);
+  afc_stereo.printAlignmentStats(&stats_stereo);
+  std::string counts = stats_stereo.text.substr(stats_stereo.text.find("Loopback:"));
+  if (counts != stats_mono.text.substr(stats_mono.text.find("Loopback:"))) {
+    printf("test_afc_stereo: hdel = %d: *** FAIL ***: alignment differs from the left AFC's:\n    %s    %s", hdel, stats_mono.text.c_str(), stats_stereo.text.c_str());
+    n_fail++;
+  }
+  if (counts.find("out of sequence = 0") != std::string::npos) {
+    printf("test_afc_stereo: hdel = %d: *** FAIL ***: no late loopback blocks were seen: %s", hdel, counts.c_str());
+    n_fail++;
+  }
+  float cancel_dB[2];
+  for (int Iear = 0; Iear < 2; Iear++) cancel_dB[Iear] = 10.0f * log10f((float)(max(fb_pow[Iear], 1.0e-30) / max(resid_pow[Iear], 1.0e-30)));
+  if (!((cancel_dB[0] >= MIN_CANCEL_dB) && (cancel_dB[1] >= MIN_CANCEL_dB))) {
+    printf("test_afc_stereo: hdel = %d: *** FAIL ***: feedback canceled by only %.1f dB (left), %.1f dB (right)\n", hdel, cancel_dB[0], cancel_dB[1]);
+    n_fail++;
+  }
+  printf("test_afc_stereo: hdel = %3d: largest difference from the separate AFCs = %.2e, feedback canceled by %.1f dB (left), %.1f dB (right)\n",
+         hdel, max_err, cancel_dB[0], cancel_dB[1]);
+  printf("    : %s", counts.c_str());
+  printf("    : %s\n", n_fail ? "FAIL" : "ok");
+  return n_fail;
+}
+
+int main(void) {
+  int n_fail = 0;
+  n_fail += testHdel(-1);              //one block (what the binaural AFC always assumed)
+  n_fail += testHdel(TRUE_DELAY);      //the true delay
+  n_fail += testHdel(TRUE_DELAY - 8);  //a bit short of it
+  return n_fail ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+/*
+   test_fast_gain
+
+   Created: OpenAudio, 2022
+   Purpose: Checks WDRC_FastGain_F32 against the Tympan_Library's AudioCalcGainWDRC_F32 (as transcribed
+       in host/AudioEffectCompWDRC_F32.h) on a PC, for a few band prescriptions:
+         * the gain rule: calcGain_dB() vs WDRC_circuit_gain(), every 0.01 dB from 0 to 140 dB SPL.
+           They must agree to 0.001 dB, except exactly at the limiter knee (pblt), where BTNRH's ">"
+           gives the linear gain and calcGain_dB() already limits.
+         * the gain from the envelope: calcGainFromEnvelope() in each mode vs calcGain's, on an envelope
+           that sweeps from -100 to 0 dBFS while moving +/-10 dB at 4 Hz.  The limits are what each mode
+           promises (see WDRC_FastGain_F32.h), plus the reference's own log2 error (it uses the
+           Tympan_Library's log2f_approx()).  Samples within a table step of a jump in the gain rule
+           (an expansion knee above the compression knee) are left out: either side is right there.
+       It also prints the sketch's benchmark ('/', wdrc_fastGainBenchmark()), in nanoseconds on this PC.
+       Exits non-zero on failure.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>                //host/Arduino.h
+#include "WDRC_FastGain_F32.h"
+
+#define FS_HZ        24000.0f
+#define BLOCK_LEN    24
+#define N_BLOCKS     20000
+#define MAX_RULE_ERR_dB (0.001f)
+
+typedef struct { const char *name; float maxdB, exp_cr, exp_end_knee, tkgain, cr, tk, bolt; } Prescription;
+static const Prescription prescriptions[] = {
+  { "default band 1",     130.0f, 0.7f, 50.0f,  7.0f, 1.3f, 50.0f, 110.0f },
+  { "knee above tk",      130.0f, 0.7f, 45.0f, 25.0f, 2.4f, 40.0f,  95.0f },
+  { "no expansion",       115.0f, 1.0f, 10.0f, 30.0f, 3.0f, 35.0f,  90.0f },
+};
+
+typedef struct { const char *name; int mode, decimation; float max_err_dB; } FastCase;
+static const FastCase cases[] = {
+  { "fast log2/exp2",   WDRC_FastGain_F32::MODE_FAST_MATH, 1, 0.05f },
+  { "table",            WDRC_FastGain_F32::MODE_TABLE,     1, 0.08f },
+  { "table, every 4th", WDRC_FastGain_F32::MODE_TABLE,     4, 0.10f },
+  { "table, every 8th", WDRC_FastGain_F32::MODE_TABLE,     8, 0.15f },
+};
+
+static int testGainRule(AudioEffectCompWDRC_F32 &comp, const Prescription &pre) {
+  WDRC_FastGain_F32 fast;
+  fast.syncTo(comp);
+  float tk_tmp = pre.tk;
+  if ((tk_tmp + pre.tkgain) > pre.bolt) tk_tmp = pre.bolt - pre.tkgain;
+  float pblt = pre.cr * (pre.bolt - (pre.tkgain + tk_tmp * (1.0f - 1.0f / pre.cr)));
+
+  float max_err_dB = 0.0f, worst_level = 0.0f;
+  for (int i = 0; i <= 14000; i++) {
+    float level_dB = 0.01f * (float)i, gain_ref;
+    if (level_dB == pblt) continue;  //">=" vs BTNRH's ">" (see WDRC_FastGain_F32::calcGain_dB())
+    comp.calcGain.WDRC_circuit_gain(&level_dB, &gain_ref, 1, pre.exp_cr, pre.exp_end_knee, pre.tkgain, pre.tk, pre.cr, pre.bolt);
+    float err_dB = fabsf(fast.calcGain_dB(level_dB) - (float)(20.0 * log10((double)gain_ref)));
+    if (err_dB > max_err_dB) { max_err_dB = err_dB; worst_level = level_dB; }
+  }
+  bool is_ok = (max_err_dB <= MAX_RULE_ERR_dB);
+  printf("test_fast_gain: %s: calcGain_dB vs WDRC_circuit_gain: max error = %.6f dB (at %.2f dB SPL): %s\n",
+         pre.name, max_err_dB, worst_level, is_ok ? "ok" : "*** FAIL ***");
+  return is_ok ? 0 : 1;
+}
+
+static int testFromEnvelope(AudioEffectCompWDRC_F32 &comp, const Prescription &pre) {
+  static float env[N_BLOCKS * BLOCK_LEN], gain_ref[N_BLOCKS * BLOCK_LEN], gain[N_BLOCKS * BLOCK_LEN];
+  const int n_total = N_BLOCKS * BLOCK_LEN;
+  for (int i = 0; i < n_total; i++) {
+    float level_dBFS = -100.0f + 100.0f * (float)i / (float)n_total + 10.0f * sinf(2.0f * PI * 4.0f * (float)i / FS_HZ);
+    env[i] = powf(10.0f, min(level_dBFS, 0.0f) / 20.0f);
+  }
+  for (int Iblock = 0; Iblock < N_BLOCKS; Iblock++) comp.calcGain.calcGainFromEnvelope(env + Iblock * BLOCK_LEN, gain_ref + Iblock * BLOCK_LEN, BLOCK_LEN);
+  bool has_jump = (pre.exp_cr < 1.0f) && (pre.exp_end_knee > pre.tk);  //the rule jumps at the expansion knee
+
+  int n_fail = 0;
+  for (const FastCase &fc : cases) {
+    WDRC_FastGain_F32 fast;
+    fast.syncTo(comp);
+    fast.setMode(fc.mode);
+    fast.setDecimation(fc.decimation);
+    for (int Iblock = 0; Iblock < N_BLOCKS; Iblock++) fast.calcGainFromEnvelope(env + Iblock * BLOCK_LEN, gain + Iblock * BLOCK_LEN, BLOCK_LEN);
+
+    float max_err_dB = 0.0f;
+    for (int i = BLOCK_LEN; i < n_total; i++) {  //skip the first block (the decimated ramps start from 0 dB)
+      float level_dB = pre.maxdB + 20.0f * log10f(env[i]);
+      if (has_jump && (fabsf(level_dB - pre.exp_end_knee) < WDRC_FASTGAIN_TABLE_STEP_dB)) continue;
+      max_err_dB = max(max_err_dB, fabsf(20.0f * log10f(gain[i] / gain_ref[i])));
+    }
+    bool is_ok = (max_err_dB <= fc.max_err_dB);
+    if (!is_ok) n_fail++;
+    printf("test_fast_gain: %s: %s vs calcGain: max error = %.4f dB (limit %.2f): %s\n",
+           pre.name, fc.name, max_err_dB, fc.max_err_dB, is_ok ? "ok" : "*** FAIL ***");
+  }
+  return n_fail;
+}
+
+int main(void) {
+  int n_fail = 0;
+  for (const Prescription &pre : prescriptions) {
+    AudioEffectCompWDRC_F32 comp;
+    comp.setSampleRate_Hz(FS_HZ);
+    comp.setParams(5.0f, 300.0f, pre.maxdB, pre.exp_cr, pre.exp_end_knee, pre.tkgain, pre.cr, pre.tk, pre.bolt);
+    n_fail += testGainRule(comp, pre);
+    n_fail += testFromEnvelope(comp, pre);
+    wdrc_fastGainBenchmark(&Serial, &comp, FS_HZ);
+  }
+  return n_fail ? 1 : 0;
+}
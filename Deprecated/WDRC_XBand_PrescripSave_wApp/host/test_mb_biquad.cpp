@@ -0,0 +1,254 @@
+/*
+   test_mb_biquad
+
+   Created: OpenAudio, 2022
+   Purpose: Checks the multi-band WDRC's lockstep filters (MultiBandBiquad_Kernels.h) on a PC:
+         * the sketch's filterbank benchmark ('9', mb_biquad_benchmark()) runs, and the lockstep
+           kernel matches arm_biquad_cascade_df1_f32() (here, host/arm_math.h's plain DF1) to within
+           1e-6.  Its cycles per sample per band are nanoseconds on this PC.
+         * a whole AudioEffectMultiBandWDRC_F32 (6 bands of 3 biquads, each with its compressor) gives
+           exactly the same output with the lockstep filters as with the one-band-at-a-time ones
+           ('0', setUseBandParallel()), over 500 blocks of noise that changes level.
+         * a second applyBands() during a crossfade (two preset changes in a row) is queued, not cut
+           short: the output of a sine never jumps by more than it does steadily, and the second
+           filterbank ends up running, with both the lockstep and the one-band-at-a-time filters.
+         * with per-band delays (setBand()'s delay) and compressors that have no gain, the output is
+           the same as the unfused chain's: each band's filter (bpFilt), then its delay
+           (postFiltDelay), then the sum, with both kinds of filters.  Changing only the delays is
+           a new filterbank (it crossfades), and staging the same delays again is not.
+       Exits non-zero on failure.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>                //host/Arduino.h
+#include "AudioEffectMultiBandWDRC_F32.h"
+#include <string>
+
+#define FS_HZ        24000.0f
+#define BLOCK_LEN    24
+#define N_BANDS      6
+#define N_BIQUADS    3
+#define N_BLOCKS     500
+#define MAX_BENCH_DIFF (1.0e-6f)
+#define MAX_DELAY_DIFF (1.0e-6f)
+
+//keep what the benchmark prints (and echo it)
+class CapturePrint : public Print {
+  public:
+    size_t write(uint8_t c) { text += (char)c; return fputc(c, stdout) == EOF ? 0 : 1; }
+    std::string text;
+};
+
+static int testBenchmark(void) {
+  CapturePrint p;
+  mb_biquad_benchmark(&p, N_BIQUADS, 2000);
+  size_t pos = p.text.find("max difference = ");
+  if (pos == std::string::npos) { printf("test_mb_biquad: benchmark: *** FAIL ***: no max difference in its output\n"); return 1; }
+  float max_diff = (float)atof(p.text.c_str() + pos + strlen("max difference = "));
+  bool is_ok = (max_diff <= MAX_BENCH_DIFF);
+  printf("test_mb_biquad: benchmark: lockstep vs arm_biquad_cascade_df1_f32, max difference = %g: %s\n", max_diff, is_ok ? "ok" : "*** FAIL ***");
+  return is_ok ? 0 : 1;
+}
+
+//one band's bandpass filter (Matlab-style SOS)
+static void makeBandSOS(int Iband, float f_low_Hz, float *sos) {
+  for (int s = 0; s < N_BIQUADS; s++) {
+    float w0 = 2.0f * PI * (f_low_Hz * powf(2.0f, 0.8f * Iband) * (1.0f + 0.05f * s)) / FS_HZ;
+    float alpha = sinf(w0) / (2.0f * 1.5f);
+    float *c = sos + s * MULTIBAND_WDRC_COEFF_PER_BIQUAD_MATLAB;
+    c[0] = alpha;  c[1] = 0.0f;  c[2] = -alpha;
+    c[3] = 1.0f + alpha;  c[4] = -2.0f * cosf(w0);  c[5] = 1.0f - alpha;
+  }
+}
+
+//the same bandpass filters and compressors for every instance
+static void setupBands(AudioEffectMultiBandWDRC_F32 &mb, AudioEffectCompWDRC_F32 *comps, int n_bands = N_BANDS, float f_low_Hz = 250.0f) {
+  for (int Iband = 0; Iband < n_bands; Iband++) {
+    float sos[N_BIQUADS * MULTIBAND_WDRC_COEFF_PER_BIQUAD_MATLAB];
+    makeBandSOS(Iband, f_low_Hz, sos);
+    comps[Iband].setSampleRate_Hz(FS_HZ);
+    comps[Iband].setParams(5.0f, 300.0f, 115.0f, 0.57f, 45.0f, 20.0f + 2.0f * Iband, 2.0f, 50.0f, 100.0f);
+    mb.setBand(Iband, sos, N_BIQUADS, &comps[Iband]);
+  }
+  mb.setNumBands(n_bands);
+  mb.applyBands();
+}
+
+//run one block through the given instance.  Returns its output.
+static const float* runBlock(AudioEffectMultiBandWDRC_F32 &mb, const float *x) {
+  AudioStream_F32::host_releaseAll();
+  audio_block_f32_t *block = AudioStream_F32::allocate_f32();
+  block->length = BLOCK_LEN;
+  for (int i = 0; i < BLOCK_LEN; i++) block->data[i] = x[i];
+  AudioStream_F32::host_in[0] = block;  AudioStream_F32::host_out[0] = NULL;
+  mb.update();
+  return (AudioStream_F32::host_out[0] != NULL) ? AudioStream_F32::host_out[0]->data : NULL;
+}
+
+static int testParallelVsCMSIS(void) {
+  AudioSettings_F32 audio_settings(FS_HZ, BLOCK_LEN);
+  static AudioEffectMultiBandWDRC_F32 mb_parallel(audio_settings), mb_cmsis(audio_settings);
+  static AudioEffectCompWDRC_F32 comps_parallel[N_BANDS], comps_cmsis[N_BANDS];  //each has its own envelope state
+  setupBands(mb_parallel, comps_parallel);
+  setupBands(mb_cmsis, comps_cmsis);
+  mb_cmsis.setUseBandParallel(false);
+
+  float x[BLOCK_LEN], y_parallel[BLOCK_LEN], max_diff = 0.0f, max_out = 0.0f;
+  uint32_t seed = 12345;
+  for (int Iblock = 0; Iblock < N_BLOCKS; Iblock++) {
+    float amp = powf(10.0f, (-50.0f + 40.0f * (float)((Iblock / 50) % 2)) / 20.0f);  //+/-20 dB steps, to work the compressors
+    for (int i = 0; i < BLOCK_LEN; i++) {
+      seed = seed * 1664525UL + 1013904223UL;
+      x[i] = amp * (((float)(seed >> 8) / 16777216.0f) - 0.5f);
+    }
+    const float *y = runBlock(mb_parallel, x);
+    if (y == NULL) { printf("test_mb_biquad: parallel vs CMSIS: *** FAIL ***: no output\n"); return 1; }
+    for (int i = 0; i < BLOCK_LEN; i++) y_parallel[i] = y[i];
+    y = runBlock(mb_cmsis, x);
+    if (y == NULL) { printf("test_mb_biquad: parallel vs CMSIS: *** FAIL ***: no output\n"); return 1; }
+    for (int i = 0; i < BLOCK_LEN; i++) {
+      max_diff = max(max_diff, fabsf(y_parallel[i] - y[i]));
+      max_out = max(max_out, fabsf(y[i]));
+    }
+  }
+  bool is_ok = (max_diff == 0.0f) && (max_out > 0.0f);
+  printf("test_mb_biquad: parallel vs CMSIS: %d bands, %d blocks, max difference = %g (max output %g): %s\n",
+         N_BANDS, N_BLOCKS, max_diff, max_out, is_ok ? "ok" : "*** FAIL ***");
+  return is_ok ? 0 : 1;
+}
+
+//the largest second difference of y (how sharply it bends), carrying the last two samples across blocks
+static float maxBend(const float *y, int n, float *prev) {
+  float max_bend = 0.0f;
+  for (int i = 0; i < n; i++) {
+    max_bend = max(max_bend, fabsf(y[i] - 2.0f * prev[0] + prev[1]));
+    prev[1] = prev[0];  prev[0] = y[i];
+  }
+  return max_bend;
+}
+
+static int testQueuedApply(bool use_band_parallel) {
+  const char *name = use_band_parallel ? "lockstep" : "CMSIS";
+  AudioSettings_F32 audio_settings(FS_HZ, BLOCK_LEN);
+  static AudioEffectMultiBandWDRC_F32 mb(audio_settings);
+  static AudioEffectCompWDRC_F32 comps[N_BANDS];
+  mb.setUseBandParallel(use_band_parallel);
+  setupBands(mb, comps);
+  const int n_fade_blocks = (mb.getCrossfadeLength_samples() + BLOCK_LEN - 1) / BLOCK_LEN;
+
+  float x[BLOCK_LEN], prev[2] = { 0.0f, 0.0f }, max_steady = 0.0f, max_swap = 0.0f;
+  bool was_queued = false, was_pending_at_end = false;
+  for (int Iblock = 0; Iblock < 400; Iblock++) {
+    if (Iblock == 200) setupBands(mb, comps, 4, 450.0f);     //first preset change
+    if (Iblock == 201) {                                       //second one, during the first one's crossfade
+      setupBands(mb, comps, 5, 350.0f);
+      was_queued = mb.isApplyPending();
+    }
+    for (int i = 0; i < BLOCK_LEN; i++) x[i] = 0.01f * sinf(2.0f * PI * 1000.0f * (float)(Iblock * BLOCK_LEN + i) / FS_HZ);
+    const float *y = runBlock(mb, x);
+    if (y == NULL) { printf("test_mb_biquad: queued applyBands: %s: *** FAIL ***: no output\n", name); return 1; }
+    float bend = maxBend(y, BLOCK_LEN, prev);
+    if ((Iblock >= 100) && (Iblock < 200)) max_steady = max(max_steady, bend);
+    if ((Iblock >= 200) && (Iblock < 200 + 3 * n_fade_blocks)) max_swap = max(max_swap, bend);
+    if (Iblock == 200 + 3 * n_fade_blocks) was_pending_at_end = mb.isApplyPending() || mb.isCrossfading();
+  }
+  bool is_ok = was_queued && !was_pending_at_end && (mb.getNumBands() == 5) && (max_swap <= 2.0f * max_steady);
+  printf("test_mb_biquad: queued applyBands: %s: queued %s, then %d bands running; largest bend %g (steady %g): %s\n",
+         name, was_queued ? "yes" : "no", mb.getNumBands(), max_swap, max_steady, is_ok ? "ok" : "*** FAIL ***");
+  return is_ok ? 0 : 1;
+}
+
+//the unfused chain, for one band: bpFilt (AudioFilterBiquad_F32, which is arm_biquad_cascade_df1_f32()
+//with the same normalized coefficients) and then postFiltDelay
+typedef struct {
+  float32_t coeff[N_BIQUADS * MULTIBAND_WDRC_COEFF_PER_BIQUAD_ARM], state[N_BIQUADS * 4];
+  arm_biquad_casd_df1_inst_f32 iir;
+  float32_t dline[MULTIBAND_WDRC_MAX_DELAY];
+  int delay, head;
+} UnfusedBand;
+
+static void setupUnfusedBand(UnfusedBand *band, const float *sos, int delay) {
+  for (int s = 0; s < N_BIQUADS; s++) {
+    const float *in = sos + s * MULTIBAND_WDRC_COEFF_PER_BIQUAD_MATLAB;
+    float32_t *out = band->coeff + s * MULTIBAND_WDRC_COEFF_PER_BIQUAD_ARM;
+    out[0] = in[0] / in[3];  out[1] = in[1] / in[3];  out[2] = in[2] / in[3];  out[3] = -in[4] / in[3];  out[4] = -in[5] / in[3];
+  }
+  for (int i = 0; i < N_BIQUADS * 4; i++) band->state[i] = 0.0f;
+  arm_biquad_cascade_df1_init_f32(&band->iir, N_BIQUADS, band->coeff, band->state);
+  for (int i = 0; i < MULTIBAND_WDRC_MAX_DELAY; i++) band->dline[i] = 0.0f;
+  band->delay = delay;  band->head = 0;
+}
+
+static int testDelayedBands(bool use_band_parallel) {
+  const char *name = use_band_parallel ? "lockstep" : "CMSIS";
+  const int delays[N_BANDS] = {60, 41, 27, 14, 6, 0};  //like the filter_delay of a real filterbank: the low bands are slowest
+  const int mask = MULTIBAND_WDRC_MAX_DELAY - 1;
+  AudioSettings_F32 audio_settings(FS_HZ, BLOCK_LEN);
+  AudioEffectMultiBandWDRC_F32 *mb = new AudioEffectMultiBandWDRC_F32(audio_settings);
+  static AudioEffectCompWDRC_F32 comps[N_BANDS];
+  static UnfusedBand unfused[N_BANDS];
+  float sos[N_BANDS][N_BIQUADS * MULTIBAND_WDRC_COEFF_PER_BIQUAD_MATLAB];
+  mb->setUseBandParallel(use_band_parallel);
+  mb->setUseFastGain(false);
+  mb->setCrossfadeLength_samples(0);  //(so that the first filterbank starts right away, like the unfused chain)
+  for (int Iband = 0; Iband < N_BANDS; Iband++) {
+    makeBandSOS(Iband, 250.0f, sos[Iband]);
+    comps[Iband].setSampleRate_Hz(FS_HZ);
+    comps[Iband].setParams(5.0f, 300.0f, 115.0f, 1.0f, 0.0f, 0.0f, 1.0f, 50.0f, 115.0f);  //no gain at all
+    mb->setBand(Iband, sos[Iband], N_BIQUADS, &comps[Iband], delays[Iband]);
+    setupUnfusedBand(&unfused[Iband], sos[Iband], delays[Iband]);
+  }
+  mb->setNumBands(N_BANDS);
+  mb->applyBands();
+
+  float x[BLOCK_LEN], y_band[BLOCK_LEN], y_ref[BLOCK_LEN], max_diff = 0.0f, max_out = 0.0f;
+  uint32_t seed = 12345;
+  for (int Iblock = 0; Iblock < N_BLOCKS; Iblock++) {
+    for (int i = 0; i < BLOCK_LEN; i++) {
+      seed = seed * 1664525UL + 1013904223UL;
+      x[i] = 0.01f * (((float)(seed >> 8) / 16777216.0f) - 0.5f);
+      y_ref[i] = 0.0f;
+    }
+    for (int Iband = 0; Iband < N_BANDS; Iband++) {  //bpFilt -> postFiltDelay -> mixer
+      UnfusedBand *band = &unfused[Iband];
+      arm_biquad_cascade_df1_f32(&band->iir, x, y_band, BLOCK_LEN);
+      for (int i = 0; i < BLOCK_LEN; i++, band->head++) {
+        band->dline[band->head & mask] = y_band[i];
+        y_ref[i] += band->dline[(band->head - band->delay) & mask];
+      }
+    }
+    const float *y = runBlock(*mb, x);
+    if (y == NULL) { printf("test_mb_biquad: per-band delays: %s: *** FAIL ***: no output\n", name); delete mb; return 1; }
+    for (int i = 0; i < BLOCK_LEN; i++) {
+      max_diff = max(max_diff, fabsf(y[i] - y_ref[i]));
+      max_out = max(max_out, fabsf(y_ref[i]));
+    }
+  }
+
+  //a new delay alone is a new filterbank, but the same delays again are not
+  mb->setCrossfadeLength_samples(96);
+  mb->setBand(0, sos[0], N_BIQUADS, &comps[0], delays[0] + 1);
+  bool new_delay_swaps = mb->applyBands();
+  for (int Iblock = 0; Iblock < 10; Iblock++) runBlock(*mb, x);  //(to finish the crossfade)
+  mb->setBand(0, sos[0], N_BIQUADS, &comps[0], delays[0] + 1);
+  bool same_delay_swaps = mb->applyBands();
+  bool bad_delay_refused = !mb->setBand(0, sos[0], N_BIQUADS, &comps[0], MULTIBAND_WDRC_MAX_DELAY);
+  delete mb;
+
+  bool is_ok = (max_diff <= MAX_DELAY_DIFF) && (max_out > 0.0f) && new_delay_swaps && !same_delay_swaps && bad_delay_refused;
+  printf("test_mb_biquad: per-band delays: %s: vs bpFilt -> delay -> sum, max difference = %g (max output %g); new delay swaps %s, same delay swaps %s: %s\n",
+         name, max_diff, max_out, new_delay_swaps ? "yes" : "no", same_delay_swaps ? "yes" : "no", is_ok ? "ok" : "*** FAIL ***");
+  return is_ok ? 0 : 1;
+}
+
+int main(void) {
+  int n_fail = 0;
+  n_fail += testBenchmark();
+  n_fail += testParallelVsCMSIS();
+  n_fail += testQueuedApply(true);
+  n_fail += testQueuedApply(false);
+  n_fail += testDelayedBands(true);
+  n_fail += testDelayedBands(false);
+  return n_fail ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/*
+   test_nlms_kernel
+
+   Created: OpenAudio, 2022
+   Purpose: Checks the NLMS kernels in AFC_NLMS_Kernels.h on a PC.  On the same (pseudo-random)
+       audio, for afl = 32 to 256:
+         * the fused kernel (both the portable and the unrolled step) matches the original three-pass
+           kernel to within MAX_ERR_Y in the output and MAX_ERR_EFBP in the coefficients, which only
+           differ by the order of the summation, also with some coefficients held at zero
+         * the stereo fused kernel matches the fused kernel run on each ear
+       It prints the ns/sample of each kernel on this PC, and then runs the sketch's own kernel
+       benchmark (afc_benchmarkKernels()) and checks its errors against the same limits.  Exits
+       non-zero on failure.
+
+       There is no x86 SIMD (SSE/AVX) version of the kernels to compare: the kernels are written for
+       the Cortex-M4F/M7 FPU, and a PC-only path would not tell us anything about the Tympan.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>                //host/Arduino.h
+#include "AFC_NLMS_Kernels.h"
+#include <string>
+
+#define BLOCK_LEN     24
+#define N_BLOCKS      2000
+#define MAX_AFL       256
+#define MAX_ERR_Y     (1.0e-5f)   //outputs are about +/-0.5
+#define MAX_ERR_EFBP  (1.0e-5f)
+
+//keep what the benchmark prints (and echo it)
+class CapturePrint : public Print {
+  public:
+    size_t write(uint8_t c) { text += (char)c; return fputc(c, stdout) == EOF ? 0 : 1; }
+    std::string text;
+};
+
+typedef float32_t (*FusedStep)(float32_t *efbp, const float32_t *p, int j0, int afl, float32_t g_prev);
+
+//same as afc_nlms_fused(), but with the given step, so that both steps can be checked on this PC
+static void fusedWithStep(FusedStep step, const float32_t *x, float32_t *y, int cs, const float32_t *ring,
+      float32_t *efbp, int afl, int j0, float32_t mu, float32_t rho, float32_t eps, float32_t *pwr_state) {
+  float32_t pwr = *pwr_state, g = 0.0f;
+  for (int j = 0; j < j0; j++) efbp[j] = 0.0f;
+  for (int i = 0; i < cs; i++) {
+    float32_t s0 = x[i], s1 = s0 - step(efbp, ring + (cs - 1) - i, j0, afl, g);
+    pwr = rho * pwr + s0 * s0 + s1 * s1;
+    g = (mu / (eps + pwr)) * s1;
+    y[i] = s1;
+  }
+  for (int j = j0; j < afl; j++) efbp[j] += g * ring[j];
+  *pwr_state = pwr;
+}
+
+//white noise output, and an input that has some of the output in it (so the model has to adapt)
+static void makeAudio(uint32_t *seed, const float32_t *ring, int afl, float32_t *out, float32_t *x, int cs) {
+  for (int i = 0; i < cs; i++) {
+    *seed = *seed * 1664525UL + 1013904223UL;
+    out[i] = ((float32_t)(*seed >> 8) / 16777216.0f) - 0.5f;
+    x[i] = 0.1f * ring[afl / 2] + 0.5f * out[i];
+  }
+}
+
+static int testFused(const char *name, FusedStep step, int afl, int n_zero) {
+  static float32_t ring[MAX_AFL + BLOCK_LEN + 1], efbp_ref[MAX_AFL], efbp_fused[MAX_AFL], scratch[MAX_AFL];
+  float32_t x[BLOCK_LEN], out[BLOCK_LEN], y_ref[BLOCK_LEN], y_fused[BLOCK_LEN];
+  const float32_t mu = 1.0e-3f, rho = 0.9f, eps = 0.008f;
+  const int cs = BLOCK_LEN;
+  float32_t pwr_ref = 0.0f, pwr_fused = 0.0f, max_err_y = 0.0f, max_err_efbp = 0.0f;
+  unsigned long dT_ref = 0, dT_fused = 0;
+  uint32_t seed = 12345;
+  for (int i = 0; i < MAX_AFL + BLOCK_LEN + 1; i++) ring[i] = 0.0f;
+  for (int i = 0; i < MAX_AFL; i++) { efbp_ref[i] = 0.0f; efbp_fused[i] = 0.0f; }
+
+  for (int Iblock = 0; Iblock < N_BLOCKS; Iblock++) {
+    makeAudio(&seed, ring, afl, out, x, cs);
+    unsigned long t0 = micros();
+    afc_nlms_threepass(x, y_ref, cs, ring, efbp_ref, scratch, afl, n_zero, mu, rho, eps, &pwr_ref);
+    unsigned long t1 = micros();
+    fusedWithStep(step, x, y_fused, cs, ring, efbp_fused, afl, n_zero, mu, rho, eps, &pwr_fused);
+    unsigned long t2 = micros();
+    dT_ref += t1 - t0;  dT_fused += t2 - t1;
+    for (int i = 0; i < cs; i++) max_err_y = max(max_err_y, fabsf(y_ref[i] - y_fused[i]));
+    afc_ring_push_reversed(ring, afl, out, cs);
+  }
+  for (int j = 0; j < afl; j++) max_err_efbp = max(max_err_efbp, fabsf(efbp_ref[j] - efbp_fused[j]));
+
+  bool ok = (max_err_y <= MAX_ERR_Y) && (max_err_efbp <= MAX_ERR_EFBP);
+  float n_samps = (float)(N_BLOCKS * cs);
+  printf("    : %-9s afl = %3d, zeroed = %d: 3-pass = %5.1f ns/samp, fused = %5.1f ns/samp, max err y = %.2e, efbp = %.2e: %s\n",
+         name, afl, n_zero, 1000.0f * dT_ref / n_samps, 1000.0f * dT_fused / n_samps, max_err_y, max_err_efbp, ok ? "ok" : "*** FAIL ***");
+  return ok ? 0 : 1;
+}
+
+static int testStereo(int afl) {
+  static float32_t ringL[MAX_AFL + BLOCK_LEN + 1], ringR[MAX_AFL + BLOCK_LEN + 1], ring2[2*(MAX_AFL + BLOCK_LEN + 1)];
+  static float32_t efbpL[MAX_AFL], efbpR[MAX_AFL], efbp2[2*MAX_AFL];
+  float32_t xL[BLOCK_LEN], xR[BLOCK_LEN], outL[BLOCK_LEN], outR[BLOCK_LEN];
+  float32_t yL[BLOCK_LEN], yR[BLOCK_LEN], y2L[BLOCK_LEN], y2R[BLOCK_LEN];
+  const float32_t mu = 1.0e-3f, rho = 0.9f, eps = 0.008f;
+  const int cs = BLOCK_LEN;
+  float32_t pwrL = 0.0f, pwrR = 0.0f, pwr2L = 0.0f, pwr2R = 0.0f, max_err_y = 0.0f, max_err_efbp = 0.0f;
+  uint32_t seedL = 12345, seedR = 54321;
+  for (int i = 0; i < MAX_AFL + BLOCK_LEN + 1; i++) { ringL[i] = 0.0f; ringR[i] = 0.0f; ring2[2*i] = 0.0f; ring2[2*i+1] = 0.0f; }
+  for (int i = 0; i < MAX_AFL; i++) { efbpL[i] = 0.0f; efbpR[i] = 0.0f; efbp2[2*i] = 0.0f; efbp2[2*i+1] = 0.0f; }
+
+  for (int Iblock = 0; Iblock < N_BLOCKS; Iblock++) {
+    makeAudio(&seedL, ringL, afl, outL, xL, cs);
+    makeAudio(&seedR, ringR, afl, outR, xR, cs);
+    afc_nlms_fused(xL, yL, cs, ringL, efbpL, afl, 0, mu, rho, eps, &pwrL);
+    afc_nlms_fused(xR, yR, cs, ringR, efbpR, afl, 0, mu, rho, eps, &pwrR);
+    afc_nlms_fused_stereo(xL, xR, y2L, y2R, cs, ring2, efbp2, afl, mu, rho, eps, &pwr2L, &pwr2R);
+    for (int i = 0; i < cs; i++) max_err_y = max(max_err_y, max(fabsf(yL[i] - y2L[i]), fabsf(yR[i] - y2R[i])));
+    afc_ring_push_reversed(ringL, afl, outL, cs);
+    afc_ring_push_reversed(ringR, afl, outR, cs);
+    for (int i = 0; i < afl + cs; i++) { ring2[2*i] = ringL[i];  ring2[2*i+1] = ringR[i]; }  //the same history, interleaved
+  }
+  for (int j = 0; j < afl; j++) max_err_efbp = max(max_err_efbp, max(fabsf(efbpL[j] - efbp2[2*j]), fabsf(efbpR[j] - efbp2[2*j+1])));
+
+  bool ok = (max_err_y <= MAX_ERR_Y) && (max_err_efbp <= MAX_ERR_EFBP);
+  printf("    : stereo    afl = %3d: max err y = %.2e, efbp = %.2e: %s\n", afl, max_err_y, max_err_efbp, ok ? "ok" : "*** FAIL ***");
+  return ok ? 0 : 1;
+}
+
+//check the rows of the sketch's benchmark ("    : afl, 3-pass, fused, speedup, max err y, max err efbp")
+static int checkBenchmark(const std::string &text) {
+  int n_fail = 0, n_rows = 0;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) end = text.size();
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+    if (line.compare(0, 6, "    : ") != 0) continue;
+    float afl, ref_ns, fused_ns, speedup, err_y, err_efbp;
+    n_rows++;
+    if ((sscanf(line.c_str() + 6, "%f, %f, %f, %f, %f, %f", &afl, &ref_ns, &fused_ns, &speedup, &err_y, &err_efbp) != 6) ||
+        !(err_y <= MAX_ERR_Y) || !(err_efbp <= MAX_ERR_EFBP)) {
+      printf("test_nlms_kernel: benchmark: *** FAIL ***: %s\n", line.c_str());
+      n_fail++;
+    }
+  }
+  if (n_rows != 5) { printf("test_nlms_kernel: benchmark: *** FAIL ***: %d rows in the table\n", n_rows); n_fail++; }
+  printf("test_nlms_kernel: benchmark: %d rows: %s\n", n_rows, n_fail ? "FAIL" : "ok");
+  return n_fail;
+}
+
+int main(void) {
+  const int all_afl[] = {32, 64, 100, 128, 256};
+  int n_fail = 0;
+
+  printf("test_nlms_kernel: %d blocks of %d samples, tolerance y = %.0e, efbp = %.0e\n", N_BLOCKS, BLOCK_LEN, MAX_ERR_Y, MAX_ERR_EFBP);
+  for (unsigned int I = 0; I < sizeof(all_afl) / sizeof(all_afl[0]); I++) {
+    n_fail += testFused("portable", afc_nlms_fused_step_ref, all_afl[I], 0);
+    n_fail += testFused("unrolled", afc_nlms_fused_step_unrolled, all_afl[I], 0);
+  }
+  n_fail += testFused("portable", afc_nlms_fused_step_ref, 100, 5);
+  n_fail += testFused("unrolled", afc_nlms_fused_step_unrolled, 100, 5);
+  for (unsigned int I = 0; I < sizeof(all_afl) / sizeof(all_afl[0]); I++) n_fail += testStereo(all_afl[I]);
+
+  CapturePrint p;
+  afc_benchmarkKernels(&p, N_BLOCKS);
+  n_fail += checkBenchmark(p.text);
+
+  return n_fail ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+/*
+   test_pbfdaf
+
+   Created: OpenAudio, 2022
+   Purpose: Compares the partitioned-block frequency-domain AFC (AudioEffectFeedbackCancel_PBFDAF_F32)
+       to BTNRH's time-domain AFC (AudioEffectAFC_BTNRH_F32, the port of CHAPRO's cha_afc) on a PC.
+       Both run in the same closed loop as the sketch's convergence benchmark (AFC_FeedbackSim_F32.h),
+       on each built-in feedback path, with the same mu/rho/eps, afl, and block size.  For each one,
+       the misalignment of the feedback model (from getFeedbackModel(), against the true path) is
+       printed every second, along with the nsec/sample of cha_afc() + addNewAudio() on this PC.
+       Checks:
+         * every misalignment is a number
+         * on every path, the PBFDAF ends within 6 dB of cha_afc, and on the paths where cha_afc gets
+           below -6 dB, the PBFDAF does too (it converges more slowly at the BTNRH default mu, so the
+           test runs for 8 sec)
+         * the sketch's own PBFDAF benchmark ('O', pbfdaf_benchmarkVsNLMS()) runs and its PBFDAF
+           reduces the feedback
+       Exits non-zero on failure.
+
+   MIT License.  use at your own risk.
+*/
+
+#include <Arduino.h>                //host/Arduino.h
+#include "AudioEffectAFC_BTNRH_F32.h"
+#include "AudioEffectFeedbackCancel_PBFDAF_F32.h"
+#include "AFC_FeedbackSim_F32.h"
+#include <string>
+
+#define FS_HZ        24000.0f
+#define BLOCK_LEN    24
+#define AFL          240   //10 blocks: long enough for all of the built-in paths
+#define DUR_SEC      8
+#define GOOD_MISALIGN_dB (-6.0f)
+#define MAX_BEHIND_dB    (6.0f)   //how much worse than cha_afc the PBFDAF may end up
+#define MIN_BENCH_ERLE_dB (3.0f)
+
+//keep what the benchmark prints (and echo it)
+class CapturePrint : public Print {
+  public:
+    size_t write(uint8_t c) { text += (char)c; return fputc(c, stdout) == EOF ? 0 : 1; }
+    std::string text;
+};
+
+//misalignment (dB) of the AFC's feedback model, relative to the true path after the hardware delay
+static float misalignment_dB(AudioEffectFeedbackCancel_Local_F32 *afc, const float32_t *true_path, int n) {
+  float32_t h[MAX_PBFDAF_FILT_LEN];
+  afc->publishFeedbackModel();
+  int n_model = afc->getFeedbackModel(h, n);
+  double D = 0.0, P = 0.0;
+  for (int j = 0; j < n; j++) {
+    double d = ((j < n_model) ? h[j] : 0.0f) - true_path[j];
+    D += d * d;  P += (double)true_path[j] * true_path[j];
+  }
+  return 10.0f * log10f((float)max(D / max(P, 1.0e-20), 1.0e-20));
+}
+
+//run one AFC on one path in the closed loop.  Fills misalign_dB[0..DUR_SEC-1], returns nsec/sample.
+static float runClosedLoop(AudioEffectFeedbackCancel_Local_F32 *afc, AFC_FeedbackPathSim_F32 &sim, int Ipath, float *misalign_dB) {
+  const float32_t mu = 1.0e-3f, rho = 0.9f, eps = 0.008f, fwd_gain = powf(10.0f, 10.0f / 20.0f);
+  const int cs = BLOCK_LEN, hdel = BLOCK_LEN;  //the PBFDAF's model starts one block after the output
+  float32_t x[BLOCK_LEN], y[BLOCK_LEN], u[BLOCK_LEN], fbs[BLOCK_LEN], fbs_win[BLOCK_LEN];
+  int blocks_per_sec = (int)FS_HZ / cs;
+
+  sim.setBuiltInPath(Ipath, FS_HZ, hdel);
+  afc->setParams(mu, rho, eps, AFL);
+  afc->initializeStates();
+  afc->initializeRingBuffer();
+  uint32_t seed = 22222;
+  float32_t s1 = 0.0f, s2 = 0.0f;
+  unsigned long dT_usec = 0;
+
+  for (int Iblock = 0; Iblock < DUR_SEC * blocks_per_sec; Iblock++) {
+    //microphone: colored noise plus the feedback (as in afc_convergenceBenchmark())
+    sim.computeFeedback(fbs, fbs_win, cs, hdel, AFL);
+    for (int i = 0; i < cs; i++) {
+      seed = seed * 1664525UL + 1013904223UL;
+      float32_t w = ((float32_t)(seed >> 8) / 16777216.0f) - 0.5f;
+      float32_t s = w + 1.6f * s1 - 0.9f * s2;  s2 = s1; s1 = s;
+      x[i] = 0.05f * s + fbs[i];
+    }
+
+    unsigned long t0 = micros();
+    afc->cha_afc(x, y, cs);
+    for (int i = 0; i < cs; i++) u[i] = min(max(fwd_gain * y[i], -1.0f), 1.0f);
+    afc->addNewAudio(u, cs);
+    dT_usec += micros() - t0;
+    sim.addOutputAudio(u, cs);
+
+    if (((Iblock + 1) % blocks_per_sec) == 0) misalign_dB[Iblock / blocks_per_sec] = misalignment_dB(afc, sim.getPath() + hdel, AFL);
+  }
+  return 1000.0f * (float)dT_usec / (float)(DUR_SEC * blocks_per_sec * cs);
+}
+
+//check the rows of the sketch's PBFDAF benchmark ("    : afl, NLMS usec, PBFDAF usec, NLMS ERLE, PBFDAF ERLE")
+static int checkBenchmark(const std::string &text) {
+  int n_fail = 0, n_rows = 0;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) end = text.size();
+    std::string line = text.substr(start, end - start);
+    start = end + 1;
+    if (line.compare(0, 6, "    : ") != 0) continue;
+    size_t last = line.rfind(", ");
+    float erle_dB = (last == std::string::npos) ? NAN : (float)atof(line.c_str() + last + 2);
+    n_rows++;
+    if (!(erle_dB > MIN_BENCH_ERLE_dB)) { printf("test_pbfdaf: benchmark: *** FAIL ***: PBFDAF ERLE too low in: %s\n", line.c_str()); n_fail++; }
+  }
+  if (text.find("ERROR") != std::string::npos) { printf("test_pbfdaf: benchmark: *** FAIL ***: it printed an error\n"); n_fail++; }
+  if (n_rows != 3) { printf("test_pbfdaf: benchmark: *** FAIL ***: %d rows in the table\n", n_rows); n_fail++; }
+  printf("test_pbfdaf: benchmark: %d rows: %s\n", n_rows, n_fail ? "FAIL" : "ok");
+  return n_fail;
+}
+
+int main(void) {
+  AudioSettings_F32 audio_settings(FS_HZ, BLOCK_LEN);
+  int n_fail = 0;
+
+  //unconnected AFCs, as the sketch's benchmarks use
+  AudioEffectAFC_BTNRH_F32 *btnrh = new AudioEffectAFC_BTNRH_F32(audio_settings);
+  btnrh->setHdel(BLOCK_LEN);
+  AudioEffectFeedbackCancel_PBFDAF_F32 *pbfdaf = new AudioEffectFeedbackCancel_PBFDAF_F32(audio_settings);
+  static AFC_FeedbackPathSim_F32 sim;
+
+  printf("test_pbfdaf: afl = %d, block = %d, misalignment (dB) every 1 sec..., nsec/sample\n", AFL, BLOCK_LEN);
+  for (int Ipath = 0; Ipath < AFC_SIM_N_PATHS; Ipath++) {
+    float m_btnrh[DUR_SEC], m_pbfdaf[DUR_SEC];
+    float ns_btnrh = runClosedLoop(btnrh, sim, Ipath, m_btnrh);
+    float ns_pbfdaf = runClosedLoop(pbfdaf, sim, Ipath, m_pbfdaf);
+
+    bool ok = true;
+    for (int I = 0; I < DUR_SEC; I++) ok = ok && isfinite(m_btnrh[I]) && isfinite(m_pbfdaf[I]);
+    float best_btnrh = m_btnrh[0], best_pbfdaf = m_pbfdaf[0];
+    for (int I = 1; I < DUR_SEC; I++) { best_btnrh = min(best_btnrh, m_btnrh[I]);  best_pbfdaf = min(best_pbfdaf, m_pbfdaf[I]); }
+    ok = ok && (m_pbfdaf[DUR_SEC-1] < m_btnrh[DUR_SEC-1] + MAX_BEHIND_dB);
+    if (best_btnrh < GOOD_MISALIGN_dB) ok = ok && (best_pbfdaf < GOOD_MISALIGN_dB);
+
+    printf("    : %-12s cha_afc:", sim.getPathName());
+    for (int I = 0; I < DUR_SEC; I++) printf(" %6.1f", m_btnrh[I]);
+    printf(", %4.0f ns | PBFDAF:", ns_btnrh);
+    for (int I = 0; I < DUR_SEC; I++) printf(" %6.1f", m_pbfdaf[I]);
+    printf(", %4.0f ns: %s\n", ns_pbfdaf, ok ? "ok" : "*** FAIL ***");
+    if (!ok) n_fail++;
+  }
+  delete btnrh;
+  delete pbfdaf;
+
+  //the sketch's benchmark, which allocates its own PBFDAF
+  CapturePrint p;
+  pbfdaf_benchmarkVsNLMS(&p, 2000);
+  n_fail += checkBenchmark(p.text);
+
+  return n_fail ? 1 : 0;
+}